@@ -0,0 +1,393 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "../lib/color-print.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// The most arguments a benchmark configuration passes to dumpmemory
+#define MAX_CONFIG_ARGS 4
+
+// The most chunk sizes that can be compared in one run
+#define MAX_CHUNK_SIZES 16
+
+// How much of each image is compared at a time
+#define COMPARE_BLOCK_SIZE 0x100000
+
+// A way of running dumpmemory that we want to measure
+struct bench_config
+{
+    const char* name;
+    const char* args[MAX_CONFIG_ARGS + 1];
+};
+
+static const struct bench_config configs[] = {
+    { "sync",      { "-e", "sync", NULL } },
+    { "sync x4",   { "-e", "sync", "-t", "4", NULL } },
+    { "uring",     { "-e", "uring", NULL } },
+    { "splice",    { "-e", "splice", NULL } },
+    { "vector",    { "-e", "vector", NULL } },
+    { "direct",    { "-e", "sync", "-d", NULL } },
+};
+
+// The measurements taken from a single run
+struct bench_result
+{
+    double      seconds;
+    uint64_t    bytes;
+    uint64_t    syscalls;
+    double      user_seconds;
+    double      system_seconds;
+};
+
+/**
+ * Prints the usage information for the program.
+ * 
+ * @param program The name the program was invoked as
+ */
+static void print_usage(const char* program)
+{
+    printf("Usage: %s [options] <kcore_file> <iomem_file> <output_file> "
+           "<dumpmemory>...\n", program);
+    printf("\n");
+    printf("Runs each dumpmemory build with every copy engine against a fixture.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -c, --chunk-size <n>  Compare chunks of n bytes, may be repeated\n"
+           "                        (default dumpmemory's own chunk size)\n");
+    printf("  -r, --runs <n>        Keep the best of n runs of each (default 3)\n");
+    printf("  -h, --help            Show this help message\n");
+}
+
+/**
+ * Gets the current time in seconds.
+ *
+ * @return The time from the monotonic clock
+ */
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Reads the number of read and write system calls a process has made. This
+ * has to be done after it exits but before it's reaped.
+ * 
+ * @param pid The process to read the counters of
+ * 
+ * @return The number of system calls, or 0 if they're unavailable
+ */
+static uint64_t read_syscalls(const pid_t pid)
+{
+    char path[64];
+    char line[128];
+    uint64_t value, total = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    FILE* f = fopen(path, "r");
+    if (NULL == f)
+    {
+        return 0;
+    }
+
+    while (NULL != fgets(line, sizeof(line), f))
+    {
+        if (1 == sscanf(line, "syscr: %lu", &value) || 
+            1 == sscanf(line, "syscw: %lu", &value))
+        {
+            total += value;
+        }
+    }
+
+    fclose(f);
+    return total;
+}
+
+/**
+ * Checks whether two files hold the same bytes.
+ * 
+ * @param a The path of the first file
+ * @param b The path of the second file
+ * 
+ * @return 1 if they're the same, 0 if they differ, else -1 if there's an
+ *         error
+ */
+static int same_contents(const char* a, const char* b)
+{
+    int ret = -1;
+    FILE* fa = fopen(a, "r");
+    FILE* fb = fopen(b, "r");
+    char* buffer_a = malloc(COMPARE_BLOCK_SIZE);
+    char* buffer_b = malloc(COMPARE_BLOCK_SIZE);
+    if (NULL == fa || NULL == fb || NULL == buffer_a || NULL == buffer_b)
+    {
+        goto cleanup;
+    }
+
+    for (;;)
+    {
+        size_t len_a = fread(buffer_a, 1, COMPARE_BLOCK_SIZE, fa);
+        size_t len_b = fread(buffer_b, 1, COMPARE_BLOCK_SIZE, fb);
+        if (ferror(fa) || ferror(fb))
+        {
+            goto cleanup;
+        }
+        if (len_a != len_b || 0 != memcmp(buffer_a, buffer_b, len_a))
+        {
+            ret = 0;
+            goto cleanup;
+        }
+        if (0 == len_a)
+        {
+            ret = 1;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    if (NULL != fa)
+    {
+        fclose(fa);
+    }
+    if (NULL != fb)
+    {
+        fclose(fb);
+    }
+    free(buffer_a);
+    free(buffer_b);
+    return ret;
+}
+
+/**
+ * Runs dumpmemory once and measures it.
+ * 
+ * @param dumpmemory The dumpmemory binary to run
+ * @param config     The configuration to run it with
+ * @param chunk_size The chunk size to copy with, or NULL for the default
+ * @param kcore      The fixture kcore file
+ * @param iomem      The fixture iomem file
+ * @param output     The file to dump to
+ * @param result     The measurements (output)
+ * 
+ * @return 0 for success, else -1 if the run failed
+ */
+static int run_once(const char* dumpmemory,
+                    const struct bench_config* config,
+                    const char* chunk_size,
+                    const char* kcore,
+                    const char* iomem,
+                    const char* output,
+                    struct bench_result* result)
+{
+    const char* argv[MAX_CONFIG_ARGS + 9];
+    int argc = 0;
+    siginfo_t info;
+    struct rusage usage;
+    struct stat st;
+    int status;
+
+    argv[argc++] = dumpmemory;
+    argv[argc++] = "-k";
+    argv[argc++] = kcore;
+    argv[argc++] = "-i";
+    argv[argc++] = iomem;
+    for (int i = 0; NULL != config->args[i]; i++)
+    {
+        argv[argc++] = config->args[i];
+    }
+    if (NULL != chunk_size)
+    {
+        argv[argc++] = "-c";
+        argv[argc++] = chunk_size;
+    }
+    argv[argc++] = output;
+    argv[argc] = NULL;
+
+    unlink(output);
+
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (-1 == pid)
+    {
+        return -1;
+    }
+
+    if (0 == pid)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execv(dumpmemory, (char* const*) argv);
+        _exit(127);
+    }
+
+    if (-1 == waitid(P_PID, pid, &info, WEXITED | WNOWAIT))
+    {
+        return -1;
+    }
+    result->seconds = now_seconds() - start;
+    result->syscalls = read_syscalls(pid);
+
+    if (-1 == wait4(pid, &status, 0, &usage) || 
+        !WIFEXITED(status) || 0 != WEXITSTATUS(status) ||
+        -1 == stat(output, &st))
+    {
+        return -1;
+    }
+
+    result->bytes = st.st_size;
+    result->user_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    result->system_seconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option long_options[] = {
+        { "chunk-size", required_argument, NULL, 'c' },
+        { "runs",       required_argument, NULL, 'r' },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL,         0,                 NULL, 0   }
+    };
+
+    int ret = 0;
+    int runs = 3;
+    const char* chunk_sizes[MAX_CHUNK_SIZES] = { NULL };
+    int num_chunk_sizes = 0;
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "c:r:h", long_options, NULL)))
+    {
+        switch (opt)
+        {
+        case 'c':
+            if (num_chunk_sizes == MAX_CHUNK_SIZES)
+            {
+                fprint_red(stderr, "[-] At most %d chunk sizes can be compared\n",
+                    MAX_CHUNK_SIZES);
+                return -1;
+            }
+            chunk_sizes[num_chunk_sizes++] = optarg;
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (argc - optind < 4 || runs < 1)
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+    const char* kcore = argv[optind];
+    const char* iomem = argv[optind + 1];
+    const char* output = argv[optind + 2];
+
+    // The first sync run's image is kept, and every other run has to match
+    // it byte for byte
+    char reference[PATH_MAX];
+    int have_reference = 0;
+    snprintf(reference, sizeof(reference), "%s.ref", output);
+
+    // Without any chunk sizes, each build runs once with its default
+    if (0 == num_chunk_sizes)
+    {
+        num_chunk_sizes = 1;
+    }
+
+    printf("%-20s %-10s %-10s %10s %12s %10s %10s\n", "build", "chunk", "engine", 
+        "GB/s", "syscalls", "user s", "sys s");
+
+    for (int b = optind + 3; b < argc; b++)
+    {
+        char* build = strdup(argv[b]);
+        for (int k = 0; k < num_chunk_sizes; k++)
+        {
+            for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++)
+            {
+                struct bench_result best = { 0 };
+                int succeeded = 0;
+                int mismatched = 0;
+
+                for (int r = 0; r < runs; r++)
+                {
+                    struct bench_result result;
+                    if (0 == run_once(argv[b], &configs[c], chunk_sizes[k], kcore, 
+                        iomem, output, &result))
+                    {
+                        if (!have_reference)
+                        {
+                            have_reference = 0 == rename(output, reference);
+                        }
+                        else if (1 != same_contents(reference, output))
+                        {
+                            mismatched = 1;
+                        }
+
+                        if (0 == succeeded++ || result.seconds < best.seconds)
+                        {
+                            best = result;
+                        }
+                    }
+                }
+
+                if (0 == succeeded)
+                {
+                    fprint_red(stderr, "[-] %s failed with the %s engine\n", 
+                        argv[b], configs[c].name);
+                    ret = -1;
+                    continue;
+                }
+                if (mismatched)
+                {
+                    fprint_red(stderr, "[-] %s wrote a different image with the %s "
+                        "engine than with sync\n", argv[b], configs[c].name);
+                    ret = -1;
+                }
+
+                printf("%-20s %-10s %-10s %10.2f %12lu %10.2f %10.2f\n", 
+                    basename(build), chunk_sizes[k] ? chunk_sizes[k] : "default",
+                    configs[c].name, best.bytes / best.seconds / 1e9, 
+                    best.syscalls, best.user_seconds, best.system_seconds);
+            }
+        }
+        free(build);
+    }
+
+    unlink(output);
+    unlink(reference);
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,351 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "../lib/lmat.h"
+
+#include "../lib/color-print.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Where the kernel's direct map of physical memory starts on x86_64
+#define DIRECT_MAP_BASE 0xffff888000000000UL
+
+// The alignment (and minimum gap) of the generated physical ranges
+#define RANGE_ALIGNMENT 0x1000000UL
+
+// The size of the runs that the mixed pattern alternates between
+#define PATTERN_RUN_SIZE 0x100000
+
+#define PAGE_SIZE 0x1000
+
+// The kinds of content a fixture can be filled with
+enum fill_pattern
+{
+    PATTERN_ZERO,
+    PATTERN_RANDOM,
+    PATTERN_REPEATED,
+    PATTERN_MIXED,
+};
+
+/**
+ * Prints the usage information for the program.
+ * 
+ * @param program The name the program was invoked as
+ */
+static void print_usage(const char* program)
+{
+    printf("Usage: %s [options] <kcore_file> <iomem_file>\n", program);
+    printf("\n");
+    printf("Generates a synthetic kcore image and a matching iomem file.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -n, --sections <n>     The number of System RAM sections (default 4)\n");
+    printf("  -s, --size <bytes>     The size of each section (default 0x8000000)\n");
+    printf("  -p, --pattern <name>   Fill memory with zero, random, repeated or mixed\n"
+           "                         content (default mixed)\n");
+    printf("  -h, --help             Show this help message\n");
+}
+
+/**
+ * Fills a buffer with pseudo-random data using xorshift64.
+ * 
+ * @param buffer The buffer to fill
+ * @param len    The length of the buffer, a multiple of 8 bytes
+ * @param state  The state of the generator
+ */
+static void fill_random(char* buffer, const size_t len, uint64_t* state)
+{
+    uint64_t x = *state;
+
+    for (size_t i = 0; i < len; i += sizeof(uint64_t))
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(buffer + i, &x, sizeof(x));
+    }
+
+    *state = x;
+}
+
+/**
+ * Fills a buffer with the same non-zero page over and over.
+ * 
+ * @param buffer The buffer to fill
+ * @param len    The length of the buffer
+ */
+static void fill_repeated(char* buffer, const size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        buffer[i] = (char) (0x20 + (i % PAGE_SIZE) % 0x5f);
+    }
+}
+
+/**
+ * Writes the content of a single section. Zero-filled runs are left as
+ * holes, since the fixture file is pre-sized.
+ * 
+ * @param fd      The file descriptor of the kcore image
+ * @param offset  The file offset of the section
+ * @param size    The size of the section
+ * @param pattern The content to fill the section with
+ * @param buffer  A buffer of PATTERN_RUN_SIZE bytes
+ * @param state   The state of the random generator
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_section(const int fd,
+                         const uint64_t offset,
+                         const uint64_t size,
+                         const enum fill_pattern pattern,
+                         char* buffer,
+                         uint64_t* state)
+{
+    for (uint64_t pos = 0; pos < size; pos += PATTERN_RUN_SIZE)
+    {
+        size_t len = size - pos < PATTERN_RUN_SIZE ? size - pos : PATTERN_RUN_SIZE;
+        enum fill_pattern run = pattern;
+        if (PATTERN_MIXED == pattern)
+        {
+            run = (enum fill_pattern) ((pos / PATTERN_RUN_SIZE) % PATTERN_MIXED);
+        }
+
+        if (PATTERN_ZERO == run)
+        {
+            continue;
+        }
+        else if (PATTERN_RANDOM == run)
+        {
+            fill_random(buffer, len, state);
+        }
+        else
+        {
+            fill_repeated(buffer, len);
+        }
+
+        if ((ssize_t) len != pwrite(fd, buffer, len, offset + pos))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option long_options[] = {
+        { "sections", required_argument, NULL, 'n' },
+        { "size",     required_argument, NULL, 's' },
+        { "pattern",  required_argument, NULL, 'p' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL,       0,                 NULL, 0   }
+    };
+
+    int ret = 0;
+    int kcore_fd = -1;
+    FILE* iomem = NULL;
+    Elf64_Phdr* prog_hdr = NULL;
+    char* buffer = NULL;
+    int num_sections = 4;
+    uint64_t size = 0x8000000;
+    enum fill_pattern pattern = PATTERN_MIXED;
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "n:s:p:h", long_options, NULL)))
+    {
+        switch (opt)
+        {
+        case 'n':
+            num_sections = atoi(optarg);
+            break;
+        case 's':
+            size = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            if (0 == strcmp(optarg, "zero"))
+            {
+                pattern = PATTERN_ZERO;
+            }
+            else if (0 == strcmp(optarg, "random"))
+            {
+                pattern = PATTERN_RANDOM;
+            }
+            else if (0 == strcmp(optarg, "repeated"))
+            {
+                pattern = PATTERN_REPEATED;
+            }
+            else if (0 == strcmp(optarg, "mixed"))
+            {
+                pattern = PATTERN_MIXED;
+            }
+            else
+            {
+                fprint_red(stderr, "[-] Unknown pattern: %s\n", optarg);
+                ret = -1;
+                goto cleanup;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (argc - optind < 2)
+    {
+        print_usage(argv[0]);
+        ret = -1;
+        goto cleanup;
+    }
+    const char* kcore_file = argv[optind];
+    const char* iomem_file = argv[optind + 1];
+
+    // The note and the loads all have to be counted by e_phnum
+    if (num_sections < 1 || num_sections >= PN_XNUM - 1 || 
+        0 == size || 0 != size % PAGE_SIZE)
+    {
+        fprint_red(stderr, "[-] Need 1 to %d sections of a non-zero number of pages\n",
+            PN_XNUM - 2);
+        ret = -1;
+        goto cleanup;
+    }
+
+    // Like the real kcore, a note comes first and is followed by the loads
+    int num_hdrs = num_sections + 1;
+    prog_hdr = calloc(num_hdrs, sizeof(Elf64_Phdr));
+    buffer = malloc(PATTERN_RUN_SIZE);
+    if (NULL == prog_hdr || NULL == buffer)
+    {
+        fprint_red(stderr, "[-] Failed to allocate buffers\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (-1 == (kcore_fd = 
+        open64(kcore_file, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, 0644)))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", kcore_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (NULL == (iomem = fopen(iomem_file, "w")))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", iomem_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    uint64_t offset = sizeof(Elf64_Ehdr) + num_hdrs * sizeof(Elf64_Phdr);
+    offset = (offset + PAGE_SIZE - 1) & ~(uint64_t) (PAGE_SIZE - 1);
+    uint64_t physical = RANGE_ALIGNMENT;
+
+    prog_hdr[0].p_type = PT_NOTE;
+    prog_hdr[0].p_offset = sizeof(Elf64_Ehdr) + num_hdrs * sizeof(Elf64_Phdr);
+
+    fprintf(iomem, "00000000-00000fff : Reserved\n");
+    for (int i = 1; i < num_hdrs; i++)
+    {
+        prog_hdr[i].p_type = PT_LOAD;
+        prog_hdr[i].p_flags = PF_R | PF_W | PF_X;
+        prog_hdr[i].p_offset = offset;
+        prog_hdr[i].p_vaddr = DIRECT_MAP_BASE + physical;
+        prog_hdr[i].p_paddr = physical;
+        prog_hdr[i].p_filesz = size;
+        prog_hdr[i].p_memsz = size;
+        prog_hdr[i].p_align = PAGE_SIZE;
+
+        fprintf(iomem, "%08lx-%08lx : System RAM\n", physical, physical + size - 1);
+        if (1 == i)
+        {
+            fprintf(iomem, "  %08lx-%08lx : Kernel code\n", physical, 
+                physical + (size < 0x100000 ? size : 0x100000) - 1);
+        }
+
+        offset += size;
+        physical = (physical + size + 2 * RANGE_ALIGNMENT - 1) & 
+            ~(RANGE_ALIGNMENT - 1);
+    }
+    fprintf(iomem, "%08lx-%08lx : PCI Bus 0000:00\n", physical, 
+        physical + RANGE_ALIGNMENT - 1);
+
+    Elf64_Ehdr elf_hdr = {
+        .e_ident = { ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64, ELFDATA2LSB,
+            EV_CURRENT, ELFOSABI_SYSV },
+        .e_type = ET_CORE,
+        .e_machine = EM_X86_64,
+        .e_version = EV_CURRENT,
+        .e_phoff = sizeof(Elf64_Ehdr),
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_phentsize = sizeof(Elf64_Phdr),
+        .e_phnum = num_hdrs,
+    };
+
+    if (-1 == ftruncate(kcore_fd, offset) ||
+        sizeof(elf_hdr) != pwrite(kcore_fd, &elf_hdr, sizeof(elf_hdr), 0) ||
+        (ssize_t) (num_hdrs * sizeof(Elf64_Phdr)) != 
+            pwrite(kcore_fd, prog_hdr, num_hdrs * sizeof(Elf64_Phdr), 
+                sizeof(elf_hdr)))
+    {
+        fprint_red(stderr, "[-] Failed to write %s\n", kcore_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    for (int i = 1; i < num_hdrs; i++)
+    {
+        if (-1 == write_section(kcore_fd, prog_hdr[i].p_offset, size, pattern,
+            buffer, &state))
+        {
+            fprint_red(stderr, "[-] Failed to write %s\n", kcore_file);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    print_green("[+] Generated %d sections of 0x%lx bytes in %s and %s\n", 
+        num_sections, size, kcore_file, iomem_file);
+
+cleanup:
+    if (kcore_fd >= 0)
+    {
+        close(kcore_fd);
+    }
+
+    if (NULL != iomem)
+    {
+        fclose(iomem);
+    }
+
+    free(prog_hdr);
+    free(buffer);
+
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,240 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "lib/lmz.h"
+
+#include "lib/color-print.h"
+#include "lib/io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/**
+ * Prints the usage information for the program.
+ * 
+ * @param program The name the program was invoked as
+ */
+static void print_usage(const char* program)
+{
+    printf("Usage: %s [options] <compressed_file> <output_file>\n", program);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -b, --block <n>  Only decompress block n\n");
+    printf("  -h, --help       Show this help message\n");
+}
+
+/**
+ * Decompresses a single block and appends it to the output file.
+ * 
+ * @param in_fd  The file descriptor of the compressed file
+ * @param out_fd The file descriptor of the output file
+ * @param entry  The index entry of the block
+ * @param in     A buffer large enough for any compressed block
+ * @param out    A buffer large enough for any uncompressed block
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int decompress_block(const int in_fd,
+                            const int out_fd,
+                            const lmz_block_entry* entry,
+                            char* in,
+                            char* out)
+{
+    uint32_t size = entry->compressed_size & ~LMZ_BLOCK_STORED;
+    int stored = 0 != (entry->compressed_size & LMZ_BLOCK_STORED);
+    if (size > compressBound(LMZ_BLOCK_SIZE) || entry->raw_size > LMZ_BLOCK_SIZE ||
+        (stored && size != entry->raw_size))
+    {
+        fprint_red(stderr, "[-] Corrupt block index entry\n");
+        return -1;
+    }
+
+    if (-1 == read_all_at(in_fd, in, size, entry->offset))
+    {
+        fprint_red(stderr, "[-] Failed to read block at 0x%lx\n", entry->offset);
+        return -1;
+    }
+
+    const char* data = in;
+    if (!stored)
+    {
+        uLongf out_len = LMZ_BLOCK_SIZE;
+        if (Z_OK != uncompress((Bytef*) out, &out_len, (const Bytef*) in, size) ||
+            out_len != entry->raw_size)
+        {
+            fprint_red(stderr, "[-] Failed to decompress block at 0x%lx\n",
+                entry->offset);
+            return -1;
+        }
+        data = out;
+    }
+
+    if (-1 == write_all(out_fd, data, entry->raw_size))
+    {
+        fprint_red(stderr, "[-] Failed to write output (errno %d)\n", errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option long_options[] = {
+        { "block", required_argument, NULL, 'b' },
+        { "help",  no_argument,       NULL, 'h' },
+        { NULL,    0,                 NULL, 0   }
+    };
+
+    int ret = 0;
+    int in_fd = -1, out_fd = -1;
+    long long only_block = -1;
+    lmz_block_entry* index = NULL;
+    char* in = NULL;
+    char* out = NULL;
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "b:h", long_options, NULL)))
+    {
+        switch (opt)
+        {
+        case 'b':
+            only_block = atoll(optarg);
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            goto cleanup;
+        default:
+            print_usage(argv[0]);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (argc - optind < 2)
+    {
+        print_usage(argv[0]);
+        ret = -1;
+        goto cleanup;
+    }
+    const char* input_file = argv[optind];
+    const char* output_file = argv[optind + 1];
+
+    if (-1 == (in_fd = open64(input_file, O_RDONLY | O_LARGEFILE)))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", input_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    // Check the header, then find the block index through the trailer
+    lmz_file_header header;
+    lmz_trailer trailer;
+    struct stat st;
+    if (-1 == fstat(in_fd, &st) || 
+        st.st_size < (off_t) (sizeof(header) + sizeof(trailer)) ||
+        -1 == read_all_at(in_fd, &header, sizeof(header), 0) ||
+        -1 == read_all_at(in_fd, &trailer, sizeof(trailer), 
+            st.st_size - sizeof(trailer)))
+    {
+        fprint_red(stderr, "[-] Could not read %s\n", input_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (LMZ_HEADER_MAGIC != header.magic || LMZ_TRAILER_MAGIC != trailer.magic ||
+        LMZ_VERSION != header.version || LMZ_CODEC_ZLIB != header.codec ||
+        LMZ_BLOCK_SIZE != header.block_size)
+    {
+        fprint_red(stderr, "[-] %s is not a supported compressed dump\n", input_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (trailer.num_blocks > (uint64_t) st.st_size / sizeof(lmz_block_entry) ||
+        (only_block >= 0 && (uint64_t) only_block >= trailer.num_blocks))
+    {
+        fprint_red(stderr, "[-] Invalid block index\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    size_t index_len = trailer.num_blocks * sizeof(lmz_block_entry);
+    index = malloc(index_len ? index_len : 1);
+    in = malloc(compressBound(LMZ_BLOCK_SIZE));
+    out = malloc(LMZ_BLOCK_SIZE);
+    if (NULL == index || NULL == in || NULL == out)
+    {
+        fprint_red(stderr, "[-] Failed to allocate buffers\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (-1 == read_all_at(in_fd, index, index_len, trailer.index_offset))
+    {
+        fprint_red(stderr, "[-] Failed to read the block index\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (-1 == (out_fd = 
+        open64(output_file, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, S_IRUSR)))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", output_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    uint64_t first = only_block >= 0 ? only_block : 0;
+    uint64_t last = only_block >= 0 ? only_block + 1 : trailer.num_blocks;
+    for (uint64_t i = first; i < last; i++)
+    {
+        if (-1 == decompress_block(in_fd, out_fd, &index[i], in, out))
+        {
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    print_green("[+] Decompressed %lu blocks to %s\n", last - first, output_file);
+
+cleanup:
+    if (in_fd >= 0)
+    {
+        close(in_fd);
+    }
+
+    if (out_fd >= 0)
+    {
+        close(out_fd);
+    }
+
+    free(index);
+    free(in);
+    free(out);
+
+    return ret;
+}
\ No newline at end of file
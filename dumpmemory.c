@@ -15,93 +15,1107 @@ Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
 */
 
 
+#define _GNU_SOURCE
 #define _FILE_OFFSET_BITS 64
 #define _LARGEFILE64_SOURCE
 
 #include "lib/lmat.h"
 
+#include "lib/budget.h"
+#include "lib/buffer.h"
 #include "lib/color-print.h"
+#include "lib/daemon.h"
+#include "lib/format.h"
+#include "lib/io.h"
 #include "lib/iomem.h"
+#include "lib/journal.h"
 #include "lib/kcore.h"
+#include "lib/merkle.h"
+#include "lib/priority.h"
+#include "lib/stream.h"
+#include "lib/stripe.h"
+#include "lib/target.h"
+#include "lib/tee.h"
 
 #include <elf.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-int main(int argc, char* argv[])
+/**
+ * Prints the usage information for the program.
+ * 
+ * @param program The name the program was invoked as
+ */
+static void print_usage(const char* program)
 {
-    int ret = 0;
-    int kcore_fd, out_fd;
+    printf("Usage: %s [options] <output_file>\n", program);
+    printf("\n");
+    printf("The output may be a regular file, a FIFO, \"%s\" for stdout or\n",
+        STDOUT_OUTPUT);
+    printf("\"%s<path>\" for a UNIX domain socket.\n", UNIX_SOCKET_PREFIX);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -k, --kcore <file>       Read memory from file instead of %s\n",
+        KCORE_FILENAME);
+    printf("  -i, --iomem <file>       Read memory ranges from file instead of %s\n",
+        IOMEM_FILENAME);
+    printf("  -T, --pid <pid>          Only dump the memory of process pid (may be\n"
+           "                           repeated)\n");
+    printf("  -A, --range <start>-<end>\n"
+           "                           Only dump the physical range start-end (in hex,\n"
+           "                           inclusive; may be repeated)\n");
+    printf("  -K, --kernel-first       Capture the kernel's code and data before the\n"
+           "                           rest of memory\n");
+    printf("  -u, --first <start>-<end>\n"
+           "                           Capture the physical range start-end before the\n"
+           "                           rest of memory (in hex, inclusive; may be\n"
+           "                           repeated)\n");
+    printf("  -e, --engine <name>      The copy engine to use: sync, uring,\n"
+           "                           splice or vector (default sync)\n");
+    printf("  -F, --format <name>      The output format: lime or elf (default lime)\n");
+    printf("  -t, --threads <n>        Copy (or compress) memory using n worker threads\n"
+           "                           (default 1)\n");
+    printf("  -N, --numa               Copy each part of memory with threads pinned to\n"
+           "                           its NUMA node (requires --threads)\n");
+    printf("  -q, --queue-depth <n>    Keep n chunks in flight with io_uring (default %d)\n",
+        DEFAULT_QUEUE_DEPTH);
+    printf("  -c, --chunk-size <n>     Copy memory in chunks of n bytes (default 0x%x)\n",
+        CHUNK_SIZE);
+    printf("  -o, --tee <path>[,drop]  Also write the dump to path, which may be a file,\n"
+           "                           FIFO, socket or stdout (may be repeated). With\n"
+           "                           drop, it's given up on if it falls behind rather\n"
+           "                           than slowing the dump down\n");
+    printf("  -Q, --tee-queue <n>      Let each destination fall up to n chunks behind\n"
+           "                           (default %d)\n", DEFAULT_TEE_QUEUE_DEPTH);
+    printf("  -O, --stripe <path>      Stripe the dump across path and the other --stripe\n"
+           "                           files (at least two), leaving only the layout in\n"
+           "                           output_file\n");
+    printf("  -w, --stripe-size <n>    Use stripes of n bytes (default 0x%x)\n",
+        DEFAULT_STRIPE_SIZE);
+    printf("  -d, --direct             Write the output with O_DIRECT, bypassing the\n"
+           "                           page cache\n");
+    printf("  -s, --sparse             Skip zero-filled pages, leaving holes in the output\n");
+    printf("  -f, --skip-free          Skip free and unbacked pages, as reported by\n"
+           "                           /proc/kpageflags\n");
+    printf("  -z, --compress           Compress the output in independent blocks\n");
+    printf("  -m, --manifest <file>    Write a manifest of per-page hashes to file\n");
+    printf("  -b, --base <file>        Only write pages that changed since the capture\n"
+           "                           described by the manifest in file\n");
+    printf("  -H, --hash <file>        Write a SHA-256 Merkle tree root and per-section\n"
+           "                           hashes of the captured memory to file\n");
+    printf("  -x, --scan <file>        Search the memory for the signatures in file as\n"
+           "                           it's copied\n");
+    printf("  -X, --hits <file>        Write the address and name of each signature\n"
+           "                           match to file\n");
+    printf("  -j, --journal <file>     Record checkpoints in file so that an interrupted\n"
+           "                           dump can be resumed\n");
+    printf("  -J, --journal-interval <n>\n"
+           "                           Checkpoint every n chunks (default %d)\n",
+        DEFAULT_JOURNAL_INTERVAL);
+    printf("  -r, --resume             Resume the dump from the last checkpoint in the\n"
+           "                           journal\n");
+    printf("  -R, --max-rate <n>       Copy at most n bytes per second (K, M and G\n"
+           "                           suffixes are accepted)\n");
+    printf("  -P, --psi-threshold <n>  Back off while I/O or memory pressure is over\n"
+           "                           n percent\n");
+    printf("  -I, --io-priority <c[:n]>\n"
+           "                           The I/O priority: idle, best-effort or realtime,\n"
+           "                           with an optional level from 0 to 7\n");
+    printf("  -n, --nice <n>           Run with a nice value of n\n");
+    printf("  -C, --cpus <list>        Only run on the listed CPUs, e.g. 0-3,8\n");
+    printf("  -M, --max-memory <n>     Keep the buffers and hashes within n bytes\n");
+    printf("  -D, --daemon             Stay running with kcore open and the buffers\n"
+           "                           allocated, capturing a snapshot on SIGUSR1 to\n"
+           "                           output_file.<n>\n");
+    printf("  -L, --listen <socket>    Also capture a snapshot whenever a client\n"
+           "                           connects to socket, replying with its path\n"
+           "                           (implies --daemon)\n");
+    printf("  -E, --every <seconds>    Also capture a snapshot every n seconds\n"
+           "                           (implies --daemon)\n");
+    printf("  -p, --progress           Show progress and per-section latencies\n");
+    printf("  -S, --stats <file>       Write throughput and latency histograms to file\n"
+           "                           as JSON\n");
+    printf("  -h, --help               Show this help message\n");
+}
 
-    // The program expects a single argument: the file to dump memory to
-    if (argc < 2)
+/**
+ * Adds an extra destination for the dump, given as a path optionally
+ * followed by the policy for when it falls behind.
+ * 
+ * @param options The options to add the destination to
+ * @param text    The destination, e.g. "unix:/run/collector.sock,drop"
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int add_tee_output(struct dump_options* options, char* text)
+{
+    if (options->num_tee_outputs == MAX_TEE_OUTPUTS)
     {
-        printf("Usage: %s <output_file>\n", argv[0]);
-        ret = -1;
-        goto cleanup;
+        fprint_red(stderr, "[-] At most %d --tee destinations are supported\n",
+            MAX_TEE_OUTPUTS);
+        return -1;
     }
-    const char* output_file = argv[1];
 
-    // We will require root privileges to dump kcore
-    if (0 != getuid())
+    struct tee_output* outputs = realloc(options->tee_outputs, 
+        (options->num_tee_outputs + 1) * sizeof(struct tee_output));
+    if (NULL == outputs)
     {
-        fprint_red(stderr, "[-] This program required root privileges to function!\n");
-        ret = -1;
-        goto cleanup;
+        fprint_red(stderr, "[-] Failed to allocate the --tee destinations\n");
+        return -1;
     }
+    options->tee_outputs = outputs;
 
-    // Obtain a handle to /proc/kcore
-    if (-1 == (kcore_fd = open64(KCORE_FILENAME, O_RDWR | O_LARGEFILE)))
+    struct tee_output* output = &outputs[options->num_tee_outputs];
+    output->path = text;
+    output->policy = TEE_BLOCK;
+    output->fd = -1;
+    output->stream = 0;
+
+    char* comma = strrchr(text, ',');
+    if (NULL != comma && 
+        (0 == strcmp(comma + 1, "drop") || 0 == strcmp(comma + 1, "block")))
     {
-        fprint_red(stderr, "[-] Could not open %s\n", KCORE_FILENAME);
-        ret = -1;
-        goto cleanup;
+        output->policy = 0 == strcmp(comma + 1, "drop") ? TEE_DROP : TEE_BLOCK;
+        *comma = '\0';
+    }
+
+    options->num_tee_outputs++;
+    return 0;
+}
+
+/**
+ * Adds a file to stripe the dump across.
+ * 
+ * @param options The options to add the file to
+ * @param path    The path of the file
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int add_stripe_target(struct dump_options* options, const char* path)
+{
+    if (options->num_stripe_targets == MAX_STRIPE_TARGETS)
+    {
+        fprint_red(stderr, "[-] At most %d --stripe files are supported\n",
+            MAX_STRIPE_TARGETS);
+        return -1;
+    }
+
+    struct stripe_target* targets = realloc(options->stripe_targets, 
+        (options->num_stripe_targets + 1) * sizeof(struct stripe_target));
+    if (NULL == targets)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the --stripe files\n");
+        return -1;
+    }
+    options->stripe_targets = targets;
+
+    targets[options->num_stripe_targets].path = path;
+    targets[options->num_stripe_targets].fd = -1;
+    options->num_stripe_targets++;
+    return 0;
+}
+
+/**
+ * Parses a whole number, rejecting anything trailing it.
+ * 
+ * @param text  The number, in any base strtol accepts
+ * @param min   The smallest value allowed
+ * @param max   The largest value allowed
+ * @param value The number (output)
+ * 
+ * @return 0 for success, else -1 if it isn't a number between min and max
+ */
+static int parse_int(const char* text, const int min, const int max, int* value)
+{
+    char* end;
+    errno = 0;
+    long number = strtol(text, &end, 0);
+    if (0 != errno || end == text || '\0' != *end || number < min || 
+        number > max)
+    {
+        return -1;
+    }
+
+    *value = number;
+    return 0;
+}
+
+/**
+ * Parses the command line options.
+ * 
+ * @param argc    The number of arguments
+ * @param argv    The arguments
+ * @param options The parsed options (output)
+ * 
+ * @return The index of the first non-option argument, else -1 if there's an
+ *         error
+ */
+static int parse_options(int argc, char* argv[], struct dump_options* options)
+{
+    static const struct option long_options[] = {
+        { "kcore",       required_argument, NULL, 'k' },
+        { "iomem",       required_argument, NULL, 'i' },
+        { "pid",         required_argument, NULL, 'T' },
+        { "range",       required_argument, NULL, 'A' },
+        { "kernel-first", no_argument,      NULL, 'K' },
+        { "first",       required_argument, NULL, 'u' },
+        { "engine",      required_argument, NULL, 'e' },
+        { "format",      required_argument, NULL, 'F' },
+        { "threads",     required_argument, NULL, 't' },
+        { "numa",        no_argument,       NULL, 'N' },
+        { "queue-depth", required_argument, NULL, 'q' },
+        { "chunk-size",  required_argument, NULL, 'c' },
+        { "tee",         required_argument, NULL, 'o' },
+        { "tee-queue",   required_argument, NULL, 'Q' },
+        { "stripe",      required_argument, NULL, 'O' },
+        { "stripe-size", required_argument, NULL, 'w' },
+        { "direct",      no_argument,       NULL, 'd' },
+        { "sparse",      no_argument,       NULL, 's' },
+        { "skip-free",   no_argument,       NULL, 'f' },
+        { "compress",    no_argument,       NULL, 'z' },
+        { "manifest",    required_argument, NULL, 'm' },
+        { "base",        required_argument, NULL, 'b' },
+        { "hash",        required_argument, NULL, 'H' },
+        { "scan",        required_argument, NULL, 'x' },
+        { "hits",        required_argument, NULL, 'X' },
+        { "journal",     required_argument, NULL, 'j' },
+        { "journal-interval", required_argument, NULL, 'J' },
+        { "resume",      no_argument,       NULL, 'r' },
+        { "max-rate",    required_argument, NULL, 'R' },
+        { "psi-threshold", required_argument, NULL, 'P' },
+        { "io-priority", required_argument, NULL, 'I' },
+        { "nice",        required_argument, NULL, 'n' },
+        { "cpus",        required_argument, NULL, 'C' },
+        { "max-memory",  required_argument, NULL, 'M' },
+        { "daemon",      no_argument,       NULL, 'D' },
+        { "listen",      required_argument, NULL, 'L' },
+        { "every",       required_argument, NULL, 'E' },
+        { "progress",    no_argument,       NULL, 'p' },
+        { "stats",       required_argument, NULL, 'S' },
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL,          0,                 NULL, 0   }
+    };
+
+    options->kcore_path = KCORE_FILENAME;
+    options->iomem_path = IOMEM_FILENAME;
+    options->engine = ENGINE_SYNC;
+    options->format = &lime_format;
+    options->targets = NULL;
+    options->priorities = NULL;
+    options->threads = 1;
+    options->numa = 0;
+    options->queue_depth = DEFAULT_QUEUE_DEPTH;
+    options->chunk_size = CHUNK_SIZE;
+    options->direct = 0;
+    options->sparse = 0;
+    options->skip_free = 0;
+    options->compress = 0;
+    options->manifest_path = NULL;
+    options->base_path = NULL;
+    options->hash_path = NULL;
+    options->scan_path = NULL;
+    options->hits_path = NULL;
+    options->journal_path = NULL;
+    options->journal_interval = DEFAULT_JOURNAL_INTERVAL;
+    options->resume = 0;
+    options->max_rate = 0;
+    options->psi_threshold = 0;
+    options->io_priority = -1;
+    options->renice = 0;
+    options->nice = 0;
+    options->cpus = NULL;
+    options->max_memory = 0;
+    options->streaming = 0;
+    options->tee_outputs = NULL;
+    options->num_tee_outputs = 0;
+    options->tee_queue_depth = DEFAULT_TEE_QUEUE_DEPTH;
+    options->stripe_targets = NULL;
+    options->num_stripe_targets = 0;
+    options->stripe_size = DEFAULT_STRIPE_SIZE;
+    options->daemon = 0;
+    options->listen_path = NULL;
+    options->interval = 0;
+    options->buffers = NULL;
+    options->progress = 0;
+    options->stats_path = NULL;
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "k:i:T:A:Ku:e:F:t:Nq:c:o:Q:O:w:dsfzm:b:H:x:X:j:J:rR:P:I:n:C:M:DL:E:pS:h", long_options, NULL)))
+    {
+        switch (opt)
+        {
+        case 'k':
+            options->kcore_path = optarg;
+            break;
+        case 'i':
+            options->iomem_path = optarg;
+            break;
+        case 'T':
+        case 'A':
+            if (NULL == options->targets && 
+                NULL == (options->targets = target_create()))
+            {
+                fprint_red(stderr, "[-] Failed to allocate the targets\n");
+                return -1;
+            }
+            if ('T' == opt && -1 == target_add_pid(options->targets, optarg))
+            {
+                fprint_red(stderr, "[-] Invalid process id: %s\n", optarg);
+                return -1;
+            }
+            if ('A' == opt && -1 == target_add_range(options->targets, optarg))
+            {
+                fprint_red(stderr, "[-] Invalid physical range: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'K':
+        case 'u':
+            if (NULL == options->priorities && 
+                NULL == (options->priorities = priority_create()))
+            {
+                fprint_red(stderr, "[-] Failed to allocate the priorities\n");
+                return -1;
+            }
+            if ('K' == opt)
+            {
+                options->priorities->kernel_first = 1;
+            }
+            else if (-1 == priority_add_range(options->priorities, optarg))
+            {
+                fprint_red(stderr, "[-] Invalid physical range: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'e':
+            if (0 == strcmp(optarg, "sync"))
+            {
+                options->engine = ENGINE_SYNC;
+            }
+            else if (0 == strcmp(optarg, "uring"))
+            {
+                options->engine = ENGINE_URING;
+            }
+            else if (0 == strcmp(optarg, "splice"))
+            {
+                options->engine = ENGINE_SPLICE;
+            }
+            else if (0 == strcmp(optarg, "vector"))
+            {
+                options->engine = ENGINE_VECTOR;
+            }
+            else
+            {
+                fprint_red(stderr, "[-] Unknown copy engine: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'F':
+            if (NULL == (options->format = format_find(optarg)))
+            {
+                fprint_red(stderr, "[-] Unknown output format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 't':
+            if (-1 == parse_int(optarg, 1, MAX_THREADS, &options->threads))
+            {
+                fprint_red(stderr, "[-] The number of threads must be between 1 and %d\n",
+                    MAX_THREADS);
+                return -1;
+            }
+            break;
+        case 'N':
+            options->numa = 1;
+            break;
+        case 'q':
+            if (-1 == parse_int(optarg, 1, MAX_QUEUE_DEPTH, 
+                &options->queue_depth))
+            {
+                fprint_red(stderr, "[-] The queue depth must be between 1 and %d\n",
+                    MAX_QUEUE_DEPTH);
+                return -1;
+            }
+            break;
+        case 'c':
+        {
+            char* end;
+            errno = 0;
+            options->chunk_size = strtoull(optarg, &end, 0);
+            if (0 != errno || end == optarg || '\0' != *end || 
+                options->chunk_size < MIN_CHUNK_SIZE || 
+                options->chunk_size > MAX_CHUNK_SIZE ||
+                0 != options->chunk_size % MIN_CHUNK_SIZE)
+            {
+                fprint_red(stderr, "[-] The chunk size must be a multiple of 0x%x "
+                    "between 0x%x and 0x%x\n", MIN_CHUNK_SIZE, MIN_CHUNK_SIZE, 
+                    MAX_CHUNK_SIZE);
+                return -1;
+            }
+            break;
+        }
+        case 'o':
+            if (-1 == add_tee_output(options, optarg))
+            {
+                return -1;
+            }
+            break;
+        case 'Q':
+            if (-1 == parse_int(optarg, 1, MAX_QUEUE_DEPTH, 
+                &options->tee_queue_depth))
+            {
+                fprint_red(stderr, "[-] The tee queue must be between 1 and %d chunks\n",
+                    MAX_QUEUE_DEPTH);
+                return -1;
+            }
+            break;
+        case 'O':
+            if (-1 == add_stripe_target(options, optarg))
+            {
+                return -1;
+            }
+            break;
+        case 'w':
+            options->stripe_size = budget_parse_size(optarg);
+            if (0 == options->stripe_size || 
+                0 != options->stripe_size % MIN_CHUNK_SIZE)
+            {
+                fprint_red(stderr, "[-] The stripe size must be a multiple of 0x%x\n",
+                    MIN_CHUNK_SIZE);
+                return -1;
+            }
+            break;
+        case 'd':
+            options->direct = 1;
+            break;
+        case 's':
+            options->sparse = 1;
+            break;
+        case 'f':
+            options->skip_free = 1;
+            break;
+        case 'z':
+            options->compress = 1;
+            break;
+        case 'm':
+            options->manifest_path = optarg;
+            break;
+        case 'b':
+            options->base_path = optarg;
+            break;
+        case 'H':
+            options->hash_path = optarg;
+            break;
+        case 'x':
+            options->scan_path = optarg;
+            break;
+        case 'X':
+            options->hits_path = optarg;
+            break;
+        case 'j':
+            options->journal_path = optarg;
+            break;
+        case 'J':
+            if (-1 == parse_int(optarg, 1, INT_MAX, &options->journal_interval))
+            {
+                fprint_red(stderr, "[-] The journal interval must be a whole number of at least 1\n");
+                return -1;
+            }
+            break;
+        case 'r':
+            options->resume = 1;
+            break;
+        case 'R':
+            if (0 == (options->max_rate = budget_parse_size(optarg)))
+            {
+                fprint_red(stderr, "[-] Invalid rate: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'P':
+        {
+            char* end;
+            options->psi_threshold = strtod(optarg, &end);
+            if ('\0' != *end || options->psi_threshold <= 0 || 
+                options->psi_threshold > 100)
+            {
+                fprint_red(stderr, "[-] The pressure threshold must be a percentage above 0\n");
+                return -1;
+            }
+            break;
+        }
+        case 'I':
+            if (-1 == (options->io_priority = budget_parse_io_priority(optarg)))
+            {
+                fprint_red(stderr, "[-] Invalid I/O priority: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'n':
+            options->renice = 1;
+            if (-1 == parse_int(optarg, -20, 19, &options->nice))
+            {
+                fprint_red(stderr, "[-] The nice value must be between -20 and 19\n");
+                return -1;
+            }
+            break;
+        case 'C':
+        {
+            cpu_set_t cpus;
+            if (-1 == budget_parse_cpus(optarg, &cpus))
+            {
+                fprint_red(stderr, "[-] Invalid CPU list: %s\n", optarg);
+                return -1;
+            }
+            options->cpus = optarg;
+            break;
+        }
+        case 'M':
+            if (0 == (options->max_memory = budget_parse_size(optarg)))
+            {
+                fprint_red(stderr, "[-] Invalid memory limit: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'D':
+            options->daemon = 1;
+            break;
+        case 'L':
+            options->daemon = 1;
+            options->listen_path = optarg;
+            break;
+        case 'E':
+        {
+            char* end;
+            unsigned long interval = strtoul(optarg, &end, 0);
+            if ('\0' != *end || 0 == interval || interval > UINT_MAX)
+            {
+                fprint_red(stderr, "[-] Invalid snapshot interval: %s\n", optarg);
+                return -1;
+            }
+            options->daemon = 1;
+            options->interval = interval;
+            break;
+        }
+        case 'p':
+            options->progress = 1;
+            break;
+        case 'S':
+            options->stats_path = optarg;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    // Only the engines that see the data in user space can look for zeros
+    if (options->sparse && ENGINE_SYNC != options->engine)
+    {
+        fprint_red(stderr, "[-] --sparse is only supported by the sync engine\n");
+        return -1;
+    }
+
+    if (options->skip_free && ENGINE_SYNC != options->engine)
+    {
+        fprint_red(stderr, "[-] --skip-free is only supported by the sync engine\n");
+        return -1;
+    }
+
+    if (options->compress && ENGINE_SYNC != options->engine)
+    {
+        fprint_red(stderr, "[-] --compress is only supported by the sync engine\n");
+        return -1;
+    }
+
+    if ((NULL != options->manifest_path || NULL != options->base_path) &&
+        ENGINE_SYNC != options->engine)
+    {
+        fprint_red(stderr, "[-] Page hashing is only supported by the sync engine\n");
+        return -1;
+    }
+
+    if (NULL != options->hash_path && ENGINE_SYNC != options->engine)
+    {
+        fprint_red(stderr, "[-] --hash is only supported by the sync engine\n");
+        return -1;
+    }
+
+    // Chunks are hashed as a whole number of leaves
+    if (NULL != options->hash_path && 0 != options->chunk_size % MERKLE_LEAF_SIZE)
+    {
+        fprint_red(stderr, "[-] --hash requires a chunk size that's a multiple of 0x%x\n",
+            MERKLE_LEAF_SIZE);
+        return -1;
+    }
+
+    // O_DIRECT output is staged so that it can be written in order, which
+    // rules out the positional engines and leaving holes
+    if (options->direct && (ENGINE_SYNC != options->engine || options->sparse ||
+        (options->threads > 1 && !options->compress)))
+    {
+        fprint_red(stderr, "[-] --direct is only supported by the sync engine, without\n"
+            "    --sparse, and with --threads only when compressing\n");
+        return -1;
+    }
+
+    // A differential dump can't be rebuilt without its own manifest
+    if (NULL != options->base_path && NULL == options->manifest_path)
+    {
+        fprint_red(stderr, "[-] --base requires --manifest\n");
+        return -1;
+    }
+
+    // Differential dumps are made of LiME headers for each run of pages
+    if (NULL != options->base_path && &lime_format != options->format)
+    {
+        fprint_red(stderr, "[-] --base is only supported by the lime format\n");
+        return -1;
+    }
+
+    // The hashes cover every captured page, but a differential dump only
+    // holds the ones that changed, so it could never be verified against them
+    if (NULL != options->base_path && NULL != options->hash_path)
+    {
+        fprint_red(stderr, "[-] --hash can't be used with --base\n");
+        return -1;
+    }
+
+    // Only the threaded positional copy schedules chunks by where they live
+    if (options->numa && (ENGINE_SYNC != options->engine || 
+        options->threads < 2 || options->compress || options->direct || 
+        NULL != options->base_path))
+    {
+        fprint_red(stderr, "[-] --numa is only supported by the sync engine with --threads,\n"
+            "    and without --compress, --direct or --base\n");
+        return -1;
+    }
+
+    // Only the engines that copy chunk by chunk can be held to a rate
+    if ((0 != options->max_rate || options->psi_threshold > 0) && 
+        ENGINE_SYNC != options->engine)
+    {
+        fprint_red(stderr, "[-] --max-rate and --psi-threshold are only supported by the sync engine\n");
+        return -1;
+    }
+
+    // Fanning out happens in the sink stack, which the threaded positional
+    // copy doesn't use
+    if (options->num_tee_outputs > 0 && (ENGINE_SYNC != options->engine ||
+        (options->threads > 1 && !options->compress) || options->numa || 
+        NULL != options->journal_path))
+    {
+        fprint_red(stderr, "[-] --tee is only supported by the sync engine, with --threads\n"
+            "    only when compressing, and without --numa or --journal\n");
+        return -1;
+    }
+
+    // Striping happens at the bottom of the sink stack, which neither the
+    // threaded copies nor the other ways of writing the output go through
+    if (1 == options->num_stripe_targets)
+    {
+        fprint_red(stderr, "[-] --stripe needs at least two files\n");
+        return -1;
+    }
+    if (options->num_stripe_targets > 0 && (ENGINE_SYNC != options->engine ||
+        options->threads > 1 || options->compress || options->direct || 
+        options->numa || NULL != options->journal_path || 
+        options->num_tee_outputs > 0 || options->daemon))
+    {
+        fprint_red(stderr, "[-] --stripe is only supported by the sync engine, with one\n"
+            "    thread and without --compress, --direct, --journal, --tee or --daemon\n");
+        return -1;
+    }
+
+    // Checkpoints are only meaningful when the output is written in order
+    if (NULL != options->journal_path && (ENGINE_SYNC != options->engine ||
+        options->threads > 1 || options->compress || options->direct || 
+        NULL != options->base_path))
+    {
+        fprint_red(stderr, "[-] --journal is only supported by the sync engine, with one\n"
+            "    thread and without --compress, --direct or --base\n");
+        return -1;
+    }
+
+    if (options->resume && NULL == options->journal_path)
+    {
+        fprint_red(stderr, "[-] --resume requires --journal\n");
+        return -1;
+    }
+
+    // Page and leaf hashes of the part written before the interruption are
+    // gone, so they can't be completed
+    if (options->resume && 
+        (NULL != options->manifest_path || NULL != options->hash_path))
+    {
+        fprint_red(stderr, "[-] --resume can't be used with --manifest or --hash\n");
+        return -1;
+    }
+
+    if ((NULL == options->scan_path) != (NULL == options->hits_path))
+    {
+        fprint_red(stderr, "[-] --scan and --hits must be used together\n");
+        return -1;
+    }
+
+    // Signatures are matched across chunks, so the chunks have to be copied
+    // in order
+    if (NULL != options->scan_path && (ENGINE_SYNC != options->engine || 
+        (options->threads > 1 && !options->compress) || options->resume))
+    {
+        fprint_red(stderr, "[-] --scan is only supported by the sync engine, with\n"
+            "    --threads only when compressing, and without --resume\n");
+        return -1;
+    }
+
+    // Every snapshot gets a fresh output, so there's nothing to resume and
+    // no one place to send copies to
+    if (options->daemon && 
+        (NULL != options->journal_path || options->num_tee_outputs > 0))
+    {
+        fprint_red(stderr, "[-] --daemon can't be used with --journal or --tee\n");
+        return -1;
+    }
+
+    return optind;
+}
+
+/**
+ * Opens a regular file as the output, bypassing the page cache if asked to.
+ * Filesystems that don't support O_DIRECT fall back to buffered output.
+ * 
+ * @param path    The path of the output file
+ * @param options The options, updated if O_DIRECT isn't supported
+ * 
+ * @return The file descriptor of the output, else -1 if there's an error
+ */
+static int open_file(const char* path, struct dump_options* options)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE;
+
+    // The existing output is kept, and its headers read back to check them
+    if (options->resume)
+    {
+        return open64(path, O_RDWR | O_LARGEFILE);
+    }
+
+    if (options->direct)
+    {
+        int fd = open64(path, flags | O_DIRECT, S_IRUSR);
+        if (-1 != fd || EINVAL != errno)
+        {
+            return fd;
+        }
+
+        print_yellow("[!] %s doesn't support O_DIRECT, using the page cache\n", path);
+        options->direct = 0;
+    }
+
+    return open64(path, flags, S_IRUSR);
+}
+
+/**
+ * Opens the output the dump is written to. Anything other than a regular
+ * file is treated as a stream, which has to be written strictly in order.
+ * 
+ * @param path      The output path given on the command line
+ * @param stdout_fd A duplicate of the original stdout, or -1
+ * @param options   The options, updated if the output is a stream
+ * 
+ * @return The file descriptor of the output, else -1 if there's an error
+ */
+static int open_output(const char* path, 
+                       const int stdout_fd, 
+                       struct dump_options* options)
+{
+    int fd;
+    struct stat st;
+
+    if (0 == strcmp(path, STDOUT_OUTPUT))
+    {
+        fd = stdout_fd;
+    }
+    else if (0 == strncmp(path, UNIX_SOCKET_PREFIX, strlen(UNIX_SOCKET_PREFIX)))
+    {
+        fd = stream_connect_unix(path + strlen(UNIX_SOCKET_PREFIX));
+    }
+    else if (0 == stat(path, &st) && S_ISFIFO(st.st_mode))
+    {
+        fd = open64(path, O_WRONLY | O_LARGEFILE);
+    }
+    else
+    {
+        return open_file(path, options);
+    }
+
+    if (-1 == fd)
+    {
+        return -1;
+    }
+
+    if (ENGINE_SYNC != options->engine)
+    {
+        fprint_red(stderr, "[-] Streaming output is only supported by the sync engine\n");
+        close(fd);
+        return -1;
+    }
+
+    if (options->numa)
+    {
+        fprint_red(stderr, "[-] --numa is only supported for regular files\n");
+        close(fd);
+        return -1;
+    }
+
+    if (NULL != options->journal_path)
+    {
+        fprint_red(stderr, "[-] --journal is only supported for regular files\n");
+        close(fd);
+        return -1;
+    }
+
+    if (options->direct)
+    {
+        print_yellow("[!] --direct has no effect when streaming\n");
+        options->direct = 0;
+    }
+
+    // A reader going away should surface as a write error, not kill us
+    signal(SIGPIPE, SIG_IGN);
+    options->streaming = 1;
+
+    return fd;
+}
+
+/**
+ * Opens an extra destination for the dump. Anything other than a regular
+ * file is a stream, just like the main output.
+ * 
+ * @param output    The destination
+ * @param stdout_fd A duplicate of the original stdout if it's free for the
+ *                  destination to take, or -1
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int open_tee_output(struct tee_output* output, int* stdout_fd)
+{
+    struct stat st;
+
+    output->stream = 1;
+    if (0 == strcmp(output->path, STDOUT_OUTPUT))
+    {
+        if (-1 == *stdout_fd)
+        {
+            fprint_red(stderr, "[-] Only one destination can be stdout\n");
+            return -1;
+        }
+        output->fd = *stdout_fd;
+        *stdout_fd = -1;
+    }
+    else if (0 == strncmp(output->path, UNIX_SOCKET_PREFIX, 
+        strlen(UNIX_SOCKET_PREFIX)))
+    {
+        output->fd = stream_connect_unix(output->path + strlen(UNIX_SOCKET_PREFIX));
+    }
+    else if (0 == stat(output->path, &st) && S_ISFIFO(st.st_mode))
+    {
+        output->fd = open64(output->path, O_WRONLY | O_LARGEFILE);
+    }
+    else
+    {
+        output->stream = 0;
+        output->fd = open64(output->path, 
+            O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, S_IRUSR);
     }
 
+    if (-1 == output->fd)
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", output->path);
+        return -1;
+    }
+
+    if (output->stream)
+    {
+        signal(SIGPIPE, SIG_IGN);
+    }
+    return 0;
+}
+
+/**
+ * Works out which parts of memory to dump, by matching the System RAM in
+ * iomem to the segments of kcore, then narrowing them to any targets and
+ * putting them in priority order.
+ * 
+ * @param kcore_fd The file descriptor for kcore
+ * @param options  The options
+ * @param sections The sections to dump, which are replaced (input/output)
+ * 
+ * @return The number of sections, else -1 if there's an error
+ */
+static int load_sections(const int kcore_fd, 
+                         struct dump_options* options, 
+                         struct section** sections)
+{
+    int num_sections = -1;
+    Elf64_Phdr* prog_hdr = NULL;
+    struct addr_range* ranges = NULL;
+
+    free(*sections);
+    *sections = NULL;
+
     // Get the physical memory ranges from iomem
-    struct addr_range ranges[MAX_PHYSICAL_RANGES];
-    int num_physical_ranges = get_system_ram_address_ranges(ranges);
+    int num_physical_ranges = get_system_ram_address_ranges(options->iomem_path, 
+        &ranges);
     if (-1 == num_physical_ranges)
     {
         fprint_red(stderr, "[-] Failed to get physical memory range\n");
-        ret = -1;
         goto cleanup;
     }
 
-    // Get the ELF headers from kcore
+    // Get the ELF headers from kcore, which may be a file we were given
+    // rather than the kernel's own
     Elf64_Ehdr elf_hdr;
-    read(kcore_fd, (void*)&elf_hdr, sizeof(elf_hdr));
+    if (-1 == read_all_at(kcore_fd, &elf_hdr, sizeof(elf_hdr), 0) ||
+        0 != memcmp(elf_hdr.e_ident, ELFMAG, SELFMAG) ||
+        ELFCLASS64 != elf_hdr.e_ident[EI_CLASS] ||
+        sizeof(Elf64_Phdr) != elf_hdr.e_phentsize ||
+        0 == elf_hdr.e_phnum || PN_XNUM == elf_hdr.e_phnum)
+    {
+        fprint_red(stderr, "[-] %s isn't a 64-bit ELF core\n", 
+            options->kcore_path);
+        goto cleanup;
+    }
 
     // Get the program headers from kcore
-    lseek(kcore_fd, elf_hdr.e_phoff, SEEK_SET);
-    size_t phdrs_size = elf_hdr.e_phnum * elf_hdr.e_phentsize;
-    Elf64_Phdr* prog_hdr = (Elf64_Phdr*) malloc(phdrs_size);
+    size_t phdrs_size = (size_t) elf_hdr.e_phnum * sizeof(Elf64_Phdr);
+    prog_hdr = (Elf64_Phdr*) malloc(phdrs_size);
     if (NULL == prog_hdr)
     {
         fprint_red(stderr, "[-] Failed to get program headers from kcore\n");
-        ret = -1;
         goto cleanup;
     }
-    read(kcore_fd, (void*)prog_hdr, phdrs_size);
+    if (-1 == read_all_at(kcore_fd, prog_hdr, phdrs_size, elf_hdr.e_phoff))
+    {
+        fprint_red(stderr, "[-] Failed to read the program headers of %s\n", 
+            options->kcore_path);
+        goto cleanup;
+    }
 
     // Map the physical address ranges from iomem to the headers from kcore
-    struct section sections[MAX_PHYSICAL_RANGES];
-    match_physical_addresses_to_phdrs(prog_hdr, elf_hdr.e_phnum, ranges, 
-        num_physical_ranges, sections);
+    num_sections = match_physical_addresses_to_phdrs(prog_hdr, 
+        elf_hdr.e_phnum, ranges, num_physical_ranges, sections);
+    if (-1 == num_sections)
+    {
+        fprint_red(stderr, "[-] Failed to map memory ranges to kcore\n");
+        goto cleanup;
+    }
+    print_green("[*] Found %d sections in %d memory ranges\n", num_sections,
+        num_physical_ranges);
+
+    // A targeted dump only copies the parts of those sections it was asked for
+    if (NULL != options->targets)
+    {
+        struct section* selected = NULL;
+        num_sections = target_select_sections(options->targets, *sections, 
+            num_sections, &selected);
+        free(*sections);
+        *sections = selected;
+        if (num_sections <= 0)
+        {
+            fprint_red(stderr, "[-] None of the targeted memory is in System RAM\n");
+            num_sections = -1;
+            goto cleanup;
+        }
+        print_green("[*] Limited the dump to %d targeted sections\n", num_sections);
+    }
+
+    // The most urgent memory is captured first, in case the dump is cut short
+    if (NULL != options->priorities)
+    {
+        num_sections = priority_order_sections(options->priorities, 
+            options->iomem_path, sections, num_sections);
+        if (-1 == num_sections)
+        {
+            fprint_red(stderr, "[-] Failed to prioritise the sections\n");
+        }
+    }
+
+cleanup:
+    free(prog_hdr);
+    free(ranges);
+    return num_sections;
+}
+
+/**
+ * Captures a single dump of the sections to the output.
+ * 
+ * @param kcore_fd     The file descriptor for kcore
+ * @param output_file  The output path
+ * @param stdout_fd    A duplicate of the original stdout, which is set to -1
+ *                     once an output takes it over (input/output)
+ * @param sections     The sections to dump
+ * @param num_sections The number of sections
+ * @param options      The options
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int capture(const int kcore_fd,
+                   const char* output_file,
+                   int* stdout_fd,
+                   struct section* sections,
+                   const int num_sections,
+                   struct dump_options* options)
+{
+    int ret = 0;
+    int out_fd = -1;
+    struct dump_stats stats;
 
     // Obtain a handle to the output file
-    if (-1 == (out_fd = 
-        open64(output_file, O_WRONLY | O_CREAT | O_LARGEFILE, S_IRUSR)))
+    if (-1 == (out_fd = open_output(output_file, *stdout_fd, options)))
     {
         fprint_red(stderr, "[-] Could not open %s\n", output_file);
         ret = -1;
         goto cleanup;
     }
 
+    // The main output gets first claim on stdout
+    int taken = -1;
+    if (out_fd == *stdout_fd)
+    {
+        *stdout_fd = -1;
+    }
+    for (int i = 0; i < options->num_tee_outputs; i++)
+    {
+        if (-1 == open_tee_output(&options->tee_outputs[i], 
+            -1 == *stdout_fd ? &taken : stdout_fd))
+        {
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    // Each file of a striped dump is written in order by its own thread
+    for (int i = 0; i < options->num_stripe_targets; i++)
+    {
+        struct stripe_target* target = &options->stripe_targets[i];
+        if (-1 == (target->fd = open64(target->path, 
+            O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, S_IRUSR)))
+        {
+            fprint_red(stderr, "[-] Could not open %s\n", target->path);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
     // Finally, dump kcore to disk
-    if (-1 == dump_kcore(kcore_fd, out_fd, sections, num_physical_ranges))
+    if (-1 == dump_kcore(kcore_fd, out_fd, sections, num_sections, 
+        options, &stats))
     {
         fprint_red(stderr, "[-] Failed to dump memory to disk\n");
         ret = -1;
@@ -109,6 +1123,304 @@ int main(int argc, char* argv[])
     }
 
     print_green("[+] Successfully dumped kcore to %s\n", output_file);
+    if (options->sparse)
+    {
+        print_green("[+] Skipped 0x%lx of 0x%lx bytes of zero-filled memory\n",
+            stats.bytes_elided, stats.bytes_copied);
+    }
+    if (options->skip_free)
+    {
+        print_green("[+] Skipped 0x%lx of 0x%lx bytes of free or unbacked pages\n",
+            stats.bytes_free, stats.bytes_copied);
+    }
+    if (0 != stats.throttled_ns || 0 != stats.backoffs)
+    {
+        print_green("[+] Throttled for %.1f seconds, backing off %lu times\n",
+            stats.throttled_ns / 1e9, stats.backoffs);
+    }
+    if (NULL != options->base_path)
+    {
+        print_green("[+] Left out 0x%lx of 0x%lx bytes that were unchanged\n",
+            stats.bytes_unchanged, stats.bytes_copied);
+    }
+    if (0 != stats.read_calls && 0 != stats.write_calls)
+    {
+        print_green("[+] Made %lu reads averaging 0x%lx bytes and %lu writes "
+            "averaging 0x%lx bytes\n", stats.read_calls, 
+            stats.bytes_read / stats.read_calls, stats.write_calls,
+            stats.bytes_written / stats.write_calls);
+    }
+    if (NULL != options->hits_path)
+    {
+        print_green("[+] Found %lu signature matches, listed in %s\n",
+            stats.signature_hits, options->hits_path);
+    }
+
+cleanup:
+    if (out_fd >= 0)
+    {
+        close(out_fd);
+    }
+
+    for (int i = 0; i < options->num_tee_outputs; i++)
+    {
+        if (options->tee_outputs[i].fd >= 0)
+        {
+            close(options->tee_outputs[i].fd);
+            options->tee_outputs[i].fd = -1;
+        }
+    }
+
+    for (int i = 0; i < options->num_stripe_targets; i++)
+    {
+        if (options->stripe_targets[i].fd >= 0)
+        {
+            close(options->stripe_targets[i].fd);
+            options->stripe_targets[i].fd = -1;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Works out where a daemon's snapshot goes, by numbering the path given on
+ * the command line.
+ * 
+ * @param buffer   The buffer for the path
+ * @param path     The path given on the command line, or NULL
+ * @param snapshot The number of the snapshot
+ * 
+ * @return The numbered path, else NULL if there's no path
+ */
+static const char* snapshot_path(char* buffer, 
+                                 const char* path, 
+                                 const unsigned int snapshot)
+{
+    if (NULL == path)
+    {
+        return NULL;
+    }
+
+    snprintf(buffer, PATH_MAX, "%s.%u", path, snapshot);
+    return buffer;
+}
+
+/**
+ * Runs as a daemon, capturing a dump whenever one is asked for. kcore stays
+ * open, the sections stay matched and the chunk buffers stay allocated
+ * between snapshots, so a request is only held up by the copy itself. The
+ * sections are only matched again when memory is hotplugged, or before each
+ * snapshot of a process, as its pages move around.
+ * 
+ * Each snapshot gets the next unused number, which is appended to the output
+ * path along with those of the manifest, hashes, signature matches and stats.
+ * 
+ * @param kcore_fd     The file descriptor for kcore
+ * @param output_file  The output path
+ * @param sections     The sections to dump, which are replaced when the
+ *                     layout changes (input/output)
+ * @param num_sections The number of sections (input/output)
+ * @param options      The options
+ * 
+ * @return 0 when the daemon is asked to exit, else -1 if there's an error
+ */
+static int run_daemon(const int kcore_fd,
+                      const char* output_file,
+                      struct section** sections,
+                      int* num_sections,
+                      struct dump_options* options)
+{
+    int ret = 0;
+    int stdout_fd = -1;
+    unsigned int snapshot = 0;
+    struct capture_daemon sd;
+    const char* manifest_path = options->manifest_path;
+    const char* hash_path = options->hash_path;
+    const char* hits_path = options->hits_path;
+    const char* stats_path = options->stats_path;
+    char output_buffer[PATH_MAX], manifest_buffer[PATH_MAX];
+    char hash_buffer[PATH_MAX], hits_buffer[PATH_MAX], stats_buffer[PATH_MAX];
+
+    if (-1 == daemon_open(&sd, options->listen_path, options->interval))
+    {
+        return -1;
+    }
+
+    if (NULL == (options->buffers = dump_buffers_create(*sections, 
+        *num_sections, options)))
+    {
+        fprint_red(stderr, "[-] Failed to allocate the chunk buffers\n");
+        ret = -1;
+        goto cleanup;
+    }
+    buffer_pool_prefault(options->buffers);
+
+    print_green("[*] Waiting for snapshot requests (pid %d)\n", getpid());
+
+    while (1)
+    {
+        int client_fd;
+        int event = daemon_wait(&sd, &client_fd);
+        if (-1 == event)
+        {
+            ret = -1;
+            break;
+        }
+        if (DAEMON_STOP == event)
+        {
+            print_green("[*] Stopping\n");
+            break;
+        }
+
+        // Pages of processes move between snapshots, the rest of memory only
+        // moves when it's hotplugged
+        if (DAEMON_RELOAD == event || 
+            (NULL != options->targets && options->targets->num_pids > 0))
+        {
+            if (DAEMON_RELOAD == event)
+            {
+                print_green("[*] Reloading the memory layout\n");
+            }
+            if (-1 == (*num_sections = load_sections(kcore_fd, options, sections)))
+            {
+                daemon_reply(client_fd, NULL);
+                continue;
+            }
+        }
+        if (DAEMON_RELOAD == event)
+        {
+            buffer_pool_destroy(options->buffers);
+            if (NULL == (options->buffers = dump_buffers_create(*sections, 
+                *num_sections, options)))
+            {
+                fprint_red(stderr, "[-] Failed to allocate the chunk buffers\n");
+                ret = -1;
+                break;
+            }
+            buffer_pool_prefault(options->buffers);
+            continue;
+        }
+
+        // A layout that couldn't be loaded can't be dumped
+        if (-1 == *num_sections)
+        {
+            daemon_reply(client_fd, NULL);
+            continue;
+        }
+
+        do
+        {
+            snapshot_path(output_buffer, output_file, ++snapshot);
+        } while (0 == access(output_buffer, F_OK));
+        options->manifest_path = snapshot_path(manifest_buffer, manifest_path, 
+            snapshot);
+        options->hash_path = snapshot_path(hash_buffer, hash_path, snapshot);
+        options->hits_path = snapshot_path(hits_buffer, hits_path, snapshot);
+        options->stats_path = snapshot_path(stats_buffer, stats_path, snapshot);
+
+        print_green("[*] Capturing snapshot %u\n", snapshot);
+        int captured = capture(kcore_fd, output_buffer, &stdout_fd, *sections, 
+            *num_sections, options);
+        daemon_reply(client_fd, -1 == captured ? NULL : output_buffer);
+    }
+
+cleanup:
+    daemon_close(&sd);
+    buffer_pool_destroy(options->buffers);
+    options->buffers = NULL;
+    options->manifest_path = manifest_path;
+    options->hash_path = hash_path;
+    options->hits_path = hits_path;
+    options->stats_path = stats_path;
+    return ret;
+}
+
+int main(int argc, char* argv[])
+{
+    int ret = 0;
+    int kcore_fd = -1, stdout_fd = -1;
+    struct section* sections = NULL;
+    struct dump_options options;
+
+    // Parse the options, after which we expect the file to dump memory to
+    int arg_index = parse_options(argc, argv, &options);
+    if (-1 == arg_index || arg_index >= argc)
+    {
+        print_usage(argv[0]);
+        ret = -1;
+        goto cleanup;
+    }
+    const char* output_file = argv[arg_index];
+
+    // A daemon writes each snapshot to its own file
+    if (options.daemon && (0 == strcmp(output_file, STDOUT_OUTPUT) ||
+        0 == strncmp(output_file, UNIX_SOCKET_PREFIX, strlen(UNIX_SOCKET_PREFIX))))
+    {
+        fprint_red(stderr, "[-] --daemon can only write to regular files\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    // When streaming to stdout our messages have to stay out of the stream,
+    // so they're sent to stderr instead
+    int tee_stdout = 0;
+    for (int i = 0; i < options.num_tee_outputs; i++)
+    {
+        tee_stdout |= 0 == strcmp(options.tee_outputs[i].path, STDOUT_OUTPUT);
+    }
+    if (0 == strcmp(output_file, STDOUT_OUTPUT) || tee_stdout)
+    {
+        if (-1 == (stdout_fd = dup(STDOUT_FILENO)) || 
+            -1 == dup2(STDERR_FILENO, STDOUT_FILENO))
+        {
+            fprint_red(stderr, "[-] Could not redirect stdout\n");
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    // We will require root privileges to dump the real kcore, and to see the
+    // real addresses in iomem
+    if ((0 == strcmp(options.kcore_path, KCORE_FILENAME) ||
+        0 == strcmp(options.iomem_path, IOMEM_FILENAME)) && 0 != getuid())
+    {
+        fprint_red(stderr, "[-] This program required root privileges to function!\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    // Obtain a handle to /proc/kcore
+    if (-1 == (kcore_fd = open64(options.kcore_path, O_RDONLY | O_LARGEFILE)))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", options.kcore_path);
+        ret = -1;
+        goto cleanup;
+    }
+
+    int num_sections = load_sections(kcore_fd, &options, &sections);
+    if (-1 == num_sections)
+    {
+        ret = -1;
+        goto cleanup;
+    }
+
+    // Any threads started for the dump inherit the process's limits
+    if (-1 == budget_apply_process_limits(&options))
+    {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (options.daemon)
+    {
+        ret = run_daemon(kcore_fd, output_file, &sections, &num_sections, &options);
+    }
+    else
+    {
+        ret = capture(kcore_fd, output_file, &stdout_fd, sections, num_sections, 
+            &options);
+    }
 
     // Cleanup
 cleanup:
@@ -118,17 +1430,17 @@ cleanup:
         kcore_fd = -1;
     }
 
-    if (out_fd >= 0)
+    if (stdout_fd >= 0)
     {
-        close(out_fd);
-        out_fd = -1;
+        close(stdout_fd);
+        stdout_fd = -1;
     }
 
-    if (NULL != prog_hdr)
-    {
-        free(prog_hdr);
-        prog_hdr = NULL;
-    }
+    free(sections);
+    target_free(options.targets);
+    priority_free(options.priorities);
+    free(options.tee_outputs);
+    free(options.stripe_targets);
 
     return ret;
 }
\ No newline at end of file
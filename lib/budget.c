@@ -0,0 +1,481 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "budget.h"
+
+#include "color-print.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// ioprio_set has no wrapper in glibc
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_MAX_LEVEL 7
+
+/**
+ * Parses a size with an optional K, M or G suffix (powers of 1024).
+ * 
+ * @param text The size, in any base strtoull accepts
+ * 
+ * @return The size in bytes, else 0 if it isn't valid
+ */
+size_t budget_parse_size(const char* text)
+{
+    // strtoull would quietly wrap a negative size around to a huge one
+    if (NULL != strchr(text, '-'))
+    {
+        return 0;
+    }
+
+    char* end;
+    errno = 0;
+    size_t size = strtoull(text, &end, 0);
+    if (0 != errno || end == text)
+    {
+        return 0;
+    }
+
+    int shift = 0;
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        shift = 10;
+        end++;
+        break;
+    case 'm':
+    case 'M':
+        shift = 20;
+        end++;
+        break;
+    case 'g':
+    case 'G':
+        shift = 30;
+        end++;
+        break;
+    }
+
+    // Sizes that don't fit once the suffix is applied are rejected too
+    if (size > (SIZE_MAX >> shift))
+    {
+        return 0;
+    }
+    size <<= shift;
+
+    return '\0' == *end ? size : 0;
+}
+
+/**
+ * Parses an I/O priority, given as a class name optionally followed by a
+ * level from 0 (highest) to 7, e.g. "idle" or "best-effort:7".
+ * 
+ * @param text The I/O priority
+ * 
+ * @return The value to pass to ioprio_set, else -1 if it isn't valid
+ */
+int budget_parse_io_priority(const char* text)
+{
+    static const struct
+    {
+        const char* name;
+        int         io_class;
+    } classes[] = {
+        { "realtime",    IOPRIO_CLASS_RT   },
+        { "best-effort", IOPRIO_CLASS_BE   },
+        { "idle",        IOPRIO_CLASS_IDLE },
+    };
+
+    const char* colon = strchr(text, ':');
+    size_t name_len = NULL == colon ? strlen(text) : (size_t) (colon - text);
+    int level = 0;
+
+    if (NULL != colon)
+    {
+        char* end;
+        level = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || '\0' != *end || level < 0 || 
+            level > IOPRIO_MAX_LEVEL)
+        {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+    {
+        if (strlen(classes[i].name) == name_len && 
+            0 == strncmp(classes[i].name, text, name_len))
+        {
+            // The idle class has no levels
+            if (IOPRIO_CLASS_IDLE == classes[i].io_class && NULL != colon)
+            {
+                return -1;
+            }
+            return (classes[i].io_class << IOPRIO_CLASS_SHIFT) | level;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Parses a list of CPUs, such as "0-3,8".
+ * 
+ * @param text The list of CPUs
+ * @param cpus The set of CPUs (output)
+ * 
+ * @return 0 for success, else -1 if the list isn't valid
+ */
+int budget_parse_cpus(const char* text, cpu_set_t* cpus)
+{
+    const char* p = text;
+
+    CPU_ZERO(cpus);
+    while ('\0' != *p)
+    {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0)
+        {
+            return -1;
+        }
+
+        p = end;
+        if ('-' == *p)
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first)
+            {
+                return -1;
+            }
+            p = end;
+        }
+
+        if (last >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            CPU_SET(cpu, cpus);
+        }
+
+        if (',' == *p)
+        {
+            p++;
+        }
+        else if ('\0' != *p)
+        {
+            return -1;
+        }
+    }
+
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+/**
+ * Lowers the priority of the process and pins it to the chosen CPUs. This
+ * has to happen before any threads are started, so that they inherit it.
+ * 
+ * @param options The options for the dump
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+int budget_apply_process_limits(const struct dump_options* options)
+{
+    if (-1 != options->io_priority)
+    {
+        if (-1 == syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, 
+            options->io_priority))
+        {
+            fprint_red(stderr, "[-] Failed to set the I/O priority (errno %d)\n", 
+                errno);
+            return -1;
+        }
+    }
+
+    if (options->renice)
+    {
+        if (-1 == setpriority(PRIO_PROCESS, 0, options->nice))
+        {
+            fprint_red(stderr, "[-] Failed to set the nice value (errno %d)\n", 
+                errno);
+            return -1;
+        }
+    }
+
+    if (NULL != options->cpus)
+    {
+        cpu_set_t cpus;
+        if (-1 == budget_parse_cpus(options->cpus, &cpus) ||
+            -1 == sched_setaffinity(0, sizeof(cpus), &cpus))
+        {
+            fprint_red(stderr, "[-] Failed to pin to CPUs %s (errno %d)\n", 
+                options->cpus, errno);
+            return -1;
+        }
+        print_green("[*] Pinned to CPUs %s\n", options->cpus);
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the share of time in the last 10 seconds that some tasks were
+ * stalled on a resource.
+ * 
+ * @param fd The file descriptor of the resource's pressure file
+ * 
+ * @return The percentage of time stalled, else 0 if it can't be read
+ */
+static double read_pressure(const int fd)
+{
+    char text[256];
+    double avg10;
+
+    if (-1 == fd)
+    {
+        return 0;
+    }
+
+    ssize_t len = pread(fd, text, sizeof(text) - 1, 0);
+    if (len <= 0)
+    {
+        return 0;
+    }
+    text[len] = '\0';
+
+    if (1 != sscanf(text, "some avg10=%lf", &avg10))
+    {
+        return 0;
+    }
+    return avg10;
+}
+
+/**
+ * Creates the impact budget for a dump.
+ * 
+ * @param options The options for the dump
+ * 
+ * @return The budget, else NULL if there's an error
+ */
+struct budget* budget_create(const struct dump_options* options)
+{
+    struct budget* budget = calloc(1, sizeof(struct budget));
+    if (NULL == budget)
+    {
+        return NULL;
+    }
+
+    budget->max_rate = options->max_rate;
+    budget->psi_threshold = options->psi_threshold;
+    budget->psi_io_fd = -1;
+    budget->psi_memory_fd = -1;
+    budget->tokens = options->max_rate;
+    budget->refill_ns = metrics_now();
+    budget->interval_start_ns = budget->refill_ns;
+    budget->next_check_ns = budget->refill_ns + 
+        BUDGET_CHECK_INTERVAL_MS * 1000000ULL;
+    pthread_mutex_init(&budget->lock, NULL);
+
+    if (budget->psi_threshold > 0)
+    {
+        budget->psi_io_fd = open(PSI_IO_FILENAME, O_RDONLY);
+        budget->psi_memory_fd = open(PSI_MEMORY_FILENAME, O_RDONLY);
+        if (-1 == budget->psi_io_fd && -1 == budget->psi_memory_fd)
+        {
+            print_yellow("[!] Pressure stall information isn't available, only write "
+                "latency will be watched\n");
+        }
+    }
+
+    return budget;
+}
+
+/**
+ * Adjusts the rate to how the host is coping. Once I/O or memory pressure
+ * crosses the threshold, or writes slow down well beyond their usual
+ * latency, the rate is halved. It then recovers gradually once things have
+ * calmed down. The budget must be locked.
+ * 
+ * @param budget The budget
+ * @param now    The current time
+ */
+static void budget_adapt(struct budget* budget, const uint64_t now)
+{
+    uint64_t observed = budget->interval_bytes * 1000000000ULL / 
+        (now - budget->interval_start_ns);
+    if (observed > budget->peak_rate)
+    {
+        budget->peak_rate = observed;
+    }
+
+    double pressure = read_pressure(budget->psi_io_fd);
+    double memory_pressure = read_pressure(budget->psi_memory_fd);
+    if (memory_pressure > pressure)
+    {
+        pressure = memory_pressure;
+    }
+
+    int congested = (budget->psi_threshold > 0 && 
+        pressure >= budget->psi_threshold) || (0 != budget->latency_floor && 
+        budget->latency > BUDGET_LATENCY_FACTOR * budget->latency_floor);
+    int calm = (0 == budget->psi_threshold || 
+        pressure < budget->psi_threshold / 2) && 
+        budget->latency <= 2 * budget->latency_floor;
+
+    // Without a rate limit the fastest the dump has gone stands in for one
+    uint64_t ceiling = budget->max_rate ? budget->max_rate : budget->peak_rate;
+    if (congested && ceiling > 0)
+    {
+        uint64_t rate = budget->rate ? budget->rate : ceiling;
+        budget->rate = rate / 2;
+        if (budget->rate < ceiling / BUDGET_MIN_RATE_FRACTION)
+        {
+            budget->rate = ceiling / BUDGET_MIN_RATE_FRACTION;
+        }
+        if (0 == budget->rate)
+        {
+            budget->rate = 1;
+        }
+        budget->backoffs++;
+    }
+    else if (calm && 0 != budget->rate)
+    {
+        budget->rate += budget->rate / 4;
+        if (budget->rate >= ceiling)
+        {
+            budget->rate = 0;
+        }
+    }
+
+    // The usual latency follows drops straight away but only creeps up, so
+    // that sustained congestion still stands out against it
+    if (0 == budget->latency_floor || budget->latency < budget->latency_floor)
+    {
+        budget->latency_floor = budget->latency;
+    }
+    else
+    {
+        budget->latency_floor += (budget->latency - budget->latency_floor) / 64;
+    }
+
+    budget->interval_start_ns = now;
+    budget->interval_bytes = 0;
+    budget->next_check_ns = now + BUDGET_CHECK_INTERVAL_MS * 1000000ULL;
+}
+
+/**
+ * Accounts for a chunk that has been copied, waiting for as long as it
+ * takes to stay within the budget.
+ * 
+ * @param budget   The budget
+ * @param bytes    The number of bytes copied
+ * @param write_ns How long it took to write the chunk
+ */
+void budget_account(struct budget* budget, 
+                    const size_t bytes, 
+                    const uint64_t write_ns)
+{
+    uint64_t wait_ns = 0;
+
+    pthread_mutex_lock(&budget->lock);
+    uint64_t now = metrics_now();
+
+    // Latency is compared per MiB so that short chunks don't skew it
+    if (bytes > 0)
+    {
+        uint64_t latency = write_ns * 0x100000 / bytes;
+        budget->latency = budget->latency ? 
+            (7 * budget->latency + latency) / 8 : latency;
+    }
+
+    budget->interval_bytes += bytes;
+    if (now >= budget->next_check_ns)
+    {
+        budget_adapt(budget, now);
+    }
+
+    uint64_t rate = budget->rate ? budget->rate : budget->max_rate;
+    if (0 != rate)
+    {
+        budget->tokens += (double) (now - budget->refill_ns) * rate / 1e9;
+        if (budget->tokens > (double) rate * BUDGET_BURST_SECONDS)
+        {
+            budget->tokens = (double) rate * BUDGET_BURST_SECONDS;
+        }
+        budget->tokens -= bytes;
+        if (budget->tokens < 0)
+        {
+            wait_ns = -budget->tokens * 1e9 / rate;
+        }
+    }
+    budget->refill_ns = now;
+    budget->throttled_ns += wait_ns;
+    pthread_mutex_unlock(&budget->lock);
+
+    if (wait_ns > 0)
+    {
+        struct timespec ts = {
+            .tv_sec = wait_ns / 1000000000ULL,
+            .tv_nsec = wait_ns % 1000000000ULL,
+        };
+        while (-1 == nanosleep(&ts, &ts) && EINTR == errno)
+        {
+        }
+    }
+}
+
+/**
+ * Releases an impact budget.
+ * 
+ * @param budget The budget, which may be NULL
+ */
+void budget_free(struct budget* budget)
+{
+    if (NULL == budget)
+    {
+        return;
+    }
+
+    if (-1 != budget->psi_io_fd)
+    {
+        close(budget->psi_io_fd);
+    }
+    if (-1 != budget->psi_memory_fd)
+    {
+        close(budget->psi_memory_fd);
+    }
+    pthread_mutex_destroy(&budget->lock);
+    free(budget);
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lmat.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+// The pressure stall information the kernel exports for I/O and memory
+#define PSI_IO_FILENAME "/proc/pressure/io"
+#define PSI_MEMORY_FILENAME "/proc/pressure/memory"
+
+// How often the host is checked for pressure, in milliseconds
+#define BUDGET_CHECK_INTERVAL_MS 1000
+
+// How many seconds of the rate limit may be used up in a single burst
+#define BUDGET_BURST_SECONDS 1
+
+// Backing off never slows the copy below this fraction of its rate
+#define BUDGET_MIN_RATE_FRACTION 16
+
+// Write latencies this many times their usual level count as congestion
+#define BUDGET_LATENCY_FACTOR 4
+
+// The limits on how much the dump may interfere with the rest of the host.
+// Chunks may be accounted for from any thread.
+struct budget
+{
+    // The configured rate limit in bytes per second, or 0 for unlimited
+    uint64_t        max_rate;
+
+    // The rate currently being held to after backing off, or 0 for the
+    // configured limit
+    uint64_t        rate;
+
+    // The bytes that may be copied before waiting, which goes negative when
+    // copies have been let through ahead of their time
+    double          tokens;
+    uint64_t        refill_ns;
+
+    // PSI "some" avg10 percentage that counts as pressure, or 0 for none
+    double          psi_threshold;
+    int             psi_io_fd;
+    int             psi_memory_fd;
+
+    // The smoothed write latency per MiB and its usual level
+    uint64_t        latency;
+    uint64_t        latency_floor;
+
+    // Throughput over the current check interval, and the best seen
+    uint64_t        next_check_ns;
+    uint64_t        interval_start_ns;
+    uint64_t        interval_bytes;
+    uint64_t        peak_rate;
+
+    uint64_t        throttled_ns;
+    uint64_t        backoffs;
+    pthread_mutex_t lock;
+};
+
+int budget_apply_process_limits(const struct dump_options* options);
+
+size_t budget_parse_size(const char* text);
+
+int budget_parse_io_priority(const char* text);
+
+int budget_parse_cpus(const char* text, cpu_set_t* cpus);
+
+struct budget* budget_create(const struct dump_options* options);
+
+void budget_account(struct budget* budget, 
+                    const size_t bytes, 
+                    const uint64_t write_ns);
+
+void budget_free(struct budget* budget);
\ No newline at end of file
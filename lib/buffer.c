@@ -0,0 +1,242 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "buffer.h"
+
+#include "color-print.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static const char* backing_names[] = {
+    "huge pages",
+    "transparent huge pages",
+    "regular pages",
+};
+
+/**
+ * Maps page aligned memory for I/O buffers. Explicit huge pages are tried
+ * first, then transparent huge pages, so that copying large chunks doesn't
+ * thrash the TLB. Small mappings just use regular pages.
+ *
+ * @param len        The number of bytes needed
+ * @param mapped_len The number of bytes actually mapped (output)
+ * @param backing    How the memory ended up being backed (output)
+ *
+ * @return The memory, else NULL if there's an error
+ */
+char* buffer_map(const size_t len, size_t* mapped_len, enum buffer_backing* backing)
+{
+    void* memory;
+
+    if (len >= HUGE_PAGE_SIZE)
+    {
+        *mapped_len = (len + HUGE_PAGE_SIZE - 1) & ~(size_t) (HUGE_PAGE_SIZE - 1);
+
+        // This only works if huge pages have been reserved
+        memory = mmap(NULL, *mapped_len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (MAP_FAILED != memory)
+        {
+            *backing = BACKING_HUGETLB;
+            return memory;
+        }
+
+        memory = mmap(NULL, *mapped_len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == memory)
+        {
+            return NULL;
+        }
+
+        *backing = 0 == madvise(memory, *mapped_len, MADV_HUGEPAGE) ? 
+            BACKING_THP : BACKING_PAGES;
+        return memory;
+    }
+
+    *mapped_len = len;
+    memory = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0);
+    if (MAP_FAILED == memory)
+    {
+        return NULL;
+    }
+
+    *backing = BACKING_PAGES;
+    return memory;
+}
+
+/**
+ * Unmaps memory mapped by buffer_map.
+ *
+ * @param memory     The memory to unmap
+ * @param mapped_len The number of bytes that were mapped
+ */
+void buffer_unmap(char* memory, const size_t mapped_len)
+{
+    if (NULL != memory)
+    {
+        munmap(memory, mapped_len);
+    }
+}
+
+/**
+ * Gets a description of how buffer memory is backed.
+ *
+ * @param backing The backing
+ *
+ * @return The description
+ */
+const char* buffer_backing_name(const enum buffer_backing backing)
+{
+    return backing_names[backing];
+}
+
+/**
+ * Creates a pool of buffers from a single mapping.
+ *
+ * @param buffer_size The size of each buffer, a multiple of the page size
+ * @param num_buffers The number of buffers in the pool
+ *
+ * @return The pool, else NULL if there's an error
+ */
+struct buffer_pool* buffer_pool_create(const size_t buffer_size, const int num_buffers)
+{
+    struct buffer_pool* pool = calloc(1, sizeof(struct buffer_pool));
+    if (NULL == pool)
+    {
+        return NULL;
+    }
+
+    pool->buffer_size = buffer_size;
+    pool->num_buffers = num_buffers;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->available, NULL);
+
+    pool->free_buffers = calloc(num_buffers, sizeof(char*));
+    pool->memory = buffer_map(buffer_size * num_buffers, &pool->memory_size, 
+        &pool->backing);
+    if (NULL == pool->free_buffers || NULL == pool->memory)
+    {
+        buffer_pool_destroy(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < num_buffers; i++)
+    {
+        pool->free_buffers[pool->num_free++] = pool->memory + i * buffer_size;
+    }
+
+    print_cyan("\t[*] Using %d 0x%lx byte buffers backed by %s\n", num_buffers, 
+        buffer_size, buffer_backing_name(pool->backing));
+    return pool;
+}
+
+/**
+ * Faults in every page of a pool and locks it in memory if we're allowed
+ * to, so a pool that's kept around is ready to use straight away.
+ *
+ * @param pool The pool to fault in
+ */
+void buffer_pool_prefault(struct buffer_pool* pool)
+{
+    memset(pool->memory, 0, pool->memory_size);
+    mlock(pool->memory, pool->memory_size);
+}
+
+/**
+ * Takes a buffer out of a pool.
+ *
+ * @param pool The pool to take the buffer from
+ *
+ * @return The buffer, else NULL if they're all in use
+ */
+char* buffer_pool_get(struct buffer_pool* pool)
+{
+    char* buffer = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->num_free > 0)
+    {
+        buffer = pool->free_buffers[--pool->num_free];
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return buffer;
+}
+
+/**
+ * Takes a buffer out of a pool, waiting for one to be returned if they're
+ * all in use.
+ *
+ * @param pool The pool to take the buffer from
+ *
+ * @return The buffer
+ */
+char* buffer_pool_wait(struct buffer_pool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (0 == pool->num_free)
+    {
+        pthread_cond_wait(&pool->available, &pool->lock);
+    }
+    char* buffer = pool->free_buffers[--pool->num_free];
+    pthread_mutex_unlock(&pool->lock);
+
+    return buffer;
+}
+
+/**
+ * Returns a buffer to the pool it was taken from.
+ *
+ * @param pool   The pool the buffer came from
+ * @param buffer The buffer to return
+ */
+void buffer_pool_put(struct buffer_pool* pool, char* buffer)
+{
+    if (NULL == buffer)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->free_buffers[pool->num_free++] = buffer;
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Releases a pool and all of its buffers.
+ *
+ * @param pool The pool to release
+ */
+void buffer_pool_destroy(struct buffer_pool* pool)
+{
+    if (NULL == pool)
+    {
+        return;
+    }
+
+    buffer_unmap(pool->memory, pool->memory_size);
+    free(pool->free_buffers);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->available);
+    free(pool);
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lmat.h"
+
+#include <pthread.h>
+
+// The size of a huge page, which large buffers are rounded up to
+#define HUGE_PAGE_SIZE 0x200000
+
+// How the memory behind a buffer is backed
+enum buffer_backing
+{
+    BACKING_HUGETLB,
+    BACKING_THP,
+    BACKING_PAGES,
+};
+
+// A fixed set of equally sized, page aligned buffers that are handed out and
+// returned rather than allocated for each use
+struct buffer_pool
+{
+    size_t              buffer_size;
+    int                 num_buffers;
+
+    char*               memory;
+    size_t              memory_size;
+    enum buffer_backing backing;
+
+    pthread_mutex_t     lock;
+    pthread_cond_t      available;
+    char**              free_buffers;
+    int                 num_free;
+};
+
+char* buffer_map(const size_t len, size_t* mapped_len, enum buffer_backing* backing);
+
+void buffer_unmap(char* memory, const size_t mapped_len);
+
+const char* buffer_backing_name(const enum buffer_backing backing);
+
+struct buffer_pool* buffer_pool_create(const size_t buffer_size, const int num_buffers);
+
+void buffer_pool_prefault(struct buffer_pool* pool);
+
+char* buffer_pool_get(struct buffer_pool* pool);
+
+char* buffer_pool_wait(struct buffer_pool* pool);
+
+void buffer_pool_put(struct buffer_pool* pool, char* buffer);
+
+void buffer_pool_destroy(struct buffer_pool* pool);
\ No newline at end of file
@@ -0,0 +1,512 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "compress.h"
+
+#include "color-print.h"
+#include "lmat.h"
+#include "lmz.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// The life cycle of a block slot
+enum block_state
+{
+    BLOCK_FREE,
+    BLOCK_FILLING,
+    BLOCK_QUEUED,
+    BLOCK_COMPRESSING,
+    BLOCK_DONE,
+};
+
+// A buffer that one block of the stream passes through
+struct block_slot
+{
+    enum block_state    state;
+    uint64_t            seq;
+    char*               raw;
+    size_t              raw_len;
+    char*               out;
+    size_t              out_len;
+    int                 stored;
+};
+
+// A sink that compresses the stream in independent blocks
+struct compress_sink
+{
+    struct sink         sink;
+    struct sink*        inner;
+
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+
+    // Block seq always passes through slots[seq % num_slots]
+    struct block_slot*  slots;
+    int                 num_slots;
+    struct block_slot*  filling;
+    uint64_t            next_fill_seq;
+    uint64_t            next_write_seq;
+
+    pthread_t*          workers;
+    int                 num_workers;
+    pthread_t           writer;
+    int                 writer_started;
+    int                 stopping;
+    int                 failed;
+
+    lmz_block_entry*    index;
+    uint64_t            index_capacity;
+    uint64_t            out_offset;
+    uint64_t            raw_size;
+};
+
+/**
+ * Compresses a single block. Blocks that don't shrink are stored as-is.
+ *
+ * @param slot The slot holding the block
+ */
+static void compress_block(struct block_slot* slot)
+{
+    uLongf out_len = compressBound(LMZ_BLOCK_SIZE);
+
+    if (Z_OK == compress2((Bytef*) slot->out, &out_len, (const Bytef*) slot->raw,
+        slot->raw_len, Z_BEST_SPEED) && out_len < slot->raw_len)
+    {
+        slot->out_len = out_len;
+        slot->stored = 0;
+    }
+    else
+    {
+        slot->out_len = slot->raw_len;
+        slot->stored = 1;
+    }
+}
+
+/**
+ * The entry point for the compression workers. Each worker repeatedly takes
+ * the oldest queued block and compresses it.
+ *
+ * @param arg The compress sink
+ *
+ * @return NULL
+ */
+static void* compress_worker(void* arg)
+{
+    struct compress_sink* cs = (struct compress_sink*) arg;
+
+    pthread_mutex_lock(&cs->lock);
+    for (;;)
+    {
+        struct block_slot* next = NULL;
+        for (int i = 0; i < cs->num_slots; i++)
+        {
+            if (BLOCK_QUEUED == cs->slots[i].state &&
+                (NULL == next || cs->slots[i].seq < next->seq))
+            {
+                next = &cs->slots[i];
+            }
+        }
+
+        if (NULL == next)
+        {
+            if (cs->stopping)
+            {
+                break;
+            }
+            pthread_cond_wait(&cs->cond, &cs->lock);
+            continue;
+        }
+
+        next->state = BLOCK_COMPRESSING;
+        pthread_mutex_unlock(&cs->lock);
+
+        compress_block(next);
+
+        pthread_mutex_lock(&cs->lock);
+        next->state = BLOCK_DONE;
+        pthread_cond_broadcast(&cs->cond);
+    }
+    pthread_mutex_unlock(&cs->lock);
+
+    return NULL;
+}
+
+/**
+ * Records a written block in the block index.
+ *
+ * @param cs   The compress sink
+ * @param slot The slot holding the block that was written
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int append_index(struct compress_sink* cs, const struct block_slot* slot)
+{
+    if (slot->seq >= cs->index_capacity)
+    {
+        uint64_t capacity = cs->index_capacity ? cs->index_capacity * 2 : 1024;
+        lmz_block_entry* index = realloc(cs->index, 
+            capacity * sizeof(lmz_block_entry));
+        if (NULL == index)
+        {
+            return -1;
+        }
+        cs->index = index;
+        cs->index_capacity = capacity;
+    }
+
+    cs->index[slot->seq].offset = cs->out_offset;
+    cs->index[slot->seq].compressed_size = slot->out_len |
+        (slot->stored ? LMZ_BLOCK_STORED : 0);
+    cs->index[slot->seq].raw_size = slot->raw_len;
+    return 0;
+}
+
+/**
+ * The entry point for the writer thread. Compressed blocks are written out
+ * strictly in stream order, regardless of the order they finish in.
+ *
+ * @param arg The compress sink
+ *
+ * @return NULL
+ */
+static void* compress_writer(void* arg)
+{
+    struct compress_sink* cs = (struct compress_sink*) arg;
+
+    pthread_mutex_lock(&cs->lock);
+    for (;;)
+    {
+        struct block_slot* slot = &cs->slots[cs->next_write_seq % cs->num_slots];
+        if (BLOCK_DONE != slot->state || slot->seq != cs->next_write_seq)
+        {
+            if ((cs->stopping && cs->next_write_seq == cs->next_fill_seq) ||
+                cs->failed)
+            {
+                break;
+            }
+            pthread_cond_wait(&cs->cond, &cs->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&cs->lock);
+
+        int ret = sink_write(cs->inner, slot->stored ? slot->raw : slot->out,
+            slot->out_len);
+        if (0 == ret)
+        {
+            ret = append_index(cs, slot);
+        }
+
+        pthread_mutex_lock(&cs->lock);
+        if (-1 == ret)
+        {
+            fprint_red(stderr, "[-] Failed to write compressed block (errno %d)\n",
+                errno);
+            cs->failed = 1;
+            pthread_cond_broadcast(&cs->cond);
+            break;
+        }
+
+        cs->out_offset += slot->out_len;
+        cs->raw_size += slot->raw_len;
+        slot->state = BLOCK_FREE;
+        cs->next_write_seq++;
+        pthread_cond_broadcast(&cs->cond);
+    }
+    pthread_mutex_unlock(&cs->lock);
+
+    return NULL;
+}
+
+/**
+ * Hands the block currently being filled over to the compression workers.
+ *
+ * @param cs The compress sink
+ */
+static void queue_filling_block(struct compress_sink* cs)
+{
+    pthread_mutex_lock(&cs->lock);
+    cs->filling->state = BLOCK_QUEUED;
+    cs->next_fill_seq++;
+    pthread_cond_broadcast(&cs->cond);
+    pthread_mutex_unlock(&cs->lock);
+
+    cs->filling = NULL;
+}
+
+/**
+ * Appends data to the compressed stream. Data is gathered into blocks, and
+ * each full block is queued for compression.
+ *
+ * @param sink The sink to write to
+ * @param data The data to write
+ * @param len  The length of the data
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int compress_sink_write(struct sink* sink, 
+                               const char* data, 
+                               const size_t len)
+{
+    struct compress_sink* cs = (struct compress_sink*) sink;
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        if (NULL == cs->filling)
+        {
+            struct block_slot* slot = 
+                &cs->slots[cs->next_fill_seq % cs->num_slots];
+
+            pthread_mutex_lock(&cs->lock);
+            while (BLOCK_FREE != slot->state && !cs->failed)
+            {
+                pthread_cond_wait(&cs->cond, &cs->lock);
+            }
+            if (cs->failed)
+            {
+                pthread_mutex_unlock(&cs->lock);
+                return -1;
+            }
+            slot->state = BLOCK_FILLING;
+            slot->seq = cs->next_fill_seq;
+            slot->raw_len = 0;
+            pthread_mutex_unlock(&cs->lock);
+
+            cs->filling = slot;
+        }
+
+        size_t n = LMZ_BLOCK_SIZE - cs->filling->raw_len;
+        if (n > len - pos)
+        {
+            n = len - pos;
+        }
+        memcpy(cs->filling->raw + cs->filling->raw_len, data + pos, n);
+        cs->filling->raw_len += n;
+        pos += n;
+
+        if (LMZ_BLOCK_SIZE == cs->filling->raw_len)
+        {
+            queue_filling_block(cs);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Stops the worker and writer threads once everything queued is written.
+ *
+ * @param cs The compress sink
+ */
+static void stop_threads(struct compress_sink* cs)
+{
+    pthread_mutex_lock(&cs->lock);
+    cs->stopping = 1;
+    pthread_cond_broadcast(&cs->cond);
+    pthread_mutex_unlock(&cs->lock);
+
+    if (cs->writer_started)
+    {
+        pthread_join(cs->writer, NULL);
+        cs->writer_started = 0;
+    }
+
+    // If the writer gave up, blocks may still be queued, so let the workers
+    // drain them before they exit
+    for (int i = 0; i < cs->num_workers; i++)
+    {
+        pthread_join(cs->workers[i], NULL);
+    }
+    cs->num_workers = 0;
+}
+
+/**
+ * Flushes the final partial block and writes out the block index and
+ * trailer.
+ *
+ * @param sink The sink to finish
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int compress_sink_finish(struct sink* sink)
+{
+    struct compress_sink* cs = (struct compress_sink*) sink;
+
+    if (NULL != cs->filling && cs->filling->raw_len)
+    {
+        queue_filling_block(cs);
+    }
+    stop_threads(cs);
+
+    if (cs->failed)
+    {
+        return -1;
+    }
+
+    lmz_trailer trailer = {
+        .index_offset = cs->out_offset,
+        .num_blocks = cs->next_write_seq,
+        .raw_size = cs->raw_size,
+        .magic = LMZ_TRAILER_MAGIC,
+        .reserved = 0,
+    };
+
+    size_t index_len = trailer.num_blocks * sizeof(lmz_block_entry);
+    if (-1 == sink_write(cs->inner, (const char*) cs->index, index_len) ||
+        -1 == sink_write(cs->inner, (const char*) &trailer, sizeof(trailer)) ||
+        -1 == sink_finish(cs->inner))
+    {
+        fprint_red(stderr, "[-] Failed to write the block index (errno %d)\n",
+            errno);
+        return -1;
+    }
+
+    print_cyan("\t[*] Compressed 0x%lx bytes into 0x%lx bytes (%lu blocks)\n",
+        cs->raw_size, trailer.index_offset, trailer.num_blocks);
+    return 0;
+}
+
+/**
+ * Releases a compress sink, stopping its threads if it wasn't finished.
+ *
+ * @param sink The sink to release
+ */
+static void compress_sink_destroy(struct sink* sink)
+{
+    struct compress_sink* cs = (struct compress_sink*) sink;
+
+    pthread_mutex_lock(&cs->lock);
+    if (!cs->stopping)
+    {
+        cs->failed = 1;
+    }
+    pthread_mutex_unlock(&cs->lock);
+    stop_threads(cs);
+
+    for (int i = 0; i < cs->num_slots; i++)
+    {
+        free(cs->slots[i].raw);
+        free(cs->slots[i].out);
+    }
+    pthread_cond_destroy(&cs->cond);
+    pthread_mutex_destroy(&cs->lock);
+    free(cs->slots);
+    free(cs->workers);
+    free(cs->index);
+    sink_destroy(cs->inner);
+    free(cs);
+}
+
+static const struct sink_ops compress_sink_ops = {
+    .write = compress_sink_write,
+    .skip = NULL,
+    .finish = compress_sink_finish,
+    .destroy = compress_sink_destroy,
+};
+
+/**
+ * Creates a sink that compresses the stream into fixed-size blocks on a pool
+ * of worker threads. Blocks are compressed independently and written in
+ * order, followed by an index so any block can be decompressed on its own.
+ *
+ * @param inner       The sink to write the compressed stream to, which is
+ *                    released along with this sink
+ * @param num_threads The number of compression workers
+ *
+ * @return The sink, else NULL if there's an error
+ */
+struct sink* compress_sink_create(struct sink* inner, const int num_threads)
+{
+    struct compress_sink* cs = calloc(1, sizeof(struct compress_sink));
+    if (NULL == cs)
+    {
+        sink_destroy(inner);
+        return NULL;
+    }
+
+    cs->sink.ops = &compress_sink_ops;
+    cs->inner = inner;
+    pthread_mutex_init(&cs->lock, NULL);
+    pthread_cond_init(&cs->cond, NULL);
+
+    // Enough slots for every worker to have a block while the writer and
+    // the producer each hold one more
+    int num_slots = 2 * num_threads + 2;
+    cs->slots = calloc(num_slots, sizeof(struct block_slot));
+    cs->workers = calloc(num_threads, sizeof(pthread_t));
+    if (NULL == cs->slots || NULL == cs->workers)
+    {
+        goto fail;
+    }
+    cs->num_slots = num_slots;
+
+    for (int i = 0; i < cs->num_slots; i++)
+    {
+        cs->slots[i].raw = malloc(LMZ_BLOCK_SIZE);
+        cs->slots[i].out = malloc(compressBound(LMZ_BLOCK_SIZE));
+        if (NULL == cs->slots[i].raw || NULL == cs->slots[i].out)
+        {
+            goto fail;
+        }
+    }
+
+    lmz_file_header header = {
+        .magic = LMZ_HEADER_MAGIC,
+        .version = LMZ_VERSION,
+        .codec = LMZ_CODEC_ZLIB,
+        .block_size = LMZ_BLOCK_SIZE,
+    };
+    if (-1 == sink_write(inner, (const char*) &header, sizeof(header)))
+    {
+        fprint_red(stderr, "[-] Failed to write the compressed header (errno %d)\n",
+            errno);
+        goto fail;
+    }
+    cs->out_offset = sizeof(header);
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        if (0 != pthread_create(&cs->workers[i], NULL, compress_worker, cs))
+        {
+            goto fail;
+        }
+        cs->num_workers++;
+    }
+
+    if (0 != pthread_create(&cs->writer, NULL, compress_writer, cs))
+    {
+        goto fail;
+    }
+    cs->writer_started = 1;
+
+    print_cyan("\t[*] Compressing with %d threads\n", num_threads);
+    return &cs->sink;
+
+fail:
+    fprint_red(stderr, "[-] Failed to set up compression\n");
+    cs->stopping = 1;
+    compress_sink_destroy(&cs->sink);
+    return NULL;
+}
\ No newline at end of file
@@ -0,0 +1,348 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "daemon.h"
+
+#include "color-print.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// The number of snapshot requests that can wait on the socket
+#define LISTEN_BACKLOG 16
+
+// The largest kernel uevent we expect to read in one go
+#define UEVENT_BUFFER_SIZE 8192
+
+// The netlink group the kernel sends its uevents to
+#define UEVENT_KERNEL_GROUP 1
+
+// The uevent field that marks memory blocks being added, onlined, offlined or
+// removed
+#define UEVENT_MEMORY_SUBSYSTEM "SUBSYSTEM=memory"
+
+/**
+ * Starts listening for snapshot requests on a UNIX domain socket that only
+ * the owner can connect to. A socket left behind by an earlier daemon is
+ * replaced.
+ * 
+ * @param path The path of the socket
+ * 
+ * @return The listening socket, else -1 if there's an error
+ */
+static int listen_unix(const char* path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprint_red(stderr, "[-] Socket path is too long: %s\n", path);
+        return -1;
+    }
+
+    if (0 == lstat(path, &st) && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == fd)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    mode_t mask = umask(S_IRWXG | S_IRWXO);
+    int ret = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    umask(mask);
+
+    if (-1 == ret || -1 == listen(fd, LISTEN_BACKLOG))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Subscribes to the kernel's uevents, which announce memory hotplug.
+ * 
+ * @return The netlink socket, else -1 if there's an error
+ */
+static int open_uevents(void)
+{
+    struct sockaddr_nl addr;
+
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 
+        NETLINK_KOBJECT_UEVENT);
+    if (-1 == fd)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_KERNEL_GROUP;
+
+    if (-1 == bind(fd, (struct sockaddr*) &addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Reads every pending uevent, looking for any that concern memory.
+ * 
+ * @param fd The netlink socket
+ * 
+ * @return 1 if memory was hotplugged, else 0
+ */
+static int memory_changed(const int fd)
+{
+    char buffer[UEVENT_BUFFER_SIZE];
+    int changed = 0;
+    ssize_t n;
+
+    // Each uevent is an "action@devpath" header followed by KEY=VALUE fields,
+    // all terminated by NULs
+    while ((n = recv(fd, buffer, sizeof(buffer) - 1, 0)) > 0)
+    {
+        buffer[n] = '\0';
+        for (char* field = buffer; field < buffer + n; field += strlen(field) + 1)
+        {
+            if (0 == strcmp(field, UEVENT_MEMORY_SUBSYSTEM))
+            {
+                changed = 1;
+            }
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * Sets up everything a daemon waits on. SIGUSR1 asks for a snapshot, SIGHUP
+ * for the layout to be reloaded and SIGINT or SIGTERM for the daemon to exit.
+ * These are blocked, so this has to be called before any threads are started.
+ * 
+ * @param sd          The daemon (output)
+ * @param listen_path The path of the socket to take requests on, or NULL
+ * @param interval    The number of seconds between periodic snapshots, or 0
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+int daemon_open(struct capture_daemon* sd, 
+                const char* listen_path, 
+                const unsigned int interval)
+{
+    sigset_t mask;
+
+    sd->listen_path = listen_path;
+    sd->listen_fd = -1;
+    sd->signal_fd = -1;
+    sd->timer_fd = -1;
+    sd->uevent_fd = -1;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, &sd->old_mask);
+
+    if (-1 == (sd->signal_fd = signalfd(-1, &mask, SFD_CLOEXEC)))
+    {
+        fprint_red(stderr, "[-] Failed to set up the daemon's signals\n");
+        daemon_close(sd);
+        return -1;
+    }
+
+    if (0 != interval)
+    {
+        struct itimerspec period = {
+            .it_interval = { .tv_sec = interval },
+            .it_value = { .tv_sec = interval },
+        };
+        if (-1 == (sd->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) ||
+            -1 == timerfd_settime(sd->timer_fd, 0, &period, NULL))
+        {
+            fprint_red(stderr, "[-] Failed to set up the snapshot timer\n");
+            daemon_close(sd);
+            return -1;
+        }
+    }
+
+    if (NULL != listen_path && -1 == (sd->listen_fd = listen_unix(listen_path)))
+    {
+        fprint_red(stderr, "[-] Could not listen on %s\n", listen_path);
+        daemon_close(sd);
+        return -1;
+    }
+
+    if (-1 == (sd->uevent_fd = open_uevents()))
+    {
+        print_yellow("[!] Can't watch for memory hotplug, send SIGHUP when the "
+            "layout changes\n");
+    }
+
+    return 0;
+}
+
+/**
+ * Waits for the next request. Exiting takes precedence over reloading,
+ * which takes precedence over snapshots.
+ * 
+ * @param sd        The daemon
+ * @param client_fd The connection the request came in on, which is owned by
+ *                  the caller, else -1 (output)
+ * 
+ * @return The request, else -1 if there's an error
+ */
+int daemon_wait(struct capture_daemon* sd, int* client_fd)
+{
+    struct pollfd fds[] = {
+        { .fd = sd->signal_fd, .events = POLLIN },
+        { .fd = sd->uevent_fd, .events = POLLIN },
+        { .fd = sd->timer_fd,  .events = POLLIN },
+        { .fd = sd->listen_fd, .events = POLLIN },
+    };
+
+    *client_fd = -1;
+
+    while (1)
+    {
+        if (-1 == poll(fds, sizeof(fds) / sizeof(fds[0]), -1))
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            fprint_red(stderr, "[-] Failed to wait for snapshot requests\n");
+            return -1;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            struct signalfd_siginfo info;
+            if (sizeof(info) == read(sd->signal_fd, &info, sizeof(info)))
+            {
+                if (SIGUSR1 == info.ssi_signo)
+                {
+                    return DAEMON_SNAPSHOT;
+                }
+                return SIGHUP == info.ssi_signo ? DAEMON_RELOAD : DAEMON_STOP;
+            }
+        }
+
+        if ((fds[1].revents & POLLIN) && memory_changed(sd->uevent_fd))
+        {
+            return DAEMON_RELOAD;
+        }
+
+        if (fds[2].revents & POLLIN)
+        {
+            uint64_t expirations;
+            if (sizeof(expirations) == read(sd->timer_fd, &expirations, 
+                sizeof(expirations)))
+            {
+                return DAEMON_SNAPSHOT;
+            }
+        }
+
+        if ((fds[3].revents & POLLIN) && 
+            -1 != (*client_fd = accept4(sd->listen_fd, NULL, NULL, SOCK_CLOEXEC)))
+        {
+            return DAEMON_SNAPSHOT;
+        }
+    }
+}
+
+/**
+ * Tells the client that asked for a snapshot where it was written, or that
+ * it failed, and closes the connection.
+ * 
+ * @param client_fd The connection, or -1 if the request didn't come from a
+ *                  client
+ * @param path      The path of the snapshot, or NULL if it failed
+ */
+void daemon_reply(const int client_fd, const char* path)
+{
+    char reply[PATH_MAX + 4];
+
+    if (-1 == client_fd)
+    {
+        return;
+    }
+
+    int len = NULL != path ? snprintf(reply, sizeof(reply), "+ %s\n", path) :
+        snprintf(reply, sizeof(reply), "- snapshot failed\n");
+
+    // The client may have given up on us already
+    send(client_fd, reply, (size_t) len < sizeof(reply) ? len : sizeof(reply) - 1, 
+        MSG_NOSIGNAL);
+    close(client_fd);
+}
+
+/**
+ * Stops a daemon, removing its socket and unblocking its signals.
+ * 
+ * @param sd The daemon
+ */
+void daemon_close(struct capture_daemon* sd)
+{
+    if (-1 != sd->listen_fd)
+    {
+        close(sd->listen_fd);
+        unlink(sd->listen_path);
+    }
+    if (-1 != sd->signal_fd)
+    {
+        close(sd->signal_fd);
+    }
+    if (-1 != sd->timer_fd)
+    {
+        close(sd->timer_fd);
+    }
+    if (-1 != sd->uevent_fd)
+    {
+        close(sd->uevent_fd);
+    }
+
+    sd->listen_fd = sd->signal_fd = sd->timer_fd = sd->uevent_fd = -1;
+    pthread_sigmask(SIG_SETMASK, &sd->old_mask, NULL);
+}
\ No newline at end of file
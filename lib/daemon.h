@@ -0,0 +1,53 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <signal.h>
+
+// What woke the daemon up
+enum daemon_event
+{
+    // A snapshot was asked for
+    DAEMON_SNAPSHOT,
+
+    // The memory layout changed, or a reload was asked for with SIGHUP
+    DAEMON_RELOAD,
+
+    // The daemon was asked to exit
+    DAEMON_STOP,
+};
+
+// The sources of requests a daemon waits on, each of which is -1 if unused
+struct capture_daemon
+{
+    const char* listen_path;
+    int         listen_fd;
+    int         signal_fd;
+    int         timer_fd;
+    int         uevent_fd;
+    sigset_t    old_mask;
+};
+
+int daemon_open(struct capture_daemon* sd, 
+                const char* listen_path, 
+                const unsigned int interval);
+
+int daemon_wait(struct capture_daemon* sd, int* client_fd);
+
+void daemon_reply(const int client_fd, const char* path);
+
+void daemon_close(struct capture_daemon* sd);
\ No newline at end of file
@@ -0,0 +1,169 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "direct.h"
+
+#include "io.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A sink that writes to a file opened with O_DIRECT. Output is staged in an
+// aligned buffer so that every write is aligned, however the LiME headers
+// and data fall.
+struct direct_sink
+{
+    struct sink             sink;
+    int                     fd;
+    struct buffer_pool*     pool;
+    char*                   buffer;
+    size_t                  used;
+    uint64_t                offset;
+};
+
+/**
+ * Writes data to a direct sink. Data is only written out once a whole
+ * buffer has been staged.
+ *
+ * @param sink The sink to write to
+ * @param data The data to write
+ * @param len  The length of the data
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int direct_sink_write(struct sink* sink, const char* data, const size_t len)
+{
+    struct direct_sink* ds = (struct direct_sink*) sink;
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        size_t n = ds->pool->buffer_size - ds->used;
+        if (n > len - pos)
+        {
+            n = len - pos;
+        }
+
+        memcpy(ds->buffer + ds->used, data + pos, n);
+        ds->used += n;
+        pos += n;
+
+        if (ds->used == ds->pool->buffer_size)
+        {
+            if (-1 == write_all_at(ds->fd, ds->buffer, ds->used, ds->offset))
+            {
+                return -1;
+            }
+            ds->offset += ds->used;
+            ds->used = 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Finishes a direct sink. The aligned part of whatever is still staged is
+ * written directly, then O_DIRECT is turned off to write the unaligned tail.
+ *
+ * @param sink The sink to finish
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int direct_sink_finish(struct sink* sink)
+{
+    struct direct_sink* ds = (struct direct_sink*) sink;
+    size_t aligned = ds->used & ~(size_t) (DIRECT_ALIGNMENT - 1);
+
+    if (aligned > 0 && -1 == write_all_at(ds->fd, ds->buffer, aligned, ds->offset))
+    {
+        return -1;
+    }
+
+    if (aligned < ds->used)
+    {
+        int flags = fcntl(ds->fd, F_GETFL);
+        if (-1 == flags || -1 == fcntl(ds->fd, F_SETFL, flags & ~O_DIRECT) ||
+            -1 == write_all_at(ds->fd, ds->buffer + aligned, ds->used - aligned,
+                ds->offset + aligned))
+        {
+            return -1;
+        }
+        fcntl(ds->fd, F_SETFL, flags);
+    }
+
+    ds->offset += ds->used;
+    ds->used = 0;
+    return 0;
+}
+
+/**
+ * Releases a direct sink, returning its buffer to the pool. The file
+ * descriptor is owned by the caller.
+ *
+ * @param sink The sink to release
+ */
+static void direct_sink_destroy(struct sink* sink)
+{
+    struct direct_sink* ds = (struct direct_sink*) sink;
+
+    buffer_pool_put(ds->pool, ds->buffer);
+    free(ds);
+}
+
+static const struct sink_ops direct_sink_ops = {
+    .write = direct_sink_write,
+    .skip = NULL,
+    .finish = direct_sink_finish,
+    .destroy = direct_sink_destroy,
+};
+
+/**
+ * Creates a sink that writes to a file opened with O_DIRECT, bypassing the
+ * page cache.
+ *
+ * @param fd   The file descriptor of the file
+ * @param pool The pool to take the staging buffer from. Its buffers must be
+ *             a multiple of DIRECT_ALIGNMENT in size.
+ *
+ * @return The sink, else NULL if there's an error
+ */
+struct sink* direct_sink_create(const int fd, struct buffer_pool* pool)
+{
+    struct direct_sink* ds = calloc(1, sizeof(struct direct_sink));
+    if (NULL == ds)
+    {
+        return NULL;
+    }
+
+    ds->sink.ops = &direct_sink_ops;
+    ds->fd = fd;
+    ds->pool = pool;
+    if (NULL == (ds->buffer = buffer_pool_get(pool)))
+    {
+        free(ds);
+        return NULL;
+    }
+
+    return &ds->sink;
+}
\ No newline at end of file
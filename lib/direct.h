@@ -0,0 +1,26 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "buffer.h"
+#include "sink.h"
+
+// The alignment O_DIRECT needs for file offsets, lengths and memory. This
+// covers both 512 byte and 4 KiB logical sectors.
+#define DIRECT_ALIGNMENT 0x1000
+
+struct sink* direct_sink_create(const int fd, struct buffer_pool* pool);
\ No newline at end of file
@@ -0,0 +1,270 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "format.h"
+
+#include <string.h>
+
+// The machine recorded in ELF cores, which is always the one we run on
+#if defined(__x86_64__)
+#define ELF_CORE_MACHINE EM_X86_64
+#elif defined(__aarch64__)
+#define ELF_CORE_MACHINE EM_AARCH64
+#else
+#define ELF_CORE_MACHINE EM_NONE
+#endif
+
+/**
+ * Fills in a LiME header describing a memory range.
+ * 
+ * @param header        The header to fill in
+ * @param physical_base The starting physical address of the range
+ * @param size          The size of the range
+ */
+void fill_lime_header(lime_memory_range_header* header,
+                      const uint64_t physical_base,
+                      const uint64_t size)
+{
+    header->magic = LIME_HEADER_MAGIC;
+    header->version = LIME_HEADER_VERSION;
+    header->s_addr = physical_base;
+    header->e_addr = physical_base + size - 1;
+    memset(&header->reserved, 0x00, 8);
+}
+
+/**
+ * Computes where each section's LiME header and data will be placed in the
+ * output file. Each section contributes a LiME header followed directly by
+ * its contents, so the layout is fully determined by the section sizes.
+ * 
+ * @param sections     The array of memory sections
+ * @param num_sections The number of memory sections
+ * @param layout       The location of each section in the output (output)
+ * 
+ * @return The total size of the output file
+ */
+static uint64_t lime_layout(const struct section* sections,
+                            const int num_sections,
+                            struct section_layout* layout)
+{
+    uint64_t offset = 0;
+
+    for (int i = 0; i < num_sections; i++)
+    {
+        layout[i].header_offset = offset;
+        layout[i].data_offset = offset + sizeof(lime_memory_range_header);
+        offset = layout[i].data_offset + sections[i].size;
+    }
+
+    return offset;
+}
+
+/**
+ * Returns the size of the LiME header that precedes each section.
+ * 
+ * @param num_sections The number of memory sections
+ * 
+ * @return The size of a LiME header
+ */
+static size_t lime_header_size(const int num_sections)
+{
+    return sizeof(lime_memory_range_header);
+}
+
+/**
+ * Renders the LiME header that precedes a section.
+ * 
+ * @param sections     The array of memory sections
+ * @param layout       The location of each section in the output
+ * @param num_sections The number of memory sections
+ * @param index        The section to render the header of
+ * @param buffer       The buffer to render the header into (output)
+ * 
+ * @return The length of the header
+ */
+static size_t lime_header(const struct section* sections,
+                          const struct section_layout* layout,
+                          const int num_sections,
+                          const int index,
+                          char* buffer)
+{
+    fill_lime_header((lime_memory_range_header*) buffer, 
+        sections[index].physical_base, sections[index].size);
+    return sizeof(lime_memory_range_header);
+}
+
+/**
+ * Returns the size of the headers at the start of an ELF core. With more
+ * segments than e_phnum can count, the real count is kept in a single
+ * section header following the program headers.
+ * 
+ * @param num_sections The number of memory sections
+ * 
+ * @return The size of the ELF headers
+ */
+static size_t elf_header_size(const int num_sections)
+{
+    size_t size = sizeof(Elf64_Ehdr) + num_sections * sizeof(Elf64_Phdr);
+    if (num_sections >= PN_XNUM)
+    {
+        size += sizeof(Elf64_Shdr);
+    }
+    return size;
+}
+
+/**
+ * Computes where each section's data will be placed in an ELF core. The ELF
+ * and program headers come first, then each section's data on its own page,
+ * offset within the page the same way its physical address is so that each
+ * segment can be mapped directly.
+ * 
+ * @param sections     The array of memory sections
+ * @param num_sections The number of memory sections
+ * @param layout       The location of each section in the output (output)
+ * 
+ * @return The total size of the output file
+ */
+static uint64_t elf_layout(const struct section* sections,
+                           const int num_sections,
+                           struct section_layout* layout)
+{
+    uint64_t offset = elf_header_size(num_sections);
+
+    for (int i = 0; i < num_sections; i++)
+    {
+        uint64_t page = (offset + ELF_SEGMENT_ALIGNMENT - 1) & 
+            ~((uint64_t) ELF_SEGMENT_ALIGNMENT - 1);
+        uint64_t data_offset = page + 
+            sections[i].physical_base % ELF_SEGMENT_ALIGNMENT;
+
+        // Only the first section carries a header, which holds them all
+        layout[i].header_offset = 0 == i ? 0 : data_offset;
+        layout[i].data_offset = data_offset;
+        offset = data_offset + sections[i].size;
+    }
+
+    return offset;
+}
+
+/**
+ * Renders the ELF header and the program headers for every section, which
+ * all sit at the very start of the file ahead of the first section.
+ * 
+ * @param sections     The array of memory sections
+ * @param layout       The location of each section in the output
+ * @param num_sections The number of memory sections
+ * @param index        The section to render the header of
+ * @param buffer       The buffer to render the header into (output)
+ * 
+ * @return The length of the header
+ */
+static size_t elf_header(const struct section* sections,
+                         const struct section_layout* layout,
+                         const int num_sections,
+                         const int index,
+                         char* buffer)
+{
+    if (0 != index)
+    {
+        return 0;
+    }
+
+    Elf64_Ehdr* ehdr = (Elf64_Ehdr*) buffer;
+    memset(ehdr, 0x00, sizeof(Elf64_Ehdr));
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    ehdr->e_ident[EI_DATA] = ELFDATA2MSB;
+#else
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+#endif
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_ident[EI_OSABI] = ELFOSABI_NONE;
+    ehdr->e_type = ET_CORE;
+    ehdr->e_machine = ELF_CORE_MACHINE;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_phoff = sizeof(Elf64_Ehdr);
+    ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr->e_phentsize = sizeof(Elf64_Phdr);
+    ehdr->e_phnum = num_sections;
+
+    if (num_sections >= PN_XNUM)
+    {
+        Elf64_Shdr* shdr = (Elf64_Shdr*) (buffer + sizeof(Elf64_Ehdr) + 
+            num_sections * sizeof(Elf64_Phdr));
+        memset(shdr, 0x00, sizeof(Elf64_Shdr));
+        shdr->sh_info = num_sections;
+
+        ehdr->e_phnum = PN_XNUM;
+        ehdr->e_shoff = (uint8_t*) shdr - (uint8_t*) buffer;
+        ehdr->e_shentsize = sizeof(Elf64_Shdr);
+        ehdr->e_shnum = 1;
+    }
+
+    Elf64_Phdr* phdr = (Elf64_Phdr*) (buffer + sizeof(Elf64_Ehdr));
+    for (int i = 0; i < num_sections; i++)
+    {
+        memset(&phdr[i], 0x00, sizeof(Elf64_Phdr));
+        phdr[i].p_type = PT_LOAD;
+        phdr[i].p_flags = PF_R | PF_W | PF_X;
+        phdr[i].p_offset = layout[i].data_offset;
+        phdr[i].p_vaddr = sections[i].virtual_base;
+        phdr[i].p_paddr = sections[i].physical_base;
+        phdr[i].p_filesz = sections[i].size;
+        phdr[i].p_memsz = sections[i].size;
+        phdr[i].p_align = ELF_SEGMENT_ALIGNMENT;
+    }
+
+    return elf_header_size(num_sections);
+}
+
+const struct output_format lime_format = {
+    .name = "lime",
+    .layout = lime_layout,
+    .header_size = lime_header_size,
+    .header = lime_header,
+};
+
+const struct output_format elf_format = {
+    .name = "elf",
+    .layout = elf_layout,
+    .header_size = elf_header_size,
+    .header = elf_header,
+};
+
+/**
+ * Looks up an output format by name.
+ * 
+ * @param name The name of the format
+ * 
+ * @return The format, else NULL if there's no format with that name
+ */
+const struct output_format* format_find(const char* name)
+{
+    if (0 == strcmp(name, lime_format.name))
+    {
+        return &lime_format;
+    }
+
+    if (0 == strcmp(name, elf_format.name))
+    {
+        return &elf_format;
+    }
+
+    return NULL;
+}
\ No newline at end of file
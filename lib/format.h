@@ -0,0 +1,62 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+
+#include <elf.h>
+
+#include "lime.h"
+#include "lmat.h"
+
+// The alignment of each section's data in an ELF core, so it can be mapped
+#define ELF_SEGMENT_ALIGNMENT 0x1000
+
+// The framing that surrounds the section contents in the output. The copy
+// engines only ever see the layout, so every format shares them.
+struct output_format
+{
+    // The name used to select the format on the command line
+    const char* name;
+
+    // Places each section's header and data in the output, returning the
+    // total size of the output
+    uint64_t (*layout)(const struct section* sections,
+                       const int num_sections,
+                       struct section_layout* layout);
+
+    // Returns the most header bytes placed ahead of any single section
+    size_t (*header_size)(const int num_sections);
+
+    // Renders the header that sits at layout[index].header_offset into
+    // buffer, which holds header_size() bytes. Returns the length of the
+    // header, which may be 0.
+    size_t (*header)(const struct section* sections,
+                     const struct section_layout* layout,
+                     const int num_sections,
+                     const int index,
+                     char* buffer);
+};
+
+extern const struct output_format lime_format;
+extern const struct output_format elf_format;
+
+const struct output_format* format_find(const char* name);
+
+void fill_lime_header(lime_memory_range_header* header,
+                      const uint64_t physical_base,
+                      const uint64_t size);
\ No newline at end of file
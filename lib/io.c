@@ -0,0 +1,170 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "io.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+/**
+ * Reads exactly len bytes from a file. Short reads and interrupted calls are
+ * retried, and running out of file is an error.
+ *
+ * @param fd     The file descriptor to read from
+ * @param buffer The buffer to read into
+ * @param len    The number of bytes to read
+ *
+ * @return 0 for success, else -1 with errno set if there's an error
+ */
+int read_all(const int fd, void* buffer, const size_t len)
+{
+    size_t have_read = 0;
+
+    while (have_read < len)
+    {
+        ssize_t n = read(fd, (char*) buffer + have_read, len - have_read);
+        if (n > 0)
+        {
+            have_read += n;
+        }
+        else if (0 == n)
+        {
+            errno = EIO;
+            return -1;
+        }
+        else if (EINTR != errno)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads exactly len bytes from a file at a given offset. Short reads and
+ * interrupted calls are retried, and running out of file is an error.
+ *
+ * @param fd     The file descriptor to read from
+ * @param buffer The buffer to read into
+ * @param len    The number of bytes to read
+ * @param offset The offset to read from
+ *
+ * @return 0 for success, else -1 with errno set if there's an error
+ */
+int read_all_at(const int fd, 
+                void* buffer, 
+                const size_t len, 
+                const uint64_t offset)
+{
+    size_t have_read = 0;
+
+    while (have_read < len)
+    {
+        ssize_t n = pread(fd, (char*) buffer + have_read, len - have_read, 
+            offset + have_read);
+        if (n > 0)
+        {
+            have_read += n;
+        }
+        else if (0 == n)
+        {
+            errno = EIO;
+            return -1;
+        }
+        else if (EINTR != errno)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Writes exactly len bytes to a file. Short writes and interrupted calls are
+ * retried.
+ *
+ * @param fd     The file descriptor to write to
+ * @param buffer The data to write
+ * @param len    The number of bytes to write
+ *
+ * @return 0 for success, else -1 with errno set if there's an error
+ */
+int write_all(const int fd, const void* buffer, const size_t len)
+{
+    size_t written = 0;
+
+    while (written < len)
+    {
+        ssize_t n = write(fd, (const char*) buffer + written, len - written);
+        if (n > 0)
+        {
+            written += n;
+        }
+        else if (0 == n)
+        {
+            errno = EIO;
+            return -1;
+        }
+        else if (EINTR != errno)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Writes exactly len bytes to a file at a given offset. Short writes and
+ * interrupted calls are retried.
+ *
+ * @param fd     The file descriptor to write to
+ * @param buffer The data to write
+ * @param len    The number of bytes to write
+ * @param offset The offset to write the data at
+ *
+ * @return 0 for success, else -1 with errno set if there's an error
+ */
+int write_all_at(const int fd, 
+                 const void* buffer, 
+                 const size_t len, 
+                 const uint64_t offset)
+{
+    size_t written = 0;
+
+    while (written < len)
+    {
+        ssize_t n = pwrite(fd, (const char*) buffer + written, len - written, 
+            offset + written);
+        if (n > 0)
+        {
+            written += n;
+        }
+        else if (0 == n)
+        {
+            errno = EIO;
+            return -1;
+        }
+        else if (EINTR != errno)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -15,6 +15,7 @@ Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
 */
 
 
+
 #include "iomem.h"
 
 #include "color-print.h"
@@ -25,62 +26,325 @@ Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
 
 #define LINE_SIZE 512
 
+// The number of ranges to make room for up front
+#define INITIAL_RANGES 64
+
+/**
+ * Parses a hexadecimal number, advancing past it.
+ * 
+ * @param p     The text to parse (input/output)
+ * @param value The parsed number (output)
+ * 
+ * @return 0 for success, else -1 if there are no hex digits or more than
+ *         fit in 64 bits
+ */
+static int parse_hex(const char** p, uint64_t* value)
+{
+    const char* start = *p;
+    uint64_t v = 0;
+
+    for (;; (*p)++)
+    {
+        char c = **p;
+        if (c >= '0' && c <= '9')
+        {
+            v = (v << 4) | (c - '0');
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            v = (v << 4) | (c - 'a' + 10);
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            v = (v << 4) | (c - 'A' + 10);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    *value = v;
+    return *p == start || *p - start > 16 ? -1 : 0;
+}
+
+/**
+ * Parses a single line of iomem, which looks like
+ * "<indent><start>-<end> : <label>". Each level of nesting is indented by
+ * two more spaces.
+ * 
+ * @param line  The line to parse
+ * @param depth The nesting depth of the resource (output)
+ * @param start The first address of the resource (output)
+ * @param end   The last address of the resource (output)
+ * @param label The label of the resource (output)
+ * 
+ * @return 0 for success, else -1 if the line isn't a resource
+ */
+static int parse_resource(const char* line,
+                          int* depth,
+                          uint64_t* start,
+                          uint64_t* end,
+                          const char** label)
+{
+    const char* p = line;
+    while (' ' == *p)
+    {
+        p++;
+    }
+    *depth = (p - line) / 2;
+
+    if (-1 == parse_hex(&p, start) || '-' != *p++ || -1 == parse_hex(&p, end) ||
+        0 != strncmp(p, " : ", 3) || *end < *start)
+    {
+        return -1;
+    }
+
+    *label = p + 3;
+    return 0;
+}
+
+/**
+ * Orders address ranges by their start address.
+ * 
+ * @param a The first range
+ * @param b The second range
+ * 
+ * @return Less than, equal to or greater than zero as a sorts before, with
+ *         or after b
+ */
+static int compare_ranges(const void* a, const void* b)
+{
+    const struct addr_range* ra = (const struct addr_range*) a;
+    const struct addr_range* rb = (const struct addr_range*) b;
+
+    if (ra->start < rb->start)
+    {
+        return -1;
+    }
+    return ra->start > rb->start;
+}
+
 /**
  * Parses the /proc/iomem file to determine the address ranges of the physical
- * ram. 
+ * ram. This is done in a single pass, following the nesting of the resources
+ * so that RAM is found wherever it sits in the tree (such as under a CXL
+ * window), while anything nested within RAM is ignored.
  * 
- * @param addrs The array of address ranges that was found 
+ * @param path  The path of the iomem file to read
+ * @param addrs The address ranges that were found, sorted by address, which
+ *              must be freed by the caller (output)
  * 
  * @return The number of RAM regions found, or -1 if there was an error
  */
-int get_system_ram_address_ranges(struct addr_range* addrs)
+int get_system_ram_address_ranges(const char* path, struct addr_range** addrs)
 {
     FILE* iomem_fd;
     size_t n = LINE_SIZE;
     int count = 0;
+    int capacity = INITIAL_RANGES;
 
     char* lineptr = malloc(LINE_SIZE);
-    if (NULL == lineptr)
+    struct addr_range* ranges = malloc(capacity * sizeof(struct addr_range));
+    if (NULL == lineptr || NULL == ranges)
     {
-        fprint_red(stderr, "[-] Failed to allocated memory for line buffer\n");
+        fprint_red(stderr, "[-] Failed to allocate memory for parsing iomem\n");
+        free(lineptr);
+        free(ranges);
         return -1;
     }
 
-    if (NULL == (iomem_fd = fopen(IOMEM_FILENAME, "r")))
+    if (NULL == (iomem_fd = fopen(path, "r")))
     {
-        fprint_red(stderr, "[-] Could not open %s\n", IOMEM_FILENAME);
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        free(lineptr);
+        free(ranges);
         return -1;
     }
 
-    print_green("[*] Scanning %s for physical memory regions\n", IOMEM_FILENAME);
+    print_green("[*] Scanning %s for physical memory regions\n", path);
 
-    int index = 0;
+    // The depth of the RAM resource we're currently inside of, if any
+    int ram_depth = -1;
+    int index = -1;
     while (getline(&lineptr, &n, iomem_fd) != -1)
     {
-        if (strstr(lineptr, SYSTEM_RAM_LABEL))
+        int depth;
+        uint64_t start, end;
+        const char* label;
+        if (-1 == parse_resource(lineptr, &depth, &start, &end, &label))
+        {
+            continue;
+        }
+
+        if (0 == depth)
+        {
+            index++;
+        }
+
+        if (depth <= ram_depth)
         {
-            uint64_t start, end;
-            sscanf(lineptr, "%lx-%lx", &start, &end);
+            ram_depth = -1;
+        }
 
-            addrs[count].index = index;
-            addrs[count].start = start;
-            addrs[count].end = end;
+        if (-1 != ram_depth || 
+            0 != strncmp(label, SYSTEM_RAM_LABEL, sizeof(SYSTEM_RAM_LABEL) - 1))
+        {
+            continue;
+        }
+        ram_depth = depth;
 
-            if (++count >= MAX_PHYSICAL_RANGES)
+        if (count == capacity)
+        {
+            capacity *= 2;
+            struct addr_range* grown = realloc(ranges, 
+                capacity * sizeof(struct addr_range));
+            if (NULL == grown)
             {
-                fprint_red(stderr, "[-] Too many physical memory regions encountered\n");
+                fprint_red(stderr, "[-] Failed to allocate the memory ranges\n");
+                fclose(iomem_fd);
+                free(lineptr);
+                free(ranges);
                 return -1;
             }
+            ranges = grown;
         }
 
-        if (lineptr[0] != ' ')
+        ranges[count].index = index;
+        ranges[count].start = start;
+        ranges[count].end = end;
+        count++;
+    }
+
+    fclose(iomem_fd);
+    free(lineptr);
+
+    // Sibling resources never overlap, but merge any that do so every byte
+    // is only claimed once
+    qsort(ranges, count, sizeof(struct addr_range), compare_ranges);
+    int merged = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (merged > 0 && ranges[i].start <= ranges[merged - 1].end)
         {
-            index++;
+            if (ranges[i].end > ranges[merged - 1].end)
+            {
+                ranges[merged - 1].end = ranges[i].end;
+            }
+            continue;
+        }
+        ranges[merged++] = ranges[i];
+    }
+
+    *addrs = ranges;
+    return merged;
+}
+
+/**
+ * Finds every resource in /proc/iomem with one of the given labels, at any
+ * depth, such as the "Kernel code" nested within System RAM.
+ * 
+ * @param path       The path of the iomem file to read
+ * @param labels     The labels to look for
+ * @param num_labels The number of labels
+ * @param addrs      The address ranges that were found, in the order they
+ *                   appear, with the index of the matching label, which
+ *                   must be freed by the caller (output)
+ * 
+ * @return The number of resources found, or -1 if there was an error
+ */
+int get_labelled_address_ranges(const char* path,
+                                const char** labels,
+                                const int num_labels,
+                                struct addr_range** addrs)
+{
+    FILE* iomem_fd;
+    char* lineptr = NULL;
+    size_t n = 0;
+    int count = 0;
+    struct addr_range* ranges = NULL;
+
+    if (NULL == (iomem_fd = fopen(path, "r")))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        return -1;
+    }
+
+    while (getline(&lineptr, &n, iomem_fd) != -1)
+    {
+        int depth;
+        uint64_t start, end;
+        const char* label;
+        if (-1 == parse_resource(lineptr, &depth, &start, &end, &label))
+        {
+            continue;
+        }
+
+        for (int i = 0; i < num_labels; i++)
+        {
+            size_t len = strlen(labels[i]);
+            if (0 != strncmp(label, labels[i], len) || 
+                ('\n' != label[len] && '\0' != label[len]))
+            {
+                continue;
+            }
+
+            struct addr_range* grown = realloc(ranges, 
+                (count + 1) * sizeof(struct addr_range));
+            if (NULL == grown)
+            {
+                fprint_red(stderr, "[-] Failed to allocate the memory ranges\n");
+                fclose(iomem_fd);
+                free(lineptr);
+                free(ranges);
+                return -1;
+            }
+            ranges = grown;
+            ranges[count].index = i;
+            ranges[count].start = start;
+            ranges[count].end = end;
+            count++;
+            break;
         }
     }
 
     fclose(iomem_fd);
     free(lineptr);
-
+    *addrs = ranges;
     return count;
+}
+
+/**
+ * Parses a physical address range given on the command line, in the same
+ * "<start>-<end>" form as /proc/iomem, with an inclusive end.
+ * 
+ * @param text  The range
+ * @param start The first address of the range (output)
+ * @param end   The last address of the range (output)
+ * 
+ * @return 0 for success, else -1 if the range isn't valid
+ */
+int parse_address_range(const char* text, uint64_t* start, uint64_t* end)
+{
+    const char* p = text;
+
+    if (0 == strncmp(p, "0x", 2))
+    {
+        p += 2;
+    }
+    if (-1 == parse_hex(&p, start) || '-' != *p++)
+    {
+        return -1;
+    }
+
+    if (0 == strncmp(p, "0x", 2))
+    {
+        p += 2;
+    }
+    if (-1 == parse_hex(&p, end) || '\0' != *p || *end < *start)
+    {
+        return -1;
+    }
+
+    return 0;
 }
\ No newline at end of file
@@ -19,4 +19,11 @@ Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
 
 #include "lmat.h"
 
-int get_system_ram_address_ranges(struct addr_range* addrs);
\ No newline at end of file
+int get_system_ram_address_ranges(const char* path, struct addr_range** addrs);
+
+int get_labelled_address_ranges(const char* path,
+                                const char** labels,
+                                const int num_labels,
+                                struct addr_range** addrs);
+
+int parse_address_range(const char* text, uint64_t* start, uint64_t* end);
\ No newline at end of file
@@ -0,0 +1,303 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "journal.h"
+
+#include "color-print.h"
+#include "format.h"
+#include "io.h"
+#include "xxhash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Computes a fingerprint of a dump's layout, so that a journal is only ever
+ * used to resume the same dump.
+ * 
+ * @param sections     The sections being dumped
+ * @param num_sections The number of sections
+ * @param format       The output format
+ * 
+ * @return The fingerprint
+ */
+uint64_t journal_fingerprint(const struct section* sections,
+                             const int num_sections,
+                             const struct output_format* format)
+{
+    uint64_t hash = xxh64(format->name, strlen(format->name), 0);
+
+    for (int i = 0; i < num_sections; i++)
+    {
+        uint64_t bounds[2] = { sections[i].physical_base, sections[i].size };
+        hash = xxh64(bounds, sizeof(bounds), hash);
+    }
+
+    return hash;
+}
+
+/**
+ * Computes the check value of a journal record.
+ * 
+ * @param record The record
+ * 
+ * @return The check value
+ */
+static uint64_t record_check(const journal_record* record)
+{
+    return xxh64(record, offsetof(journal_record, check), JOURNAL_MAGIC);
+}
+
+/**
+ * Finds the last checkpoint in an existing journal. A record that was only
+ * partly written when the dump died is dropped, so that new records follow
+ * straight on from the last good one.
+ * 
+ * @param journal      The journal, whose start is filled in
+ * @param path         The path of the journal, for messages
+ * @param fingerprint  The fingerprint of the dump being resumed
+ * @param num_sections The number of sections being dumped
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int load_checkpoint(struct journal* journal,
+                           const char* path,
+                           const uint64_t fingerprint,
+                           const int num_sections)
+{
+    journal_file_header header;
+    journal_record record;
+    off64_t good_end = sizeof(header);
+
+    if (-1 == read_all_at(journal->fd, &header, sizeof(header), 0) ||
+        JOURNAL_MAGIC != header.magic || JOURNAL_VERSION != header.version)
+    {
+        fprint_red(stderr, "[-] %s isn't a journal\n", path);
+        return -1;
+    }
+
+    if (fingerprint != header.fingerprint || num_sections != header.num_sections)
+    {
+        fprint_red(stderr, "[-] %s is the journal of a different dump\n", path);
+        return -1;
+    }
+
+    while (0 == read_all_at(journal->fd, &record, sizeof(record), good_end))
+    {
+        if (record_check(&record) != record.check || 
+            record.section >= num_sections)
+        {
+            break;
+        }
+
+        journal->start_section = record.section;
+        journal->start_offset = record.offset;
+        good_end += sizeof(record);
+    }
+
+    if (-1 == ftruncate(journal->fd, good_end) || 
+        -1 == lseek64(journal->fd, good_end, SEEK_SET))
+    {
+        fprint_red(stderr, "[-] Failed to trim %s (errno %d)\n", path, errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Opens the journal of a dump. A new journal is started unless resuming, in
+ * which case the existing journal is checked against the dump and its last
+ * checkpoint becomes the place to resume from.
+ * 
+ * @param path         The path of the journal
+ * @param out_fd       The file descriptor of the output, which is synced
+ *                     before each checkpoint
+ * @param interval     The number of chunks to write between checkpoints
+ * @param fingerprint  The fingerprint of the dump
+ * @param num_sections The number of sections being dumped
+ * @param resume       Non-zero to resume from an existing journal
+ * 
+ * @return The journal, else NULL if there's an error
+ */
+struct journal* journal_open(const char* path,
+                             const int out_fd,
+                             const int interval,
+                             const uint64_t fingerprint,
+                             const int num_sections,
+                             const int resume)
+{
+    struct journal* journal = calloc(1, sizeof(struct journal));
+    if (NULL == journal)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the journal\n");
+        return NULL;
+    }
+
+    journal->path = path;
+    journal->out_fd = out_fd;
+    journal->interval = interval;
+
+    if (resume)
+    {
+        journal->fd = open64(path, O_RDWR | O_LARGEFILE);
+        if (-1 == journal->fd)
+        {
+            fprint_red(stderr, "[-] Could not open %s\n", path);
+            goto fail;
+        }
+
+        if (-1 == load_checkpoint(journal, path, fingerprint, num_sections))
+        {
+            goto fail;
+        }
+
+        return journal;
+    }
+
+    journal->fd = open64(path, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, 
+        S_IRUSR | S_IWUSR);
+    if (-1 == journal->fd)
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        goto fail;
+    }
+
+    journal_file_header header = {
+        .magic = JOURNAL_MAGIC,
+        .version = JOURNAL_VERSION,
+        .fingerprint = fingerprint,
+        .num_sections = num_sections,
+    };
+    if (-1 == write_all(journal->fd, &header, sizeof(header)) ||
+        -1 == fdatasync(journal->fd))
+    {
+        fprint_red(stderr, "[-] Failed to write %s (errno %d)\n", path, errno);
+        goto fail;
+    }
+
+    return journal;
+
+fail:
+    journal_close(journal);
+    return NULL;
+}
+
+/**
+ * Records that a chunk has been written, checkpointing once enough chunks
+ * have been written since the last checkpoint.
+ * 
+ * @param journal The journal
+ * @param section The section the chunk belongs to
+ * @param offset  How much of the section has now been written
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+int journal_commit(struct journal* journal,
+                   const int section,
+                   const uint64_t offset)
+{
+    if (++journal->pending < journal->interval)
+    {
+        return 0;
+    }
+
+    return journal_checkpoint(journal, section, offset);
+}
+
+/**
+ * Makes everything written so far durable and records a checkpoint of it.
+ * The output is synced before the record is written, so a checkpoint never
+ * points past data that could have been lost.
+ * 
+ * @param journal The journal
+ * @param section The section being copied
+ * @param offset  How much of the section has been written
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+int journal_checkpoint(struct journal* journal,
+                       const int section,
+                       const uint64_t offset)
+{
+    journal_record record = {
+        .section = section,
+        .offset = offset,
+    };
+    record.check = record_check(&record);
+
+    journal->pending = 0;
+    if (-1 == fdatasync(journal->out_fd) ||
+        -1 == write_all(journal->fd, &record, sizeof(record)) ||
+        -1 == fdatasync(journal->fd))
+    {
+        fprint_red(stderr, "[-] Failed to checkpoint %s (errno %d)\n", 
+            journal->path, errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Closes the journal of a dump that has completed, removing it since there's
+ * nothing left to resume.
+ * 
+ * @param journal The journal
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+int journal_finish(struct journal* journal)
+{
+    if (-1 == fdatasync(journal->out_fd) || -1 == unlink(journal->path))
+    {
+        fprint_red(stderr, "[-] Failed to finish %s (errno %d)\n", 
+            journal->path, errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Closes a journal, leaving it in place.
+ * 
+ * @param journal The journal to close
+ */
+void journal_close(struct journal* journal)
+{
+    if (NULL == journal)
+    {
+        return;
+    }
+
+    if (journal->fd >= 0)
+    {
+        close(journal->fd);
+    }
+    free(journal);
+}
\ No newline at end of file
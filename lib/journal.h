@@ -0,0 +1,86 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+
+#include "lmat.h"
+
+#define JOURNAL_MAGIC 0x524A4D4C    // "LMJR"
+#define JOURNAL_VERSION 1
+
+// The default number of chunks written between checkpoints
+#define DEFAULT_JOURNAL_INTERVAL 64
+
+// The header at the start of a journal file. It is followed by a
+// journal_record for each checkpoint, the last valid one of which is where
+// the dump can be resumed from.
+typedef struct
+{
+    unsigned int magic;         // Always 0x524A4D4C (LMJR)
+    unsigned int version;       // Format version number
+    uint64_t fingerprint;       // Hash of the output format and sections
+    uint64_t num_sections;      // The number of sections being dumped
+} __attribute__ ((__packed__)) journal_file_header;
+
+// A checkpoint, after which everything up to offset bytes into the section
+// is known to be on disk
+typedef struct
+{
+    uint64_t section;           // The section being copied
+    uint64_t offset;            // How much of the section has been written
+    uint64_t check;             // Hash of the fields above
+} __attribute__ ((__packed__)) journal_record;
+
+struct output_format;
+
+// A journal of how far a dump has durably progressed
+struct journal
+{
+    const char* path;
+    int         fd;
+    int         out_fd;
+    int         interval;
+    int         pending;
+
+    // Where this run of the dump started from
+    uint64_t    start_section;
+    uint64_t    start_offset;
+};
+
+uint64_t journal_fingerprint(const struct section* sections,
+                             const int num_sections,
+                             const struct output_format* format);
+
+struct journal* journal_open(const char* path,
+                             const int out_fd,
+                             const int interval,
+                             const uint64_t fingerprint,
+                             const int num_sections,
+                             const int resume);
+
+int journal_commit(struct journal* journal,
+                   const int section,
+                   const uint64_t offset);
+
+int journal_checkpoint(struct journal* journal,
+                       const int section,
+                       const uint64_t offset);
+
+int journal_finish(struct journal* journal);
+
+void journal_close(struct journal* journal);
\ No newline at end of file
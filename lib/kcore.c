@@ -20,8 +20,29 @@ Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
 
 #include "kcore.h"
 
+#include "budget.h"
+#include "buffer.h"
 #include "color-print.h"
-#include "lime.h"
+#include "compress.h"
+#include "direct.h"
+#include "format.h"
+#include "io.h"
+#include "journal.h"
+#include "lmz.h"
+#include "manifest.h"
+#include "merkle.h"
+#include "metrics.h"
+#include "pageflags.h"
+#include "parallel.h"
+#include "scan.h"
+#include "sink.h"
+#include "splice.h"
+#include "stream.h"
+#include "stripe.h"
+#include "tee.h"
+#include "uring.h"
+#include "vector.h"
+#include "zero.h"
 
 #include <elf.h>
 #include <errno.h>
@@ -29,179 +50,1380 @@ Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/sysinfo.h>
+#include <zlib.h>
 
-#define CHUNK_SIZE 0x100000 // 1M
+/**
+ * Writes a buffer to the output sink, skipping over zero-filled pages rather
+ * than writing them so that they become holes in the output.
+ * 
+ * @param sink   The sink to write to
+ * @param buffer The data to write
+ * @param len    The length of the data
+ * @param stats  The statistics to record skipped bytes in
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_sparse(struct sink* sink,
+                        const char* buffer,
+                        const size_t len,
+                        struct dump_stats* stats)
+{
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        int zero;
+        size_t run = scan_page_run(buffer + pos, len - pos, &zero);
+
+        if (zero)
+        {
+            if (-1 == sink_skip(sink, run))
+            {
+                return -1;
+            }
+            stats->bytes_elided += run;
+        }
+        else if (-1 == sink_write(sink, buffer + pos, run))
+        {
+            return -1;
+        }
+
+        pos += run;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes a chunk of memory to the output sink.
+ * 
+ * @param sink   The sink to write to
+ * @param buffer The data to write
+ * @param len    The length of the data
+ * @param ctx    The dump context
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_chunk(struct sink* sink,
+                       const char* buffer,
+                       const size_t len,
+                       struct dump_context* ctx)
+{
+    if (ctx->options->sparse)
+    {
+        return write_sparse(sink, buffer, len, ctx->stats);
+    }
+
+    return sink_write(sink, buffer, len);
+}
+
+/**
+ * Writes the selected pages of a chunk to the output sink. The pages that
+ * weren't worth capturing are skipped, leaving holes (or zeros) behind.
+ * 
+ * @param sink   The sink to write to
+ * @param buffer The data to write
+ * @param len    The length of the data
+ * @param keep   Non-zero for each page that should be written
+ * @param ctx    The dump context
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_selected(struct sink* sink,
+                          const char* buffer,
+                          const size_t len,
+                          const uint64_t* keep,
+                          struct dump_context* ctx)
+{
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        size_t page = pos / PAGE_FILTER_PAGE_SIZE;
+        size_t end = pos;
+        while (end < len && !keep[end / PAGE_FILTER_PAGE_SIZE] == !keep[page])
+        {
+            end += PAGE_FILTER_PAGE_SIZE;
+        }
+        if (end > len)
+        {
+            end = len;
+        }
+
+        if (keep[page])
+        {
+            if (-1 == write_chunk(sink, buffer + pos, end - pos, ctx))
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            if (-1 == sink_skip(sink, end - pos))
+            {
+                return -1;
+            }
+            ctx->stats->bytes_free += end - pos;
+        }
+
+        pos = end;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes the pages of a chunk that have changed since the base capture.
+ * Each run of changed pages becomes its own LiME range, so the output is a
+ * LiME file that only holds what changed.
+ * 
+ * @param sink    The sink to write to
+ * @param section The index of the section the chunk belongs to
+ * @param offset  The offset of the chunk within the section
+ * @param buffer  The contents of the chunk
+ * @param len     The length of the chunk
+ * @param ctx     The dump context
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_changed_pages(struct sink* sink,
+                               const int section,
+                               const uint64_t offset,
+                               const char* buffer,
+                               const size_t len,
+                               struct dump_context* ctx)
+{
+    const struct manifest_section* s = &ctx->manifest->sections[section];
+    lime_memory_range_header lime_header;
+    size_t run_start = 0;
+    size_t run_len = 0;
+
+    for (size_t pos = 0; pos <= len; pos += MANIFEST_PAGE_SIZE)
+    {
+        int changed = 0;
+        size_t page_len = 0;
+
+        if (pos < len)
+        {
+            page_len = len - pos;
+            if (page_len > MANIFEST_PAGE_SIZE)
+            {
+                page_len = MANIFEST_PAGE_SIZE;
+            }
+
+            uint64_t hash = ctx->manifest->hashes[s->first_page + 
+                (offset + pos) / MANIFEST_PAGE_SIZE];
+            const uint64_t* base_hash = manifest_find_page(ctx->base,
+                s->physical_base + offset + pos, page_len);
+            changed = NULL == base_hash || hash != *base_hash;
+
+            if (!changed)
+            {
+                ctx->stats->bytes_unchanged += page_len;
+            }
+        }
+
+        if (changed)
+        {
+            if (0 == run_len)
+            {
+                run_start = pos;
+            }
+            run_len += page_len;
+            continue;
+        }
+
+        // The run of changed pages (if any) has ended, so write it out
+        if (run_len)
+        {
+            fill_lime_header(&lime_header, s->physical_base + offset + run_start,
+                run_len);
+            if (-1 == sink_write(sink, (const char*) &lime_header, 
+                    sizeof(lime_memory_range_header)) ||
+                -1 == write_chunk(sink, buffer + run_start, run_len, ctx))
+            {
+                return -1;
+            }
+            run_len = 0;
+        }
+    }
+
+    return 0;
+}
 
 /**
- * Writes a memory region to an output file.asm
+ * Writes a memory region to an output sink.
  * 
- * @param out_fd   The file descriptor of the output file
- * @param kcore_fd The file descriptor of the /proc/kcore file
- * @param len      The length of the memory region to write
+ * @param sink        The sink to write the memory region to
+ * @param kcore_fd    The file descriptor of the /proc/kcore file
+ * @param section     The index of the section being written
+ * @param from        The offset in the section to start writing from
+ * @param len         The length of the memory region to write
+ * @param file_offset The offset of the region in kcore
+ * @param ctx         The dump context
  * 
  * @return 0 for success, else -1 if there's an error
  */
-static int write_memory_region(const int out_fd, 
+static int write_memory_region(struct sink* sink, 
                                const int kcore_fd, 
-                               const size_t len)
+                               const int section,
+                               const uint64_t from,
+                               const size_t len,
+                               const uint64_t file_offset,
+                               struct dump_context* ctx)
 {
     size_t remaining = len;
     size_t next_chunk;
-    int have_read, written;
-    char* buffer = malloc(CHUNK_SIZE);
+    ssize_t have_read, written;
+    size_t chunk_size = ctx->options->chunk_size;
+    uint64_t physical_base = ctx->metrics->sections[section].physical_base;
+    uint64_t* keep = NULL;
+    char* buffer = buffer_pool_get(ctx->buffers);
     if (NULL == buffer)
     {
         // Shouldn't happen...
-        fprint_red(stderr, "[-] Failed to malloc buffer\n");
+        fprint_red(stderr, "[-] Failed to get a buffer\n");
         return -1;
     }
 
+    // Pages are only filtered if they line up with the chunks
+    if (NULL != ctx->filter && 0 == physical_base % PAGE_FILTER_PAGE_SIZE)
+    {
+        keep = malloc(chunk_size / PAGE_FILTER_PAGE_SIZE * sizeof(uint64_t));
+        if (NULL == keep)
+        {
+            fprint_red(stderr, "[-] Failed to set up page filtering\n");
+            buffer_pool_put(ctx->buffers, buffer);
+            return -1;
+        }
+    }
+
     while (remaining)
     {
-        if (remaining > CHUNK_SIZE)
+        if (remaining > chunk_size)
         {
-            next_chunk = CHUNK_SIZE;
+            next_chunk = chunk_size;
         }
         else
         {
             next_chunk = remaining;
         }
 
-        have_read = read(kcore_fd, buffer, next_chunk);
+        uint64_t offset = from + (len - remaining);
+        uint64_t address = physical_base + offset;
+        uint64_t start = metrics_now();
+        int skipped = 0;
+        if (NULL != keep)
+        {
+            size_t num_pages = (next_chunk + PAGE_FILTER_PAGE_SIZE - 1) / 
+                PAGE_FILTER_PAGE_SIZE;
+            skipped = page_filter_select(ctx->filter, address, num_pages, keep);
+        }
+
+        // Chunks are always read in full, as a short chunk would throw every
+        // later one out of line with the pages and leaves they're hashed by
+        have_read = next_chunk;
+        if (skipped > 0)
+        {
+            if (-1 == page_filter_read(kcore_fd, buffer, 
+                file_offset + (len - remaining), next_chunk, keep))
+            {
+                have_read = -1;
+            }
+        }
+        else if (-1 == skipped)
+        {
+            fprint_red(stderr, "[-] Failed to read the page flags at 0x%lx\n", 
+                address);
+            have_read = -1;
+        }
+        else if (-1 == read_all_at(kcore_fd, buffer, next_chunk, 
+            file_offset + (len - remaining)))
+        {
+            have_read = -1;
+        }
+
         if (-1 == have_read)
         {
-            fprint_red(stderr, "[-] Kcore read failed!\n");
-            free(buffer);
+            fprint_red(stderr, "[-] Kcore read failed at 0x%lx (errno %d)\n", 
+                address, errno);
+            buffer_pool_put(ctx->buffers, buffer);
+            free(keep);
             return -1;
         }
+        uint64_t read_done = metrics_now();
+        metrics_record_read(ctx->metrics, section, address, start, read_done);
 
-        written = write(out_fd, buffer, have_read);
+        if (NULL != ctx->manifest)
+        {
+            manifest_hash_pages(ctx->manifest, section, offset, 
+                buffer, have_read);
+        }
+
+        // Scanning the chunk before it's written keeps it in cache
+        if (NULL != ctx->scanner)
+        {
+            scanner_scan(ctx->scanner, address, buffer, have_read);
+        }
+
+        // Skipped pages read back as zeros, so differential dumps can just
+        // compare them like any other page
+        if (NULL != ctx->base)
+        {
+            written = write_changed_pages(sink, section, offset, 
+                buffer, have_read, ctx);
+        }
+        else if (skipped > 0)
+        {
+            written = write_selected(sink, buffer, have_read, keep, ctx);
+        }
+        else
+        {
+            written = write_chunk(sink, buffer, have_read, ctx);
+        }
         if (-1 == written)
         {
             fprint_red(stderr, "[-] Failed to write memory regions!\n");
-            free(buffer);
+            buffer_pool_put(ctx->buffers, buffer);
+            free(keep);
+            return -1;
+        }
+        uint64_t write_done = metrics_now();
+        metrics_record_write(ctx->metrics, section, address, read_done, 
+            write_done, have_read);
+
+        // The chunk has been written, so it can be hashed while the next one
+        // is copied into another buffer
+        if (NULL != ctx->merkle && NULL == (buffer = merkle_submit(ctx->merkle, 
+            section, offset, buffer, have_read)))
+        {
+            fprint_red(stderr, "[-] Failed to hash memory regions!\n");
+            free(keep);
             return -1;
         }
 
-        remaining -= written;
+        remaining -= have_read;
+        ctx->stats->bytes_copied += have_read;
+
+        if (NULL != ctx->budget)
+        {
+            budget_account(ctx->budget, have_read, write_done - read_done);
+        }
+
+        if (NULL != ctx->journal && 
+            -1 == journal_commit(ctx->journal, section, offset + have_read))
+        {
+            buffer_pool_put(ctx->buffers, buffer);
+            free(keep);
+            return -1;
+        }
     }
 
-    free(buffer);
+    buffer_pool_put(ctx->buffers, buffer);
+    free(keep);
     return 0;
 }
 
 /**
- * Writes the LiME headers (and associated memory regions) to an output file.
+ * Writes the framing and contents of each section to an output sink, in the
+ * order they appear in the output. The gaps the format leaves around its
+ * headers are skipped over.
  * 
  * @param kcore_fd   The file descriptor of the /proc/kcore file
- * @param out_fd     The file descriptor for the output file
+ * @param sink       The sink to write the output to
  * @param sections   The array of memory sections to write
+ * @param layout     The location of each section in the output
  * @param num_ranges The number of memory ranges to write
+ * @param ctx        The dump context
  * 
  * @return 0 for success, else -1 if there's an error
  */
-static int write_lime(const int kcore_fd,
-                      const int out_fd,
-                      const struct section* sections,
-                      const int num_ranges)
+static int write_sections(const int kcore_fd,
+                          struct sink* sink,
+                          const struct section* sections,
+                          const struct section_layout* layout,
+                          const int num_ranges,
+                          struct dump_context* ctx)
 {
-    // Setup the basic header structure
-    lime_memory_range_header lime_header;
-    lime_header.magic = LIME_HEADER_MAGIC;
-    lime_header.version = LIME_HEADER_VERSION;
-    memset(&lime_header.reserved, 0x00, 8);
+    const struct output_format* format = ctx->options->format;
+    uint64_t pos = 0;
+    int ret = 0;
+
+    // A resumed dump picks up partway through a section whose header, and
+    // everything before it, is already in place
+    int first = 0;
+    uint64_t start = 0;
+    if (NULL != ctx->journal && 
+        (ctx->journal->start_section > 0 || ctx->journal->start_offset > 0))
+    {
+        first = ctx->journal->start_section;
+        start = ctx->journal->start_offset;
+        pos = layout[first].data_offset + start;
+    }
+
+    char* header = malloc(format->header_size(num_ranges));
+    if (NULL == header)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the headers\n");
+        return -1;
+    }
 
     // Write out each memory region
-    for (int i = 0; i < num_ranges; i++)
+    for (int i = first; i < num_ranges; i++)
     {
-        lime_header.s_addr = sections[i].physical_base;
-        lime_header.e_addr = sections[i].physical_base + sections[i].size - 1;
+        uint64_t offset = i == first ? start : 0;
 
-        // Write the LiME memory range header
-        if (sizeof(lime_memory_range_header) != 
-            write(out_fd, &lime_header, sizeof(lime_memory_range_header)))
+        // Write the section's header. In a differential dump each run of
+        // changed pages gets its own LiME header instead.
+        if (NULL == ctx->base && 0 == offset)
         {
-            fprint_red(stderr, "[-] Error writing file header (errno %d)\n", errno);
-            return -1;
+            size_t header_len = format->header(sections, layout, num_ranges, 
+                i, header);
+            if (-1 == sink_skip(sink, layout[i].header_offset - pos) ||
+                -1 == sink_write(sink, header, header_len) ||
+                -1 == sink_skip(sink, layout[i].data_offset - 
+                    layout[i].header_offset - header_len))
+            {
+                fprint_red(stderr, "[-] Error writing file header (errno %d)\n", 
+                    errno);
+                ret = -1;
+                break;
+            }
         }
+        pos = layout[i].data_offset + sections[i].size;
 
         print_cyan("\t[*] Copying section %d (0x%lx - 0x%lx)\n", 
-            i, lime_header.s_addr, lime_header.e_addr);
+            i, sections[i].physical_base + offset, 
+            sections[i].physical_base + sections[i].size - 1);
 
         // Copy over the actual memory content
-        off64_t pos = lseek64(kcore_fd, sections[i].file_offset, SEEK_SET);
-        if (-1 == pos)
+        if (write_memory_region(sink, kcore_fd, i, offset, 
+            sections[i].size - offset, sections[i].file_offset + offset, 
+            ctx) != 0)
         {
-            fprint_red(stderr, "[-] Error setting position in kcore (errno %d)\n", 
-                errno);
-            return -1;
+            fprint_red(stderr, "[-] Error writing data (errno %d)\n", errno);
+            ret = -1;
+            break;
         }
+    }
+
+    free(header);
+    return ret;
+}
 
-        if (write_memory_region(out_fd, kcore_fd, sections[i].size) != 0)
+/**
+ * Writes the output using one of the positional copy engines. The headers
+ * are written up front at their precomputed offsets, after which the section
+ * contents are copied by the selected engine.
+ * 
+ * @param kcore_fd     The file descriptor of the /proc/kcore file
+ * @param out_fd       The file descriptor for the output file
+ * @param sections     The array of memory sections to write
+ * @param num_sections The number of memory sections to write
+ * @param ctx          The dump context
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_output_positional(const int kcore_fd,
+                                   const int out_fd,
+                                   const struct section* sections,
+                                   const int num_sections,
+                                   struct dump_context* ctx)
+{
+    int ret = 0;
+    const struct dump_options* options = ctx->options;
+
+    struct section_layout* layout = 
+        malloc(num_sections * sizeof(struct section_layout));
+    char* header = malloc(options->format->header_size(num_sections));
+    if (NULL == layout || NULL == header)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the output layout\n");
+        free(layout);
+        free(header);
+        return -1;
+    }
+    uint64_t total_size = options->format->layout(sections, num_sections, 
+        layout);
+
+    // The vector engine writes each header along with its section's data
+    if (ENGINE_VECTOR == options->engine)
+    {
+        ret = copy_sections_vector(kcore_fd, out_fd, sections, layout,
+            num_sections, ctx);
+        goto cleanup;
+    }
+
+    for (int i = 0; i < num_sections; i++)
+    {
+        size_t header_len = options->format->header(sections, layout, 
+            num_sections, i, header);
+        if (-1 == write_all_at(out_fd, header, header_len, 
+            layout[i].header_offset))
         {
-            fprint_red(stderr, "[-] Error writing data (errno %d)\n", errno);
-            return -1;
+            fprint_red(stderr, "[-] Error writing file header (errno %d)\n", errno);
+            ret = -1;
+            goto cleanup;
         }
     }
 
-    return 0;
+    if (ENGINE_URING == options->engine)
+    {
+        ret = copy_sections_uring(kcore_fd, out_fd, sections, layout,
+            num_sections, ctx);
+        if (COPY_UNSUPPORTED != ret)
+        {
+            goto cleanup;
+        }
+
+        print_yellow("[!] io_uring is unavailable, falling back to synchronous I/O\n");
+        ret = 0;
+    }
+    else if (ENGINE_SPLICE == options->engine)
+    {
+        ret = copy_sections_splice(kcore_fd, out_fd, sections, layout,
+            num_sections, ctx);
+        goto cleanup;
+    }
+
+    if (-1 == copy_sections_parallel(kcore_fd, out_fd, sections, layout,
+        num_sections, ctx))
+    {
+        ret = -1;
+        goto cleanup;
+    }
+
+    // Trailing zero or free pages were skipped, so extend the file to cover them
+    if ((options->sparse || NULL != ctx->filter) && 
+        -1 == ftruncate(out_fd, total_size))
+    {
+        fprint_red(stderr, "[-] Failed to set the output size (errno %d)\n", errno);
+        ret = -1;
+    }
+
+cleanup:
+    free(layout);
+    free(header);
+    return ret;
+}
+
+/**
+ * Prepares the output of an interrupted dump to be resumed. The headers that
+ * were written before the last checkpoint are checked, and anything written
+ * after it is thrown away.
+ * 
+ * @param out_fd       The file descriptor for the output file
+ * @param sections     The array of memory sections being written
+ * @param layout       The location of each section in the output
+ * @param num_sections The number of memory sections being written
+ * @param ctx          The dump context
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int resume_output(const int out_fd,
+                         const struct section* sections,
+                         const struct section_layout* layout,
+                         const int num_sections,
+                         struct dump_context* ctx)
+{
+    const struct output_format* format = ctx->options->format;
+    const struct journal* journal = ctx->journal;
+    int ret = 0;
+    uint64_t pos = 0;
+
+    if (journal->start_section > 0 || journal->start_offset > 0)
+    {
+        pos = layout[journal->start_section].data_offset + journal->start_offset;
+    }
+
+    size_t header_size = format->header_size(num_sections);
+    char* expected = malloc(header_size);
+    char* actual = malloc(header_size);
+    if (NULL == expected || NULL == actual)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the headers\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    for (int i = 0; pos > 0 && (uint64_t)i <= journal->start_section; i++)
+    {
+        size_t header_len = format->header(sections, layout, num_sections, i, 
+            expected);
+        if (-1 == read_all_at(out_fd, actual, header_len, 
+            layout[i].header_offset) || 0 != memcmp(expected, actual, header_len))
+        {
+            fprint_red(stderr, "[-] The header of section %d doesn't match, so the dump can't be resumed\n", 
+                i);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (-1 == ftruncate(out_fd, pos) || -1 == lseek64(out_fd, pos, SEEK_SET))
+    {
+        fprint_red(stderr, "[-] Failed to rewind the output (errno %d)\n", errno);
+        ret = -1;
+        goto cleanup;
+    }
+
+    print_green("[*] Resuming from section %lu at offset 0x%lx\n", 
+        journal->start_section, journal->start_offset);
+
+cleanup:
+    free(expected);
+    free(actual);
+    return ret;
+}
+
+/**
+ * Sets up the extra destinations of a dump alongside its main output.
+ * 
+ * @param main    The sink for the main output
+ * @param options The options for the dump
+ * 
+ * @return A sink that feeds every destination, else NULL if there's an error
+ */
+static struct sink* create_tee(struct sink* main, 
+                               const struct dump_options* options)
+{
+    struct sink* sinks[MAX_TEE_OUTPUTS + 1] = { main };
+    const char* names[MAX_TEE_OUTPUTS + 1] = { "the output" };
+    enum tee_policy policies[MAX_TEE_OUTPUTS + 1] = { TEE_BLOCK };
+    int num_sinks = 1;
+
+    for (int i = 0; i < options->num_tee_outputs; i++)
+    {
+        const struct tee_output* output = &options->tee_outputs[i];
+        sinks[num_sinks] = output->stream ? stream_sink_create(output->fd) :
+            file_sink_create(output->fd);
+        if (NULL == sinks[num_sinks])
+        {
+            for (int j = 0; j < num_sinks; j++)
+            {
+                sink_destroy(sinks[j]);
+            }
+            return NULL;
+        }
+        names[num_sinks] = output->path;
+        policies[num_sinks] = output->policy;
+        num_sinks++;
+    }
+
+    print_cyan("\t[*] Writing to %d destinations with queues of %d blocks\n",
+        num_sinks, options->tee_queue_depth);
+    return tee_sink_create(sinks, names, policies, num_sinks, 
+        options->chunk_size, options->tee_queue_depth);
 }
 
 /**
- * Dumps the system's RAM from the /proc/kcore file to disk.asm
+ * Writes the output through a sink, one section after another.
+ * 
+ * @param kcore_fd     The file descriptor of the /proc/kcore file
+ * @param out_fd       The file descriptor for the output file
+ * @param sections     The array of memory sections to write
+ * @param num_sections The number of memory sections to write
+ * @param ctx          The dump context
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_output_stream(const int kcore_fd,
+                               const int out_fd,
+                               const struct section* sections,
+                               const int num_sections,
+                               struct dump_context* ctx)
+{
+    int ret = 0;
+    struct sink* sink;
+
+    struct section_layout* layout = 
+        malloc(num_sections * sizeof(struct section_layout));
+    if (NULL == layout)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the output layout\n");
+        return -1;
+    }
+    ctx->options->format->layout(sections, num_sections, layout);
+
+    if (ctx->options->resume && 
+        -1 == resume_output(out_fd, sections, layout, num_sections, ctx))
+    {
+        free(layout);
+        return -1;
+    }
+
+    // A striped dump only leaves its layout in the output itself
+    if (ctx->options->num_stripe_targets > 0)
+    {
+        sink = stripe_sink_create(ctx->options->stripe_targets, 
+            ctx->options->num_stripe_targets, ctx->options->stripe_size,
+            ctx->options->chunk_size, out_fd);
+    }
+    else if (ctx->options->streaming)
+    {
+        sink = stream_sink_create(out_fd);
+    }
+    else if (ctx->options->direct)
+    {
+        sink = direct_sink_create(out_fd, ctx->buffers);
+    }
+    else
+    {
+        sink = file_sink_create(out_fd);
+    }
+
+    // Every destination is fed from the one copy, which is only compressed
+    // once on the way in
+    if (NULL != sink && ctx->options->num_tee_outputs > 0)
+    {
+        sink = create_tee(sink, ctx->options);
+    }
+
+    if (NULL != sink && ctx->options->compress)
+    {
+        sink = compress_sink_create(sink, ctx->options->threads);
+    }
+
+    if (NULL == sink)
+    {
+        fprint_red(stderr, "[-] Failed to set up the output\n");
+        free(layout);
+        return -1;
+    }
+
+    ret = write_sections(kcore_fd, sink, sections, layout, num_sections, ctx);
+    if (0 == ret && -1 == sink_finish(sink))
+    {
+        fprint_red(stderr, "[-] Failed to finish the output (errno %d)\n", errno);
+        ret = -1;
+    }
+
+    if (0 == ret && NULL != ctx->journal && -1 == journal_finish(ctx->journal))
+    {
+        ret = -1;
+    }
+
+    sink_destroy(sink);
+    free(layout);
+    return ret;
+}
+
+/**
+ * Works out how much memory a dump will hold on to for its buffers, hashes,
+ * metrics and signature automaton, cutting back on hashing threads to fit
+ * within --max-memory.
+ * 
+ * @param sections     The array of memory sections to dump
+ * @param num_sections The number of memory sections to dump
+ * @param options      The options for the dump
+ * @param scanner      The dump's signature scanner, or NULL if there isn't
+ *                     one (yet)
+ * @param hash_threads The number of hashing threads, which may be lowered
+ * 
+ * @return 0 if the dump fits, else -1
+ */
+static int fit_memory_budget(const struct section* sections,
+                             const int num_sections,
+                             const struct dump_options* options,
+                             const struct scanner* scanner,
+                             int* hash_threads)
+{
+    size_t chunk_size = options->chunk_size;
+    size_t total_size = 0;
+    size_t buffers;
+
+    // Every section has its own latency histograms
+    size_t fixed = sizeof(struct dump_metrics) + 
+        (size_t) num_sections * sizeof(struct section_metrics);
+
+    for (int i = 0; i < num_sections; i++)
+    {
+        total_size += sections[i].size;
+    }
+
+    if (NULL != options->manifest_path)
+    {
+        fixed += total_size / MANIFEST_PAGE_SIZE * sizeof(uint64_t);
+    }
+    if (NULL != options->base_path)
+    {
+        fixed += total_size / MANIFEST_PAGE_SIZE * sizeof(uint64_t);
+    }
+    if (NULL != options->hash_path)
+    {
+        fixed += total_size / MERKLE_LEAF_SIZE * MERKLE_HASH_SIZE;
+    }
+    if (options->compress)
+    {
+        fixed += (size_t) (2 * options->threads + 2) * 
+            (LMZ_BLOCK_SIZE + compressBound(LMZ_BLOCK_SIZE));
+    }
+    if (NULL != scanner)
+    {
+        fixed += scanner_memory(scanner);
+    }
+
+    if (options->num_tee_outputs > 0)
+    {
+        fixed += (size_t) (options->tee_queue_depth + 
+            options->num_tee_outputs + 2) * chunk_size;
+    }
+
+    if (options->num_stripe_targets > 0)
+    {
+        fixed += (size_t) options->num_stripe_targets * 
+            (STRIPE_QUEUE_DEPTH + 1) * chunk_size;
+    }
+
+    // The other engines bring their own buffers
+    if (ENGINE_URING == options->engine)
+    {
+        fixed += (size_t) options->queue_depth * chunk_size;
+    }
+    else if (ENGINE_SPLICE == options->engine)
+    {
+        fixed += (size_t) options->threads * chunk_size;
+    }
+
+    do
+    {
+        buffers = options->threads + (options->direct ? 1 : 0) + 
+            2 * *hash_threads;
+        if (fixed + buffers * chunk_size <= options->max_memory)
+        {
+            if (NULL != options->hash_path)
+            {
+                print_cyan("\t[*] Using %d hashing threads to stay within 0x%lx bytes\n",
+                    *hash_threads, options->max_memory);
+            }
+            return 0;
+        }
+    } while (*hash_threads > 1 && --*hash_threads);
+
+    fprint_red(stderr, "[-] The dump needs at least 0x%lx bytes, more than --max-memory allows.\n"
+        "    Use a smaller --chunk-size, or fewer --threads or --queue-depth\n",
+        fixed + buffers * chunk_size);
+    return -1;
+}
+
+/**
+ * Works out how many chunk buffers a dump needs. Every copy thread needs a
+ * buffer, as does the staging for O_DIRECT. Each hashing thread gets one to
+ * hash and one queued up behind it.
+ * 
+ * @param sections     The array of memory sections to dump
+ * @param num_sections The number of memory sections to dump
+ * @param options      The options for the dump
+ * @param scanner      The dump's signature scanner, or NULL if there isn't
+ *                     one (yet)
+ * @param hash_threads The number of hashing threads to use (output)
+ * 
+ * @return The number of buffers, else -1 if the dump doesn't fit within
+ *         --max-memory
+ */
+static int plan_buffers(const struct section* sections,
+                        const int num_sections,
+                        const struct dump_options* options,
+                        const struct scanner* scanner,
+                        int* hash_threads)
+{
+    *hash_threads = 0;
+    if (NULL != options->hash_path)
+    {
+        *hash_threads = get_nprocs();
+        if (*hash_threads > MAX_HASH_THREADS)
+        {
+            *hash_threads = MAX_HASH_THREADS;
+        }
+    }
+
+    if (0 != options->max_memory && 
+        -1 == fit_memory_budget(sections, num_sections, options, scanner, 
+            hash_threads))
+    {
+        return -1;
+    }
+
+    return options->threads + (options->direct ? 1 : 0) + 2 * *hash_threads;
+}
+
+/**
+ * Creates the chunk buffers for dumps of the given sections ahead of time,
+ * so they can be kept across dumps through the options. The signature
+ * scanner is only counted against --max-memory once each dump starts.
+ * 
+ * @param sections     The array of memory sections to dump
+ * @param num_sections The number of memory sections to dump
+ * @param options      The options for the dumps
+ * 
+ * @return The buffers, else NULL if there's an error
+ */
+struct buffer_pool* dump_buffers_create(const struct section* sections,
+                                        const int num_sections,
+                                        const struct dump_options* options)
+{
+    int hash_threads;
+    int num_buffers = plan_buffers(sections, num_sections, options, NULL, 
+        &hash_threads);
+    if (-1 == num_buffers)
+    {
+        return NULL;
+    }
+
+    return buffer_pool_create(options->chunk_size, num_buffers);
+}
+
+/**
+ * Merges sections that follow on from each other in physical memory, in
+ * kcore and in the kernel's address space, so they're copied and framed as
+ * one.
+ * 
+ * @param sections     The array of memory sections to dump
+ * @param num_sections The number of memory sections to dump
+ * @param coalesced    The merged sections (output)
+ * 
+ * @return The number of merged sections, else -1 if there's an error
+ */
+static int coalesce_sections(const struct section* sections,
+                             const int num_sections,
+                             struct section** coalesced)
+{
+    int count = 0;
+
+    *coalesced = malloc((num_sections > 0 ? num_sections : 1) * 
+        sizeof(struct section));
+    if (NULL == *coalesced)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < num_sections; i++)
+    {
+        struct section* last = count > 0 ? &(*coalesced)[count - 1] : NULL;
+        if (NULL != last && 
+            last->physical_base + last->size == sections[i].physical_base &&
+            last->file_offset + last->size == sections[i].file_offset &&
+            last->virtual_base + last->size == sections[i].virtual_base)
+        {
+            last->size += sections[i].size;
+            continue;
+        }
+
+        (*coalesced)[count++] = sections[i];
+    }
+
+    return count;
+}
+
+/**
+ * Dumps the system's RAM from the /proc/kcore file to disk.
  * 
  * @param kcore_fd   The file descriptor for /proc/kcore
  * @param out_fd     The file descriptor for the output file
  * @param sections   The array of memory sections to dump to disk
  * @param num_ranges The number of memory ranges to dump
+ * @param options    The options controlling how the dump is performed
+ * @param stats      The statistics for the dump (output)
  * 
  * @return 0 for success, else -1 if there's an error
  */
 int dump_kcore(int kcore_fd, 
                int out_fd, 
                struct section* sections, 
-               int num_ranges)
+               int num_ranges,
+               const struct dump_options* options,
+               struct dump_stats* stats)
+{
+    int ret = 0;
+    int hash_threads = 0;
+    struct section* coalesced = NULL;
+    struct page_manifest* base = NULL;
+    struct page_filter filter = {
+        .kpageflags_fd = -1,
+        .kpagecount_fd = -1,
+    };
+    struct dump_context ctx = {
+        .options = options,
+        .stats = stats,
+        .manifest = NULL,
+        .base = NULL,
+        .buffers = NULL,
+        .metrics = NULL,
+        .filter = NULL,
+        .merkle = NULL,
+        .journal = NULL,
+        .budget = NULL,
+        .scanner = NULL,
+    };
+
+    memset(stats, 0, sizeof(*stats));
+
+    // The vector engine copies sections that follow on from each other as one
+    if (ENGINE_VECTOR == options->engine)
+    {
+        int num_coalesced = coalesce_sections(sections, num_ranges, &coalesced);
+        if (-1 == num_coalesced)
+        {
+            fprint_red(stderr, "[-] Failed to coalesce the sections\n");
+            ret = -1;
+            goto cleanup;
+        }
+        if (num_coalesced < num_ranges)
+        {
+            print_cyan("\t[*] Coalesced %d sections into %d\n", num_ranges, 
+                num_coalesced);
+        }
+        sections = coalesced;
+        num_ranges = num_coalesced;
+    }
+
+    // The automaton's size depends on the signatures, so it's built before
+    // the memory budget is checked
+    if (NULL != options->scan_path)
+    {
+        if (NULL == (ctx.scanner = scanner_create(options->scan_path, 
+            options->hits_path)))
+        {
+            ret = -1;
+            goto cleanup;
+        }
+        print_green("[*] Scanning for %d signatures\n", 
+            ctx.scanner->num_patterns);
+    }
+
+    int num_buffers = plan_buffers(sections, num_ranges, options, ctx.scanner, 
+        &hash_threads);
+    if (-1 == num_buffers)
+    {
+        ret = -1;
+        goto cleanup;
+    }
+
+    // Buffers created ahead of time are used if there are enough of them
+    if (NULL != options->buffers && 
+        options->buffers->buffer_size == options->chunk_size &&
+        options->buffers->num_buffers >= num_buffers)
+    {
+        ctx.buffers = options->buffers;
+    }
+    else if (NULL == (ctx.buffers = buffer_pool_create(options->chunk_size, 
+        num_buffers)))
+    {
+        fprint_red(stderr, "[-] Failed to allocate the chunk buffers\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (NULL == (ctx.metrics = metrics_create(sections, num_ranges)))
+    {
+        fprint_red(stderr, "[-] Failed to allocate the dump metrics\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (options->progress && -1 == metrics_start_progress(ctx.metrics))
+    {
+        print_yellow("[!] Failed to start the progress thread\n");
+    }
+
+    if (options->skip_free)
+    {
+        if (-1 == page_filter_open(&filter))
+        {
+            ret = -1;
+            goto cleanup;
+        }
+        ctx.filter = &filter;
+        print_green("[*] Skipping free and unbacked pages\n");
+    }
+
+    if (NULL != options->base_path)
+    {
+        if (NULL == (base = manifest_load(options->base_path)))
+        {
+            ret = -1;
+            goto cleanup;
+        }
+        ctx.base = base;
+        print_green("[*] Writing only the pages that changed since %s\n",
+            options->base_path);
+    }
+
+    if (NULL != options->manifest_path &&
+        NULL == (ctx.manifest = manifest_create(sections, num_ranges)))
+    {
+        fprint_red(stderr, "[-] Failed to allocate the page manifest\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (NULL != options->journal_path)
+    {
+        uint64_t fingerprint = journal_fingerprint(sections, num_ranges, 
+            options->format);
+        if (NULL == (ctx.journal = journal_open(options->journal_path, out_fd, 
+            options->journal_interval, fingerprint, num_ranges, options->resume)))
+        {
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (NULL != options->hash_path)
+    {
+        if (NULL == (ctx.merkle = merkle_create(sections, num_ranges)) ||
+            -1 == merkle_start(ctx.merkle, ctx.buffers, hash_threads))
+        {
+            fprint_red(stderr, "[-] Failed to set up hashing\n");
+            ret = -1;
+            goto cleanup;
+        }
+        print_green("[*] Hashing memory with %d threads\n", 
+            ctx.merkle->num_threads);
+    }
+
+    if (0 != options->max_rate || options->psi_threshold > 0)
+    {
+        if (NULL == (ctx.budget = budget_create(options)))
+        {
+            fprint_red(stderr, "[-] Failed to set up the impact budget\n");
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (!options->compress && !options->streaming && !options->direct && 
+        NULL == ctx.base && 0 == options->num_tee_outputs &&
+        0 == options->num_stripe_targets &&
+        (ENGINE_SYNC != options->engine || options->threads > 1))
+    {
+        ret = write_output_positional(kcore_fd, out_fd, sections, num_ranges,
+            &ctx);
+    }
+    else
+    {
+        ret = write_output_stream(kcore_fd, out_fd, sections, num_ranges, &ctx);
+    }
+    metrics_stop(ctx.metrics);
+
+    if (ctx.metrics->io_counted)
+    {
+        stats->read_calls = ctx.metrics->io.read_calls;
+        stats->write_calls = ctx.metrics->io.write_calls;
+        stats->bytes_read = ctx.metrics->io.bytes_read;
+        stats->bytes_written = ctx.metrics->io.bytes_written;
+    }
+
+    if (NULL != ctx.scanner)
+    {
+        stats->signature_hits = ctx.scanner->num_hits;
+        if (-1 == scanner_finish(ctx.scanner))
+        {
+            ret = -1;
+        }
+    }
+
+    if (NULL != ctx.budget)
+    {
+        stats->throttled_ns = ctx.budget->throttled_ns;
+        stats->backoffs = ctx.budget->backoffs;
+    }
+
+    if (NULL != ctx.merkle && -1 == merkle_stop(ctx.merkle))
+    {
+        fprint_red(stderr, "[-] Failed to hash memory regions\n");
+        ret = -1;
+    }
+
+    if (options->progress)
+    {
+        metrics_print_summary(ctx.metrics);
+    }
+
+    if (0 == ret && NULL != options->stats_path)
+    {
+        ret = metrics_save_json(ctx.metrics, options, options->stats_path);
+    }
+
+    if (0 == ret && NULL != ctx.manifest)
+    {
+        ret = manifest_save(ctx.manifest, options->manifest_path);
+    }
+
+    if (0 == ret && NULL != ctx.merkle)
+    {
+        ret = merkle_compute_root(ctx.merkle);
+        if (0 == ret)
+        {
+            ret = merkle_save(ctx.merkle, options->hash_path);
+        }
+    }
+
+cleanup:
+    // The hashing threads hold on to buffers, so they have to finish first
+    if (NULL != ctx.merkle)
+    {
+        merkle_stop(ctx.merkle);
+        merkle_free(ctx.merkle);
+    }
+    manifest_free(ctx.manifest);
+    manifest_free(base);
+    if (ctx.buffers != options->buffers)
+    {
+        buffer_pool_destroy(ctx.buffers);
+    }
+    metrics_free(ctx.metrics);
+    page_filter_close(&filter);
+    journal_close(ctx.journal);
+    budget_free(ctx.budget);
+    scanner_free(ctx.scanner);
+    free(coalesced);
+    return ret;
+}
+
+/**
+ * Orders the kcore segments by physical address, with the larger of any
+ * segments starting at the same address first.
+ * 
+ * @param a The first segment
+ * @param b The second segment
+ * 
+ * @return Less than, equal to or greater than zero as a sorts before, with
+ *         or after b
+ */
+static int compare_segments(const void* a, const void* b)
 {
-    return write_lime(kcore_fd, out_fd, sections, num_ranges);
+    const struct section* sa = (const struct section*) a;
+    const struct section* sb = (const struct section*) b;
+
+    if (sa->physical_base != sb->physical_base)
+    {
+        return sa->physical_base < sb->physical_base ? -1 : 1;
+    }
+    if (sa->size != sb->size)
+    {
+        return sa->size > sb->size ? -1 : 1;
+    }
+    return 0;
 }
 
 /**
  * Attempts to associate the memory ranges from /proc/iomem to the ranges
  * present in the headers of /proc/kcore. 
  * 
+ * Both sides are sorted by physical address and swept together, so each
+ * range is clipped to the segments that back it, whether it lines up with a
+ * single segment, spans several or only partly overlaps one. Where segments
+ * overlap each other, such as the kernel text alias of RAM, each byte is only
+ * taken from the first segment that covers it.
+ * 
  * @param prog_hdr            The program headers from /proc/kcore
  * @param num_hdrs            The number of headers from kcore
- * @param ranges              The memory ranges fround from iomem
+ * @param ranges              The memory ranges fround from iomem, sorted by
+ *                            address and not overlapping
  * @param num_physical_ranges The number of ranges from iomem
- * @param sections            The memory sections found (output)
+ * @param sections            The memory sections found, sorted by address,
+ *                            which must be freed by the caller (output)
  * 
- * @return The number of associated sections
+ * @return The number of associated sections, else -1 if there's an error
  */
 int match_physical_addresses_to_phdrs(const Elf64_Phdr* prog_hdr,
                                       const unsigned int num_hdrs,
                                       const struct addr_range* ranges,
                                       const unsigned int num_physical_ranges,
-                                      struct section* sections)
+                                      struct section** sections)
 {
+    int num_segments = 0;
     int filled_sections = 0;
 
-    print_green("[*] Attempting to associate memory ranges from %s with headers from %s\n", 
-        IOMEM_FILENAME, KCORE_FILENAME);
+    print_green("[*] Attempting to associate memory ranges from iomem with headers from kcore\n");
+
+    // Each range can be split at most once per segment boundary
+    struct section* segments = malloc(num_hdrs * sizeof(struct section));
+    struct section* found = malloc((num_hdrs + num_physical_ranges) * 
+        sizeof(struct section));
+    if (NULL == segments || NULL == found)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the memory sections\n");
+        free(segments);
+        free(found);
+        return -1;
+    }
 
+    // Only loads with a physical address can back RAM
     for (int i = 0; i < num_hdrs; i++)
     {
-        for (int j = 0; j < num_physical_ranges; j++)
+        if (PT_LOAD != prog_hdr[i].p_type || 0 == prog_hdr[i].p_memsz ||
+            (Elf64_Addr) -1 == prog_hdr[i].p_paddr)
         {
-            if (prog_hdr[i].p_paddr == ranges[j].start)
-            {
-                sections[filled_sections].physical_base = ranges[j].start;
-                sections[filled_sections].file_offset = prog_hdr[i].p_offset;
-                sections[filled_sections].size = prog_hdr[i].p_memsz;
+            continue;
+        }
 
-                filled_sections++;
-            }
+        segments[num_segments].physical_base = prog_hdr[i].p_paddr;
+        segments[num_segments].virtual_base = prog_hdr[i].p_vaddr;
+        segments[num_segments].file_offset = prog_hdr[i].p_offset;
+        segments[num_segments].size = prog_hdr[i].p_memsz;
+        num_segments++;
+    }
+    qsort(segments, num_segments, sizeof(struct section), compare_segments);
+
+    // Trim the segments so that none of them overlap
+    int kept = 0;
+    uint64_t covered = 0;
+    for (int i = 0; i < num_segments; i++)
+    {
+        struct section s = segments[i];
+        uint64_t end = s.physical_base + s.size;
+        if (kept > 0 && end <= covered)
+        {
+            continue;
+        }
+
+        if (kept > 0 && s.physical_base < covered)
+        {
+            uint64_t skip = covered - s.physical_base;
+            s.physical_base += skip;
+            s.virtual_base += skip;
+            s.file_offset += skip;
+            s.size -= skip;
+        }
+
+        segments[kept++] = s;
+        covered = end;
+    }
+
+    // Sweep the ranges and segments together, keeping each overlap
+    int r = 0, s = 0;
+    while (r < num_physical_ranges && s < kept)
+    {
+        uint64_t range_end = ranges[r].end + 1;
+        uint64_t segment_end = segments[s].physical_base + segments[s].size;
+        uint64_t start = ranges[r].start > segments[s].physical_base ? 
+            ranges[r].start : segments[s].physical_base;
+        uint64_t end = range_end < segment_end ? range_end : segment_end;
+
+        if (start < end)
+        {
+            uint64_t delta = start - segments[s].physical_base;
+            found[filled_sections].physical_base = start;
+            found[filled_sections].virtual_base = segments[s].virtual_base + delta;
+            found[filled_sections].file_offset = segments[s].file_offset + delta;
+            found[filled_sections].size = end - start;
+            filled_sections++;
+        }
+
+        if (range_end <= segment_end)
+        {
+            r++;
+        }
+        else
+        {
+            s++;
         }
     }
 
+    free(segments);
+    *sections = found;
     return filled_sections;
 }
\ No newline at end of file
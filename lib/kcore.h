@@ -24,10 +24,16 @@ Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
 int dump_kcore(int kcore_fd, 
                int out_fd, 
                struct section* sections, 
-               int num_ranges);
+               int num_ranges,
+               const struct dump_options* options,
+               struct dump_stats* stats);
+
+struct buffer_pool* dump_buffers_create(const struct section* sections,
+                                        const int num_sections,
+                                        const struct dump_options* options);
 
 int match_physical_addresses_to_phdrs(const Elf64_Phdr* prog_hdr,
                                       const unsigned int num_hdrs,
                                       const struct addr_range* ranges,
                                       const unsigned int num_physical_ranges,
-                                      struct section* sections);
\ No newline at end of file
+                                      struct section** sections);
\ No newline at end of file
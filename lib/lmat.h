@@ -20,18 +20,32 @@ Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
 #include <unistd.h>
 #include <stdint.h>
 
-// The path to kcore file on disk
+// The default path to kcore file on disk
 #define KCORE_FILENAME "/proc/kcore"
 
-// The path to the iomem file on disk
+// The default path to the iomem file on disk
 #define IOMEM_FILENAME "/proc/iomem"
 
-// The maximum number of physical address ranges we support
-#define MAX_PHYSICAL_RANGES 32
-
 // The label that's associated with system RAM in iomem
 #define SYSTEM_RAM_LABEL "System RAM"
 
+// The default size of the chunks that memory is copied in
+#define CHUNK_SIZE 0x100000 // 1M
+
+// The limits on the chunk size, which must also be a multiple of the minimum
+#define MIN_CHUNK_SIZE 0x1000 // 4K
+#define MAX_CHUNK_SIZE 0x4000000 // 64M
+
+// The maximum number of threads the copy engine may use
+#define MAX_THREADS 256
+
+// The default and maximum number of chunks kept in flight by io_uring
+#define DEFAULT_QUEUE_DEPTH 16
+#define MAX_QUEUE_DEPTH 1024
+
+// Returned by a copy engine that isn't supported on this system
+#define COPY_UNSUPPORTED -2
+
 // Represents a memory address range
 struct addr_range
 {
@@ -44,6 +58,136 @@ struct addr_range
 struct section 
 {
     uint64_t    physical_base;
+    uint64_t    virtual_base;
     uint64_t    file_offset;
     size_t      size;
+};
+
+// Represents where a section lands in the output file
+struct section_layout
+{
+    uint64_t    header_offset;
+    uint64_t    data_offset;
+};
+
+// The engines that can be used to copy memory to the output
+enum copy_engine
+{
+    ENGINE_SYNC,
+    ENGINE_URING,
+    ENGINE_SPLICE,
+    ENGINE_VECTOR,
+};
+
+struct buffer_pool;
+struct output_format;
+struct priority_list;
+struct stripe_target;
+struct target_list;
+struct tee_output;
+
+// Options that control how a dump is performed
+struct dump_options
+{
+    const char*         kcore_path;
+    const char*         iomem_path;
+    enum copy_engine    engine;
+    const struct output_format* format;
+    struct target_list* targets;
+    struct priority_list* priorities;
+    int                 threads;
+    int                 numa;
+    int                 queue_depth;
+    size_t              chunk_size;
+    int                 direct;
+    int                 sparse;
+    int                 skip_free;
+    int                 compress;
+    const char*         manifest_path;
+    const char*         base_path;
+    const char*         hash_path;
+    const char*         scan_path;
+    const char*         hits_path;
+    const char*         journal_path;
+    int                 journal_interval;
+    int                 resume;
+    uint64_t            max_rate;
+    double              psi_threshold;
+    int                 io_priority;
+    int                 renice;
+    int                 nice;
+    const char*         cpus;
+    size_t              max_memory;
+    int                 streaming;
+    struct tee_output*  tee_outputs;
+    int                 num_tee_outputs;
+    int                 tee_queue_depth;
+    struct stripe_target* stripe_targets;
+    int                 num_stripe_targets;
+    uint64_t            stripe_size;
+    int                 progress;
+    const char*         stats_path;
+    int                 daemon;
+    const char*         listen_path;
+    unsigned int        interval;
+    struct buffer_pool* buffers;
+};
+
+// Statistics gathered while performing a dump
+struct dump_stats
+{
+    uint64_t    bytes_copied;
+    uint64_t    bytes_elided;
+    uint64_t    bytes_unchanged;
+    uint64_t    bytes_free;
+    uint64_t    throttled_ns;
+    uint64_t    backoffs;
+    uint64_t    read_calls;
+    uint64_t    write_calls;
+    uint64_t    bytes_read;
+    uint64_t    bytes_written;
+    uint64_t    signature_hits;
+};
+
+struct page_manifest;
+struct buffer_pool;
+struct dump_metrics;
+struct page_filter;
+struct merkle_tree;
+struct journal;
+struct budget;
+struct scanner;
+
+// The state shared by everything taking part in a dump
+struct dump_context
+{
+    const struct dump_options*  options;
+    struct dump_stats*          stats;
+
+    // The page hashes of this capture, if a manifest was requested
+    struct page_manifest*       manifest;
+
+    // The page hashes of the capture this one is relative to, if any
+    const struct page_manifest* base;
+
+    // The chunk buffers shared by the copy path
+    struct buffer_pool*         buffers;
+
+    // Progress and latency instrumentation for the copy path
+    struct dump_metrics*        metrics;
+
+    // Selects the pages worth capturing, if free pages are being skipped
+    struct page_filter*         filter;
+
+    // The Merkle tree hashed during the copy, if one was requested
+    struct merkle_tree*         merkle;
+
+    // Records how far the dump has durably progressed, if requested
+    struct journal*             journal;
+
+    // Holds the copy to its impact budget, if one was set
+    struct budget*              budget;
+
+    // Searches the copied memory for signatures, if requested
+    struct scanner*             scanner;
 };
\ No newline at end of file
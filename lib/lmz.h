@@ -0,0 +1,60 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+
+#define LMZ_HEADER_MAGIC 0x5A444D4C     // "LMDZ"
+#define LMZ_TRAILER_MAGIC 0x49444D4C    // "LMDI"
+#define LMZ_VERSION 1
+
+#define LMZ_CODEC_ZLIB 1
+
+// The amount of uncompressed data in each block (only the last block may be
+// shorter)
+#define LMZ_BLOCK_SIZE 0x100000 // 1M
+
+// Set in a block's compressed size when the block is stored uncompressed
+#define LMZ_BLOCK_STORED 0x80000000
+
+// The header at the start of a compressed dump
+typedef struct
+{
+    unsigned int magic;         // Always 0x5A444D4C (LMDZ)
+    unsigned int version;       // Format version number
+    unsigned int codec;         // The codec each block is compressed with
+    unsigned int block_size;    // Uncompressed size of each block
+} __attribute__ ((__packed__)) lmz_file_header;
+
+// Locates a single block within a compressed dump
+typedef struct
+{
+    uint64_t offset;            // File offset of the compressed block
+    uint32_t compressed_size;   // Size on disk, possibly with LMZ_BLOCK_STORED
+    uint32_t raw_size;          // Uncompressed size of the block
+} __attribute__ ((__packed__)) lmz_block_entry;
+
+// The trailer at the very end of a compressed dump, after the block index
+typedef struct
+{
+    uint64_t index_offset;      // File offset of the block index
+    uint64_t num_blocks;        // Number of entries in the block index
+    uint64_t raw_size;          // Total uncompressed size
+    unsigned int magic;         // Always 0x49444D4C (LMDI)
+    unsigned int reserved;
+} __attribute__ ((__packed__)) lmz_trailer;
\ No newline at end of file
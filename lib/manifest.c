@@ -0,0 +1,370 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "manifest.h"
+
+#include "color-print.h"
+#include "io.h"
+#include "xxhash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+/**
+ * Allocates an empty manifest with room for the given sections.
+ *
+ * @param num_sections The number of sections
+ *
+ * @return The manifest, else NULL if there's an error
+ */
+static struct page_manifest* manifest_alloc(const int num_sections)
+{
+    struct page_manifest* manifest = calloc(1, sizeof(struct page_manifest));
+    if (NULL == manifest)
+    {
+        return NULL;
+    }
+
+    manifest->num_sections = num_sections;
+    manifest->sections = calloc(num_sections ? num_sections : 1, 
+        sizeof(struct manifest_section));
+    manifest->order = calloc(num_sections ? num_sections : 1, sizeof(int));
+    if (NULL == manifest->sections || NULL == manifest->order)
+    {
+        manifest_free(manifest);
+        return NULL;
+    }
+
+    return manifest;
+}
+
+/**
+ * Assigns each section its first page and orders the sections by address.
+ * The hash array is allocated to hold every page.
+ *
+ * @param manifest The manifest to index
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int manifest_index(struct page_manifest* manifest)
+{
+    manifest->num_pages = 0;
+    for (int i = 0; i < manifest->num_sections; i++)
+    {
+        manifest->sections[i].first_page = manifest->num_pages;
+        manifest->num_pages += (manifest->sections[i].size + 
+            MANIFEST_PAGE_SIZE - 1) / MANIFEST_PAGE_SIZE;
+    }
+
+    // Insertion sort, as sections almost always arrive in address order
+    for (int i = 0; i < manifest->num_sections; i++)
+    {
+        int j = i;
+        while (j > 0 && manifest->sections[manifest->order[j - 1]].physical_base >
+            manifest->sections[i].physical_base)
+        {
+            manifest->order[j] = manifest->order[j - 1];
+            j--;
+        }
+        manifest->order[j] = i;
+    }
+
+    manifest->hashes = calloc(manifest->num_pages ? manifest->num_pages : 1,
+        sizeof(uint64_t));
+    return NULL == manifest->hashes ? -1 : 0;
+}
+
+/**
+ * Creates an empty manifest for the pages of the given sections.
+ *
+ * @param sections     The array of memory sections being captured
+ * @param num_sections The number of memory sections
+ *
+ * @return The manifest, else NULL if there's an error
+ */
+struct page_manifest* manifest_create(const struct section* sections,
+                                      const int num_sections)
+{
+    struct page_manifest* manifest = manifest_alloc(num_sections);
+    if (NULL == manifest)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < num_sections; i++)
+    {
+        manifest->sections[i].physical_base = sections[i].physical_base;
+        manifest->sections[i].size = sections[i].size;
+    }
+
+    if (-1 == manifest_index(manifest))
+    {
+        manifest_free(manifest);
+        return NULL;
+    }
+
+    return manifest;
+}
+
+/**
+ * Loads a manifest written by a previous capture.
+ *
+ * @param path The path of the manifest file
+ *
+ * @return The manifest, else NULL if there's an error
+ */
+struct page_manifest* manifest_load(const char* path)
+{
+    struct page_manifest* manifest = NULL;
+    manifest_file_header header;
+
+    int fd = open64(path, O_RDONLY | O_LARGEFILE);
+    if (-1 == fd)
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        return NULL;
+    }
+
+    if (-1 == read_all(fd, &header, sizeof(header)) ||
+        MANIFEST_MAGIC != header.magic || MANIFEST_VERSION != header.version ||
+        MANIFEST_PAGE_SIZE != header.page_size || 
+        MANIFEST_HASH_XXH64 != header.hash || header.num_sections > INT32_MAX)
+    {
+        fprint_red(stderr, "[-] %s is not a supported manifest\n", path);
+        goto fail;
+    }
+
+    if (NULL == (manifest = manifest_alloc(header.num_sections)))
+    {
+        fprint_red(stderr, "[-] Failed to allocate the manifest\n");
+        goto fail;
+    }
+
+    for (int i = 0; i < manifest->num_sections; i++)
+    {
+        manifest_file_section section;
+        if (-1 == read_all(fd, &section, sizeof(section)))
+        {
+            fprint_red(stderr, "[-] Failed to read the manifest sections\n");
+            goto fail;
+        }
+        manifest->sections[i].physical_base = section.physical_base;
+        manifest->sections[i].size = section.size;
+    }
+
+    if (-1 == manifest_index(manifest) || header.num_pages != manifest->num_pages ||
+        -1 == read_all(fd, manifest->hashes, 
+            manifest->num_pages * sizeof(uint64_t)))
+    {
+        fprint_red(stderr, "[-] Failed to read the manifest hashes\n");
+        goto fail;
+    }
+
+    close(fd);
+    return manifest;
+
+fail:
+    manifest_free(manifest);
+    close(fd);
+    return NULL;
+}
+
+/**
+ * Saves a manifest to disk.
+ *
+ * @param manifest The manifest to save
+ * @param path     The path to save the manifest to
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int manifest_save(const struct page_manifest* manifest, const char* path)
+{
+    int ret = 0;
+    manifest_file_header header = {
+        .magic = MANIFEST_MAGIC,
+        .version = MANIFEST_VERSION,
+        .page_size = MANIFEST_PAGE_SIZE,
+        .hash = MANIFEST_HASH_XXH64,
+        .num_sections = manifest->num_sections,
+        .num_pages = manifest->num_pages,
+    };
+
+    int fd = open64(path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, S_IRUSR);
+    if (-1 == fd)
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        return -1;
+    }
+
+    if (-1 == write_all(fd, &header, sizeof(header)))
+    {
+        ret = -1;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < manifest->num_sections; i++)
+    {
+        manifest_file_section section = {
+            .physical_base = manifest->sections[i].physical_base,
+            .size = manifest->sections[i].size,
+        };
+        if (-1 == write_all(fd, &section, sizeof(section)))
+        {
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (-1 == write_all(fd, manifest->hashes, 
+        manifest->num_pages * sizeof(uint64_t)))
+    {
+        ret = -1;
+    }
+
+cleanup:
+    if (-1 == ret)
+    {
+        fprint_red(stderr, "[-] Failed to write %s (errno %d)\n", path, errno);
+    }
+    close(fd);
+    return ret;
+}
+
+/**
+ * Releases a manifest.
+ *
+ * @param manifest The manifest to release
+ */
+void manifest_free(struct page_manifest* manifest)
+{
+    if (NULL == manifest)
+    {
+        return;
+    }
+
+    free(manifest->sections);
+    free(manifest->order);
+    free(manifest->hashes);
+    free(manifest);
+}
+
+/**
+ * Hashes a single page.
+ *
+ * @param page The page to hash
+ * @param len  The length of the page
+ *
+ * @return The hash of the page
+ */
+uint64_t hash_page(const char* page, const size_t len)
+{
+    return xxh64(page, len, 0);
+}
+
+/**
+ * Records the hashes of the pages in a chunk of a section.
+ *
+ * @param manifest The manifest to record the hashes in
+ * @param section  The index of the section the chunk belongs to
+ * @param offset   The page-aligned offset of the chunk within the section
+ * @param buffer   The contents of the chunk
+ * @param len      The length of the chunk
+ */
+void manifest_hash_pages(struct page_manifest* manifest,
+                         const int section,
+                         const uint64_t offset,
+                         const char* buffer,
+                         const size_t len)
+{
+    uint64_t page = manifest->sections[section].first_page + 
+        offset / MANIFEST_PAGE_SIZE;
+
+    for (size_t pos = 0; pos < len; pos += MANIFEST_PAGE_SIZE, page++)
+    {
+        size_t page_len = len - pos;
+        if (page_len > MANIFEST_PAGE_SIZE)
+        {
+            page_len = MANIFEST_PAGE_SIZE;
+        }
+        manifest->hashes[page] = hash_page(buffer + pos, page_len);
+    }
+}
+
+/**
+ * Finds the recorded hash of a page by its physical address. The page has
+ * to line up exactly with a page of the manifest to be found.
+ *
+ * @param manifest         The manifest to search
+ * @param physical_address The physical address of the page
+ * @param len              The length of the page
+ *
+ * @return The hash of the page, else NULL if the manifest doesn't cover it
+ */
+const uint64_t* manifest_find_page(const struct page_manifest* manifest,
+                                   const uint64_t physical_address,
+                                   const size_t len)
+{
+    // Find the last section starting at or before the address
+    int lo = 0;
+    int hi = manifest->num_sections - 1;
+    int found = -1;
+
+    while (lo <= hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (manifest->sections[manifest->order[mid]].physical_base <= 
+            physical_address)
+        {
+            found = manifest->order[mid];
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    if (-1 == found)
+    {
+        return NULL;
+    }
+
+    const struct manifest_section* s = &manifest->sections[found];
+    uint64_t offset = physical_address - s->physical_base;
+    if (offset % MANIFEST_PAGE_SIZE || offset >= s->size)
+    {
+        return NULL;
+    }
+
+    size_t page_len = s->size - offset;
+    if (page_len > MANIFEST_PAGE_SIZE)
+    {
+        page_len = MANIFEST_PAGE_SIZE;
+    }
+    if (page_len != len)
+    {
+        return NULL;
+    }
+
+    return &manifest->hashes[s->first_page + offset / MANIFEST_PAGE_SIZE];
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "lmat.h"
+
+#define MANIFEST_MAGIC 0x4D444D4C    // "LMDM"
+#define MANIFEST_VERSION 1
+
+#define MANIFEST_HASH_XXH64 1
+
+// The granularity that pages are hashed at
+#define MANIFEST_PAGE_SIZE 0x1000
+
+// The header at the start of a manifest file. It is followed by a table of
+// num_sections manifest_file_section entries and then num_pages hashes.
+typedef struct
+{
+    unsigned int magic;         // Always 0x4D444D4C (LMDM)
+    unsigned int version;       // Format version number
+    unsigned int page_size;     // The size of each hashed page
+    unsigned int hash;          // The hash function used
+    uint64_t num_sections;      // The number of sections captured
+    uint64_t num_pages;         // The total number of page hashes
+} __attribute__ ((__packed__)) manifest_file_header;
+
+// Describes a captured section within a manifest file
+typedef struct
+{
+    uint64_t physical_base;     // Starting address of the section
+    uint64_t size;              // Size of the section
+} __attribute__ ((__packed__)) manifest_file_section;
+
+// A section of a page manifest, along with where its hashes start
+struct manifest_section
+{
+    uint64_t    physical_base;
+    uint64_t    size;
+    uint64_t    first_page;
+};
+
+// The hash of every page in a capture
+struct page_manifest
+{
+    int                         num_sections;
+    struct manifest_section*    sections;
+
+    // Indices into sections, ordered by physical address
+    int*                        order;
+
+    uint64_t                    num_pages;
+    uint64_t*                   hashes;
+};
+
+struct page_manifest* manifest_create(const struct section* sections,
+                                      const int num_sections);
+
+struct page_manifest* manifest_load(const char* path);
+
+int manifest_save(const struct page_manifest* manifest, const char* path);
+
+void manifest_free(struct page_manifest* manifest);
+
+uint64_t hash_page(const char* page, const size_t len);
+
+void manifest_hash_pages(struct page_manifest* manifest,
+                         const int section,
+                         const uint64_t offset,
+                         const char* buffer,
+                         const size_t len);
+
+const uint64_t* manifest_find_page(const struct page_manifest* manifest,
+                                   const uint64_t physical_address,
+                                   const size_t len);
\ No newline at end of file
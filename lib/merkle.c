@@ -0,0 +1,622 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "merkle.h"
+
+#include "buffer.h"
+#include "color-print.h"
+
+#include <errno.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Prefixes that keep leaves, inner nodes and sections from being confused
+#define MERKLE_LEAF_PREFIX 0x00
+#define MERKLE_NODE_PREFIX 0x01
+#define MERKLE_SECTION_PREFIX 0x02
+
+#define LINE_SIZE 256
+
+/**
+ * Hashes a prefix byte followed by up to two pieces of data with SHA-256.
+ *
+ * @param md     The digest context to use
+ * @param prefix The prefix byte
+ * @param a      The first piece of data
+ * @param a_len  The length of the first piece of data
+ * @param b      The second piece of data, or NULL for none
+ * @param b_len  The length of the second piece of data
+ * @param out    The hash (output)
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int hash_prefixed(EVP_MD_CTX* md,
+                         const unsigned char prefix,
+                         const void* a,
+                         const size_t a_len,
+                         const void* b,
+                         const size_t b_len,
+                         unsigned char* out)
+{
+    if (1 != EVP_DigestInit_ex(md, EVP_sha256(), NULL) ||
+        1 != EVP_DigestUpdate(md, &prefix, 1) ||
+        1 != EVP_DigestUpdate(md, a, a_len) ||
+        (NULL != b && 1 != EVP_DigestUpdate(md, b, b_len)) ||
+        1 != EVP_DigestFinal_ex(md, out, NULL))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Reduces a level of hashes to a single root, pairing neighbours until one
+ * is left. An odd hash out is carried up to the next level unchanged.
+ *
+ * @param md     The digest context to use
+ * @param hashes The hashes to reduce, which are overwritten
+ * @param count  The number of hashes
+ * @param out    The root (output)
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int reduce_level(EVP_MD_CTX* md,
+                        unsigned char* hashes,
+                        uint64_t count,
+                        unsigned char* out)
+{
+    if (0 == count)
+    {
+        return hash_prefixed(md, MERKLE_NODE_PREFIX, "", 0, NULL, 0, out);
+    }
+
+    while (count > 1)
+    {
+        uint64_t next = 0;
+        for (uint64_t i = 0; i < count; i += 2)
+        {
+            unsigned char* dest = hashes + next * MERKLE_HASH_SIZE;
+            unsigned char* left = hashes + i * MERKLE_HASH_SIZE;
+            if (i + 1 == count)
+            {
+                memmove(dest, left, MERKLE_HASH_SIZE);
+            }
+            else if (-1 == hash_prefixed(md, MERKLE_NODE_PREFIX, left, 
+                MERKLE_HASH_SIZE, left + MERKLE_HASH_SIZE, MERKLE_HASH_SIZE, 
+                dest))
+            {
+                return -1;
+            }
+            next++;
+        }
+        count = next;
+    }
+
+    memcpy(out, hashes, MERKLE_HASH_SIZE);
+    return 0;
+}
+
+/**
+ * Creates an empty Merkle tree covering the given sections.
+ *
+ * @param sections     The sections to cover
+ * @param num_sections The number of sections
+ *
+ * @return The tree, else NULL if there's an error
+ */
+struct merkle_tree* merkle_create(const struct section* sections,
+                                  const int num_sections)
+{
+    struct merkle_tree* tree = calloc(1, sizeof(struct merkle_tree));
+    if (NULL == tree)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&tree->lock, NULL);
+    pthread_cond_init(&tree->cond, NULL);
+
+    tree->num_sections = num_sections;
+    tree->sections = calloc(num_sections ? num_sections : 1, 
+        sizeof(struct merkle_section));
+    if (NULL == tree->sections)
+    {
+        merkle_free(tree);
+        return NULL;
+    }
+
+    for (int i = 0; i < num_sections; i++)
+    {
+        tree->sections[i].physical_base = sections[i].physical_base;
+        tree->sections[i].size = sections[i].size;
+        tree->sections[i].first_leaf = tree->num_leaves;
+        tree->sections[i].num_leaves = (sections[i].size + MERKLE_LEAF_SIZE - 1) / 
+            MERKLE_LEAF_SIZE;
+        tree->num_leaves += tree->sections[i].num_leaves;
+    }
+
+    tree->leaves = calloc(tree->num_leaves ? tree->num_leaves : 1, 
+        MERKLE_HASH_SIZE);
+    if (NULL == tree->leaves)
+    {
+        merkle_free(tree);
+        return NULL;
+    }
+
+    return tree;
+}
+
+/**
+ * Hashes the leaves held in a chunk of a section. Each leaf is only ever
+ * hashed by one caller, so chunks can be hashed concurrently.
+ *
+ * @param tree    The tree
+ * @param section The section the chunk belongs to
+ * @param offset  The offset of the chunk in the section, a multiple of the
+ *                leaf size
+ * @param data    The contents of the chunk
+ * @param len     The length of the chunk
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int merkle_hash_leaves(struct merkle_tree* tree,
+                       const int section,
+                       const uint64_t offset,
+                       const char* data,
+                       const size_t len)
+{
+    const struct merkle_section* s = &tree->sections[section];
+    int ret = 0;
+
+    EVP_MD_CTX* md = EVP_MD_CTX_new();
+    if (NULL == md)
+    {
+        return -1;
+    }
+
+    for (size_t pos = 0; pos < len; pos += MERKLE_LEAF_SIZE)
+    {
+        uint64_t leaf = s->first_leaf + (offset + pos) / MERKLE_LEAF_SIZE;
+        size_t leaf_len = len - pos < MERKLE_LEAF_SIZE ? len - pos : MERKLE_LEAF_SIZE;
+        if (-1 == hash_prefixed(md, MERKLE_LEAF_PREFIX, data + pos, leaf_len, 
+            NULL, 0, tree->leaves + leaf * MERKLE_HASH_SIZE))
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    EVP_MD_CTX_free(md);
+    return ret;
+}
+
+/**
+ * The entry point for each background hashing thread. Threads take chunks
+ * off the queue until it's empty and the tree is being stopped.
+ *
+ * @param arg The tree
+ *
+ * @return NULL
+ */
+static void* hash_worker(void* arg)
+{
+    struct merkle_tree* tree = (struct merkle_tree*) arg;
+
+    pthread_mutex_lock(&tree->lock);
+    while (1)
+    {
+        while (0 == tree->queue_count && !tree->stopping)
+        {
+            pthread_cond_wait(&tree->cond, &tree->lock);
+        }
+        if (0 == tree->queue_count)
+        {
+            break;
+        }
+
+        struct merkle_job job = tree->queue[tree->queue_head];
+        tree->queue_head = (tree->queue_head + 1) % tree->queue_size;
+        tree->queue_count--;
+        pthread_cond_broadcast(&tree->cond);
+        pthread_mutex_unlock(&tree->lock);
+
+        int ret = merkle_hash_leaves(tree, job.section, job.offset, job.buffer, 
+            job.len);
+        buffer_pool_put(tree->buffers, job.buffer);
+
+        pthread_mutex_lock(&tree->lock);
+        if (-1 == ret)
+        {
+            tree->failed = 1;
+        }
+    }
+    pthread_mutex_unlock(&tree->lock);
+
+    return NULL;
+}
+
+/**
+ * Starts hashing chunks in the background. Until this is called, submitted
+ * chunks are hashed in place.
+ *
+ * @param tree        The tree
+ * @param buffers     The pool that submitted buffers come from
+ * @param num_threads The number of hashing threads to start
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int merkle_start(struct merkle_tree* tree,
+                 struct buffer_pool* buffers,
+                 const int num_threads)
+{
+    // A queued chunk always holds a buffer, so the queue can never overflow
+    tree->buffers = buffers;
+    tree->queue_size = buffers->num_buffers;
+    tree->queue = calloc(tree->queue_size, sizeof(struct merkle_job));
+    if (NULL == tree->queue)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < num_threads && i < MAX_HASH_THREADS; i++)
+    {
+        if (0 != pthread_create(&tree->threads[i], NULL, hash_worker, tree))
+        {
+            fprint_red(stderr, "[-] Failed to start hashing thread %d\n", i);
+            break;
+        }
+        tree->num_threads++;
+    }
+
+    return 0 == tree->num_threads ? -1 : 0;
+}
+
+/**
+ * Hands a chunk over to be hashed. When hashing in the background the
+ * buffer goes with it, and another buffer is taken from the pool in its
+ * place.
+ *
+ * @param tree    The tree
+ * @param section The section the chunk belongs to
+ * @param offset  The offset of the chunk in the section
+ * @param buffer  The buffer holding the chunk
+ * @param len     The length of the chunk
+ *
+ * @return The buffer to carry on with, else NULL if there's an error
+ */
+char* merkle_submit(struct merkle_tree* tree,
+                    const int section,
+                    const uint64_t offset,
+                    char* buffer,
+                    const size_t len)
+{
+    if (0 == tree->num_threads)
+    {
+        return -1 == merkle_hash_leaves(tree, section, offset, buffer, len) ? 
+            NULL : buffer;
+    }
+
+    pthread_mutex_lock(&tree->lock);
+    while (tree->queue_count == tree->queue_size)
+    {
+        pthread_cond_wait(&tree->cond, &tree->lock);
+    }
+    tree->queue[(tree->queue_head + tree->queue_count) % tree->queue_size] = 
+        (struct merkle_job) {
+            .section = section,
+            .offset = offset,
+            .buffer = buffer,
+            .len = len,
+        };
+    tree->queue_count++;
+    pthread_cond_broadcast(&tree->cond);
+    pthread_mutex_unlock(&tree->lock);
+
+    return buffer_pool_wait(tree->buffers);
+}
+
+/**
+ * Waits for every queued chunk to be hashed and stops the background
+ * hashing threads.
+ *
+ * @param tree The tree
+ *
+ * @return 0 for success, else -1 if a chunk couldn't be hashed
+ */
+int merkle_stop(struct merkle_tree* tree)
+{
+    pthread_mutex_lock(&tree->lock);
+    tree->stopping = 1;
+    pthread_cond_broadcast(&tree->cond);
+    pthread_mutex_unlock(&tree->lock);
+
+    for (int i = 0; i < tree->num_threads; i++)
+    {
+        pthread_join(tree->threads[i], NULL);
+    }
+    tree->num_threads = 0;
+
+    return tree->failed ? -1 : 0;
+}
+
+/**
+ * Computes the hash of each section from its leaves, and the root of the
+ * whole tree from the section hashes. Each section hash also covers the
+ * section's address and size.
+ *
+ * @param tree The tree, whose leaves must all have been hashed
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int merkle_compute_root(struct merkle_tree* tree)
+{
+    int ret = -1;
+    unsigned char subtree[MERKLE_HASH_SIZE];
+
+    EVP_MD_CTX* md = EVP_MD_CTX_new();
+    unsigned char* level = malloc((tree->num_leaves > tree->num_sections ? 
+        tree->num_leaves : tree->num_sections) * MERKLE_HASH_SIZE + 1);
+    if (NULL == md || NULL == level)
+    {
+        goto cleanup;
+    }
+
+    for (int i = 0; i < tree->num_sections; i++)
+    {
+        struct merkle_section* s = &tree->sections[i];
+        uint64_t bounds[2] = { s->physical_base, s->size };
+
+        memcpy(level, tree->leaves + s->first_leaf * MERKLE_HASH_SIZE,
+            s->num_leaves * MERKLE_HASH_SIZE);
+        if (-1 == reduce_level(md, level, s->num_leaves, subtree) ||
+            -1 == hash_prefixed(md, MERKLE_SECTION_PREFIX, bounds, 
+                sizeof(bounds), subtree, sizeof(subtree), s->hash))
+        {
+            goto cleanup;
+        }
+    }
+
+    for (int i = 0; i < tree->num_sections; i++)
+    {
+        memcpy(level + i * MERKLE_HASH_SIZE, tree->sections[i].hash, 
+            MERKLE_HASH_SIZE);
+    }
+    ret = reduce_level(md, level, tree->num_sections, tree->root);
+
+cleanup:
+    free(level);
+    EVP_MD_CTX_free(md);
+    return ret;
+}
+
+/**
+ * Formats a hash as lowercase hex.
+ *
+ * @param hash The hash to format
+ * @param text The hex text, which holds 2 * MERKLE_HASH_SIZE + 1 characters
+ *             (output)
+ */
+void merkle_format_hash(const unsigned char* hash, char* text)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < MERKLE_HASH_SIZE; i++)
+    {
+        text[2 * i] = digits[hash[i] >> 4];
+        text[2 * i + 1] = digits[hash[i] & 0xf];
+    }
+    text[2 * MERKLE_HASH_SIZE] = '\0';
+}
+
+/**
+ * Parses a hash formatted as hex.
+ *
+ * @param text The hex text
+ * @param hash The hash (output)
+ *
+ * @return 0 for success, else -1 if the text isn't a hash
+ */
+static int parse_hash(const char* text, unsigned char* hash)
+{
+    for (int i = 0; i < MERKLE_HASH_SIZE; i++)
+    {
+        unsigned int byte;
+        if (1 != sscanf(text + 2 * i, "%2x", &byte))
+        {
+            return -1;
+        }
+        hash[i] = byte;
+    }
+
+    return 0;
+}
+
+/**
+ * Saves the section hashes and root of a tree as text, so that they can be
+ * recorded alongside the dump and checked by hand.
+ *
+ * @param tree The tree, whose root must have been computed
+ * @param path The path to save the hashes to
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int merkle_save(const struct merkle_tree* tree, const char* path)
+{
+    char text[2 * MERKLE_HASH_SIZE + 1];
+
+    FILE* file = fopen(path, "w");
+    if (NULL == file)
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        return -1;
+    }
+
+    fprintf(file, "%s %d\n", MERKLE_FILE_MAGIC, MERKLE_FILE_VERSION);
+    fprintf(file, "leaf-size 0x%x\n", MERKLE_LEAF_SIZE);
+    for (int i = 0; i < tree->num_sections; i++)
+    {
+        merkle_format_hash(tree->sections[i].hash, text);
+        fprintf(file, "section 0x%lx 0x%lx %s\n", tree->sections[i].physical_base,
+            tree->sections[i].size, text);
+    }
+    merkle_format_hash(tree->root, text);
+    fprintf(file, "root %s\n", text);
+
+    if (0 != fclose(file))
+    {
+        fprint_red(stderr, "[-] Failed to write %s (errno %d)\n", path, errno);
+        return -1;
+    }
+
+    print_green("[+] Wrote the hashes to %s (root %s)\n", path, text);
+    return 0;
+}
+
+/**
+ * Loads the section hashes and root saved by merkle_save(). The leaves are
+ * left empty, ready to be hashed again for verification.
+ *
+ * @param path The path to load the hashes from
+ *
+ * @return The tree, else NULL if there's an error
+ */
+struct merkle_tree* merkle_load(const char* path)
+{
+    struct merkle_tree* tree = NULL;
+    struct section* sections = NULL;
+    unsigned char* hashes = NULL;
+    unsigned char root[MERKLE_HASH_SIZE];
+    int num_sections = 0, capacity = 0, have_root = 0;
+    unsigned int version = 0, leaf_size = 0;
+    char line[LINE_SIZE];
+    char text[LINE_SIZE];
+
+    FILE* file = fopen(path, "r");
+    if (NULL == file)
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        return NULL;
+    }
+
+    if (NULL == fgets(line, sizeof(line), file) || 
+        0 != strncmp(line, MERKLE_FILE_MAGIC " ", sizeof(MERKLE_FILE_MAGIC)) ||
+        1 != sscanf(line + sizeof(MERKLE_FILE_MAGIC), "%u", &version) ||
+        MERKLE_FILE_VERSION != version)
+    {
+        fprint_red(stderr, "[-] %s isn't a hash file\n", path);
+        goto cleanup;
+    }
+
+    while (NULL != fgets(line, sizeof(line), file))
+    {
+        uint64_t base, size;
+        if (1 == sscanf(line, "leaf-size %x", &leaf_size))
+        {
+            continue;
+        }
+
+        if (3 == sscanf(line, "section %lx %lx %255s", &base, &size, text))
+        {
+            if (num_sections == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 64;
+                struct section* s = realloc(sections, 
+                    capacity * sizeof(struct section));
+                unsigned char* h = realloc(hashes, capacity * MERKLE_HASH_SIZE);
+                if (NULL != s)
+                {
+                    sections = s;
+                }
+                if (NULL != h)
+                {
+                    hashes = h;
+                }
+                if (NULL == s || NULL == h)
+                {
+                    fprint_red(stderr, "[-] Failed to allocate the hashes\n");
+                    goto cleanup;
+                }
+            }
+
+            memset(&sections[num_sections], 0x00, sizeof(struct section));
+            sections[num_sections].physical_base = base;
+            sections[num_sections].size = size;
+            if (0 == size || 
+                -1 == parse_hash(text, hashes + num_sections * MERKLE_HASH_SIZE))
+            {
+                fprint_red(stderr, "[-] Invalid section in %s\n", path);
+                goto cleanup;
+            }
+            num_sections++;
+        }
+        else if (1 == sscanf(line, "root %255s", text) && 
+            0 == parse_hash(text, root))
+        {
+            have_root = 1;
+        }
+    }
+
+    if (MERKLE_LEAF_SIZE != leaf_size || !have_root)
+    {
+        fprint_red(stderr, "[-] %s is incomplete or uses another leaf size\n", 
+            path);
+        goto cleanup;
+    }
+
+    if (NULL == (tree = merkle_create(sections, num_sections)))
+    {
+        fprint_red(stderr, "[-] Failed to allocate the hashes\n");
+        goto cleanup;
+    }
+
+    for (int i = 0; i < num_sections; i++)
+    {
+        memcpy(tree->sections[i].hash, hashes + i * MERKLE_HASH_SIZE, 
+            MERKLE_HASH_SIZE);
+    }
+    memcpy(tree->root, root, MERKLE_HASH_SIZE);
+
+cleanup:
+    fclose(file);
+    free(sections);
+    free(hashes);
+    return tree;
+}
+
+/**
+ * Releases a Merkle tree. Any background hashing must have been stopped.
+ *
+ * @param tree The tree to release
+ */
+void merkle_free(struct merkle_tree* tree)
+{
+    if (NULL == tree)
+    {
+        return;
+    }
+
+    free(tree->queue);
+    free(tree->leaves);
+    free(tree->sections);
+    pthread_mutex_destroy(&tree->lock);
+    pthread_cond_destroy(&tree->cond);
+    free(tree);
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+
+#include "lmat.h"
+
+#include <pthread.h>
+
+// Each section is split into leaves of this size, the last of which may be
+// shorter. The chunk size must be a multiple of it when hashing.
+#define MERKLE_LEAF_SIZE 0x100000 // 1M
+
+// The size of a SHA-256 hash
+#define MERKLE_HASH_SIZE 32
+
+// The most threads that will hash in the background
+#define MAX_HASH_THREADS 16
+
+// The first line of a hash file
+#define MERKLE_FILE_MAGIC "LMAT-MERKLE-SHA256"
+#define MERKLE_FILE_VERSION 1
+
+// A section of a Merkle tree, along with where its leaves start
+struct merkle_section
+{
+    uint64_t        physical_base;
+    uint64_t        size;
+    uint64_t        first_leaf;
+    uint64_t        num_leaves;
+
+    // The root of the section's leaves, bound to its address and size
+    unsigned char   hash[MERKLE_HASH_SIZE];
+};
+
+// A chunk waiting to be hashed, along with the buffer it's held in
+struct merkle_job
+{
+    int             section;
+    uint64_t        offset;
+    char*           buffer;
+    size_t          len;
+};
+
+struct buffer_pool;
+
+// A SHA-256 Merkle tree over the contents of every section. Leaves can be
+// hashed in any order, either directly or by a pool of background threads.
+struct merkle_tree
+{
+    int                     num_sections;
+    struct merkle_section*  sections;
+
+    uint64_t                num_leaves;
+    unsigned char*          leaves;
+
+    unsigned char           root[MERKLE_HASH_SIZE];
+
+    // The background hashing threads and the chunks queued for them. The
+    // buffers of finished chunks go back to the pool.
+    struct buffer_pool*     buffers;
+    pthread_t               threads[MAX_HASH_THREADS];
+    int                     num_threads;
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    struct merkle_job*      queue;
+    int                     queue_size;
+    int                     queue_head;
+    int                     queue_count;
+    int                     stopping;
+    int                     failed;
+};
+
+struct merkle_tree* merkle_create(const struct section* sections,
+                                  const int num_sections);
+
+int merkle_hash_leaves(struct merkle_tree* tree,
+                       const int section,
+                       const uint64_t offset,
+                       const char* data,
+                       const size_t len);
+
+int merkle_start(struct merkle_tree* tree,
+                 struct buffer_pool* buffers,
+                 const int num_threads);
+
+char* merkle_submit(struct merkle_tree* tree,
+                    const int section,
+                    const uint64_t offset,
+                    char* buffer,
+                    const size_t len);
+
+int merkle_stop(struct merkle_tree* tree);
+
+int merkle_compute_root(struct merkle_tree* tree);
+
+int merkle_save(const struct merkle_tree* tree, const char* path);
+
+struct merkle_tree* merkle_load(const char* path);
+
+void merkle_format_hash(const unsigned char* hash, char* text);
+
+void merkle_free(struct merkle_tree* tree);
\ No newline at end of file
@@ -0,0 +1,559 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "metrics.h"
+
+#include "color-print.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* engine_names[] = {
+    "sync",
+    "uring",
+    "splice",
+    "vector",
+};
+
+/**
+ * Gets the current time in nanoseconds.
+ *
+ * @return The time from the monotonic clock
+ */
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Reads the process's I/O system call counters.
+ *
+ * @param counters The counters (output)
+ *
+ * @return 0 for success, else -1 if the kernel doesn't keep count
+ */
+static int read_io_counters(struct io_counters* counters)
+{
+    char name[32];
+    uint64_t value;
+    int found = 0;
+
+    FILE* f = fopen(PROC_IO_FILENAME, "r");
+    if (NULL == f)
+    {
+        return -1;
+    }
+
+    while (2 == fscanf(f, "%31[^:]: %lu\n", name, &value))
+    {
+        if (0 == strcmp(name, "rchar"))
+        {
+            counters->bytes_read = value;
+            found++;
+        }
+        else if (0 == strcmp(name, "wchar"))
+        {
+            counters->bytes_written = value;
+            found++;
+        }
+        else if (0 == strcmp(name, "syscr"))
+        {
+            counters->read_calls = value;
+            found++;
+        }
+        else if (0 == strcmp(name, "syscw"))
+        {
+            counters->write_calls = value;
+            found++;
+        }
+    }
+
+    fclose(f);
+    return 4 == found ? 0 : -1;
+}
+
+/**
+ * Creates the instrumentation for a dump, starting its clock.
+ *
+ * @param sections     The sections being dumped
+ * @param num_sections The number of sections being dumped
+ *
+ * @return The metrics, else NULL if there's an error
+ */
+struct dump_metrics* metrics_create(const struct section* sections, 
+                                    const int num_sections)
+{
+    struct dump_metrics* metrics = calloc(1, sizeof(struct dump_metrics));
+    if (NULL == metrics)
+    {
+        return NULL;
+    }
+
+    metrics->sections = calloc(num_sections > 0 ? num_sections : 1, 
+        sizeof(struct section_metrics));
+    if (NULL == metrics->sections)
+    {
+        free(metrics);
+        return NULL;
+    }
+
+    metrics->num_sections = num_sections;
+    for (int i = 0; i < num_sections; i++)
+    {
+        metrics->sections[i].physical_base = sections[i].physical_base;
+        metrics->sections[i].size = sections[i].size;
+        metrics->total_size += sections[i].size;
+    }
+
+    pthread_mutex_init(&metrics->lock, NULL);
+    pthread_cond_init(&metrics->cond, NULL);
+    metrics->io_counted = 0 == read_io_counters(&metrics->io);
+    metrics->start_ns = metrics_now();
+    return metrics;
+}
+
+/**
+ * Formats a number of seconds as minutes and seconds, or hours, minutes and
+ * seconds if it's long enough.
+ *
+ * @param seconds The number of seconds
+ * @param out     The buffer to format into
+ * @param len     The size of the buffer
+ */
+static void format_duration(const uint64_t seconds, char* out, const size_t len)
+{
+    if (seconds >= 3600)
+    {
+        snprintf(out, len, "%lu:%02lu:%02lu", seconds / 3600, 
+            (seconds / 60) % 60, seconds % 60);
+    }
+    else
+    {
+        snprintf(out, len, "%lu:%02lu", seconds / 60, seconds % 60);
+    }
+}
+
+/**
+ * The entry point for the progress thread. Every interval it prints how much
+ * has been copied, the rate over the last interval and an estimate of the
+ * time remaining based on the average rate so far.
+ *
+ * @param arg The metrics
+ *
+ * @return NULL
+ */
+static void* progress_thread(void* arg)
+{
+    struct dump_metrics* metrics = (struct dump_metrics*) arg;
+    int tty = isatty(STDOUT_FILENO);
+    uint64_t last_bytes = 0;
+    uint64_t last_ns = metrics->start_ns;
+
+    pthread_mutex_lock(&metrics->lock);
+    while (!metrics->stopping)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += PROGRESS_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (PROGRESS_INTERVAL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        if (ETIMEDOUT != pthread_cond_timedwait(&metrics->cond, &metrics->lock, 
+            &deadline))
+        {
+            continue;
+        }
+
+        uint64_t now = metrics_now();
+        uint64_t bytes = __atomic_load_n(&metrics->bytes, __ATOMIC_RELAXED);
+        double rate = (bytes - last_bytes) / ((now - last_ns) / 1e9);
+        double average = bytes / ((now - metrics->start_ns) / 1e9);
+        char eta[32] = "?";
+        if (average > 0)
+        {
+            format_duration((metrics->total_size - bytes) / average, eta, 
+                sizeof(eta));
+        }
+
+        print_cyan("%s\t[*] %5.1f%% (0x%lx of 0x%lx bytes) at %.2f GB/s, ETA %s%s",
+            tty ? "\r" : "", metrics->total_size ? 
+                100.0 * bytes / metrics->total_size : 100.0,
+            bytes, metrics->total_size, rate / 1e9, eta, tty ? "\033[K" : "\n");
+        fflush(stdout);
+
+        last_bytes = bytes;
+        last_ns = now;
+    }
+    pthread_mutex_unlock(&metrics->lock);
+
+    if (tty && last_bytes)
+    {
+        printf("\n");
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts printing a progress line for the dump.
+ *
+ * @param metrics The metrics of the dump
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int metrics_start_progress(struct dump_metrics* metrics)
+{
+    if (0 != pthread_create(&metrics->thread, NULL, progress_thread, metrics))
+    {
+        return -1;
+    }
+
+    metrics->progress = 1;
+    return 0;
+}
+
+/**
+ * Adds a latency to a histogram.
+ *
+ * @param histogram The histogram to add to
+ * @param address   The physical address of the chunk
+ * @param ns        The latency in nanoseconds
+ */
+static void histogram_add(struct latency_histogram* histogram,
+                          const uint64_t address,
+                          const uint64_t ns)
+{
+    int bucket = 0;
+    for (uint64_t us = ns / 1000; us > 0 && bucket < LATENCY_BUCKETS - 1; us >>= 1)
+    {
+        bucket++;
+    }
+
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->total_ns, ns, __ATOMIC_RELAXED);
+
+    // Remember where the slowest chunk was, to help track down stalls
+    uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+    while (ns > max)
+    {
+        if (__atomic_compare_exchange_n(&histogram->max_ns, &max, ns, 0,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&histogram->max_address, address, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+}
+
+/**
+ * Records the span of time a section was being copied over.
+ *
+ * @param s        The section
+ * @param start_ns When a chunk of the section started
+ * @param end_ns   When the chunk finished
+ */
+static void section_add_span(struct section_metrics* s,
+                             const uint64_t start_ns,
+                             const uint64_t end_ns)
+{
+    uint64_t first = __atomic_load_n(&s->first_ns, __ATOMIC_RELAXED);
+    while ((0 == first || start_ns < first) &&
+        !__atomic_compare_exchange_n(&s->first_ns, &first, start_ns, 0,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+
+    uint64_t last = __atomic_load_n(&s->last_ns, __ATOMIC_RELAXED);
+    while (end_ns > last &&
+        !__atomic_compare_exchange_n(&s->last_ns, &last, end_ns, 0,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/**
+ * Records a chunk being read from kcore.
+ *
+ * @param metrics  The metrics of the dump
+ * @param section  The index of the section the chunk belongs to
+ * @param address  The physical address of the chunk
+ * @param start_ns When the read started
+ * @param end_ns   When the read finished
+ */
+void metrics_record_read(struct dump_metrics* metrics,
+                         const int section,
+                         const uint64_t address,
+                         const uint64_t start_ns,
+                         const uint64_t end_ns)
+{
+    struct section_metrics* s = &metrics->sections[section];
+
+    histogram_add(&s->reads, address, end_ns - start_ns);
+    section_add_span(s, start_ns, end_ns);
+}
+
+/**
+ * Records a chunk being written to the output, which completes it.
+ *
+ * @param metrics  The metrics of the dump
+ * @param section  The index of the section the chunk belongs to
+ * @param address  The physical address of the chunk
+ * @param start_ns When the write started
+ * @param end_ns   When the write finished
+ * @param bytes    The size of the chunk
+ */
+void metrics_record_write(struct dump_metrics* metrics,
+                          const int section,
+                          const uint64_t address,
+                          const uint64_t start_ns,
+                          const uint64_t end_ns,
+                          const uint64_t bytes)
+{
+    struct section_metrics* s = &metrics->sections[section];
+
+    histogram_add(&s->writes, address, end_ns - start_ns);
+    section_add_span(s, start_ns, end_ns);
+    __atomic_fetch_add(&s->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Stops the clock on a dump, along with the progress line if there is one.
+ *
+ * @param metrics The metrics of the dump
+ */
+void metrics_stop(struct dump_metrics* metrics)
+{
+    if (0 == metrics->end_ns)
+    {
+        struct io_counters io;
+
+        metrics->end_ns = metrics_now();
+        metrics->io_counted &= 0 == read_io_counters(&io);
+        if (metrics->io_counted)
+        {
+            metrics->io.read_calls = io.read_calls - metrics->io.read_calls;
+            metrics->io.write_calls = io.write_calls - metrics->io.write_calls;
+            metrics->io.bytes_read = io.bytes_read - metrics->io.bytes_read;
+            metrics->io.bytes_written = io.bytes_written - 
+                metrics->io.bytes_written;
+        }
+    }
+
+    if (metrics->progress)
+    {
+        pthread_mutex_lock(&metrics->lock);
+        metrics->stopping = 1;
+        pthread_cond_signal(&metrics->cond);
+        pthread_mutex_unlock(&metrics->lock);
+
+        pthread_join(metrics->thread, NULL);
+        metrics->progress = 0;
+    }
+}
+
+/**
+ * Finds the latency that a given fraction of operations completed within,
+ * to the resolution of the histogram.
+ *
+ * @param histogram The histogram
+ * @param fraction  The fraction of operations, such as 0.99
+ *
+ * @return The upper bound of the bucket holding the percentile, in
+ *         microseconds
+ */
+static uint64_t histogram_percentile(const struct latency_histogram* histogram,
+                                     const double fraction)
+{
+    uint64_t seen = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= fraction * histogram->count)
+        {
+            return 1ULL << i;
+        }
+    }
+
+    return 1ULL << (LATENCY_BUCKETS - 1);
+}
+
+/**
+ * Prints the throughput and latencies of each section.
+ *
+ * @param metrics The metrics of the dump
+ */
+void metrics_print_summary(const struct dump_metrics* metrics)
+{
+    for (int i = 0; i < metrics->num_sections; i++)
+    {
+        const struct section_metrics* s = &metrics->sections[i];
+        double seconds = (s->last_ns - s->first_ns) / 1e9;
+
+        print_cyan("\t[*] Section %d: 0x%lx bytes in %.2fs (%.2f GB/s)\n", i, 
+            s->bytes, seconds, seconds > 0 ? s->bytes / seconds / 1e9 : 0.0);
+
+        if (s->reads.count)
+        {
+            print_cyan("\t    reads: p50 < %lu us, p99 < %lu us, max %lu us at 0x%lx\n",
+                histogram_percentile(&s->reads, 0.5), 
+                histogram_percentile(&s->reads, 0.99),
+                s->reads.max_ns / 1000, s->reads.max_address);
+        }
+        if (s->writes.count)
+        {
+            print_cyan("\t    writes: p50 < %lu us, p99 < %lu us, max %lu us at 0x%lx\n",
+                histogram_percentile(&s->writes, 0.5), 
+                histogram_percentile(&s->writes, 0.99),
+                s->writes.max_ns / 1000, s->writes.max_address);
+        }
+    }
+}
+
+/**
+ * Writes a latency histogram as a JSON object.
+ *
+ * @param f         The file to write to
+ * @param name      The name of the object
+ * @param histogram The histogram to write
+ */
+static void write_histogram_json(FILE* f, 
+                                 const char* name,
+                                 const struct latency_histogram* histogram)
+{
+    fprintf(f, "      \"%s\": {\n", name);
+    fprintf(f, "        \"count\": %lu,\n", histogram->count);
+    fprintf(f, "        \"total_us\": %lu,\n", histogram->total_ns / 1000);
+    fprintf(f, "        \"max_us\": %lu,\n", histogram->max_ns / 1000);
+    fprintf(f, "        \"max_address\": %lu,\n", histogram->max_address);
+    fprintf(f, "        \"buckets\": [");
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        fprintf(f, "%s%lu", i ? ", " : "", histogram->buckets[i]);
+    }
+    fprintf(f, "]\n");
+    fprintf(f, "      }");
+}
+
+/**
+ * Saves the metrics of a dump as JSON.
+ *
+ * @param metrics The metrics of the dump
+ * @param options The options the dump was performed with
+ * @param path    The path to save the metrics to
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int metrics_save_json(const struct dump_metrics* metrics,
+                      const struct dump_options* options,
+                      const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (NULL == f)
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        return -1;
+    }
+
+    double seconds = (metrics->end_ns - metrics->start_ns) / 1e9;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"engine\": \"%s\",\n", engine_names[options->engine]);
+    fprintf(f, "  \"threads\": %d,\n", options->threads);
+    fprintf(f, "  \"chunk_size\": %lu,\n", options->chunk_size);
+    fprintf(f, "  \"seconds\": %.6f,\n", seconds);
+    fprintf(f, "  \"bytes\": %lu,\n", metrics->bytes);
+    fprintf(f, "  \"bytes_per_second\": %.0f,\n", 
+        seconds > 0 ? metrics->bytes / seconds : 0.0);
+    if (metrics->io_counted)
+    {
+        fprintf(f, "  \"read_calls\": %lu,\n", metrics->io.read_calls);
+        fprintf(f, "  \"write_calls\": %lu,\n", metrics->io.write_calls);
+        fprintf(f, "  \"bytes_read\": %lu,\n", metrics->io.bytes_read);
+        fprintf(f, "  \"bytes_written\": %lu,\n", metrics->io.bytes_written);
+    }
+    fprintf(f, "  \"latency_bucket_limits_us\": [");
+    for (int i = 0; i < LATENCY_BUCKETS - 1; i++)
+    {
+        fprintf(f, "%s%llu", i ? ", " : "", 1ULL << i);
+    }
+    fprintf(f, ", null],\n");
+    fprintf(f, "  \"sections\": [\n");
+
+    for (int i = 0; i < metrics->num_sections; i++)
+    {
+        const struct section_metrics* s = &metrics->sections[i];
+        double section_seconds = (s->last_ns - s->first_ns) / 1e9;
+
+        fprintf(f, "    {\n");
+        fprintf(f, "      \"physical_base\": %lu,\n", s->physical_base);
+        fprintf(f, "      \"size\": %lu,\n", s->size);
+        fprintf(f, "      \"bytes\": %lu,\n", s->bytes);
+        fprintf(f, "      \"seconds\": %.6f,\n", section_seconds);
+        fprintf(f, "      \"bytes_per_second\": %.0f,\n", 
+            section_seconds > 0 ? s->bytes / section_seconds : 0.0);
+        write_histogram_json(f, "reads", &s->reads);
+        fprintf(f, ",\n");
+        write_histogram_json(f, "writes", &s->writes);
+        fprintf(f, "\n    }%s\n", i + 1 < metrics->num_sections ? "," : "");
+    }
+
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+
+    if (0 != fclose(f))
+    {
+        fprint_red(stderr, "[-] Failed to write %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Releases the metrics of a dump, stopping the progress line if it's still
+ * running.
+ *
+ * @param metrics The metrics to release
+ */
+void metrics_free(struct dump_metrics* metrics)
+{
+    if (NULL == metrics)
+    {
+        return;
+    }
+
+    metrics_stop(metrics);
+    pthread_mutex_destroy(&metrics->lock);
+    pthread_cond_destroy(&metrics->cond);
+    free(metrics->sections);
+    free(metrics);
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lmat.h"
+
+#include <pthread.h>
+
+// The number of buckets in a latency histogram. Bucket i counts latencies
+// under 2^i microseconds, and the last bucket counts everything slower.
+#define LATENCY_BUCKETS 24
+
+// How often the progress line is refreshed, in milliseconds
+#define PROGRESS_INTERVAL_MS 1000
+
+// The latencies of one kind of operation
+struct latency_histogram
+{
+    uint64_t    count;
+    uint64_t    total_ns;
+    uint64_t    max_ns;
+    uint64_t    max_address;
+    uint64_t    buckets[LATENCY_BUCKETS];
+};
+
+// The file the kernel counts each process's I/O system calls in
+#define PROC_IO_FILENAME "/proc/self/io"
+
+// The read and write system calls made by the whole process, and the bytes
+// they moved
+struct io_counters
+{
+    uint64_t    read_calls;
+    uint64_t    write_calls;
+    uint64_t    bytes_read;
+    uint64_t    bytes_written;
+};
+
+// What happened while copying a single section
+struct section_metrics
+{
+    uint64_t                    physical_base;
+    uint64_t                    size;
+    uint64_t                    bytes;
+    uint64_t                    first_ns;
+    uint64_t                    last_ns;
+    struct latency_histogram    reads;
+    struct latency_histogram    writes;
+};
+
+// Instrumentation for a whole dump. Chunks may be recorded from any thread.
+struct dump_metrics
+{
+    int                     num_sections;
+    struct section_metrics* sections;
+
+    uint64_t                total_size;
+    uint64_t                bytes;
+    uint64_t                start_ns;
+    uint64_t                end_ns;
+
+    // The system calls made while the clock was running, which are only
+    // known if the kernel keeps count
+    struct io_counters      io;
+    int                     io_counted;
+
+    // The thread that prints the progress line, if one was started
+    int                     progress;
+    pthread_t               thread;
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    int                     stopping;
+};
+
+uint64_t metrics_now(void);
+
+struct dump_metrics* metrics_create(const struct section* sections, 
+                                    const int num_sections);
+
+int metrics_start_progress(struct dump_metrics* metrics);
+
+void metrics_record_read(struct dump_metrics* metrics,
+                         const int section,
+                         const uint64_t address,
+                         const uint64_t start_ns,
+                         const uint64_t end_ns);
+
+void metrics_record_write(struct dump_metrics* metrics,
+                          const int section,
+                          const uint64_t address,
+                          const uint64_t start_ns,
+                          const uint64_t end_ns,
+                          const uint64_t bytes);
+
+void metrics_stop(struct dump_metrics* metrics);
+
+void metrics_print_summary(const struct dump_metrics* metrics);
+
+int metrics_save_json(const struct dump_metrics* metrics,
+                      const struct dump_options* options,
+                      const char* path);
+
+void metrics_free(struct dump_metrics* metrics);
\ No newline at end of file
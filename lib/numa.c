@@ -0,0 +1,327 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "numa.h"
+
+#include "budget.h"
+#include "color-print.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// mbind has no wrapper in glibc
+#define MPOL_PREFERRED 1
+#define MPOL_MF_MOVE (1 << 1)
+#define MAX_NUMA_NODES 1024
+
+/**
+ * Reads a small sysfs file into a string, without its trailing newline.
+ * 
+ * @param path The path of the file
+ * @param text The contents of the file (output)
+ * @param len  The size of text
+ * 
+ * @return 0 for success, else -1 if the file can't be read
+ */
+static int read_sysfs(const char* path, char* text, const size_t len)
+{
+    int fd = open(path, O_RDONLY);
+    if (-1 == fd)
+    {
+        return -1;
+    }
+
+    ssize_t n = read(fd, text, len - 1);
+    close(fd);
+    if (n < 0)
+    {
+        return -1;
+    }
+
+    text[n] = '\0';
+    text[strcspn(text, "\n")] = '\0';
+    return 0;
+}
+
+/**
+ * Orders NUMA ranges by address.
+ * 
+ * @param a The first range
+ * @param b The second range
+ * 
+ * @return Less than, equal to or greater than zero as a sorts before, with
+ *         or after b
+ */
+static int compare_ranges(const void* a, const void* b)
+{
+    const struct numa_range* ra = (const struct numa_range*) a;
+    const struct numa_range* rb = (const struct numa_range*) b;
+
+    if (ra->start != rb->start)
+    {
+        return ra->start < rb->start ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Adds the memory blocks that belong to a node to the topology.
+ * 
+ * @param topology   The topology being built
+ * @param node       The index of the node in the topology
+ * @param path       The node's sysfs directory
+ * @param block_size The size of a memory block
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int load_node_memory(struct numa_topology* topology,
+                            const int node,
+                            const char* path,
+                            const uint64_t block_size)
+{
+    DIR* dir = opendir(path);
+    if (NULL == dir)
+    {
+        return -1;
+    }
+
+    struct dirent* entry;
+    while (NULL != (entry = readdir(dir)))
+    {
+        uint64_t block;
+        char extra;
+        if (1 != sscanf(entry->d_name, "memory%lu%c", &block, &extra))
+        {
+            continue;
+        }
+
+        struct numa_range* ranges = realloc(topology->ranges, 
+            (topology->num_ranges + 1) * sizeof(struct numa_range));
+        if (NULL == ranges)
+        {
+            closedir(dir);
+            return -1;
+        }
+        topology->ranges = ranges;
+        ranges[topology->num_ranges].start = block * block_size;
+        ranges[topology->num_ranges].end = (block + 1) * block_size;
+        ranges[topology->num_ranges].node = node;
+        topology->num_ranges++;
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+/**
+ * Works out which NUMA node owns each memory block, and which CPUs we may
+ * use on each node. Nodes without any memory are left out.
+ * 
+ * @param topology The topology (output)
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+int numa_load(struct numa_topology* topology)
+{
+    char path[512];
+    char text[4096];
+    cpu_set_t allowed;
+
+    memset(topology, 0, sizeof(*topology));
+
+    if (-1 == read_sysfs(MEMORY_BLOCK_SIZE_FILENAME, text, sizeof(text)))
+    {
+        fprint_red(stderr, "[-] Could not read %s\n", MEMORY_BLOCK_SIZE_FILENAME);
+        return -1;
+    }
+    uint64_t block_size = strtoull(text, NULL, 16);
+
+    DIR* dir = opendir(NUMA_NODE_DIR);
+    if (0 == block_size || NULL == dir)
+    {
+        fprint_red(stderr, "[-] Could not read the NUMA topology from %s\n", 
+            NUMA_NODE_DIR);
+        if (NULL != dir)
+        {
+            closedir(dir);
+        }
+        return -1;
+    }
+
+    if (-1 == sched_getaffinity(0, sizeof(allowed), &allowed))
+    {
+        CPU_ZERO(&allowed);
+    }
+
+    struct dirent* entry;
+    while (NULL != (entry = readdir(dir)))
+    {
+        int id;
+        char extra;
+        if (1 != sscanf(entry->d_name, "node%d%c", &id, &extra))
+        {
+            continue;
+        }
+
+        struct numa_node* nodes = realloc(topology->nodes, 
+            (topology->num_nodes + 1) * sizeof(struct numa_node));
+        if (NULL == nodes)
+        {
+            closedir(dir);
+            numa_free(topology);
+            return -1;
+        }
+        topology->nodes = nodes;
+
+        // Nodes of memory alone, such as CXL expanders, have no CPUs
+        struct numa_node* node = &nodes[topology->num_nodes];
+        node->id = id;
+        snprintf(path, sizeof(path), "%s/%s/cpulist", NUMA_NODE_DIR, 
+            entry->d_name);
+        if (-1 == read_sysfs(path, text, sizeof(text)) || 
+            -1 == budget_parse_cpus(text, &node->cpus))
+        {
+            CPU_ZERO(&node->cpus);
+        }
+        CPU_AND(&node->cpus, &node->cpus, &allowed);
+        node->num_cpus = CPU_COUNT(&node->cpus);
+
+        int num_ranges = topology->num_ranges;
+        snprintf(path, sizeof(path), "%s/%s", NUMA_NODE_DIR, entry->d_name);
+        if (-1 == load_node_memory(topology, topology->num_nodes, path, 
+            block_size))
+        {
+            fprint_red(stderr, "[-] Could not read the memory blocks of %s\n", 
+                path);
+            closedir(dir);
+            numa_free(topology);
+            return -1;
+        }
+
+        if (topology->num_ranges > num_ranges)
+        {
+            topology->num_nodes++;
+        }
+    }
+    closedir(dir);
+
+    if (0 == topology->num_nodes)
+    {
+        fprint_red(stderr, "[-] No NUMA nodes with memory were found\n");
+        numa_free(topology);
+        return -1;
+    }
+
+    // Merge the blocks into runs, so that lookups stay cheap
+    qsort(topology->ranges, topology->num_ranges, sizeof(struct numa_range), 
+        compare_ranges);
+    int merged = 0;
+    for (int i = 0; i < topology->num_ranges; i++)
+    {
+        if (merged > 0 && 
+            topology->ranges[merged - 1].end == topology->ranges[i].start && 
+            topology->ranges[merged - 1].node == topology->ranges[i].node)
+        {
+            topology->ranges[merged - 1].end = topology->ranges[i].end;
+        }
+        else
+        {
+            topology->ranges[merged++] = topology->ranges[i];
+        }
+    }
+    topology->num_ranges = merged;
+
+    return 0;
+}
+
+/**
+ * Finds the node that owns a physical address.
+ * 
+ * @param topology The topology
+ * @param address  The physical address
+ * 
+ * @return The index of the node in the topology, else -1 if no node owns
+ *         the address
+ */
+int numa_find_node(const struct numa_topology* topology, const uint64_t address)
+{
+    int lo = 0;
+    int hi = topology->num_ranges - 1;
+
+    while (lo <= hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (address < topology->ranges[mid].start)
+        {
+            hi = mid - 1;
+        }
+        else if (address >= topology->ranges[mid].end)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            return topology->ranges[mid].node;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Asks for memory to be placed on a node, moving any pages that are already
+ * there. This is only a preference, so failures are ignored.
+ * 
+ * @param memory  The page aligned memory
+ * @param len     The length of the memory
+ * @param node_id The id of the node
+ */
+void numa_bind(void* memory, const size_t len, const int node_id)
+{
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+
+    if (node_id < 0 || node_id >= MAX_NUMA_NODES)
+    {
+        return;
+    }
+
+    mask[node_id / (8 * sizeof(unsigned long))] |= 
+        1UL << (node_id % (8 * sizeof(unsigned long)));
+    syscall(SYS_mbind, memory, len, MPOL_PREFERRED, mask, MAX_NUMA_NODES, 
+        MPOL_MF_MOVE);
+}
+
+/**
+ * Releases a NUMA topology.
+ * 
+ * @param topology The topology
+ */
+void numa_free(struct numa_topology* topology)
+{
+    free(topology->nodes);
+    free(topology->ranges);
+    topology->nodes = NULL;
+    topology->ranges = NULL;
+    topology->num_nodes = 0;
+    topology->num_ranges = 0;
+}
\ No newline at end of file
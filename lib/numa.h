@@ -0,0 +1,60 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lmat.h"
+
+#include <sched.h>
+
+// Where the kernel describes the NUMA nodes and the memory blocks they own
+#define NUMA_NODE_DIR "/sys/devices/system/node"
+#define MEMORY_BLOCK_SIZE_FILENAME "/sys/devices/system/memory/block_size_bytes"
+
+// A run of physical memory that belongs to a single node
+struct numa_range
+{
+    uint64_t    start;
+    uint64_t    end;
+    int         node;
+};
+
+// A NUMA node and the CPUs that we may run on that are local to it
+struct numa_node
+{
+    int         id;
+    cpu_set_t   cpus;
+    int         num_cpus;
+};
+
+// Which node each part of physical memory belongs to
+struct numa_topology
+{
+    int                 num_nodes;
+    struct numa_node*   nodes;
+
+    // Sorted by address, with adjacent blocks on the same node merged
+    int                 num_ranges;
+    struct numa_range*  ranges;
+};
+
+int numa_load(struct numa_topology* topology);
+
+int numa_find_node(const struct numa_topology* topology, const uint64_t address);
+
+void numa_bind(void* memory, const size_t len, const int node_id);
+
+void numa_free(struct numa_topology* topology);
\ No newline at end of file
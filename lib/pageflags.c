@@ -0,0 +1,197 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "pageflags.h"
+
+#include "color-print.h"
+#include "io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/kernel-page-flags.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// The flags of pages that hold nothing worth capturing: free pages in the
+// buddy allocator, holes without a struct page, offlined memory, and
+// poisoned pages that may not be safe to read at all
+#define SKIPPED_PAGE_FLAGS ((1ULL << KPF_BUDDY) | (1ULL << KPF_NOPAGE) | \
+                            (1ULL << KPF_OFFLINE) | (1ULL << KPF_HWPOISON))
+
+// The number of page counts read at once when checking skipped pages
+#define COUNT_BATCH 512
+
+/**
+ * Opens the kernel's per-page state. kpageflags is required, while
+ * kpagecount is only used as a safeguard if it can be opened.
+ *
+ * @param filter The filter to open
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int page_filter_open(struct page_filter* filter)
+{
+    filter->kpagecount_fd = -1;
+    if (-1 == (filter->kpageflags_fd = open64(KPAGEFLAGS_FILENAME, 
+        O_RDONLY | O_LARGEFILE)))
+    {
+        fprint_red(stderr, "[-] Could not open %s (errno %d)\n", 
+            KPAGEFLAGS_FILENAME, errno);
+        return -1;
+    }
+
+    filter->kpagecount_fd = open64(KPAGECOUNT_FILENAME, O_RDONLY | O_LARGEFILE);
+    return 0;
+}
+
+/**
+ * Closes the kernel's per-page state.
+ *
+ * @param filter The filter to close
+ */
+void page_filter_close(struct page_filter* filter)
+{
+    if (filter->kpageflags_fd >= 0)
+    {
+        close(filter->kpageflags_fd);
+        filter->kpageflags_fd = -1;
+    }
+
+    if (filter->kpagecount_fd >= 0)
+    {
+        close(filter->kpagecount_fd);
+        filter->kpagecount_fd = -1;
+    }
+}
+
+/**
+ * Works out which pages of a run of physical memory are worth capturing.
+ * The flags for the whole run are read in one batch. Any page that is
+ * mapped into a process is kept whatever its flags say, which guards
+ * against pages being allocated while we look at them.
+ *
+ * @param filter           The filter
+ * @param physical_address The page aligned address the run starts at
+ * @param num_pages        The number of pages in the run
+ * @param keep             Non-zero for each page that should be captured
+ *                         (output)
+ *
+ * @return The number of pages to skip, else -1 if there's an error
+ */
+int page_filter_select(const struct page_filter* filter,
+                       const uint64_t physical_address,
+                       const size_t num_pages,
+                       uint64_t* keep)
+{
+    uint64_t pfn = physical_address / PAGE_FILTER_PAGE_SIZE;
+    int skipped = 0;
+
+    if (-1 == read_all_at(filter->kpageflags_fd, keep, 
+        num_pages * sizeof(uint64_t), pfn * sizeof(uint64_t)))
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < num_pages; i++)
+    {
+        keep[i] = !(keep[i] & SKIPPED_PAGE_FLAGS);
+        skipped += !keep[i];
+    }
+
+    if (0 == skipped || filter->kpagecount_fd < 0)
+    {
+        return skipped;
+    }
+
+    for (size_t base = 0; base < num_pages; base += COUNT_BATCH)
+    {
+        uint64_t counts[COUNT_BATCH];
+        size_t n = num_pages - base < COUNT_BATCH ? num_pages - base : COUNT_BATCH;
+
+        if (-1 == read_all_at(filter->kpagecount_fd, counts, 
+            n * sizeof(uint64_t), (pfn + base) * sizeof(uint64_t)))
+        {
+            return -1;
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (!keep[base + i] && counts[i] > 0)
+            {
+                keep[base + i] = 1;
+                skipped--;
+            }
+        }
+    }
+
+    return skipped;
+}
+
+/**
+ * Reads only the selected pages of a chunk from kcore, zero filling the
+ * rest so that the buffer matches what ends up in the output.
+ *
+ * @param kcore_fd    The file descriptor of the /proc/kcore file
+ * @param buffer      The buffer to read into
+ * @param file_offset The kcore offset of the chunk
+ * @param len         The length of the chunk
+ * @param keep        Non-zero for each page that should be read
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int page_filter_read(const int kcore_fd,
+                     char* buffer,
+                     const uint64_t file_offset,
+                     const size_t len,
+                     const uint64_t* keep)
+{
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        size_t page = pos / PAGE_FILTER_PAGE_SIZE;
+        size_t end = pos;
+        while (end < len && !keep[end / PAGE_FILTER_PAGE_SIZE] == !keep[page])
+        {
+            end += PAGE_FILTER_PAGE_SIZE;
+        }
+        if (end > len)
+        {
+            end = len;
+        }
+
+        if (keep[page])
+        {
+            if (-1 == read_all_at(kcore_fd, buffer + pos, end - pos, 
+                file_offset + pos))
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            memset(buffer + pos, 0, end - pos);
+        }
+
+        pos = end;
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lmat.h"
+
+// The files the kernel exports per-page state through
+#define KPAGEFLAGS_FILENAME "/proc/kpageflags"
+#define KPAGECOUNT_FILENAME "/proc/kpagecount"
+
+// The size of the pages described by kpageflags
+#define PAGE_FILTER_PAGE_SIZE 0x1000
+
+// Decides which pages of physical memory are worth capturing
+struct page_filter
+{
+    int kpageflags_fd;
+    int kpagecount_fd;
+};
+
+int page_filter_open(struct page_filter* filter);
+
+void page_filter_close(struct page_filter* filter);
+
+int page_filter_select(const struct page_filter* filter,
+                       const uint64_t physical_address,
+                       const size_t num_pages,
+                       uint64_t* keep);
+
+int page_filter_read(const int kcore_fd,
+                     char* buffer,
+                     const uint64_t file_offset,
+                     const size_t len,
+                     const uint64_t* keep);
\ No newline at end of file
@@ -0,0 +1,639 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "parallel.h"
+
+#include "budget.h"
+#include "buffer.h"
+#include "color-print.h"
+#include "io.h"
+#include "manifest.h"
+#include "merkle.h"
+#include "metrics.h"
+#include "numa.h"
+#include "pageflags.h"
+#include "zero.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The chunks whose memory is on one NUMA node
+struct node_queue
+{
+    const struct numa_node* node;
+    uint64_t*               chunks;
+    uint64_t                num_chunks;
+    uint64_t                next;
+    int                     num_workers;
+};
+
+// State shared between all of the copy workers
+struct copy_context
+{
+    int                             kcore_fd;
+    int                             out_fd;
+    const struct section*           sections;
+    const struct section_layout*    layout;
+    int                             num_sections;
+    struct dump_context*            dump;
+
+    // first_chunk[i] is the global index of the first chunk of section i,
+    // first_chunk[num_sections] is the total number of chunks
+    uint64_t*                       first_chunk;
+
+    uint64_t                        next_chunk;
+    int                             failed;
+
+    // The chunks of each NUMA node, if copies are kept node-local
+    struct node_queue*              queues;
+    int                             num_queues;
+};
+
+// What each copy worker starts with
+struct copy_worker_arg
+{
+    struct copy_context*    ctx;
+    int                     queue;
+};
+
+/**
+ * Finds the section that a global chunk index belongs to.
+ *
+ * @param ctx   The copy context
+ * @param chunk The global chunk index
+ *
+ * @return The index of the section containing the chunk
+ */
+static int find_section_for_chunk(const struct copy_context* ctx,
+                                  const uint64_t chunk)
+{
+    int lo = 0;
+    int hi = ctx->num_sections - 1;
+
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (ctx->first_chunk[mid] <= chunk)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * Writes a buffer to the output file at a given offset, skipping over
+ * zero-filled pages so that they become holes in the output.
+ *
+ * @param ctx    The copy context
+ * @param buffer The data to write
+ * @param len    The length of the data
+ * @param offset The output offset to write the data at
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_sparse_at(const struct copy_context* ctx,
+                           const char* buffer,
+                           const size_t len,
+                           const uint64_t offset)
+{
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        int zero;
+        size_t run = scan_page_run(buffer + pos, len - pos, &zero);
+
+        if (zero)
+        {
+            __atomic_fetch_add(&ctx->dump->stats->bytes_elided, run, 
+                __ATOMIC_RELAXED);
+        }
+        else if (-1 == write_all_at(ctx->out_fd, buffer + pos, run, 
+            offset + pos))
+        {
+            return -1;
+        }
+
+        pos += run;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes a buffer to the output file at a given offset, eliding zero pages
+ * if sparse output was requested.
+ *
+ * @param ctx    The copy context
+ * @param buffer The data to write
+ * @param len    The length of the data
+ * @param offset The output offset to write the data at
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_at(const struct copy_context* ctx,
+                    const char* buffer,
+                    const size_t len,
+                    const uint64_t offset)
+{
+    if (ctx->dump->options->sparse)
+    {
+        return write_sparse_at(ctx, buffer, len, offset);
+    }
+
+    return write_all_at(ctx->out_fd, buffer, len, offset);
+}
+
+/**
+ * Writes the selected pages of a buffer to the output file at a given
+ * offset. The skipped pages are left as holes in the output.
+ *
+ * @param ctx    The copy context
+ * @param buffer The data to write
+ * @param len    The length of the data
+ * @param keep   Non-zero for each page that should be written
+ * @param offset The output offset to write the data at
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_selected_at(const struct copy_context* ctx,
+                             const char* buffer,
+                             const size_t len,
+                             const uint64_t* keep,
+                             const uint64_t offset)
+{
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        size_t page = pos / PAGE_FILTER_PAGE_SIZE;
+        size_t end = pos;
+        while (end < len && !keep[end / PAGE_FILTER_PAGE_SIZE] == !keep[page])
+        {
+            end += PAGE_FILTER_PAGE_SIZE;
+        }
+        if (end > len)
+        {
+            end = len;
+        }
+
+        if (!keep[page])
+        {
+            __atomic_fetch_add(&ctx->dump->stats->bytes_free, end - pos, 
+                __ATOMIC_RELAXED);
+        }
+        else if (-1 == write_at(ctx, buffer + pos, end - pos, offset + pos))
+        {
+            return -1;
+        }
+
+        pos = end;
+    }
+
+    return 0;
+}
+
+/**
+ * Copies a single chunk from kcore to the output file using positional I/O.
+ *
+ * @param ctx        The copy context
+ * @param buffer_ptr The buffer to copy through, which is swapped for another
+ *                   when the chunk is handed off to be hashed (input/output)
+ * @param keep       Scratch space for the page selection, or NULL if pages
+ *                   aren't being filtered
+ * @param chunk      The global index of the chunk to copy
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int copy_chunk(const struct copy_context* ctx,
+                      char** buffer_ptr,
+                      uint64_t* keep,
+                      const uint64_t chunk)
+{
+    char* buffer = *buffer_ptr;
+    size_t chunk_size = ctx->dump->options->chunk_size;
+    int s = find_section_for_chunk(ctx, chunk);
+    uint64_t offset = (chunk - ctx->first_chunk[s]) * chunk_size;
+    size_t len = ctx->sections[s].size - offset;
+    if (len > chunk_size)
+    {
+        len = chunk_size;
+    }
+
+    uint64_t address = ctx->sections[s].physical_base + offset;
+    uint64_t start = metrics_now();
+    uint64_t file_offset = ctx->sections[s].file_offset + offset;
+    int skipped = 0;
+    if (NULL != keep && 0 == address % PAGE_FILTER_PAGE_SIZE)
+    {
+        skipped = page_filter_select(ctx->dump->filter, address, 
+            (len + PAGE_FILTER_PAGE_SIZE - 1) / PAGE_FILTER_PAGE_SIZE, keep);
+        if (-1 == skipped)
+        {
+            fprint_red(stderr, "[-] Failed to read the page flags at 0x%lx\n",
+                address);
+            return -1;
+        }
+    }
+
+    int ret = skipped > 0 ? 
+        page_filter_read(ctx->kcore_fd, buffer, file_offset, len, keep) : 
+        read_all_at(ctx->kcore_fd, buffer, len, file_offset);
+    if (-1 == ret)
+    {
+        fprint_red(stderr, "[-] Kcore read failed at 0x%lx (errno %d)\n",
+            address, errno);
+        return -1;
+    }
+    uint64_t read_done = metrics_now();
+    metrics_record_read(ctx->dump->metrics, s, address, start, read_done);
+
+    // Each page is only ever hashed by the worker that copies it
+    if (NULL != ctx->dump->manifest)
+    {
+        manifest_hash_pages(ctx->dump->manifest, s, offset, buffer, len);
+    }
+
+    int written;
+    if (skipped > 0)
+    {
+        written = write_selected_at(ctx, buffer, len, keep, 
+            ctx->layout[s].data_offset + offset);
+    }
+    else
+    {
+        written = write_at(ctx, buffer, len, 
+            ctx->layout[s].data_offset + offset);
+    }
+    if (-1 == written)
+    {
+        fprint_red(stderr, "[-] Failed to write memory regions! (errno %d)\n",
+            errno);
+        return -1;
+    }
+
+    uint64_t write_done = metrics_now();
+    metrics_record_write(ctx->dump->metrics, s, address, read_done, 
+        write_done, len);
+    __atomic_fetch_add(&ctx->dump->stats->bytes_copied, len, __ATOMIC_RELAXED);
+
+    if (NULL != ctx->dump->merkle)
+    {
+        *buffer_ptr = merkle_submit(ctx->dump->merkle, s, offset, buffer, len);
+        if (NULL == *buffer_ptr)
+        {
+            fprint_red(stderr, "[-] Failed to hash memory regions!\n");
+            return -1;
+        }
+    }
+
+    if (NULL != ctx->dump->budget)
+    {
+        budget_account(ctx->dump->budget, len, write_done - read_done);
+    }
+    return 0;
+}
+
+/**
+ * Takes the next chunk for a worker to copy. Workers take chunks from their
+ * own node first, and help out on the other nodes once it has run dry.
+ *
+ * @param ctx   The copy context
+ * @param queue The node queue of the worker
+ * @param chunk The global index of the chunk (output)
+ *
+ * @return 1 if a chunk was taken, else 0 if there's nothing left to copy
+ */
+static int take_chunk(struct copy_context* ctx, 
+                      const int queue, 
+                      uint64_t* chunk)
+{
+    if (NULL == ctx->queues)
+    {
+        *chunk = __atomic_fetch_add(&ctx->next_chunk, 1, __ATOMIC_RELAXED);
+        return *chunk < ctx->first_chunk[ctx->num_sections];
+    }
+
+    for (int i = 0; i < ctx->num_queues; i++)
+    {
+        struct node_queue* q = &ctx->queues[(queue + i) % ctx->num_queues];
+        if (__atomic_load_n(&q->next, __ATOMIC_RELAXED) >= q->num_chunks)
+        {
+            continue;
+        }
+
+        uint64_t next = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED);
+        if (next < q->num_chunks)
+        {
+            *chunk = q->chunks[next];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * The entry point for each copy worker. Workers pull chunks off of a shared
+ * counter, or their node's queue, until there's nothing left to copy or
+ * another worker fails.
+ *
+ * @param arg The worker's copy_worker_arg
+ *
+ * @return NULL
+ */
+static void* copy_worker(void* arg)
+{
+    struct copy_context* ctx = ((struct copy_worker_arg*) arg)->ctx;
+    int queue = ((struct copy_worker_arg*) arg)->queue;
+
+    // Run on the node whose memory we're reading, which is also where our
+    // buffer should live
+    const struct numa_node* node = NULL;
+    if (NULL != ctx->queues)
+    {
+        node = ctx->queues[queue].node;
+        if (node->num_cpus > 0)
+        {
+            pthread_setaffinity_np(pthread_self(), sizeof(node->cpus), 
+                &node->cpus);
+        }
+    }
+
+    char* buffer = buffer_pool_get(ctx->dump->buffers);
+    if (NULL == buffer)
+    {
+        fprint_red(stderr, "[-] Failed to get a buffer\n");
+        __atomic_store_n(&ctx->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    if (NULL != node)
+    {
+        numa_bind(buffer, ctx->dump->options->chunk_size, node->id);
+    }
+
+    uint64_t* keep = NULL;
+    if (NULL != ctx->dump->filter)
+    {
+        keep = malloc(ctx->dump->options->chunk_size / PAGE_FILTER_PAGE_SIZE *
+            sizeof(uint64_t));
+        if (NULL == keep)
+        {
+            fprint_red(stderr, "[-] Failed to allocate the page selection\n");
+            buffer_pool_put(ctx->dump->buffers, buffer);
+            __atomic_store_n(&ctx->failed, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+
+    uint64_t chunk;
+    while (!__atomic_load_n(&ctx->failed, __ATOMIC_RELAXED) && 
+        take_chunk(ctx, queue, &chunk))
+    {
+        if (-1 == copy_chunk(ctx, &buffer, keep, chunk))
+        {
+            __atomic_store_n(&ctx->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    buffer_pool_put(ctx->dump->buffers, buffer);
+    free(keep);
+    return NULL;
+}
+
+/**
+ * Sorts the chunks into a queue for each NUMA node and shares the workers
+ * out between the nodes, in proportion to how much memory each has to copy.
+ * Chunks that don't belong to any node are left to the first.
+ *
+ * @param ctx         The copy context, whose queues are set up
+ * @param topology    The NUMA topology
+ * @param num_threads The number of copy workers
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int create_node_queues(struct copy_context* ctx,
+                              const struct numa_topology* topology,
+                              const int num_threads)
+{
+    size_t chunk_size = ctx->dump->options->chunk_size;
+    uint64_t total = ctx->first_chunk[ctx->num_sections];
+
+    ctx->num_queues = topology->num_nodes;
+    ctx->queues = calloc(ctx->num_queues, sizeof(struct node_queue));
+    if (NULL == ctx->queues)
+    {
+        return -1;
+    }
+
+    // Count the chunks on each node, then fill in the queues
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < ctx->num_queues; i++)
+        {
+            ctx->queues[i].node = &topology->nodes[i];
+            if (1 == pass && NULL == (ctx->queues[i].chunks = 
+                malloc((ctx->queues[i].num_chunks + 1) * sizeof(uint64_t))))
+            {
+                return -1;
+            }
+            ctx->queues[i].num_chunks = 0;
+        }
+
+        for (uint64_t chunk = 0; chunk < total; chunk++)
+        {
+            int s = find_section_for_chunk(ctx, chunk);
+            uint64_t address = ctx->sections[s].physical_base + 
+                (chunk - ctx->first_chunk[s]) * chunk_size;
+            int node = numa_find_node(topology, address);
+            struct node_queue* q = &ctx->queues[-1 == node ? 0 : node];
+            if (1 == pass)
+            {
+                q->chunks[q->num_chunks] = chunk;
+            }
+            q->num_chunks++;
+        }
+    }
+
+    // Every node with memory to copy gets a worker if there are enough to
+    // go around, then the rest go to whichever node has the most per worker
+    int workers = num_threads;
+    for (int i = 0; i < ctx->num_queues && workers > 0; i++)
+    {
+        if (ctx->queues[i].num_chunks > 0)
+        {
+            ctx->queues[i].num_workers = 1;
+            workers--;
+        }
+    }
+    for (; workers > 0; workers--)
+    {
+        int busiest = 0;
+        for (int i = 1; i < ctx->num_queues; i++)
+        {
+            if (ctx->queues[i].num_chunks * (ctx->queues[busiest].num_workers + 1) >
+                ctx->queues[busiest].num_chunks * (ctx->queues[i].num_workers + 1))
+            {
+                busiest = i;
+            }
+        }
+        ctx->queues[busiest].num_workers++;
+    }
+
+    for (int i = 0; i < ctx->num_queues; i++)
+    {
+        print_cyan("\t[*] NUMA node %d: %lu chunks, %d threads on %d CPUs\n",
+            ctx->queues[i].node->id, ctx->queues[i].num_chunks,
+            ctx->queues[i].num_workers, ctx->queues[i].node->num_cpus);
+    }
+
+    return 0;
+}
+
+/**
+ * Copies the contents of every section to its precomputed location in the
+ * output file using a pool of worker threads. Each worker copies whole chunks
+ * with pread/pwrite, so chunks may complete in any order.
+ *
+ * @param kcore_fd     The file descriptor of the /proc/kcore file
+ * @param out_fd       The file descriptor of the output file
+ * @param sections     The array of memory sections to copy
+ * @param layout       The output location of each section
+ * @param num_sections The number of sections to copy
+ * @param dump         The dump context
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int copy_sections_parallel(const int kcore_fd,
+                           const int out_fd,
+                           const struct section* sections,
+                           const struct section_layout* layout,
+                           const int num_sections,
+                           struct dump_context* dump)
+{
+    int num_threads = dump->options->threads;
+    int ret = 0;
+    int started = 0;
+    pthread_t threads[MAX_THREADS];
+    struct copy_worker_arg args[MAX_THREADS];
+    struct numa_topology topology = { 0 };
+
+    if (num_sections <= 0)
+    {
+        return 0;
+    }
+
+    struct copy_context ctx = {
+        .kcore_fd = kcore_fd,
+        .out_fd = out_fd,
+        .sections = sections,
+        .layout = layout,
+        .num_sections = num_sections,
+        .dump = dump,
+        .next_chunk = 0,
+        .failed = 0,
+    };
+
+    ctx.first_chunk = malloc((num_sections + 1) * sizeof(uint64_t));
+    if (NULL == ctx.first_chunk)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the chunk table\n");
+        return -1;
+    }
+
+    ctx.first_chunk[0] = 0;
+    for (int i = 0; i < num_sections; i++)
+    {
+        ctx.first_chunk[i + 1] = ctx.first_chunk[i] +
+            (sections[i].size + dump->options->chunk_size - 1) / 
+            dump->options->chunk_size;
+    }
+
+    print_cyan("\t[*] Copying %d sections with %d threads\n",
+        num_sections, num_threads);
+
+    if (dump->options->numa)
+    {
+        if (-1 == numa_load(&topology) || 
+            -1 == create_node_queues(&ctx, &topology, num_threads))
+        {
+            fprint_red(stderr, "[-] Failed to schedule the copy across NUMA nodes\n");
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    for (int i = 0, queue = 0, assigned = 0; 
+        i < num_threads && i < MAX_THREADS; i++)
+    {
+        // Hand out the workers to each node in turn
+        args[i].ctx = &ctx;
+        args[i].queue = 0;
+        if (NULL != ctx.queues)
+        {
+            while (assigned >= ctx.queues[queue].num_workers)
+            {
+                queue++;
+                assigned = 0;
+            }
+            args[i].queue = queue;
+            assigned++;
+        }
+
+        if (0 != pthread_create(&threads[i], NULL, copy_worker, &args[i]))
+        {
+            fprint_red(stderr, "[-] Failed to start copy thread %d\n", i);
+            __atomic_store_n(&ctx.failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (ctx.failed || 0 == started)
+    {
+        ret = -1;
+    }
+
+cleanup:
+    for (int i = 0; NULL != ctx.queues && i < ctx.num_queues; i++)
+    {
+        free(ctx.queues[i].chunks);
+    }
+    free(ctx.queues);
+    numa_free(&topology);
+    free(ctx.first_chunk);
+    return ret;
+}
\ No newline at end of file
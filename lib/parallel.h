@@ -0,0 +1,27 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "lmat.h"
+
+int copy_sections_parallel(const int kcore_fd,
+                           const int out_fd,
+                           const struct section* sections,
+                           const struct section_layout* layout,
+                           const int num_sections,
+                           struct dump_context* dump);
\ No newline at end of file
@@ -0,0 +1,306 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "priority.h"
+
+#include "color-print.h"
+#include "iomem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// The iomem resources that hold the kernel's image, nested within RAM
+static const char* kernel_labels[] = {
+    "Kernel code",
+    "Kernel rodata",
+    "Kernel data",
+    "Kernel bss",
+};
+
+// A piece of a section, along with where it came in the original order
+struct ranked_section
+{
+    int             priority;
+    int             order;
+    struct section  section;
+};
+
+/**
+ * Creates an empty list of priorities.
+ * 
+ * @return The list, else NULL if there's an error
+ */
+struct priority_list* priority_create(void)
+{
+    return calloc(1, sizeof(struct priority_list));
+}
+
+/**
+ * Adds a range to the list of priorities.
+ * 
+ * @param priorities The priorities
+ * @param priority   The priority class of the range
+ * @param start      The first address of the range
+ * @param end        The last address of the range
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int add_priority(struct priority_list* priorities,
+                        const int priority,
+                        const uint64_t start,
+                        const uint64_t end)
+{
+    struct addr_range* ranges = realloc(priorities->ranges, 
+        (priorities->num_ranges + 1) * sizeof(struct addr_range));
+    if (NULL == ranges)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the priority ranges\n");
+        return -1;
+    }
+
+    priorities->ranges = ranges;
+    ranges[priorities->num_ranges].index = priority;
+    ranges[priorities->num_ranges].start = start;
+    ranges[priorities->num_ranges].end = end;
+    priorities->num_ranges++;
+    return 0;
+}
+
+/**
+ * Adds a range that should be captured before anything else, given as
+ * "<start>-<end>" in hex with an inclusive end.
+ * 
+ * @param priorities The priorities
+ * @param text       The range
+ * 
+ * @return 0 for success, else -1 if the range isn't valid
+ */
+int priority_add_range(struct priority_list* priorities, const char* text)
+{
+    uint64_t start, end;
+    if (-1 == parse_address_range(text, &start, &end))
+    {
+        return -1;
+    }
+
+    return add_priority(priorities, PRIORITY_REQUESTED, start, end);
+}
+
+/**
+ * Orders ranked sections by priority, keeping the original order within
+ * each priority class.
+ * 
+ * @param a The first section
+ * @param b The second section
+ * 
+ * @return Less than, equal to or greater than zero as a sorts before, with
+ *         or after b
+ */
+static int compare_ranked(const void* a, const void* b)
+{
+    const struct ranked_section* ra = (const struct ranked_section*) a;
+    const struct ranked_section* rb = (const struct ranked_section*) b;
+
+    if (ra->priority != rb->priority)
+    {
+        return ra->priority - rb->priority;
+    }
+    return ra->order - rb->order;
+}
+
+/**
+ * Finds the next place a section has to be cut, so that each piece falls
+ * entirely within or outside of every priority range.
+ * 
+ * @param priorities The priorities
+ * @param from       The address to look after
+ * @param end        The end of the section, exclusive
+ * 
+ * @return The address of the next cut, else end if there isn't one
+ */
+static uint64_t next_cut(const struct priority_list* priorities,
+                         const uint64_t from,
+                         const uint64_t end)
+{
+    uint64_t cut = end;
+
+    for (int i = 0; i < priorities->num_ranges; i++)
+    {
+        uint64_t start = priorities->ranges[i].start;
+        uint64_t after = priorities->ranges[i].end + 1;
+        if (start > from && start < cut)
+        {
+            cut = start;
+        }
+        if (after > from && after < cut)
+        {
+            cut = after;
+        }
+    }
+
+    return cut;
+}
+
+/**
+ * Finds the priority class of an address.
+ * 
+ * @param priorities The priorities
+ * @param address    The address
+ * 
+ * @return The most urgent priority class of any range holding the address
+ */
+static int find_priority(const struct priority_list* priorities, 
+                         const uint64_t address)
+{
+    int priority = PRIORITY_NORMAL;
+
+    for (int i = 0; i < priorities->num_ranges; i++)
+    {
+        if (address >= priorities->ranges[i].start && 
+            address <= priorities->ranges[i].end && 
+            priorities->ranges[i].index < priority)
+        {
+            priority = priorities->ranges[i].index;
+        }
+    }
+
+    return priority;
+}
+
+/**
+ * Reorders the sections of a dump so the most urgent memory is captured
+ * first. Sections are cut wherever a priority range starts or ends, and the
+ * pieces are sorted by priority class, keeping address order within each.
+ * The kernel's image is found from the resources nested in iomem each time,
+ * so the sections can be ordered again after the layout changes.
+ * 
+ * @param priorities   The priorities
+ * @param iomem_path   The path of the iomem file to read
+ * @param sections     The sections of the dump, which are replaced
+ *                     (input/output)
+ * @param num_sections The number of sections
+ * 
+ * @return The new number of sections, else -1 if there's an error
+ */
+int priority_order_sections(struct priority_list* priorities,
+                            const char* iomem_path,
+                            struct section** sections,
+                            const int num_sections)
+{
+    int num_requested = priorities->num_ranges;
+    int count = -1;
+
+    if (priorities->kernel_first)
+    {
+        struct addr_range* kernel = NULL;
+        int num_kernel = get_labelled_address_ranges(iomem_path, kernel_labels,
+            sizeof(kernel_labels) / sizeof(kernel_labels[0]), &kernel);
+        if (-1 == num_kernel)
+        {
+            goto cleanup;
+        }
+        if (0 == num_kernel)
+        {
+            print_yellow("[!] %s doesn't show where the kernel is\n", iomem_path);
+        }
+
+        for (int i = 0; i < num_kernel; i++)
+        {
+            if (-1 == add_priority(priorities, PRIORITY_KERNEL, kernel[i].start, 
+                kernel[i].end))
+            {
+                free(kernel);
+                goto cleanup;
+            }
+        }
+        free(kernel);
+    }
+
+    // Each range can cut a section in two places
+    int capacity = num_sections + 2 * priorities->num_ranges;
+    struct ranked_section* ranked = malloc(capacity * sizeof(struct ranked_section));
+    if (NULL == ranked)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the prioritised sections\n");
+        goto cleanup;
+    }
+
+    count = 0;
+    uint64_t bytes[PRIORITY_NORMAL + 1] = { 0 };
+    for (int i = 0; i < num_sections; i++)
+    {
+        const struct section* s = &(*sections)[i];
+        uint64_t end = s->physical_base + s->size;
+        for (uint64_t base = s->physical_base; base < end; )
+        {
+            uint64_t cut = next_cut(priorities, base, end);
+            uint64_t delta = base - s->physical_base;
+
+            ranked[count].priority = find_priority(priorities, base);
+            ranked[count].order = count;
+            ranked[count].section.physical_base = base;
+            ranked[count].section.virtual_base = s->virtual_base + delta;
+            ranked[count].section.file_offset = s->file_offset + delta;
+            ranked[count].section.size = cut - base;
+            bytes[ranked[count].priority] += cut - base;
+            count++;
+            base = cut;
+        }
+    }
+
+    qsort(ranked, count, sizeof(struct ranked_section), compare_ranked);
+
+    struct section* ordered = malloc(count * sizeof(struct section));
+    if (NULL == ordered)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the prioritised sections\n");
+        free(ranked);
+        count = -1;
+        goto cleanup;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        ordered[i] = ranked[i].section;
+    }
+    free(ranked);
+
+    free(*sections);
+    *sections = ordered;
+
+    print_green("[*] Capturing 0x%lx bytes of requested ranges and 0x%lx bytes of "
+        "the kernel first\n", bytes[PRIORITY_REQUESTED], bytes[PRIORITY_KERNEL]);
+
+cleanup:
+    // Only the requested ranges are kept, the kernel's are looked up again
+    priorities->num_ranges = num_requested;
+    return count;
+}
+
+/**
+ * Releases a list of priorities.
+ * 
+ * @param priorities The priorities, which may be NULL
+ */
+void priority_free(struct priority_list* priorities)
+{
+    if (NULL == priorities)
+    {
+        return;
+    }
+
+    free(priorities->ranges);
+    free(priorities);
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lmat.h"
+
+// How urgently each part of memory is wanted, most urgent first
+enum priority_class
+{
+    // Ranges asked for on the command line
+    PRIORITY_REQUESTED,
+
+    // The kernel's own image, as labelled in iomem
+    PRIORITY_KERNEL,
+
+    // Everything else
+    PRIORITY_NORMAL,
+};
+
+// The parts of memory to capture ahead of the rest. The index of each range
+// is its priority class.
+struct priority_list
+{
+    struct addr_range*  ranges;
+    int                 num_ranges;
+    int                 kernel_first;
+};
+
+struct priority_list* priority_create(void);
+
+int priority_add_range(struct priority_list* priorities, const char* text);
+
+int priority_order_sections(struct priority_list* priorities,
+                            const char* iomem_path,
+                            struct section** sections,
+                            const int num_sections);
+
+void priority_free(struct priority_list* priorities);
\ No newline at end of file
@@ -0,0 +1,675 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "reader.h"
+
+#include "color-print.h"
+#include "io.h"
+#include "lime.h"
+#include "stripe.h"
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Sidecar index entries are used in place, so they must match our sections
+_Static_assert(sizeof(struct section) == sizeof(lime_index_entry),
+    "struct section doesn't match the sidecar index layout");
+
+/**
+ * Gets the modification time of a file in nanoseconds.
+ *
+ * @param st The status of the file
+ *
+ * @return The modification time
+ */
+static uint64_t mtime_ns(const struct stat* st)
+{
+    return (uint64_t) st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+/**
+ * Compares two sections by their physical address.
+ *
+ * @param a The first section
+ * @param b The second section
+ *
+ * @return Less than, equal to or greater than zero as a starts before, at or
+ *         after b
+ */
+static int compare_sections(const void* a, const void* b)
+{
+    const struct section* sa = (const struct section*) a;
+    const struct section* sb = (const struct section*) b;
+    return (sa->physical_base > sb->physical_base) - 
+        (sa->physical_base < sb->physical_base);
+}
+
+/**
+ * Maps a sidecar index and uses it in place of scanning the LiME file. The
+ * index is only used if it was built from a file of the same size and
+ * modification time.
+ *
+ * @param reader The reader to load the index into
+ * @param path   The path of the sidecar index
+ * @param st     The status of the LiME file
+ *
+ * @return 0 for success, else -1 if the index is missing, stale or invalid
+ */
+static int load_index(struct lime_reader* reader,
+                      const char* path,
+                      const struct stat* st)
+{
+    struct stat index_st;
+    lime_index_header header;
+
+    int fd = open64(path, O_RDONLY | O_LARGEFILE);
+    if (-1 == fd)
+    {
+        return -1;
+    }
+
+    if (-1 == fstat(fd, &index_st) || 
+        (uint64_t) index_st.st_size < sizeof(header) ||
+        -1 == read_all_at(fd, &header, sizeof(header), 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (LIME_INDEX_MAGIC != header.magic || LIME_INDEX_VERSION != header.version ||
+        (uint64_t) st->st_size != header.dump_size || 
+        mtime_ns(st) != header.dump_mtime ||
+        (index_st.st_size - sizeof(header)) / sizeof(lime_index_entry) != 
+            header.num_sections)
+    {
+        print_yellow("[!] Ignoring stale index %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, index_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        return -1;
+    }
+
+    reader->index_map = map;
+    reader->index_map_size = index_st.st_size;
+    reader->sections = (struct section*) ((char*) map + sizeof(header));
+    reader->num_sections = header.num_sections;
+    return 0;
+}
+
+/**
+ * Saves the range index of a reader as a sidecar index.
+ *
+ * @param reader The reader whose index should be saved
+ * @param path   The path of the sidecar index
+ * @param st     The status of the LiME file
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int save_index(const struct lime_reader* reader,
+                      const char* path,
+                      const struct stat* st)
+{
+    lime_index_header header = {
+        .magic = LIME_INDEX_MAGIC,
+        .version = LIME_INDEX_VERSION,
+        .dump_size = st->st_size,
+        .dump_mtime = mtime_ns(st),
+        .num_sections = reader->num_sections,
+    };
+
+    int fd = open64(path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 
+        S_IRUSR | S_IWUSR);
+    if (-1 == fd)
+    {
+        return -1;
+    }
+
+    if (-1 == write_all(fd, &header, sizeof(header)) ||
+        -1 == write_all(fd, reader->sections, 
+            reader->num_sections * sizeof(struct section)))
+    {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    return close(fd);
+}
+
+/**
+ * Makes room for one more range in the index.
+ *
+ * @param reader   The reader being indexed
+ * @param capacity The number of ranges there's room for (input/output)
+ *
+ * @return The new range, else NULL if there's an error
+ */
+static struct section* add_section(struct lime_reader* reader, 
+                                   uint64_t* capacity)
+{
+    if (reader->num_sections == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        struct section* sections = realloc(reader->sections, 
+            *capacity * sizeof(struct section));
+        if (NULL == sections)
+        {
+            fprint_red(stderr, "[-] Failed to allocate the range index\n");
+            return NULL;
+        }
+        reader->sections = sections;
+    }
+
+    return &reader->sections[reader->num_sections++];
+}
+
+/**
+ * Builds the range index of an ELF core from its PT_LOAD segments. Each
+ * segment's physical address is taken from p_paddr.
+ *
+ * @param reader The reader to index
+ * @param path   The path of the ELF core, for messages
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int scan_segments(struct lime_reader* reader, const char* path)
+{
+    uint64_t capacity = 0;
+    Elf64_Ehdr ehdr;
+
+    memcpy(&ehdr, reader->data, sizeof(ehdr));
+    uint64_t num_phdrs = ehdr.e_phnum;
+
+    // Too many segments for e_phnum, so the count is in the first section
+    if (PN_XNUM == ehdr.e_phnum && ehdr.e_shoff <= reader->data_size && 
+        reader->data_size - ehdr.e_shoff >= sizeof(Elf64_Shdr))
+    {
+        Elf64_Shdr shdr;
+        memcpy(&shdr, reader->data + ehdr.e_shoff, sizeof(shdr));
+        num_phdrs = shdr.sh_info;
+    }
+
+    if (ELFCLASS64 != ehdr.e_ident[EI_CLASS] || 
+        sizeof(Elf64_Phdr) != ehdr.e_phentsize ||
+        ehdr.e_phoff > reader->data_size ||
+        num_phdrs > (reader->data_size - ehdr.e_phoff) / sizeof(Elf64_Phdr))
+    {
+        fprint_red(stderr, "[-] Invalid ELF header in %s\n", path);
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < num_phdrs; i++)
+    {
+        Elf64_Phdr phdr;
+        memcpy(&phdr, reader->data + ehdr.e_phoff + i * sizeof(Elf64_Phdr),
+            sizeof(phdr));
+        if (PT_LOAD != phdr.p_type || 0 == phdr.p_filesz)
+        {
+            continue;
+        }
+
+        if (phdr.p_offset > reader->data_size || 
+            phdr.p_filesz > reader->data_size - phdr.p_offset)
+        {
+            fprint_red(stderr, "[-] Truncated ELF segment %lu in %s\n", i, path);
+            return -1;
+        }
+
+        struct section* section = add_section(reader, &capacity);
+        if (NULL == section)
+        {
+            return -1;
+        }
+        section->physical_base = phdr.p_paddr;
+        section->virtual_base = phdr.p_vaddr;
+        section->file_offset = phdr.p_offset;
+        section->size = phdr.p_filesz;
+    }
+
+    return 0;
+}
+
+/**
+ * Builds the range index of a LiME file in a single pass over its headers.
+ *
+ * @param reader The reader to index
+ * @param path   The path of the LiME file, for messages
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int scan_headers(struct lime_reader* reader, const char* path)
+{
+    uint64_t capacity = 0;
+    uint64_t offset = 0;
+
+    while (offset < reader->data_size)
+    {
+        lime_memory_range_header header;
+        if (reader->data_size - offset < sizeof(header))
+        {
+            fprint_red(stderr, "[-] Truncated LiME header in %s at 0x%lx\n",
+                path, offset);
+            return -1;
+        }
+
+        memcpy(&header, reader->data + offset, sizeof(header));
+        uint64_t data_offset = offset + sizeof(header);
+        uint64_t len = header.e_addr - header.s_addr + 1;
+
+        if (LIME_HEADER_MAGIC != header.magic || header.e_addr < header.s_addr ||
+            0 == len || len > reader->data_size - data_offset)
+        {
+            fprint_red(stderr, "[-] Invalid LiME header in %s at 0x%lx\n", 
+                path, offset);
+            return -1;
+        }
+
+        struct section* section = add_section(reader, &capacity);
+        if (NULL == section)
+        {
+            return -1;
+        }
+        section->physical_base = header.s_addr;
+        section->virtual_base = 0;
+        section->file_offset = data_offset;
+        section->size = len;
+
+        offset = data_offset + len;
+    }
+
+    return 0;
+}
+
+/**
+ * Builds the range index of a dump, which may either be a LiME file or an
+ * ELF core.
+ *
+ * @param reader The reader to index
+ * @param path   The path of the dump, for messages
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int scan_ranges(struct lime_reader* reader, const char* path)
+{
+    int ret;
+    if (reader->data_size >= sizeof(Elf64_Ehdr) && 
+        0 == memcmp(reader->data, ELFMAG, SELFMAG))
+    {
+        ret = scan_segments(reader, path);
+    }
+    else
+    {
+        ret = scan_headers(reader, path);
+    }
+
+    if (-1 == ret)
+    {
+        return -1;
+    }
+
+    qsort(reader->sections, reader->num_sections, sizeof(struct section), 
+        compare_sections);
+
+    for (uint64_t i = 1; i < reader->num_sections; i++)
+    {
+        const struct section* prev = &reader->sections[i - 1];
+        if (prev->physical_base + prev->size > reader->sections[i].physical_base)
+        {
+            fprint_red(stderr, "[-] Overlapping ranges in %s at 0x%lx\n",
+                path, reader->sections[i].physical_base);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Opens one of the files a dump was striped across. Files that have been
+ * moved are also looked for next to the layout.
+ *
+ * @param layout_path The path of the layout
+ * @param path        The path of the file, as recorded in the layout
+ *
+ * @return The file descriptor, else -1 if there's an error
+ */
+static int open_stripe_target(const char* layout_path, const char* path)
+{
+    char moved[PATH_MAX];
+
+    int fd = open64(path, O_RDONLY | O_LARGEFILE);
+    if (-1 != fd)
+    {
+        return fd;
+    }
+
+    const char* name = strrchr(path, '/');
+    const char* dir_end = strrchr(layout_path, '/');
+    name = NULL != name ? name + 1 : path;
+    int dir_len = NULL != dir_end ? (int) (dir_end - layout_path) : 1;
+    const char* dir = NULL != dir_end ? layout_path : ".";
+    if ((size_t) snprintf(moved, sizeof(moved), "%.*s/%s", dir_len, dir, name) >= 
+        sizeof(moved))
+    {
+        return -1;
+    }
+
+    return open64(moved, O_RDONLY | O_LARGEFILE);
+}
+
+/**
+ * Presents a striped dump as one image. Address space for the whole image
+ * is reserved, and each stripe is mapped from its file into place, so the
+ * stripes read back as the original dump without being copied.
+ *
+ * @param reader The reader to map the image into
+ * @param path   The path of the layout
+ * @param fd     The file descriptor of the layout
+ * @param st     The status of the layout
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int map_stripes(struct lime_reader* reader, 
+                       const char* path, 
+                       const int fd, 
+                       const struct stat* st)
+{
+    int ret = -1;
+    int target_fd = -1;
+    stripe_file_header header;
+    char* names = NULL;
+
+    size_t names_len = st->st_size - sizeof(header);
+    if ((uint64_t) st->st_size < sizeof(header) || 
+        -1 == read_all_at(fd, &header, sizeof(header), 0) ||
+        STRIPE_VERSION != header.version || 0 == header.stripe_size || 
+        0 != header.stripe_size % sysconf(_SC_PAGESIZE) ||
+        0 == header.num_targets || header.num_targets > MAX_STRIPE_TARGETS ||
+        NULL == (names = malloc(names_len + 1)) ||
+        -1 == read_all_at(fd, names, names_len, sizeof(header)))
+    {
+        fprint_red(stderr, "[-] %s isn't a valid stripe layout\n", path);
+        goto cleanup;
+    }
+    names[names_len] = '\0';
+
+    if (0 == header.image_size)
+    {
+        ret = 0;
+        goto cleanup;
+    }
+
+    void* image = mmap(NULL, header.image_size, PROT_NONE, 
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (MAP_FAILED == image)
+    {
+        fprint_red(stderr, "[-] Could not reserve 0x%lx bytes for %s\n", 
+            header.image_size, path);
+        goto cleanup;
+    }
+    reader->data = image;
+    reader->data_size = header.image_size;
+
+    const char* name = names;
+    for (uint64_t t = 0; t < header.num_targets; t++)
+    {
+        struct stat target_st;
+
+        if (name >= names + names_len)
+        {
+            fprint_red(stderr, "[-] %s isn't a valid stripe layout\n", path);
+            goto cleanup;
+        }
+
+        if (-1 == (target_fd = open_stripe_target(path, name)) || 
+            -1 == fstat(target_fd, &target_st))
+        {
+            fprint_red(stderr, "[-] Could not open %s\n", name);
+            goto cleanup;
+        }
+
+        for (uint64_t stripe = t; stripe * header.stripe_size < header.image_size; 
+            stripe += header.num_targets)
+        {
+            uint64_t offset = stripe * header.stripe_size;
+            uint64_t target_offset = stripe / header.num_targets * header.stripe_size;
+            uint64_t len = header.image_size - offset < header.stripe_size ?
+                header.image_size - offset : header.stripe_size;
+
+            if (target_offset + len > (uint64_t) target_st.st_size)
+            {
+                fprint_red(stderr, "[-] %s is truncated\n", name);
+                goto cleanup;
+            }
+
+            if (MAP_FAILED == mmap((char*) image + offset, len, PROT_READ, 
+                MAP_SHARED | MAP_FIXED, target_fd, target_offset))
+            {
+                fprint_red(stderr, "[-] Could not map %s (errno %d), a larger "
+                    "--stripe-size may help\n", name, errno);
+                goto cleanup;
+            }
+        }
+
+        close(target_fd);
+        target_fd = -1;
+        name += strlen(name) + 1;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (target_fd >= 0)
+    {
+        close(target_fd);
+    }
+    free(names);
+    return ret;
+}
+
+/**
+ * Opens a LiME file or ELF core for reading by physical address. The file
+ * is mapped rather than read, so data is only paged in as it's accessed.
+ *
+ * The file may also be the layout of a dump that was striped across several
+ * files, which are then read as one.
+ *
+ * If an index path is given and it holds an up to date sidecar index, the
+ * index is mapped in place of scanning the file. Otherwise the file is
+ * scanned and the index is written there for next time.
+ *
+ * @param path       The path of the LiME file
+ * @param index_path The path of the sidecar index, or NULL for none
+ *
+ * @return The reader, else NULL if there's an error
+ */
+struct lime_reader* lime_reader_open(const char* path, const char* index_path)
+{
+    struct stat st;
+
+    struct lime_reader* reader = calloc(1, sizeof(struct lime_reader));
+    if (NULL == reader)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the reader\n");
+        return NULL;
+    }
+
+    int fd = open64(path, O_RDONLY | O_LARGEFILE);
+    if (-1 == fd || -1 == fstat(fd, &st))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        goto fail;
+    }
+
+    unsigned int magic = 0;
+    if (0 == read_all_at(fd, &magic, sizeof(magic), 0) && 
+        STRIPE_MAGIC == magic)
+    {
+        if (-1 == map_stripes(reader, path, fd, &st))
+        {
+            goto fail;
+        }
+    }
+    else if ((reader->data_size = st.st_size) > 0)
+    {
+        void* map = mmap(NULL, reader->data_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (MAP_FAILED == map)
+        {
+            fprint_red(stderr, "[-] Could not map %s (errno %d)\n", path, errno);
+            goto fail;
+        }
+        reader->data = map;
+    }
+
+    close(fd);
+    fd = -1;
+
+    if (NULL != index_path && 0 == load_index(reader, index_path, &st))
+    {
+        return reader;
+    }
+
+    if (-1 == scan_ranges(reader, path))
+    {
+        goto fail;
+    }
+
+    if (NULL != index_path && -1 == save_index(reader, index_path, &st))
+    {
+        print_yellow("[!] Could not save index %s (errno %d)\n", index_path, 
+            errno);
+    }
+
+    return reader;
+
+fail:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    lime_reader_close(reader);
+    return NULL;
+}
+
+/**
+ * Closes a LiME file, unmapping it and releasing its index.
+ *
+ * @param reader The reader to close
+ */
+void lime_reader_close(struct lime_reader* reader)
+{
+    if (NULL == reader)
+    {
+        return;
+    }
+
+    if (NULL != reader->index_map)
+    {
+        munmap(reader->index_map, reader->index_map_size);
+    }
+    else
+    {
+        free(reader->sections);
+    }
+
+    if (NULL != reader->data)
+    {
+        munmap((void*) reader->data, reader->data_size);
+    }
+
+    free(reader);
+}
+
+/**
+ * Finds the range that contains a physical address, or failing that the
+ * first range after it.
+ *
+ * @param reader           The reader to search
+ * @param physical_address The address to look for
+ *
+ * @return The index of the range, which is num_sections if there are none
+ */
+uint64_t lime_reader_find(const struct lime_reader* reader, 
+                          const uint64_t physical_address)
+{
+    uint64_t lo = 0;
+    uint64_t hi = reader->num_sections;
+
+    // Find the first range that ends after the address
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        const struct section* s = &reader->sections[mid];
+        if (s->physical_base + s->size <= physical_address)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * Gets the captured contents of a physical address range. No data is
+ * copied, the result points straight into the mapped file.
+ *
+ * @param reader           The reader to read from
+ * @param physical_address The address to read from
+ * @param len              The number of bytes to read
+ *
+ * @return The data, else NULL if the range wasn't captured in a single piece
+ */
+const char* lime_read_phys(const struct lime_reader* reader,
+                           const uint64_t physical_address,
+                           const uint64_t len)
+{
+    uint64_t i = lime_reader_find(reader, physical_address);
+    if (i >= reader->num_sections)
+    {
+        return NULL;
+    }
+
+    const struct section* s = &reader->sections[i];
+    if (s->physical_base > physical_address ||
+        len > s->size - (physical_address - s->physical_base) ||
+        s->file_offset > reader->data_size || 
+        s->size > reader->data_size - s->file_offset)
+    {
+        return NULL;
+    }
+
+    return reader->data + s->file_offset + (physical_address - s->physical_base);
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lmat.h"
+
+#define LIME_INDEX_MAGIC 0x58444D4C    // "LMDX"
+#define LIME_INDEX_VERSION 2
+
+// The header at the start of a sidecar index file. It is followed by
+// num_sections lime_index_entry entries, sorted by physical address.
+typedef struct
+{
+    unsigned int magic;         // Always 0x58444D4C (LMDX)
+    unsigned int version;       // Format version number
+    uint64_t dump_size;         // The size of the indexed LiME file
+    uint64_t dump_mtime;        // The modification time of the LiME file (ns)
+    uint64_t num_sections;      // The number of ranges in the LiME file
+} __attribute__ ((__packed__)) lime_index_header;
+
+// Describes where a range's data lives within the LiME file
+typedef struct
+{
+    uint64_t physical_base;     // Starting address of the range
+    uint64_t virtual_base;      // Kernel virtual address of the range, if known
+    uint64_t file_offset;       // Offset of the range's data in the LiME file
+    uint64_t size;              // Size of the range
+} __attribute__ ((__packed__)) lime_index_entry;
+
+// A LiME file mapped into memory, with its ranges indexed by address
+struct lime_reader
+{
+    const char*         data;
+    uint64_t            data_size;
+
+    // The ranges of the file, sorted by physical address. These either live
+    // in their own allocation or point straight into a mapped sidecar index.
+    struct section*     sections;
+    uint64_t            num_sections;
+
+    void*               index_map;
+    uint64_t            index_map_size;
+};
+
+struct lime_reader* lime_reader_open(const char* path, const char* index_path);
+
+void lime_reader_close(struct lime_reader* reader);
+
+uint64_t lime_reader_find(const struct lime_reader* reader, 
+                          const uint64_t physical_address);
+
+const char* lime_read_phys(const struct lime_reader* reader,
+                           const uint64_t physical_address,
+                           const uint64_t len);
\ No newline at end of file
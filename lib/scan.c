@@ -0,0 +1,649 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "scan.h"
+
+#include "color-print.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/**
+ * Converts a hex digit to its value.
+ *
+ * @param c The digit
+ *
+ * @return The value of the digit, else -1 if it isn't one
+ */
+static int hex_value(const char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * Parses a signature written as hex bytes, which may be separated by spaces.
+ *
+ * @param text  The signature
+ * @param bytes The bytes of the signature (output)
+ * @param len   The number of bytes (output)
+ *
+ * @return 0 for success, else -1 if the signature is invalid
+ */
+static int parse_hex(const char* text, uint8_t* bytes, size_t* len)
+{
+    int high = -1;
+
+    *len = 0;
+    for (; '\0' != *text; text++)
+    {
+        if (isspace((unsigned char) *text))
+        {
+            continue;
+        }
+
+        int nibble = hex_value(*text);
+        if (-1 == nibble)
+        {
+            return -1;
+        }
+        if (-1 == high)
+        {
+            high = nibble;
+            continue;
+        }
+        if (SCAN_MAX_PATTERN == *len)
+        {
+            return -1;
+        }
+        bytes[(*len)++] = (high << 4) | nibble;
+        high = -1;
+    }
+
+    return -1 == high && *len > 0 ? 0 : -1;
+}
+
+/**
+ * Parses a signature written as a quoted string. Quotes, backslashes and
+ * arbitrary bytes can be escaped as \", \\ and \xNN.
+ *
+ * @param text  The signature, starting with its opening quote
+ * @param bytes The bytes of the signature (output)
+ * @param len   The number of bytes (output)
+ *
+ * @return 0 for success, else -1 if the signature is invalid
+ */
+static int parse_string(const char* text, uint8_t* bytes, size_t* len)
+{
+    *len = 0;
+    for (text++; '"' != *text; text++)
+    {
+        if ('\0' == *text || SCAN_MAX_PATTERN == *len)
+        {
+            return -1;
+        }
+
+        if ('\\' != *text)
+        {
+            bytes[(*len)++] = *text;
+            continue;
+        }
+
+        text++;
+        if ('"' == *text || '\\' == *text)
+        {
+            bytes[(*len)++] = *text;
+        }
+        else if ('x' == *text && -1 != hex_value(text[1]) && 
+            -1 != hex_value(text[2]))
+        {
+            bytes[(*len)++] = (hex_value(text[1]) << 4) | hex_value(text[2]);
+            text += 2;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    // Only whitespace may follow the closing quote
+    for (text++; '\0' != *text; text++)
+    {
+        if (!isspace((unsigned char) *text))
+        {
+            return -1;
+        }
+    }
+
+    return *len > 0 ? 0 : -1;
+}
+
+/**
+ * Loads the signatures from a file. Each line holds a name and then the
+ * signature, either as hex bytes or as a quoted string. Blank lines and
+ * lines starting with # are ignored.
+ *
+ * @param scanner The scanner to add the signatures to
+ * @param path    The path of the signature file
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int load_patterns(struct scanner* scanner, const char* path)
+{
+    int ret = 0;
+    int line_number = 0, capacity = 0;
+    char* lineptr = NULL;
+    size_t n = 0;
+    uint8_t bytes[SCAN_MAX_PATTERN];
+
+    FILE* file = fopen(path, "r");
+    if (NULL == file)
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", path);
+        return -1;
+    }
+
+    while (-1 != getline(&lineptr, &n, file))
+    {
+        line_number++;
+        lineptr[strcspn(lineptr, "\r\n")] = '\0';
+
+        char* name = lineptr + strspn(lineptr, " \t");
+        if ('\0' == *name || '#' == *name)
+        {
+            continue;
+        }
+
+        char* text = name + strcspn(name, " \t");
+        if ('\0' != *text)
+        {
+            *text++ = '\0';
+            text += strspn(text, " \t");
+        }
+
+        size_t len;
+        int parsed = '"' == *text ? parse_string(text, bytes, &len) : 
+            parse_hex(text, bytes, &len);
+        if (-1 == parsed)
+        {
+            fprint_red(stderr, "[-] Invalid signature on line %d of %s\n", 
+                line_number, path);
+            ret = -1;
+            break;
+        }
+
+        if (scanner->num_patterns == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            struct scan_pattern* patterns = realloc(scanner->patterns, 
+                capacity * sizeof(struct scan_pattern));
+            if (NULL == patterns)
+            {
+                fprint_red(stderr, "[-] Failed to allocate the signatures\n");
+                ret = -1;
+                break;
+            }
+            scanner->patterns = patterns;
+        }
+
+        struct scan_pattern* pattern = &scanner->patterns[scanner->num_patterns];
+        pattern->name = strdup(name);
+        pattern->bytes = malloc(len);
+        pattern->len = len;
+        scanner->num_patterns++;
+        if (NULL == pattern->name || NULL == pattern->bytes)
+        {
+            fprint_red(stderr, "[-] Failed to allocate the signatures\n");
+            ret = -1;
+            break;
+        }
+        memcpy(pattern->bytes, bytes, len);
+    }
+
+    if (0 == ret && 0 == scanner->num_patterns)
+    {
+        fprint_red(stderr, "[-] There are no signatures in %s\n", path);
+        ret = -1;
+    }
+
+    free(lineptr);
+    fclose(file);
+    return ret;
+}
+
+/**
+ * Compiles the signatures into an automaton. The trie of signatures is
+ * walked breadth first to set each state's failure link, and every missing
+ * transition is filled in from the failure link's, so scanning only ever
+ * takes one step per byte.
+ *
+ * @param scanner The scanner holding the signatures
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int build_automaton(struct scanner* scanner)
+{
+    size_t max_states = 1;
+    for (int i = 0; i < scanner->num_patterns; i++)
+    {
+        max_states += scanner->patterns[i].len;
+    }
+    if (max_states > SCAN_MAX_STATES)
+    {
+        fprint_red(stderr, "[-] The signatures are too long to search for at once\n");
+        return -1;
+    }
+
+    scanner->next = calloc(max_states * 256, sizeof(uint32_t));
+    scanner->fail = calloc(max_states, sizeof(uint32_t));
+    scanner->match = malloc(max_states * sizeof(int));
+    scanner->output = calloc(max_states, sizeof(uint32_t));
+    uint32_t* queue = malloc(max_states * sizeof(uint32_t));
+    if (NULL == scanner->next || NULL == scanner->fail || 
+        NULL == scanner->match || NULL == scanner->output || NULL == queue)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the signature automaton\n");
+        free(queue);
+        return -1;
+    }
+
+    // Build the trie, where 0 means there's no transition yet as nothing
+    // leads back to the root
+    scanner->num_states = 1;
+    scanner->match[0] = -1;
+    for (int i = 0; i < scanner->num_patterns; i++)
+    {
+        const struct scan_pattern* pattern = &scanner->patterns[i];
+        uint32_t state = 0;
+        for (size_t j = 0; j < pattern->len; j++)
+        {
+            uint32_t* next = &scanner->next[(size_t) state * 256 + 
+                pattern->bytes[j]];
+            if (0 == *next)
+            {
+                *next = scanner->num_states++;
+                scanner->match[*next] = -1;
+            }
+            state = *next;
+        }
+
+        if (-1 != scanner->match[state])
+        {
+            print_yellow("[!] Signature %s is the same as %s, so it's ignored\n",
+                pattern->name, scanner->patterns[scanner->match[state]].name);
+            continue;
+        }
+        scanner->match[state] = i;
+    }
+
+    size_t head = 0, tail = 0;
+    queue[tail++] = 0;
+    while (head < tail)
+    {
+        uint32_t state = queue[head++];
+        uint32_t* next = &scanner->next[(size_t) state * 256];
+        const uint32_t* fallback = &scanner->next[(size_t) scanner->fail[state] * 256];
+
+        for (int c = 0; c < 256; c++)
+        {
+            if (0 == next[c])
+            {
+                next[c] = 0 == state ? 0 : fallback[c];
+                continue;
+            }
+
+            uint32_t child = next[c];
+            scanner->fail[child] = 0 == state ? 0 : fallback[c];
+            scanner->output[child] = -1 != scanner->match[child] ? child : 
+                scanner->output[scanner->fail[child]];
+            queue[tail++] = child;
+        }
+    }
+
+    free(queue);
+    return 0;
+}
+
+/**
+ * Sets up the prefilter on the bytes that can start a signature. Each byte
+ * is put in a bucket by its high nibble, and marked in the masks for its
+ * low and high nibbles, so a byte can only start a signature if the masks
+ * for both of its nibbles share a bucket. That's exact for up to 8 distinct
+ * high nibbles, and lets some bytes through otherwise, which the automaton
+ * then steps past.
+ *
+ * @param scanner The scanner holding the signatures
+ */
+static void build_prefilter(struct scanner* scanner)
+{
+    int bucket[16];
+    int num_buckets = 0;
+
+    memset(bucket, 0xFF, sizeof(bucket));
+    for (int i = 0; i < scanner->num_patterns; i++)
+    {
+        uint8_t c = scanner->patterns[i].bytes[0];
+        scanner->start[c] = 1;
+        if (-1 == bucket[c >> 4])
+        {
+            bucket[c >> 4] = num_buckets++ % 8;
+        }
+        scanner->low_mask[c & 0xF] |= 1 << bucket[c >> 4];
+        scanner->high_mask[c >> 4] |= 1 << bucket[c >> 4];
+    }
+}
+
+/**
+ * Finds how many bytes at the start of a buffer can't start a signature, one
+ * byte at a time.
+ *
+ * @param scanner The scanner
+ * @param data    The buffer to check
+ * @param len     The length of the buffer
+ *
+ * @return The number of bytes that can be skipped
+ */
+static size_t skip_scalar(const struct scanner* scanner, 
+                          const uint8_t* data, 
+                          const size_t len)
+{
+    size_t i = 0;
+    while (i < len && !scanner->start[data[i]])
+    {
+        i++;
+    }
+    return i;
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Finds how many bytes at the start of a buffer can't start a signature, 16
+ * bytes at a time using SSSE3.
+ *
+ * @param scanner The scanner
+ * @param data    The buffer to check
+ * @param len     The length of the buffer
+ *
+ * @return The number of bytes that can be skipped
+ */
+__attribute__((target("ssse3")))
+static size_t skip_ssse3(const struct scanner* scanner, 
+                         const uint8_t* data, 
+                         const size_t len)
+{
+    const __m128i low = _mm_loadu_si128((const __m128i*) scanner->low_mask);
+    const __m128i high = _mm_loadu_si128((const __m128i*) scanner->high_mask);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i lo = _mm_shuffle_epi8(low, _mm_and_si128(v, nibble));
+        __m128i hi = _mm_shuffle_epi8(high, 
+            _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        unsigned int candidates = 0xFFFF & 
+            ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero));
+        if (candidates)
+        {
+            return i + __builtin_ctz(candidates);
+        }
+    }
+
+    return i + skip_scalar(scanner, data + i, len - i);
+}
+
+/**
+ * Finds how many bytes at the start of a buffer can't start a signature, 32
+ * bytes at a time using AVX2.
+ *
+ * @param scanner The scanner
+ * @param data    The buffer to check
+ * @param len     The length of the buffer
+ *
+ * @return The number of bytes that can be skipped
+ */
+__attribute__((target("avx2")))
+static size_t skip_avx2(const struct scanner* scanner, 
+                        const uint8_t* data, 
+                        const size_t len)
+{
+    const __m256i low = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*) scanner->low_mask));
+    const __m256i high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*) scanner->high_mask));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i lo = _mm256_shuffle_epi8(low, _mm256_and_si256(v, nibble));
+        __m256i hi = _mm256_shuffle_epi8(high, 
+            _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        unsigned int candidates = ~(unsigned int) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero));
+        if (candidates)
+        {
+            return i + __builtin_ctz(candidates);
+        }
+    }
+
+    return i + skip_scalar(scanner, data + i, len - i);
+}
+#endif
+
+/**
+ * Picks the fastest prefilter supported by the CPU we're running on.
+ *
+ * @return The prefilter to use
+ */
+static scan_skip_fn select_skip(void)
+{
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return skip_avx2;
+    }
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        return skip_ssse3;
+    }
+#endif
+    return skip_scalar;
+}
+
+/**
+ * Creates a scanner for the signatures in a file, which writes the physical
+ * address and name of each match it finds to another.
+ *
+ * @param patterns_path The path of the signature file
+ * @param hits_path     The path to write the matches to
+ *
+ * @return The scanner, else NULL if there's an error
+ */
+struct scanner* scanner_create(const char* patterns_path, 
+                               const char* hits_path)
+{
+    struct scanner* scanner = calloc(1, sizeof(struct scanner));
+    if (NULL == scanner)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the scanner\n");
+        return NULL;
+    }
+
+    if (-1 == load_patterns(scanner, patterns_path) || 
+        -1 == build_automaton(scanner))
+    {
+        scanner_free(scanner);
+        return NULL;
+    }
+    build_prefilter(scanner);
+    scanner->skip = select_skip();
+
+    if (NULL == (scanner->hits = fopen(hits_path, "w")))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", hits_path);
+        scanner_free(scanner);
+        return NULL;
+    }
+
+    return scanner;
+}
+
+/**
+ * Scans a chunk of memory for the signatures. A chunk that carries straight
+ * on from the last one picks up where it left off, so matches can span
+ * chunks. While no signature is partly matched, the prefilter skips over
+ * the bytes that can't start one.
+ *
+ * @param scanner The scanner
+ * @param address The physical address of the chunk
+ * @param data    The contents of the chunk
+ * @param len     The length of the chunk
+ */
+void scanner_scan(struct scanner* scanner,
+                  const uint64_t address,
+                  const char* data,
+                  const size_t len)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint32_t state = address == scanner->next_address ? scanner->state : 0;
+    size_t i = 0;
+
+    while (i < len)
+    {
+        if (0 == state)
+        {
+            i += scanner->skip(scanner, bytes + i, len - i);
+            if (i == len)
+            {
+                break;
+            }
+        }
+
+        state = scanner->next[(size_t) state * 256 + bytes[i]];
+        for (uint32_t o = scanner->output[state]; 0 != o; 
+            o = scanner->output[scanner->fail[o]])
+        {
+            const struct scan_pattern* pattern = 
+                &scanner->patterns[scanner->match[o]];
+            fprintf(scanner->hits, "0x%016lx %s\n", 
+                address + i + 1 - pattern->len, pattern->name);
+            scanner->num_hits++;
+        }
+        i++;
+    }
+
+    scanner->state = state;
+    scanner->next_address = address + len;
+}
+
+/**
+ * Finishes writing the matches.
+ *
+ * @param scanner The scanner
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int scanner_finish(struct scanner* scanner)
+{
+    int ret = fclose(scanner->hits);
+    scanner->hits = NULL;
+    if (0 != ret)
+    {
+        fprint_red(stderr, "[-] Failed to write the signature matches (errno %d)\n", 
+            errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Works out how much memory a scanner holds, which is mostly the
+ * automaton's transition table.
+ *
+ * @param scanner The scanner
+ *
+ * @return The number of bytes allocated for the scanner
+ */
+size_t scanner_memory(const struct scanner* scanner)
+{
+    size_t size = sizeof(struct scanner) + 
+        scanner->num_patterns * sizeof(struct scan_pattern);
+    size_t max_states = 1;
+
+    for (int i = 0; i < scanner->num_patterns; i++)
+    {
+        size += strlen(scanner->patterns[i].name) + 1 + 
+            scanner->patterns[i].len;
+        max_states += scanner->patterns[i].len;
+    }
+
+    return size + max_states * (256 * sizeof(uint32_t) + 
+        2 * sizeof(uint32_t) + sizeof(int));
+}
+
+/**
+ * Frees a scanner.
+ *
+ * @param scanner The scanner to free
+ */
+void scanner_free(struct scanner* scanner)
+{
+    if (NULL == scanner)
+    {
+        return;
+    }
+
+    if (NULL != scanner->hits)
+    {
+        fclose(scanner->hits);
+    }
+    for (int i = 0; i < scanner->num_patterns; i++)
+    {
+        free(scanner->patterns[i].name);
+        free(scanner->patterns[i].bytes);
+    }
+    free(scanner->patterns);
+    free(scanner->next);
+    free(scanner->fail);
+    free(scanner->match);
+    free(scanner->output);
+    free(scanner);
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The longest signature that can be searched for
+#define SCAN_MAX_PATTERN 256
+
+// The most automaton states, which bounds the total length of the signatures
+#define SCAN_MAX_STATES 0x10000
+
+// A signature to search for
+struct scan_pattern
+{
+    char*       name;
+    uint8_t*    bytes;
+    size_t      len;
+};
+
+struct scanner;
+
+// Finds how many bytes at the start of a buffer can't start a signature
+typedef size_t (*scan_skip_fn)(const struct scanner* scanner,
+                               const uint8_t* data,
+                               const size_t len);
+
+// Searches the memory being copied for a set of signatures. The signatures
+// are compiled into an Aho-Corasick automaton whose state is carried from
+// one chunk to the next, so matches can span chunks.
+struct scanner
+{
+    struct scan_pattern*    patterns;
+    int                     num_patterns;
+
+    // The automaton's transitions, 256 for each state
+    uint32_t*               next;
+
+    // The failure link of each state
+    uint32_t*               fail;
+
+    // The signature that ends at each state, else -1
+    int*                    match;
+
+    // The closest state on each failure chain that ends a signature, else 0
+    uint32_t*               output;
+    uint32_t                num_states;
+
+    // The bytes that can start a signature, and the same set split into
+    // nibble masks for the vectorised prefilter
+    uint8_t                 start[256];
+    uint8_t                 low_mask[16];
+    uint8_t                 high_mask[16];
+    scan_skip_fn            skip;
+
+    // Where the last chunk left off
+    uint32_t                state;
+    uint64_t                next_address;
+
+    FILE*                   hits;
+    uint64_t                num_hits;
+};
+
+struct scanner* scanner_create(const char* patterns_path, 
+                               const char* hits_path);
+
+void scanner_scan(struct scanner* scanner,
+                  const uint64_t address,
+                  const char* data,
+                  const size_t len);
+
+int scanner_finish(struct scanner* scanner);
+
+size_t scanner_memory(const struct scanner* scanner);
+
+void scanner_free(struct scanner* scanner);
\ No newline at end of file
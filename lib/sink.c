@@ -0,0 +1,198 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "sink.h"
+
+#include "io.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// A sink that writes directly to a regular file
+struct file_sink
+{
+    struct sink sink;
+    int         fd;
+    int         skipped;
+};
+
+/**
+ * Writes data to a file sink, retrying short writes.
+ *
+ * @param sink The sink to write to
+ * @param data The data to write
+ * @param len  The length of the data
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int file_sink_write(struct sink* sink, const char* data, const size_t len)
+{
+    struct file_sink* fs = (struct file_sink*) sink;
+    return write_all(fs->fd, data, len);
+}
+
+/**
+ * Seeks a file sink over a run of zeros, leaving a hole in the file.
+ *
+ * @param sink The sink to skip in
+ * @param len  The number of bytes to skip
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int file_sink_skip(struct sink* sink, const size_t len)
+{
+    struct file_sink* fs = (struct file_sink*) sink;
+
+    if (-1 == lseek64(fs->fd, len, SEEK_CUR))
+    {
+        return -1;
+    }
+
+    fs->skipped = 1;
+    return 0;
+}
+
+/**
+ * Finishes a file sink. Any zeros skipped at the very end of the output have
+ * to be accounted for by extending the file.
+ *
+ * @param sink The sink to finish
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int file_sink_finish(struct sink* sink)
+{
+    struct file_sink* fs = (struct file_sink*) sink;
+
+    if (fs->skipped && -1 == ftruncate(fs->fd, lseek64(fs->fd, 0, SEEK_CUR)))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Releases a file sink. The file descriptor is owned by the caller.
+ *
+ * @param sink The sink to release
+ */
+static void file_sink_destroy(struct sink* sink)
+{
+    free(sink);
+}
+
+static const struct sink_ops file_sink_ops = {
+    .write = file_sink_write,
+    .skip = file_sink_skip,
+    .finish = file_sink_finish,
+    .destroy = file_sink_destroy,
+};
+
+/**
+ * Creates a sink that writes to a regular file.
+ *
+ * @param fd The file descriptor of the file
+ *
+ * @return The sink, else NULL if there's an error
+ */
+struct sink* file_sink_create(const int fd)
+{
+    struct file_sink* fs = calloc(1, sizeof(struct file_sink));
+    if (NULL == fs)
+    {
+        return NULL;
+    }
+
+    fs->sink.ops = &file_sink_ops;
+    fs->fd = fd;
+    return &fs->sink;
+}
+
+/**
+ * Writes data to a sink.
+ *
+ * @param sink The sink to write to
+ * @param data The data to write
+ * @param len  The length of the data
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int sink_write(struct sink* sink, const char* data, const size_t len)
+{
+    return sink->ops->write(sink, data, len);
+}
+
+/**
+ * Advances a sink past a run of zeros. Sinks that can't leave holes write
+ * the zeros out instead.
+ *
+ * @param sink The sink to skip in
+ * @param len  The number of zero bytes to skip
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int sink_skip(struct sink* sink, const size_t len)
+{
+    if (NULL != sink->ops->skip)
+    {
+        return sink->ops->skip(sink, len);
+    }
+
+    static const char zeros[0x1000];
+    size_t remaining = len;
+    while (remaining)
+    {
+        size_t n = remaining > sizeof(zeros) ? sizeof(zeros) : remaining;
+        if (-1 == sink->ops->write(sink, zeros, n))
+        {
+            return -1;
+        }
+        remaining -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Flushes any output a sink has buffered.
+ *
+ * @param sink The sink to finish
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int sink_finish(struct sink* sink)
+{
+    return sink->ops->finish(sink);
+}
+
+/**
+ * Releases a sink.
+ *
+ * @param sink The sink to release
+ */
+void sink_destroy(struct sink* sink)
+{
+    if (NULL != sink)
+    {
+        sink->ops->destroy(sink);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct sink;
+
+// The operations implemented by each kind of output sink
+struct sink_ops
+{
+    // Writes all of the given data, returning 0 for success or -1 on error
+    int (*write)(struct sink* sink, const char* data, const size_t len);
+
+    // Advances past len bytes of zeros, returning 0 for success or -1 on error
+    int (*skip)(struct sink* sink, const size_t len);
+
+    // Flushes any buffered output, returning 0 for success or -1 on error
+    int (*finish)(struct sink* sink);
+
+    // Releases the sink
+    void (*destroy)(struct sink* sink);
+};
+
+// An ordered stream of output bytes. Specific sinks embed this as their
+// first member.
+struct sink
+{
+    const struct sink_ops*  ops;
+};
+
+struct sink* file_sink_create(const int fd);
+
+int sink_write(struct sink* sink, const char* data, const size_t len);
+int sink_skip(struct sink* sink, const size_t len);
+int sink_finish(struct sink* sink);
+void sink_destroy(struct sink* sink);
\ No newline at end of file
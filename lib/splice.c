@@ -0,0 +1,335 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "splice.h"
+
+#include "color-print.h"
+#include "io.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The ways a chunk can be moved from kcore to the output, from most to least
+// preferred
+enum transfer_method
+{
+    TRANSFER_COPY_FILE_RANGE,
+    TRANSFER_SPLICE,
+    TRANSFER_BUFFERED,
+    NUM_TRANSFER_METHODS,
+};
+
+static const char* transfer_method_names[NUM_TRANSFER_METHODS] = {
+    "copy_file_range",
+    "splice",
+    "read/write",
+};
+
+// The state of a zero-copy transfer
+struct transfer
+{
+    int                     kcore_fd;
+    int                     out_fd;
+    enum transfer_method    method;
+    int                     pipe_fds[2];
+    char*                   buffer;
+    size_t                  chunk_size;
+    uint64_t                transferred[NUM_TRANSFER_METHODS];
+};
+
+/**
+ * Checks if an error means that a transfer method isn't supported for the
+ * files involved, as opposed to the transfer itself failing.
+ *
+ * @param err The errno value to check
+ *
+ * @return 1 if the method is unsupported, else 0
+ */
+static int is_unsupported_error(const int err)
+{
+    return EINVAL == err || EXDEV == err || ENOSYS == err ||
+        EOPNOTSUPP == err || EBADF == err;
+}
+
+/**
+ * Moves part of a chunk with copy_file_range, which lets the kernel copy the
+ * data without it ever passing through user space.
+ *
+ * @param t       The transfer state
+ * @param in_off  The kcore offset to copy from
+ * @param out_off The output offset to copy to
+ * @param len     The maximum number of bytes to copy
+ *
+ * @return The number of bytes copied, else -1 with errno set
+ */
+static ssize_t transfer_copy_file_range(struct transfer* t,
+                                        uint64_t in_off,
+                                        uint64_t out_off,
+                                        const size_t len)
+{
+    loff_t in = in_off, out = out_off;
+    return copy_file_range(t->kcore_fd, &in, t->out_fd, &out, len, 0);
+}
+
+/**
+ * Moves part of a chunk by splicing it into a pipe and back out to the
+ * output, so the data only ever lives in kernel pages.
+ *
+ * @param t       The transfer state
+ * @param in_off  The kcore offset to copy from
+ * @param out_off The output offset to copy to
+ * @param len     The maximum number of bytes to copy
+ *
+ * @return The number of bytes copied, else -1 with errno set
+ */
+static ssize_t transfer_splice(struct transfer* t,
+                               uint64_t in_off,
+                               uint64_t out_off,
+                               const size_t len)
+{
+    loff_t in = in_off, out = out_off;
+    ssize_t have_read = splice(t->kcore_fd, &in, t->pipe_fds[1], NULL, len,
+        SPLICE_F_MOVE);
+    if (have_read <= 0)
+    {
+        return have_read;
+    }
+
+    // Once data is in the pipe it has to be drained, so any failure from
+    // here on is fatal rather than a reason to fall back
+    ssize_t written = 0;
+    while (written < have_read)
+    {
+        ssize_t n = splice(t->pipe_fds[0], NULL, t->out_fd, &out,
+            have_read - written, SPLICE_F_MOVE);
+        if (n <= 0)
+        {
+            fprint_red(stderr, "[-] Failed to splice to the output (errno %d)\n",
+                errno);
+            errno = EIO;
+            return -1;
+        }
+        written += n;
+    }
+
+    return have_read;
+}
+
+/**
+ * Moves part of a chunk through a user-space buffer. This always works, and
+ * is used when neither zero-copy method is supported.
+ *
+ * @param t       The transfer state
+ * @param in_off  The kcore offset to copy from
+ * @param out_off The output offset to copy to
+ * @param len     The maximum number of bytes to copy
+ *
+ * @return The number of bytes copied, else -1 with errno set
+ */
+static ssize_t transfer_buffered(struct transfer* t,
+                                 const uint64_t in_off,
+                                 const uint64_t out_off,
+                                 size_t len)
+{
+    if (NULL == t->buffer && NULL == (t->buffer = malloc(t->chunk_size)))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (len > t->chunk_size)
+    {
+        len = t->chunk_size;
+    }
+
+    ssize_t have_read = pread(t->kcore_fd, t->buffer, len, in_off);
+    if (have_read <= 0)
+    {
+        return have_read;
+    }
+
+    if (-1 == write_all_at(t->out_fd, t->buffer, have_read, out_off))
+    {
+        return -1;
+    }
+
+    return have_read;
+}
+
+/**
+ * Copies a chunk using the best transfer method that works. If a method turns
+ * out to be unsupported before it has moved any data, the chunk is retried
+ * with the next method and that method is used from then on.
+ *
+ * @param t       The transfer state
+ * @param in_off  The kcore offset to copy from
+ * @param out_off The output offset to copy to
+ * @param len     The number of bytes to copy
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int transfer_chunk(struct transfer* t,
+                          const uint64_t in_off,
+                          const uint64_t out_off,
+                          const size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n;
+        switch (t->method)
+        {
+        case TRANSFER_COPY_FILE_RANGE:
+            n = transfer_copy_file_range(t, in_off + done, out_off + done,
+                len - done);
+            break;
+        case TRANSFER_SPLICE:
+            n = transfer_splice(t, in_off + done, out_off + done, len - done);
+            break;
+        default:
+            n = transfer_buffered(t, in_off + done, out_off + done, len - done);
+            break;
+        }
+
+        if (n < 0 && TRANSFER_BUFFERED != t->method && 
+            is_unsupported_error(errno))
+        {
+            t->method++;
+            print_yellow("\t[!] Falling back to %s\n", 
+                transfer_method_names[t->method]);
+            continue;
+        }
+
+        if (0 == n && TRANSFER_COPY_FILE_RANGE == t->method)
+        {
+            // Some filesystems report EOF rather than refusing outright
+            t->method++;
+            print_yellow("\t[!] Falling back to %s\n", 
+                transfer_method_names[t->method]);
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            fprint_red(stderr, "[-] Kcore transfer failed at offset 0x%lx (errno %d)\n",
+                in_off + done, errno);
+            return -1;
+        }
+
+        t->transferred[t->method] += n;
+        done += n;
+    }
+
+    return 0;
+}
+
+/**
+ * Copies the contents of every section to its precomputed location in the
+ * output file without staging it in user space where possible. The kernel
+ * is asked to copy the data with copy_file_range, then splice through a
+ * pipe, before falling back to an ordinary buffered copy. Since the data
+ * never surfaces, each chunk's transfer is recorded as its write.
+ *
+ * @param kcore_fd     The file descriptor of the /proc/kcore file
+ * @param out_fd       The file descriptor of the output file
+ * @param sections     The array of memory sections to copy
+ * @param layout       The output location of each section
+ * @param num_sections The number of sections to copy
+ * @param dump         The dump context
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int copy_sections_splice(const int kcore_fd,
+                         const int out_fd,
+                         const struct section* sections,
+                         const struct section_layout* layout,
+                         const int num_sections,
+                         struct dump_context* dump)
+{
+    size_t chunk_size = dump->options->chunk_size;
+    int ret = 0;
+    struct transfer t = {
+        .kcore_fd = kcore_fd,
+        .out_fd = out_fd,
+        .method = TRANSFER_COPY_FILE_RANGE,
+        .buffer = NULL,
+        .chunk_size = chunk_size,
+    };
+
+    if (-1 == pipe(t.pipe_fds))
+    {
+        // Without a pipe there's no splice, but copy_file_range may still work
+        t.pipe_fds[0] = t.pipe_fds[1] = -1;
+    }
+    else
+    {
+        // A larger pipe lets each splice move a whole chunk. This is capped
+        // by /proc/sys/fs/pipe-max-size, so failing here is harmless.
+        fcntl(t.pipe_fds[1], F_SETPIPE_SZ, chunk_size);
+    }
+
+    print_cyan("\t[*] Copying %d sections with zero-copy transfers\n",
+        num_sections);
+
+    for (int i = 0; i < num_sections && 0 == ret; i++)
+    {
+        for (uint64_t offset = 0; offset < sections[i].size; offset += chunk_size)
+        {
+            size_t len = sections[i].size - offset;
+            if (len > chunk_size)
+            {
+                len = chunk_size;
+            }
+
+            uint64_t start = metrics_now();
+            if (-1 == transfer_chunk(&t, sections[i].file_offset + offset,
+                layout[i].data_offset + offset, len))
+            {
+                ret = -1;
+                break;
+            }
+            metrics_record_write(dump->metrics, i, 
+                sections[i].physical_base + offset, start, metrics_now(), len);
+        }
+    }
+
+    for (int i = 0; i < NUM_TRANSFER_METHODS; i++)
+    {
+        if (t.transferred[i])
+        {
+            print_cyan("\t[*] Transferred 0x%lx bytes with %s\n",
+                t.transferred[i], transfer_method_names[i]);
+        }
+    }
+
+    if (t.pipe_fds[0] >= 0)
+    {
+        close(t.pipe_fds[0]);
+        close(t.pipe_fds[1]);
+    }
+    free(t.buffer);
+
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,262 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+
+#include "stream.h"
+
+#include "color-print.h"
+#include "lmat.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// The file holding the largest pipe buffer an unprivileged process may ask for
+#define PIPE_MAX_SIZE_FILENAME "/proc/sys/fs/pipe-max-size"
+
+// The socket send buffer we ask for when streaming to a socket
+#define SOCKET_BUFFER_SIZE (4 * CHUNK_SIZE)
+
+// A sink that streams to a pipe, FIFO or socket, waiting for the reader
+// whenever it falls behind
+struct stream_sink
+{
+    struct sink sink;
+    int         fd;
+    int         original_flags;
+    uint64_t    stalls;
+    uint64_t    stall_ns;
+};
+
+/**
+ * Connects to a UNIX domain stream socket.
+ *
+ * @param path The path of the socket
+ *
+ * @return The connected socket, else -1 if there's an error
+ */
+int stream_connect_unix(const char* path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprint_red(stderr, "[-] Socket path is too long: %s\n", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == fd)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (-1 == connect(fd, (struct sockaddr*) &addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Writes data to the stream. When the reader falls behind and the buffer
+ * fills up, we block in poll until there is room again.
+ *
+ * @param sink The sink to write to
+ * @param data The data to write
+ * @param len  The length of the data
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int stream_sink_write(struct sink* sink, const char* data, const size_t len)
+{
+    struct stream_sink* ss = (struct stream_sink*) sink;
+    size_t written = 0;
+
+    while (written < len)
+    {
+        ssize_t n = write(ss->fd, data + written, len - written);
+        if (n > 0)
+        {
+            written += n;
+            continue;
+        }
+
+        if (-1 == n && EINTR == errno)
+        {
+            continue;
+        }
+
+        if (-1 == n && (EAGAIN == errno || EWOULDBLOCK == errno))
+        {
+            struct pollfd pfd = { .fd = ss->fd, .events = POLLOUT };
+            uint64_t start = metrics_now();
+            int ret = poll(&pfd, 1, -1);
+            ss->stall_ns += metrics_now() - start;
+            ss->stalls++;
+
+            if ((-1 == ret && EINTR != errno) || 
+                (ret > 0 && (pfd.revents & (POLLERR | POLLHUP))))
+            {
+                errno = EPIPE;
+                return -1;
+            }
+            continue;
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Finishes a stream sink, reporting how long was spent waiting on the
+ * reader.
+ *
+ * @param sink The sink to finish
+ *
+ * @return 0
+ */
+static int stream_sink_finish(struct sink* sink)
+{
+    struct stream_sink* ss = (struct stream_sink*) sink;
+
+    if (ss->stalls)
+    {
+        print_cyan("\t[*] Waited %lu ms for the reader (%lu stalls)\n",
+            ss->stall_ns / 1000000, ss->stalls);
+    }
+
+    return 0;
+}
+
+/**
+ * Releases a stream sink, restoring the original file status flags. The
+ * file descriptor is owned by the caller.
+ *
+ * @param sink The sink to release
+ */
+static void stream_sink_destroy(struct sink* sink)
+{
+    struct stream_sink* ss = (struct stream_sink*) sink;
+
+    if (-1 != ss->original_flags)
+    {
+        fcntl(ss->fd, F_SETFL, ss->original_flags);
+    }
+    free(ss);
+}
+
+static const struct sink_ops stream_sink_ops = {
+    .write = stream_sink_write,
+    .skip = NULL,
+    .finish = stream_sink_finish,
+    .destroy = stream_sink_destroy,
+};
+
+/**
+ * Grows the kernel buffer behind the stream so the reader can fall further
+ * behind before we have to wait. Failure isn't fatal, the stream just
+ * stalls more often.
+ *
+ * @param fd The file descriptor of the stream
+ */
+static void grow_stream_buffer(const int fd)
+{
+    struct stat st;
+    if (-1 == fstat(fd, &st))
+    {
+        return;
+    }
+
+    if (S_ISFIFO(st.st_mode))
+    {
+        int size = CHUNK_SIZE;
+        FILE* f = fopen(PIPE_MAX_SIZE_FILENAME, "r");
+        if (NULL != f)
+        {
+            if (1 != fscanf(f, "%d", &size) || size < CHUNK_SIZE)
+            {
+                size = CHUNK_SIZE;
+            }
+            fclose(f);
+        }
+
+        int actual = fcntl(fd, F_SETPIPE_SZ, size);
+        if (-1 == actual && size > CHUNK_SIZE)
+        {
+            actual = fcntl(fd, F_SETPIPE_SZ, CHUNK_SIZE);
+        }
+        if (-1 != actual)
+        {
+            print_cyan("\t[*] Using a 0x%x byte pipe buffer\n", actual);
+        }
+    }
+    else if (S_ISSOCK(st.st_mode))
+    {
+        int size = SOCKET_BUFFER_SIZE;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+}
+
+/**
+ * Creates a sink that streams strictly in order to a pipe, FIFO or socket.
+ * The descriptor is switched to non-blocking mode so that backpressure from
+ * the reader can be waited out with poll.
+ *
+ * @param fd The file descriptor of the stream
+ *
+ * @return The sink, else NULL if there's an error
+ */
+struct sink* stream_sink_create(const int fd)
+{
+    struct stream_sink* ss = calloc(1, sizeof(struct stream_sink));
+    if (NULL == ss)
+    {
+        return NULL;
+    }
+
+    ss->sink.ops = &stream_sink_ops;
+    ss->fd = fd;
+
+    grow_stream_buffer(fd);
+
+    ss->original_flags = fcntl(fd, F_GETFL);
+    if (-1 != ss->original_flags)
+    {
+        fcntl(fd, F_SETFL, ss->original_flags | O_NONBLOCK);
+    }
+
+    return &ss->sink;
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "sink.h"
+
+// The output path that selects stdout as the output
+#define STDOUT_OUTPUT "-"
+
+// The prefix that selects a UNIX domain socket as the output
+#define UNIX_SOCKET_PREFIX "unix:"
+
+int stream_connect_unix(const char* path);
+
+struct sink* stream_sink_create(const int fd);
\ No newline at end of file
@@ -0,0 +1,303 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "stripe.h"
+
+#include "color-print.h"
+#include "io.h"
+#include "writers.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A sink that spreads the stream across several files in fixed size stripes.
+// Each file has its own writer thread and gets every num_writers'th stripe,
+// so it's written in order.
+struct stripe_sink
+{
+    struct sink         sink;
+    struct writer_pool  pool;
+    uint64_t            stripe_size;
+    uint64_t            position;
+    int                 layout_fd;
+};
+
+/**
+ * Queues a block for the file that holds the current stripe, waiting for
+ * its writer if it's a whole queue behind.
+ *
+ * @param ss   The stripe sink
+ * @param data The data of the block, or NULL for a run of zeros
+ * @param len  The length of the block, which doesn't cross a stripe
+ *
+ * @return 0 for success, else -1 if a writer has failed
+ */
+static int stripe_push(struct stripe_sink* ss, const char* data, const size_t len)
+{
+    int writer = (ss->position / ss->stripe_size) % ss->pool.num_writers;
+    if (-1 == writer_pool_push(&ss->pool, writer, data, len))
+    {
+        return -1;
+    }
+
+    ss->position += len;
+    return 0;
+}
+
+/**
+ * Gets how much of the current stripe is left.
+ *
+ * @param ss The stripe sink
+ *
+ * @return The number of bytes until the next stripe starts
+ */
+static uint64_t stripe_remaining(const struct stripe_sink* ss)
+{
+    return ss->stripe_size - ss->position % ss->stripe_size;
+}
+
+/**
+ * Writes data to a stripe sink, one block at a time.
+ *
+ * @param sink The sink to write to
+ * @param data The data to write
+ * @param len  The length of the data
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int stripe_sink_write(struct sink* sink, const char* data, const size_t len)
+{
+    struct stripe_sink* ss = (struct stripe_sink*) sink;
+    size_t written = 0;
+
+    while (written < len)
+    {
+        size_t n = len - written;
+        if (n > ss->pool.block_size)
+        {
+            n = ss->pool.block_size;
+        }
+        if (n > stripe_remaining(ss))
+        {
+            n = stripe_remaining(ss);
+        }
+
+        if (-1 == stripe_push(ss, data + written, n))
+        {
+            return -1;
+        }
+        written += n;
+    }
+
+    return 0;
+}
+
+/**
+ * Skips a run of zeros in a stripe sink, leaving a hole in each file it
+ * falls in.
+ *
+ * @param sink The sink to skip in
+ * @param len  The number of bytes to skip
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int stripe_sink_skip(struct sink* sink, const size_t len)
+{
+    struct stripe_sink* ss = (struct stripe_sink*) sink;
+    size_t skipped = 0;
+
+    while (skipped < len)
+    {
+        size_t n = len - skipped;
+        if (n > stripe_remaining(ss))
+        {
+            n = stripe_remaining(ss);
+        }
+
+        if (-1 == stripe_push(ss, NULL, n))
+        {
+            return -1;
+        }
+        skipped += n;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes the layout of a striped dump, naming each file by its absolute
+ * path so the layout can be read from anywhere.
+ *
+ * @param ss The stripe sink
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int write_layout(struct stripe_sink* ss)
+{
+    stripe_file_header header = {
+        .magic = STRIPE_MAGIC,
+        .version = STRIPE_VERSION,
+        .stripe_size = ss->stripe_size,
+        .image_size = ss->position,
+        .num_targets = ss->pool.num_writers,
+    };
+
+    if (-1 == write_all(ss->layout_fd, &header, sizeof(header)))
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < ss->pool.num_writers; i++)
+    {
+        char path[PATH_MAX];
+        const char* name = NULL != realpath(ss->pool.writers[i].name, path) ? 
+            path : ss->pool.writers[i].name;
+        if (-1 == write_all(ss->layout_fd, name, strlen(name) + 1))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Finishes every file of a stripe sink, then writes the layout that ties
+ * them together.
+ *
+ * @param sink The sink to finish
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int stripe_sink_finish(struct sink* sink)
+{
+    struct stripe_sink* ss = (struct stripe_sink*) sink;
+
+    writer_pool_stop(&ss->pool);
+    for (int i = 0; i < ss->pool.num_writers; i++)
+    {
+        if (ss->pool.writers[i].failed)
+        {
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < ss->pool.num_writers; i++)
+    {
+        if (-1 == sink_finish(ss->pool.writers[i].sink))
+        {
+            fprint_red(stderr, "[-] Failed to finish %s (errno %d)\n", 
+                ss->pool.writers[i].name, errno);
+            return -1;
+        }
+    }
+
+    if (-1 == write_layout(ss))
+    {
+        fprint_red(stderr, "[-] Failed to write the stripe layout (errno %d)\n", 
+            errno);
+        return -1;
+    }
+
+    print_cyan("\t[*] Striped 0x%lx bytes across %d files in 0x%lx byte stripes\n",
+        ss->position, ss->pool.num_writers, ss->stripe_size);
+    return 0;
+}
+
+/**
+ * Releases a stripe sink along with the sinks for its files.
+ *
+ * @param sink The sink to release
+ */
+static void stripe_sink_destroy(struct sink* sink)
+{
+    struct stripe_sink* ss = (struct stripe_sink*) sink;
+
+    writer_pool_destroy(&ss->pool);
+    free(ss);
+}
+
+static const struct sink_ops stripe_sink_ops = {
+    .write = stripe_sink_write,
+    .skip = stripe_sink_skip,
+    .finish = stripe_sink_finish,
+    .destroy = stripe_sink_destroy,
+};
+
+/**
+ * Creates a sink that stripes one stream across several files, RAID-0 style,
+ * so their combined bandwidth can be used. Each file has a writer thread
+ * that writes its stripes in order, and once everything is written the
+ * layout is saved to the main output in place of the dump.
+ *
+ * @param targets     The files to stripe across, which are owned by the
+ *                    caller
+ * @param num_targets The number of files
+ * @param stripe_size The size of each stripe
+ * @param block_size  The largest block that's queued at once
+ * @param layout_fd   The file descriptor to write the layout to
+ *
+ * @return The sink, else NULL if there's an error
+ */
+struct sink* stripe_sink_create(const struct stripe_target* targets,
+                                const int num_targets,
+                                const uint64_t stripe_size,
+                                const size_t block_size,
+                                const int layout_fd)
+{
+    struct stripe_sink* ss = calloc(1, sizeof(struct stripe_sink));
+    if (NULL == ss)
+    {
+        return NULL;
+    }
+
+    ss->sink.ops = &stripe_sink_ops;
+    ss->stripe_size = stripe_size;
+    ss->layout_fd = layout_fd;
+
+    struct sink* sinks[MAX_STRIPE_TARGETS];
+    const char* names[MAX_STRIPE_TARGETS];
+    for (int i = 0; i < num_targets; i++)
+    {
+        names[i] = targets[i].path;
+        if (NULL == (sinks[i] = file_sink_create(targets[i].fd)))
+        {
+            while (i-- > 0)
+            {
+                sink_destroy(sinks[i]);
+            }
+            free(ss);
+            return NULL;
+        }
+    }
+
+    // Every queue can be full while each writer works on one more block, and
+    // losing any file loses the whole image
+    int num_blocks = num_targets * (STRIPE_QUEUE_DEPTH + 1);
+    if (-1 == writer_pool_init(&ss->pool, sinks, names, num_targets, num_blocks, 
+        block_size, STRIPE_QUEUE_DEPTH, 1))
+    {
+        stripe_sink_destroy(&ss->sink);
+        return NULL;
+    }
+
+    return &ss->sink;
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lmat.h"
+#include "sink.h"
+
+#define STRIPE_MAGIC 0x50534D4C     // "LMSP"
+#define STRIPE_VERSION 1
+
+// The default size of each stripe
+#define DEFAULT_STRIPE_SIZE 0x1000000 // 16M
+
+// The most files one dump can be striped across
+#define MAX_STRIPE_TARGETS 16
+
+// The number of blocks each stripe's writer may have queued
+#define STRIPE_QUEUE_DEPTH 4
+
+// The layout file written in place of a striped dump. It is followed by
+// num_targets NUL terminated paths, and stripe n of the image is stripe
+// n / num_targets of target n % num_targets.
+typedef struct
+{
+    unsigned int magic;         // Always 0x50534D4C (LMSP)
+    unsigned int version;       // Format version number
+    uint64_t stripe_size;       // The size of each stripe
+    uint64_t image_size;        // The size of the whole image
+    uint64_t num_targets;       // The number of files striped across
+} __attribute__ ((__packed__)) stripe_file_header;
+
+// A file a dump is striped across, as given on the command line
+struct stripe_target
+{
+    const char* path;
+    int         fd;
+};
+
+struct sink* stripe_sink_create(const struct stripe_target* targets,
+                                const int num_targets,
+                                const uint64_t stripe_size,
+                                const size_t block_size,
+                                const int layout_fd);
\ No newline at end of file
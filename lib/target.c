@@ -0,0 +1,396 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "target.h"
+
+#include "color-print.h"
+#include "iomem.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Creates an empty list of targets.
+ * 
+ * @return The list, else NULL if there's an error
+ */
+struct target_list* target_create(void)
+{
+    return calloc(1, sizeof(struct target_list));
+}
+
+/**
+ * Adds a run of physical memory to the targets, extending the last run if
+ * it carries straight on from it and isn't one of the ranges.
+ * 
+ * @param targets The targets
+ * @param start   The first address of the run
+ * @param end     The last address of the run
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int add_run(struct target_list* targets, 
+                   const uint64_t start, 
+                   const uint64_t end)
+{
+    if (targets->num_runs > targets->num_ranges && 
+        targets->runs[targets->num_runs - 1].end + 1 == start)
+    {
+        targets->runs[targets->num_runs - 1].end = end;
+        return 0;
+    }
+
+    if (targets->num_runs == targets->capacity)
+    {
+        int capacity = targets->capacity ? 2 * targets->capacity : 64;
+        struct addr_range* runs = realloc(targets->runs, 
+            capacity * sizeof(struct addr_range));
+        if (NULL == runs)
+        {
+            fprint_red(stderr, "[-] Failed to allocate the target ranges\n");
+            return -1;
+        }
+        targets->runs = runs;
+        targets->capacity = capacity;
+    }
+
+    targets->runs[targets->num_runs].index = targets->num_runs;
+    targets->runs[targets->num_runs].start = start;
+    targets->runs[targets->num_runs].end = end;
+    targets->num_runs++;
+    return 0;
+}
+
+/**
+ * Adds a physical range to the targets, given as "<start>-<end>" in hex
+ * with an inclusive end, as in /proc/iomem.
+ * 
+ * @param targets The targets
+ * @param text    The range
+ * 
+ * @return 0 for success, else -1 if the range isn't valid
+ */
+int target_add_range(struct target_list* targets, const char* text)
+{
+    uint64_t first, last;
+    if (-1 == parse_address_range(text, &first, &last))
+    {
+        return -1;
+    }
+
+    if (-1 == add_run(targets, first, last))
+    {
+        return -1;
+    }
+
+    targets->num_ranges = targets->num_runs;
+    return 0;
+}
+
+/**
+ * Adds a process to the targets. Its memory is found once the dump starts.
+ * 
+ * @param targets The targets
+ * @param text    The process id
+ * 
+ * @return 0 for success, else -1 if the process id isn't valid
+ */
+int target_add_pid(struct target_list* targets, const char* text)
+{
+    char* end;
+    long pid = strtol(text, &end, 10);
+    if (end == text || '\0' != *end || pid <= 0)
+    {
+        return -1;
+    }
+
+    pid_t* pids = realloc(targets->pids, (targets->num_pids + 1) * sizeof(pid_t));
+    if (NULL == pids)
+    {
+        return -1;
+    }
+    targets->pids = pids;
+    targets->pids[targets->num_pids++] = pid;
+    return 0;
+}
+
+/**
+ * Adds the physical pages behind a process's mappings to the targets. Each
+ * mapping's pagemap entries are read in batches, and pages that are mapped
+ * to consecutive frames are gathered into runs as they're found.
+ * 
+ * @param targets The targets
+ * @param pid     The process id
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int add_process(struct target_list* targets, const pid_t pid)
+{
+    char path[64];
+    char* lineptr = NULL;
+    size_t n = 0;
+    int ret = 0;
+    uint64_t pages = 0, hidden = 0;
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    int first_run = targets->num_runs;
+
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    FILE* maps = fopen(path, "r");
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", pid);
+    int pagemap_fd = open(path, O_RDONLY);
+    uint64_t* entries = malloc(PAGEMAP_BATCH * sizeof(uint64_t));
+    if (NULL == maps || -1 == pagemap_fd || NULL == entries)
+    {
+        fprint_red(stderr, "[-] Could not read the memory map of process %d\n", pid);
+        ret = -1;
+        goto cleanup;
+    }
+
+    while (-1 != getline(&lineptr, &n, maps))
+    {
+        uint64_t start, end;
+        if (2 != sscanf(lineptr, "%lx-%lx", &start, &end))
+        {
+            continue;
+        }
+
+        for (uint64_t page = start / page_size; page < end / page_size; )
+        {
+            size_t count = end / page_size - page;
+            if (count > PAGEMAP_BATCH)
+            {
+                count = PAGEMAP_BATCH;
+            }
+
+            // Some mappings, like [vsyscall], have no page tables to read
+            ssize_t len = pread(pagemap_fd, entries, count * sizeof(uint64_t), 
+                page * sizeof(uint64_t));
+            if (len <= 0)
+            {
+                break;
+            }
+            count = len / sizeof(uint64_t);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                if (!(entries[i] & PAGEMAP_PRESENT) || 
+                    (entries[i] & PAGEMAP_SWAPPED))
+                {
+                    continue;
+                }
+
+                pages++;
+                uint64_t frame = entries[i] & PAGEMAP_PFN_MASK;
+                if (0 == frame)
+                {
+                    hidden++;
+                    continue;
+                }
+
+                if (-1 == add_run(targets, frame * page_size, 
+                    (frame + 1) * page_size - 1))
+                {
+                    ret = -1;
+                    goto cleanup;
+                }
+            }
+            page += count;
+        }
+    }
+
+    // Without CAP_SYS_ADMIN the kernel zeroes out every frame number
+    if (pages > 0 && hidden == pages)
+    {
+        fprint_red(stderr, "[-] The physical pages of process %d are hidden, which "
+            "needs root to read\n", pid);
+        ret = -1;
+        goto cleanup;
+    }
+
+    print_green("[*] Found %lu resident pages of process %d in %d runs\n", 
+        pages - hidden, pid, targets->num_runs - first_run);
+
+cleanup:
+    if (NULL != maps)
+    {
+        fclose(maps);
+    }
+    if (-1 != pagemap_fd)
+    {
+        close(pagemap_fd);
+    }
+    free(entries);
+    free(lineptr);
+    return ret;
+}
+
+/**
+ * Orders runs of physical memory by their first address.
+ * 
+ * @param a The first run
+ * @param b The second run
+ * 
+ * @return Less than, equal to or greater than zero as a sorts before, with
+ *         or after b
+ */
+static int compare_runs(const void* a, const void* b)
+{
+    const struct addr_range* ra = (const struct addr_range*) a;
+    const struct addr_range* rb = (const struct addr_range*) b;
+
+    if (ra->start != rb->start)
+    {
+        return ra->start < rb->start ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Limits a dump to its targets. The processes' pages are found afresh each
+ * time, so only the frames they hold now are selected. The targets are
+ * sorted and merged into runs, and each run is clipped to the sections that
+ * were matched against kcore, so that it keeps their kcore offsets. Parts of
+ * a run that aren't System RAM are left out.
+ * 
+ * @param targets      The targets
+ * @param sections     The sections of the full dump, sorted by address
+ * @param num_sections The number of sections
+ * @param selected     The sections of the targeted dump (output)
+ * 
+ * @return The number of selected sections, else -1 if there's an error
+ */
+int target_select_sections(struct target_list* targets,
+                           const struct section* sections,
+                           const int num_sections,
+                           struct section** selected)
+{
+    // Drop the pages found for the last selection
+    targets->num_runs = targets->num_ranges;
+    for (int i = 0; i < targets->num_pids; i++)
+    {
+        if (-1 == add_process(targets, targets->pids[i]))
+        {
+            return -1;
+        }
+    }
+
+    // The runs are merged in a copy, so the ranges stay at the front
+    struct addr_range* runs = malloc((targets->num_runs > 0 ? 
+        targets->num_runs : 1) * sizeof(struct addr_range));
+    if (NULL == runs)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the target ranges\n");
+        return -1;
+    }
+    memcpy(runs, targets->runs, targets->num_runs * sizeof(struct addr_range));
+
+    qsort(runs, targets->num_runs, sizeof(struct addr_range), compare_runs);
+    int merged = 0;
+    for (int i = 0; i < targets->num_runs; i++)
+    {
+        if (merged > 0 && runs[i].start <= runs[merged - 1].end + 1)
+        {
+            if (runs[i].end > runs[merged - 1].end)
+            {
+                runs[merged - 1].end = runs[i].end;
+            }
+            continue;
+        }
+        runs[merged++] = runs[i];
+    }
+
+    // Each run can be split at most once for every section boundary
+    *selected = malloc((merged + num_sections) * sizeof(struct section));
+    if (NULL == *selected)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the targeted sections\n");
+        free(runs);
+        return -1;
+    }
+
+    int count = 0;
+    uint64_t missing = 0;
+    int s = 0;
+    for (int i = 0; i < merged; i++)
+    {
+        uint64_t start = runs[i].start;
+        uint64_t end = runs[i].end;
+        uint64_t covered = 0;
+
+        while (s < num_sections && 
+            sections[s].physical_base + sections[s].size <= start)
+        {
+            s++;
+        }
+
+        for (int j = s; j < num_sections && sections[j].physical_base <= end; j++)
+        {
+            uint64_t base = start > sections[j].physical_base ? 
+                start : sections[j].physical_base;
+            uint64_t last = sections[j].physical_base + sections[j].size - 1;
+            if (end < last)
+            {
+                last = end;
+            }
+            if (base > last)
+            {
+                continue;
+            }
+
+            uint64_t delta = base - sections[j].physical_base;
+            (*selected)[count].physical_base = base;
+            (*selected)[count].virtual_base = sections[j].virtual_base + delta;
+            (*selected)[count].file_offset = sections[j].file_offset + delta;
+            (*selected)[count].size = last - base + 1;
+            covered += last - base + 1;
+            count++;
+        }
+
+        missing += end - start + 1 - covered;
+    }
+    free(runs);
+
+    if (missing > 0)
+    {
+        print_yellow("[!] Left out 0x%lx targeted bytes that aren't in System RAM\n",
+            missing);
+    }
+    return count;
+}
+
+/**
+ * Releases a list of targets.
+ * 
+ * @param targets The targets, which may be NULL
+ */
+void target_free(struct target_list* targets)
+{
+    if (NULL == targets)
+    {
+        return;
+    }
+
+    free(targets->runs);
+    free(targets->pids);
+    free(targets);
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lmat.h"
+
+#include <sys/types.h>
+
+// The number of pagemap entries read at a time
+#define PAGEMAP_BATCH 0x2000
+
+// The bits of a pagemap entry
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_PFN_MASK ((1ULL << 55) - 1)
+
+// The parts of physical memory a targeted dump is limited to. The runs
+// have inclusive ends, like the ranges read from iomem.
+struct target_list
+{
+    struct addr_range*  runs;
+    int                 num_runs;
+    int                 capacity;
+
+    // The runs given as ranges, which come first and are kept when the
+    // processes' pages are found again
+    int                 num_ranges;
+
+    pid_t*              pids;
+    int                 num_pids;
+};
+
+struct target_list* target_create(void);
+
+int target_add_range(struct target_list* targets, const char* text);
+
+int target_add_pid(struct target_list* targets, const char* text);
+
+int target_select_sections(struct target_list* targets,
+                           const struct section* sections,
+                           const int num_sections,
+                           struct section** selected);
+
+void target_free(struct target_list* targets);
\ No newline at end of file
@@ -0,0 +1,185 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "tee.h"
+
+#include "color-print.h"
+#include "writers.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// A sink that feeds every block of the stream to several destinations, each
+// through its own writer thread
+struct tee_sink
+{
+    struct sink         sink;
+    struct writer_pool  pool;
+};
+
+/**
+ * Writes data to every destination of a tee sink, one block at a time.
+ *
+ * @param sink The sink to write to
+ * @param data The data to write
+ * @param len  The length of the data
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int tee_sink_write(struct sink* sink, const char* data, const size_t len)
+{
+    struct tee_sink* tee = (struct tee_sink*) sink;
+    size_t written = 0;
+
+    while (written < len)
+    {
+        size_t n = len - written;
+        if (n > tee->pool.block_size)
+        {
+            n = tee->pool.block_size;
+        }
+
+        if (-1 == writer_pool_push(&tee->pool, ALL_WRITERS, data + written, n))
+        {
+            return -1;
+        }
+        written += n;
+    }
+
+    return 0;
+}
+
+/**
+ * Skips a run of zeros in every destination of a tee sink. Each destination
+ * leaves a hole or writes the zeros out, as it would on its own.
+ *
+ * @param sink The sink to skip in
+ * @param len  The number of bytes to skip
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int tee_sink_skip(struct sink* sink, const size_t len)
+{
+    return writer_pool_push(&((struct tee_sink*) sink)->pool, ALL_WRITERS, NULL, 
+        len);
+}
+
+/**
+ * Finishes every destination of a tee sink.
+ *
+ * @param sink The sink to finish
+ *
+ * @return 0 for success, else -1 if any destination failed
+ */
+static int tee_sink_finish(struct sink* sink)
+{
+    struct tee_sink* tee = (struct tee_sink*) sink;
+    int ret = 0;
+
+    writer_pool_stop(&tee->pool);
+
+    for (int i = 0; i < tee->pool.num_writers; i++)
+    {
+        struct queued_writer* dest = &tee->pool.writers[i];
+        if (!dest->failed && -1 == sink_finish(dest->sink))
+        {
+            fprint_red(stderr, "[-] Failed to finish %s (errno %d)\n", 
+                dest->name, errno);
+            dest->failed = 1;
+        }
+
+        if (dest->failed)
+        {
+            fprint_red(stderr, "[-] %s is incomplete\n", dest->name);
+            errno = EIO;
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Releases a tee sink along with its destinations.
+ *
+ * @param sink The sink to release
+ */
+static void tee_sink_destroy(struct sink* sink)
+{
+    struct tee_sink* tee = (struct tee_sink*) sink;
+
+    writer_pool_destroy(&tee->pool);
+    free(tee);
+}
+
+static const struct sink_ops tee_sink_ops = {
+    .write = tee_sink_write,
+    .skip = tee_sink_skip,
+    .finish = tee_sink_finish,
+    .destroy = tee_sink_destroy,
+};
+
+/**
+ * Creates a sink that feeds one stream to several destinations. Each block
+ * is copied once into a shared pool, which every destination's writer
+ * thread then writes out from its own queue.
+ *
+ * @param sinks       The destinations, which the tee takes ownership of
+ * @param names       The name of each destination, for messages
+ * @param policies    What to do when each destination falls behind
+ * @param num_sinks   The number of destinations
+ * @param block_size  The largest block that's queued at once
+ * @param queue_depth The number of blocks each destination may have queued
+ *
+ * @return The sink, else NULL if there's an error
+ */
+struct sink* tee_sink_create(struct sink** sinks,
+                             const char** names,
+                             const enum tee_policy* policies,
+                             const int num_sinks,
+                             const size_t block_size,
+                             const int queue_depth)
+{
+    struct tee_sink* tee = calloc(1, sizeof(struct tee_sink));
+    if (NULL == tee)
+    {
+        for (int i = 0; i < num_sinks; i++)
+        {
+            sink_destroy(sinks[i]);
+        }
+        return NULL;
+    }
+
+    tee->sink.ops = &tee_sink_ops;
+
+    // Every block in a queue is shared, so the slowest queue and a block
+    // being written by each destination are all that can be held up
+    int num_blocks = queue_depth + num_sinks + 1;
+    if (-1 == writer_pool_init(&tee->pool, sinks, names, num_sinks, num_blocks, 
+        block_size, queue_depth, 0))
+    {
+        tee_sink_destroy(&tee->sink);
+        return NULL;
+    }
+
+    for (int i = 0; i < num_sinks; i++)
+    {
+        tee->pool.writers[i].drop = TEE_DROP == policies[i];
+    }
+
+    return &tee->sink;
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "sink.h"
+
+// The default number of blocks each destination may have queued
+#define DEFAULT_TEE_QUEUE_DEPTH 16
+
+// The most destinations one dump can be written to
+#define MAX_TEE_OUTPUTS 16
+
+// What happens when a destination falls a whole queue behind
+enum tee_policy
+{
+    // Wait for it to catch up, slowing down the whole dump
+    TEE_BLOCK,
+
+    // Give up on it with an error, so the others carry on at full speed
+    TEE_DROP,
+};
+
+// An extra destination for the dump, as given on the command line
+struct tee_output
+{
+    const char*         path;
+    enum tee_policy     policy;
+    int                 fd;
+    int                 stream;
+};
+
+struct sink* tee_sink_create(struct sink** sinks,
+                             const char** names,
+                             const enum tee_policy* policies,
+                             const int num_sinks,
+                             const size_t block_size,
+                             const int queue_depth);
\ No newline at end of file
@@ -0,0 +1,535 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "uring.h"
+
+#include "buffer.h"
+#include "color-print.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+// The operation a slot is currently waiting on
+enum slot_state
+{
+    SLOT_IDLE,
+    SLOT_READING,
+    SLOT_WRITING,
+};
+
+// A fixed buffer and the chunk that is currently moving through it
+struct uring_slot
+{
+    enum slot_state state;
+    char*           buffer;
+    int             section;
+    uint64_t        offset;
+    size_t          len;
+    size_t          done;
+    uint64_t        started_ns;
+};
+
+// The mapped submission and completion rings of an io_uring instance
+struct uring
+{
+    int                     fd;
+    int                     fixed_ops;
+    int                     fixed_buffers;
+
+    void*                   sq_ptr;
+    size_t                  sq_len;
+    unsigned*               sq_head;
+    unsigned*               sq_tail;
+    unsigned*               sq_mask;
+    unsigned*               sq_array;
+    struct io_uring_sqe*    sqes;
+    size_t                  sqes_len;
+    unsigned                pending;
+
+    void*                   cq_ptr;
+    size_t                  cq_len;
+    unsigned*               cq_head;
+    unsigned*               cq_tail;
+    unsigned*               cq_mask;
+    struct io_uring_cqe*    cqes;
+};
+
+/**
+ * Checks whether a probed ring supports an operation.
+ *
+ * @param probe The result of probing the ring
+ * @param op    The operation to check for
+ *
+ * @return Non-zero if the operation is supported, else 0
+ */
+static int op_supported(const struct io_uring_probe* probe, const unsigned op)
+{
+    return op <= probe->last_op && 
+        (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+/**
+ * Checks that the kernel supports the operations we use. Rings can be
+ * created on kernels that lack IORING_OP_READ and IORING_OP_WRITE, where
+ * every operation would fail with EINVAL.
+ *
+ * @param ring The ring to probe
+ *
+ * @return 0 if reads and writes are supported, else -1
+ */
+static int uring_probe(struct uring* ring)
+{
+    struct io_uring_probe* probe = calloc(1, sizeof(struct io_uring_probe) + 
+        IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+    if (NULL == probe)
+    {
+        return -1;
+    }
+
+    // Probing arrived in the same kernel as IORING_OP_READ and 
+    // IORING_OP_WRITE, so if it fails they're missing too
+    int ret = -1;
+    if (0 == syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, 
+        probe, IORING_OP_LAST))
+    {
+        ring->fixed_ops = op_supported(probe, IORING_OP_READ_FIXED) &&
+            op_supported(probe, IORING_OP_WRITE_FIXED);
+        if (op_supported(probe, IORING_OP_READ) && 
+            op_supported(probe, IORING_OP_WRITE))
+        {
+            ret = 0;
+        }
+    }
+
+    free(probe);
+    return ret;
+}
+
+/**
+ * Creates an io_uring instance and maps its rings.
+ *
+ * @param ring    The ring to set up
+ * @param entries The number of submission queue entries to request
+ *
+ * @return 0 for success, else -1 if io_uring or the operations we use
+ *         aren't available
+ */
+static int uring_setup(struct uring* ring, const unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+    {
+        return -1;
+    }
+
+    if (-1 == uring_probe(ring))
+    {
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + 
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_len > ring->sq_len)
+        {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = 0;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == ring->sq_ptr)
+    {
+        goto fail;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == ring->cq_ptr)
+        {
+            ring->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == ring->sqes)
+    {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    char* sq = (char*) ring->sq_ptr;
+    ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+
+    char* cq = (char*) ring->cq_ptr;
+    ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    return 0;
+
+fail:
+    if (NULL != ring->sqes)
+    {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (NULL != ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (NULL != ring->sq_ptr && MAP_FAILED != ring->sq_ptr)
+    {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+    close(ring->fd);
+    return -1;
+}
+
+/**
+ * Unmaps the rings and closes an io_uring instance.
+ *
+ * @param ring The ring to tear down
+ */
+static void uring_teardown(struct uring* ring)
+{
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+}
+
+/**
+ * Queues a read or write of the unfinished part of a slot's chunk.
+ *
+ * @param ring   The ring to queue the operation on
+ * @param slot   The slot whose chunk is being moved
+ * @param index  The index of the slot (and its registered buffer)
+ * @param fd     The file descriptor to read from or write to
+ * @param offset The file offset of the start of the chunk
+ */
+static void uring_queue(struct uring* ring,
+                        const struct uring_slot* slot,
+                        const int index,
+                        const int fd,
+                        const uint64_t offset)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    if (SLOT_READING == slot->state)
+    {
+        sqe->opcode = ring->fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    }
+    else
+    {
+        sqe->opcode = ring->fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    }
+    sqe->fd = fd;
+    sqe->off = offset + slot->done;
+    sqe->addr = (uint64_t) (uintptr_t) (slot->buffer + slot->done);
+    sqe->len = slot->len - slot->done;
+    sqe->buf_index = ring->fixed_buffers ? index : 0;
+    sqe->user_data = index;
+
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+}
+
+/**
+ * Submits all queued operations and waits for at least one to complete.
+ *
+ * @param ring The ring to submit on
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int uring_submit_and_wait(struct uring* ring)
+{
+    int ret;
+    do
+    {
+        ret = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (ret < 0 && EINTR == errno);
+
+    if (ret < 0)
+    {
+        fprint_red(stderr, "[-] io_uring_enter failed (errno %d)\n", errno);
+        return -1;
+    }
+
+    ring->pending -= ret;
+    return 0;
+}
+
+/**
+ * Moves the copy cursor to the next chunk that needs to be copied.
+ *
+ * @param sections     The array of memory sections
+ * @param num_sections The number of memory sections
+ * @param section      The current section (input/output)
+ * @param offset       The current offset into the section (input/output)
+ * @param chunk_size   The size of each chunk
+ * @param slot         The slot to assign the chunk to
+ *
+ * @return 1 if a chunk was assigned, else 0 if there's nothing left to copy
+ */
+static int next_chunk(const struct section* sections,
+                      const int num_sections,
+                      int* section,
+                      uint64_t* offset,
+                      const size_t chunk_size,
+                      struct uring_slot* slot)
+{
+    while (*section < num_sections && *offset >= sections[*section].size)
+    {
+        (*section)++;
+        *offset = 0;
+    }
+
+    if (*section >= num_sections)
+    {
+        return 0;
+    }
+
+    slot->section = *section;
+    slot->offset = *offset;
+    slot->len = sections[*section].size - *offset;
+    if (slot->len > chunk_size)
+    {
+        slot->len = chunk_size;
+    }
+    slot->done = 0;
+    slot->state = SLOT_READING;
+    slot->started_ns = metrics_now();
+
+    *offset += slot->len;
+    return 1;
+}
+
+/**
+ * Copies the contents of every section to its precomputed location in the
+ * output file using io_uring. A fixed ring of buffers is kept busy: as soon
+ * as a chunk has been read into a buffer its write is queued, and as soon as
+ * the write completes the buffer is reused for the next read.
+ *
+ * @param kcore_fd     The file descriptor of the /proc/kcore file
+ * @param out_fd       The file descriptor of the output file
+ * @param sections     The array of memory sections to copy
+ * @param layout       The output location of each section
+ * @param num_sections The number of sections to copy
+ * @param dump         The dump context
+ *
+ * @return 0 for success, -1 if there's an error or COPY_UNSUPPORTED if
+ *         io_uring isn't available
+ */
+int copy_sections_uring(const int kcore_fd,
+                        const int out_fd,
+                        const struct section* sections,
+                        const struct section_layout* layout,
+                        const int num_sections,
+                        struct dump_context* dump)
+{
+    int queue_depth = dump->options->queue_depth;
+    size_t chunk_size = dump->options->chunk_size;
+    int ret = 0;
+    struct uring ring;
+    size_t buffers_len = 0;
+    enum buffer_backing backing;
+
+    if (-1 == uring_setup(&ring, queue_depth))
+    {
+        return COPY_UNSUPPORTED;
+    }
+
+    char* buffers = NULL;
+    struct uring_slot* slots = calloc(queue_depth, sizeof(struct uring_slot));
+    struct iovec* iovecs = calloc(queue_depth, sizeof(struct iovec));
+    if (NULL == slots || NULL == iovecs ||
+        NULL == (buffers = buffer_map((size_t) queue_depth * chunk_size,
+            &buffers_len, &backing)))
+    {
+        fprint_red(stderr, "[-] Failed to allocate io_uring buffers\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < queue_depth; i++)
+    {
+        slots[i].buffer = buffers + (size_t) i * chunk_size;
+        iovecs[i].iov_base = slots[i].buffer;
+        iovecs[i].iov_len = chunk_size;
+    }
+
+    // Registering the buffers saves the kernel from mapping them on every
+    // operation, but it counts against RLIMIT_MEMLOCK so it may not succeed
+    ring.fixed_buffers = ring.fixed_ops && (0 == syscall(__NR_io_uring_register, 
+        ring.fd, IORING_REGISTER_BUFFERS, iovecs, queue_depth));
+
+    print_cyan("\t[*] Copying %d sections with io_uring (queue depth %d%s, %s)\n",
+        num_sections, queue_depth, ring.fixed_buffers ? ", fixed buffers" : "",
+        buffer_backing_name(backing));
+
+    int section = 0;
+    uint64_t offset = 0;
+    int inflight = 0;
+    int failed = 0;
+
+    for (int i = 0; i < queue_depth; i++)
+    {
+        if (!next_chunk(sections, num_sections, &section, &offset, chunk_size, 
+            &slots[i]))
+        {
+            break;
+        }
+        uring_queue(&ring, &slots[i], i, kcore_fd,
+            sections[slots[i].section].file_offset + slots[i].offset);
+        inflight++;
+    }
+
+    while (inflight > 0)
+    {
+        if (-1 == uring_submit_and_wait(&ring))
+        {
+            // Nothing we queued can be trusted to complete anymore
+            ret = -1;
+            goto cleanup;
+        }
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            int index = (int) cqe->user_data;
+            struct uring_slot* slot = &slots[index];
+            const struct section* s = &sections[slot->section];
+
+            if (cqe->res <= 0 && !failed)
+            {
+                if (SLOT_READING == slot->state)
+                {
+                    fprint_red(stderr, "[-] Kcore read failed at 0x%lx (errno %d)\n",
+                        s->physical_base + slot->offset + slot->done, -cqe->res);
+                }
+                else
+                {
+                    fprint_red(stderr, "[-] Failed to write memory regions! (errno %d)\n",
+                        -cqe->res);
+                }
+                failed = 1;
+            }
+
+            if (failed)
+            {
+                slot->state = SLOT_IDLE;
+                inflight--;
+                continue;
+            }
+
+            slot->done += cqe->res;
+            if (slot->done < slot->len)
+            {
+                // Short read or write, so queue the remainder
+                uring_queue(&ring, slot, index,
+                    SLOT_READING == slot->state ? kcore_fd : out_fd,
+                    SLOT_READING == slot->state ? 
+                        s->file_offset + slot->offset :
+                        layout[slot->section].data_offset + slot->offset);
+            }
+            else if (SLOT_READING == slot->state)
+            {
+                uint64_t now = metrics_now();
+                metrics_record_read(dump->metrics, slot->section, 
+                    s->physical_base + slot->offset, slot->started_ns, now);
+
+                slot->state = SLOT_WRITING;
+                slot->done = 0;
+                slot->started_ns = now;
+                uring_queue(&ring, slot, index, out_fd,
+                    layout[slot->section].data_offset + slot->offset);
+            }
+            else
+            {
+                metrics_record_write(dump->metrics, slot->section,
+                    s->physical_base + slot->offset, slot->started_ns, 
+                    metrics_now(), slot->len);
+
+                if (next_chunk(sections, num_sections, &section, &offset, 
+                    chunk_size, slot))
+                {
+                    uring_queue(&ring, slot, index, kcore_fd,
+                        sections[slot->section].file_offset + slot->offset);
+                }
+                else
+                {
+                    slot->state = SLOT_IDLE;
+                    inflight--;
+                }
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (failed)
+    {
+        ret = -1;
+    }
+
+cleanup:
+    uring_teardown(&ring);
+    buffer_unmap(buffers, buffers_len);
+    free(iovecs);
+    free(slots);
+    return ret;
+}
\ No newline at end of file
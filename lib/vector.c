@@ -0,0 +1,311 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "vector.h"
+
+#include "buffer.h"
+#include "color-print.h"
+#include "format.h"
+#include "io.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+
+// The most pieces gathered into a single pwritev
+#define VECTOR_MAX_IOVECS 64
+
+// The most headers gathered into a single pwritev, each of which is
+// followed by at least one piece of data
+#define VECTOR_MAX_HEADERS (VECTOR_MAX_IOVECS / 2)
+
+// A piece of a section's data waiting to be written
+struct vector_piece
+{
+    int         section;
+    uint64_t    address;
+    size_t      len;
+};
+
+// Headers and data that sit back to back in the output, gathered up to be
+// written with one pwritev. The data all comes from one chunk buffer.
+struct vector_batch
+{
+    int                 out_fd;
+    struct iovec        iov[VECTOR_MAX_IOVECS];
+    int                 num_iov;
+    uint64_t            offset;
+    uint64_t            end;
+
+    char*               buffer;
+    size_t              buffer_size;
+    size_t              buffer_used;
+    struct vector_piece pieces[VECTOR_MAX_IOVECS];
+    int                 num_pieces;
+
+    char*               headers;
+    size_t              header_size;
+    int                 num_headers;
+};
+
+/**
+ * Writes out everything gathered in a batch, retrying short writes from
+ * where they left off.
+ *
+ * @param batch The batch to write
+ * @param dump  The dump context
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int flush_batch(struct vector_batch* batch, struct dump_context* dump)
+{
+    struct iovec* iov = batch->iov;
+    int num_iov = batch->num_iov;
+    uint64_t offset = batch->offset;
+    uint64_t start = metrics_now();
+
+    while (num_iov > 0)
+    {
+        ssize_t n = pwritev(batch->out_fd, iov, num_iov, offset);
+        if (n <= 0)
+        {
+            if (-1 == n && EINTR == errno)
+            {
+                continue;
+            }
+            fprint_red(stderr, "[-] Failed to write at 0x%lx (errno %d)\n", 
+                offset, errno);
+            return -1;
+        }
+
+        offset += n;
+        while (num_iov > 0 && (size_t) n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            num_iov--;
+        }
+        if (num_iov > 0)
+        {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    uint64_t done = metrics_now();
+    for (int i = 0; i < batch->num_pieces; i++)
+    {
+        const struct vector_piece* piece = &batch->pieces[i];
+        metrics_record_write(dump->metrics, piece->section, piece->address, 
+            start, done, piece->len);
+        dump->stats->bytes_copied += piece->len;
+    }
+
+    batch->num_iov = 0;
+    batch->num_pieces = 0;
+    batch->num_headers = 0;
+    batch->buffer_used = 0;
+    return 0;
+}
+
+/**
+ * Makes sure the next piece can join the batch, writing the batch out first
+ * if the piece isn't right after it or there's no room left.
+ *
+ * @param batch    The batch
+ * @param at       Where the piece goes in the output
+ * @param data_len The length of the piece if it's data, else 0 for a header
+ * @param dump     The dump context
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+static int make_room(struct vector_batch* batch, 
+                     const uint64_t at, 
+                     const size_t data_len,
+                     struct dump_context* dump)
+{
+    if (0 == batch->num_iov)
+    {
+        batch->offset = batch->end = at;
+        return 0;
+    }
+
+    if (at != batch->end || VECTOR_MAX_IOVECS == batch->num_iov ||
+        batch->buffer_used + data_len > batch->buffer_size ||
+        (0 == data_len && VECTOR_MAX_HEADERS == batch->num_headers))
+    {
+        if (-1 == flush_batch(batch, dump))
+        {
+            return -1;
+        }
+        batch->offset = batch->end = at;
+    }
+
+    return 0;
+}
+
+/**
+ * Adds a piece to a batch that make_room has made space for.
+ *
+ * @param batch The batch
+ * @param data  The piece
+ * @param len   The length of the piece
+ */
+static void add_piece(struct vector_batch* batch, char* data, const size_t len)
+{
+    batch->iov[batch->num_iov].iov_base = data;
+    batch->iov[batch->num_iov].iov_len = len;
+    batch->num_iov++;
+    batch->end += len;
+}
+
+/**
+ * Copies the sections to the output with as few system calls as possible.
+ * kcore is only ever read with pread, and each section's header is gathered
+ * with its data, and with the sections around it when they're small, into
+ * a single pwritev of up to a chunk. Nothing ever seeks.
+ *
+ * @param kcore_fd     The file descriptor of the /proc/kcore file
+ * @param out_fd       The file descriptor for the output file
+ * @param sections     The array of memory sections to copy
+ * @param layout       The location of each section in the output
+ * @param num_sections The number of memory sections to copy
+ * @param dump         The dump context
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int copy_sections_vector(const int kcore_fd,
+                         const int out_fd,
+                         const struct section* sections,
+                         const struct section_layout* layout,
+                         const int num_sections,
+                         struct dump_context* dump)
+{
+    int ret = 0;
+    const struct output_format* format = dump->options->format;
+    struct vector_batch batch = {
+        .out_fd = out_fd,
+        .buffer_size = dump->options->chunk_size,
+        .header_size = format->header_size(num_sections),
+    };
+
+    batch.buffer = buffer_pool_get(dump->buffers);
+    // A header is rendered before it's known whether the batch has room for
+    // it, so there's a spare slot
+    batch.headers = malloc((VECTOR_MAX_HEADERS + 1) * batch.header_size);
+    if (NULL == batch.buffer || NULL == batch.headers)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the vector buffers\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    print_cyan("\t[*] Gathering up to %d pieces into each write\n", 
+        VECTOR_MAX_IOVECS);
+
+    for (int i = 0; i < num_sections && 0 == ret; i++)
+    {
+        char* header = batch.headers + batch.num_headers * batch.header_size;
+        size_t header_len = format->header(sections, layout, num_sections, i, 
+            header);
+        if (header_len > 0)
+        {
+            if (-1 == make_room(&batch, layout[i].header_offset, 0, dump))
+            {
+                ret = -1;
+                break;
+            }
+
+            // Flushing frees up the headers, so it's rendered again in place
+            if (header != batch.headers + batch.num_headers * batch.header_size)
+            {
+                header = batch.headers + batch.num_headers * batch.header_size;
+                format->header(sections, layout, num_sections, i, header);
+            }
+            add_piece(&batch, header, header_len);
+            batch.num_headers++;
+        }
+
+        for (uint64_t offset = 0; offset < sections[i].size; )
+        {
+            // A full buffer is written out before reading any more
+            if (batch.buffer_used == batch.buffer_size && 
+                -1 == flush_batch(&batch, dump))
+            {
+                ret = -1;
+                break;
+            }
+
+            // Fill whatever is left of the buffer, or all of it if the piece
+            // can't join the batch
+            size_t len = sections[i].size - offset;
+            if (len > batch.buffer_size - batch.buffer_used)
+            {
+                len = batch.buffer_size - batch.buffer_used;
+            }
+            if (-1 == make_room(&batch, layout[i].data_offset + offset, len, dump))
+            {
+                ret = -1;
+                break;
+            }
+            if (0 == batch.num_iov && sections[i].size - offset > len)
+            {
+                len = sections[i].size - offset < batch.buffer_size ?
+                    sections[i].size - offset : batch.buffer_size;
+            }
+
+            char* data = batch.buffer + batch.buffer_used;
+            uint64_t address = sections[i].physical_base + offset;
+            uint64_t start = metrics_now();
+            if (-1 == read_all_at(kcore_fd, data, len, 
+                sections[i].file_offset + offset))
+            {
+                fprint_red(stderr, "[-] Kcore read failed at 0x%lx (errno %d)\n",
+                    address, errno);
+                ret = -1;
+                break;
+            }
+            metrics_record_read(dump->metrics, i, address, start, metrics_now());
+
+            add_piece(&batch, data, len);
+            batch.buffer_used += len;
+            batch.pieces[batch.num_pieces].section = i;
+            batch.pieces[batch.num_pieces].address = address;
+            batch.pieces[batch.num_pieces].len = len;
+            batch.num_pieces++;
+            offset += len;
+        }
+    }
+
+    if (0 == ret && batch.num_iov > 0)
+    {
+        ret = flush_batch(&batch, dump);
+    }
+
+cleanup:
+    if (NULL != batch.buffer)
+    {
+        buffer_pool_put(dump->buffers, batch.buffer);
+    }
+    free(batch.headers);
+    return ret;
+}
\ No newline at end of file
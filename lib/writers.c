@@ -0,0 +1,339 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "writers.h"
+
+#include "color-print.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Drops a writer's reference to a block, freeing the block once no writer
+ * needs it. The pool must be locked.
+ *
+ * @param pool  The writer pool
+ * @param block The index of the block
+ */
+static void release_block(struct writer_pool* pool, const int block)
+{
+    if (0 == --pool->blocks[block].refs)
+    {
+        pool->free_blocks[pool->num_free++] = block;
+        pthread_cond_broadcast(&pool->space);
+    }
+}
+
+/**
+ * Gives up on a writer, releasing everything it had queued. The pool must
+ * be locked.
+ *
+ * @param pool   The writer pool
+ * @param writer The writer
+ */
+static void fail_writer(struct writer_pool* pool, struct queued_writer* writer)
+{
+    writer->failed = 1;
+    while (writer->count > 0)
+    {
+        release_block(pool, writer->queue[writer->head]);
+        writer->head = (writer->head + 1) % pool->queue_depth;
+        writer->count--;
+    }
+    pthread_cond_broadcast(&pool->space);
+    pthread_cond_signal(&writer->work);
+}
+
+/**
+ * The thread for a single writer, which writes out the blocks queued for it
+ * in order.
+ *
+ * @param arg The writer
+ *
+ * @return NULL
+ */
+static void* queued_writer_run(void* arg)
+{
+    struct queued_writer* writer = (struct queued_writer*) arg;
+    struct writer_pool* pool = writer->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (0 == writer->count && !writer->failed && !pool->finishing)
+        {
+            pthread_cond_wait(&writer->work, &pool->lock);
+        }
+        if (writer->failed || 0 == writer->count)
+        {
+            break;
+        }
+
+        int index = writer->queue[writer->head];
+        writer->head = (writer->head + 1) % pool->queue_depth;
+        writer->count--;
+        pthread_cond_broadcast(&pool->space);
+        pthread_mutex_unlock(&pool->lock);
+
+        struct queued_block* block = &pool->blocks[index];
+        int ret = NULL == block->data ? sink_skip(writer->sink, block->len) :
+            sink_write(writer->sink, block->data, block->len);
+
+        pthread_mutex_lock(&pool->lock);
+        release_block(pool, index);
+        if (-1 == ret)
+        {
+            fprint_red(stderr, "[-] Failed to write to %s (errno %d)\n",
+                writer->name, errno);
+            fail_writer(pool, writer);
+            for (int i = 0; pool->fail_all && i < pool->num_writers; i++)
+            {
+                if (!pool->writers[i].failed)
+                {
+                    fail_writer(pool, &pool->writers[i]);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/**
+ * Queues a block for one writer, or for every writer that's still going.
+ * Writers that are a whole queue behind are waited for, unless they're
+ * marked to be dropped.
+ *
+ * @param pool   The writer pool
+ * @param writer The index of the writer, or ALL_WRITERS
+ * @param data   The data of the block, or NULL for a run of zeros
+ * @param len    The length of the block, at most the pool's block size
+ *
+ * @return 0 for success, else -1 if none of the writers are left
+ */
+int writer_pool_push(struct writer_pool* pool,
+                     const int writer,
+                     const char* data,
+                     const size_t len)
+{
+    int first = ALL_WRITERS == writer ? 0 : writer;
+    int last = ALL_WRITERS == writer ? pool->num_writers : writer + 1;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        int live = 0, blocked = 0;
+        for (int i = first; i < last; i++)
+        {
+            struct queued_writer* w = &pool->writers[i];
+            if (!w->failed && w->count == pool->queue_depth && w->drop)
+            {
+                fprint_red(stderr, "[-] Dropping %s, which fell %d blocks behind\n",
+                    w->name, pool->queue_depth);
+                fail_writer(pool, w);
+            }
+
+            if (!w->failed)
+            {
+                live++;
+                blocked |= w->count == pool->queue_depth;
+            }
+        }
+
+        if (0 == live)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            errno = EIO;
+            return -1;
+        }
+        if (!blocked && pool->num_free > 0)
+        {
+            break;
+        }
+        pthread_cond_wait(&pool->space, &pool->lock);
+    }
+
+    // Only the producer fills blocks, so this one is ours until it's queued
+    int index = pool->free_blocks[--pool->num_free];
+    pthread_mutex_unlock(&pool->lock);
+
+    struct queued_block* block = &pool->blocks[index];
+    block->len = len;
+    block->data = NULL;
+    if (NULL != data)
+    {
+        block->data = pool->memory + index * pool->block_size;
+        memcpy(block->data, data, len);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    block->refs = 0;
+    for (int i = first; i < last; i++)
+    {
+        struct queued_writer* w = &pool->writers[i];
+        if (!w->failed)
+        {
+            w->queue[(w->head + w->count) % pool->queue_depth] = index;
+            w->count++;
+            block->refs++;
+            pthread_cond_signal(&w->work);
+        }
+    }
+
+    if (0 == block->refs)
+    {
+        pool->free_blocks[pool->num_free++] = index;
+        pthread_mutex_unlock(&pool->lock);
+        errno = EIO;
+        return -1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/**
+ * Stops the writers once they have written everything queued for them.
+ *
+ * @param pool The writer pool
+ */
+void writer_pool_stop(struct writer_pool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->finishing = 1;
+    for (int i = 0; i < pool->num_writers; i++)
+    {
+        pthread_cond_signal(&pool->writers[i].work);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_writers; i++)
+    {
+        if (pool->writers[i].started)
+        {
+            pthread_join(pool->writers[i].thread, NULL);
+            pool->writers[i].started = 0;
+        }
+    }
+}
+
+/**
+ * Stops the writers of a pool and releases it along with their sinks.
+ *
+ * @param pool The writer pool
+ */
+void writer_pool_destroy(struct writer_pool* pool)
+{
+    if (NULL != pool->writers)
+    {
+        writer_pool_stop(pool);
+        for (int i = 0; i < pool->num_writers; i++)
+        {
+            sink_destroy(pool->writers[i].sink);
+            free(pool->writers[i].queue);
+            pthread_cond_destroy(&pool->writers[i].work);
+        }
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->space);
+    free(pool->writers);
+    free(pool->memory);
+    free(pool->blocks);
+    free(pool->free_blocks);
+}
+
+/**
+ * Sets up a pool of writer threads, one for each sink, which share a pool
+ * of blocks. Each block is copied into the pool once, and queued for as many
+ * writers as need it.
+ *
+ * @param pool        The writer pool, which is released with
+ *                    writer_pool_destroy even if this fails
+ * @param sinks       The sinks to write to, which the pool takes ownership
+ *                    of
+ * @param names       The name of each sink, for messages
+ * @param num_writers The number of sinks
+ * @param num_blocks  The number of blocks in the pool
+ * @param block_size  The largest block that's queued at once
+ * @param queue_depth The number of blocks each writer may have queued
+ * @param fail_all    Whether one writer failing stops all of them
+ *
+ * @return 0 for success, else -1 if there's an error
+ */
+int writer_pool_init(struct writer_pool* pool,
+                     struct sink** sinks,
+                     const char** names,
+                     const int num_writers,
+                     const int num_blocks,
+                     const size_t block_size,
+                     const int queue_depth,
+                     const int fail_all)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->block_size = block_size;
+    pool->queue_depth = queue_depth;
+    pool->fail_all = fail_all;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->space, NULL);
+
+    pool->memory = malloc(num_blocks * block_size);
+    pool->blocks = calloc(num_blocks, sizeof(struct queued_block));
+    pool->free_blocks = calloc(num_blocks, sizeof(int));
+    pool->writers = calloc(num_writers, sizeof(struct queued_writer));
+    if (NULL == pool->writers)
+    {
+        for (int i = 0; i < num_writers; i++)
+        {
+            sink_destroy(sinks[i]);
+        }
+        return -1;
+    }
+
+    pool->num_writers = num_writers;
+    for (int i = 0; i < num_writers; i++)
+    {
+        pool->writers[i].pool = pool;
+        pool->writers[i].sink = sinks[i];
+        pool->writers[i].name = names[i];
+        pool->writers[i].queue = calloc(queue_depth, sizeof(int));
+        pthread_cond_init(&pool->writers[i].work, NULL);
+    }
+
+    if (NULL == pool->memory || NULL == pool->blocks || NULL == pool->free_blocks)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < num_blocks; i++)
+    {
+        pool->free_blocks[pool->num_free++] = i;
+    }
+
+    for (int i = 0; i < num_writers; i++)
+    {
+        if (NULL == pool->writers[i].queue || 0 != pthread_create(
+            &pool->writers[i].thread, NULL, queued_writer_run, &pool->writers[i]))
+        {
+            return -1;
+        }
+        pool->writers[i].started = 1;
+    }
+
+    return 0;
+}
\ No newline at end of file
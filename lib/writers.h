@@ -0,0 +1,95 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "sink.h"
+
+#include <pthread.h>
+
+// Queue a block for every writer that's still going, rather than just one
+#define ALL_WRITERS -1
+
+// A piece of the stream, shared by every writer that has yet to write it.
+// A block with no data stands for a run of zeros.
+struct queued_block
+{
+    char*   data;
+    size_t  len;
+    int     refs;
+};
+
+struct writer_pool;
+
+// A sink being fed by its own writer thread, from its own queue of blocks
+struct queued_writer
+{
+    struct writer_pool* pool;
+    struct sink*        sink;
+    const char*         name;
+
+    // Whether to give up on the writer when it falls a whole queue behind,
+    // rather than waiting for it. Only the producer reads it.
+    int                 drop;
+
+    // A ring of the indices of the blocks waiting to be written
+    int*                queue;
+    int                 head;
+    int                 count;
+
+    int                 failed;
+    int                 started;
+    pthread_t           thread;
+    pthread_cond_t      work;
+};
+
+// A set of writer threads sharing one pool of blocks
+struct writer_pool
+{
+    struct queued_writer*   writers;
+    int                     num_writers;
+    int                     queue_depth;
+
+    // Whether one writer failing stops every other writer too
+    int                     fail_all;
+
+    size_t                  block_size;
+    char*                   memory;
+    struct queued_block*    blocks;
+    int*                    free_blocks;
+    int                     num_free;
+
+    int                     finishing;
+    pthread_mutex_t         lock;
+
+    // Signalled whenever a block is freed or a queue has room
+    pthread_cond_t          space;
+};
+
+int writer_pool_init(struct writer_pool* pool,
+                     struct sink** sinks,
+                     const char** names,
+                     const int num_writers,
+                     const int num_blocks,
+                     const size_t block_size,
+                     const int queue_depth,
+                     const int fail_all);
+int writer_pool_push(struct writer_pool* pool,
+                     const int writer,
+                     const char* data,
+                     const size_t len);
+void writer_pool_stop(struct writer_pool* pool);
+void writer_pool_destroy(struct writer_pool* pool);
\ No newline at end of file
@@ -0,0 +1,200 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "zero.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/**
+ * Checks if a buffer is entirely zero, eight bytes at a time.
+ *
+ * @param page The buffer to check
+ * @param len  The length of the buffer
+ *
+ * @return 1 if the buffer is all zero, else 0
+ */
+static int is_zero_scalar(const char* page, const size_t len)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, page + i, sizeof(word));
+        if (word)
+        {
+            return 0;
+        }
+    }
+
+    for (; i < len; i++)
+    {
+        if (page[i])
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Checks if a buffer is entirely zero, 64 bytes at a time using SSE2.
+ *
+ * @param page The buffer to check
+ * @param len  The length of the buffer
+ *
+ * @return 1 if the buffer is all zero, else 0
+ */
+__attribute__((target("sse2")))
+static int is_zero_sse2(const char* page, const size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*) (page + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (page + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*) (page + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*) (page + i + 48));
+        __m128i acc = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)))
+        {
+            return 0;
+        }
+    }
+
+    return is_zero_scalar(page + i, len - i);
+}
+
+/**
+ * Checks if a buffer is entirely zero, 128 bytes at a time using AVX2.
+ *
+ * @param page The buffer to check
+ * @param len  The length of the buffer
+ *
+ * @return 1 if the buffer is all zero, else 0
+ */
+__attribute__((target("avx2")))
+static int is_zero_avx2(const char* page, const size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 128 <= len; i += 128)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (page + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (page + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*) (page + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*) (page + i + 96));
+        __m256i acc = _mm256_or_si256(_mm256_or_si256(a, b), 
+            _mm256_or_si256(c, d));
+        if (!_mm256_testz_si256(acc, acc))
+        {
+            return 0;
+        }
+    }
+
+    return is_zero_scalar(page + i, len - i);
+}
+#endif
+
+/**
+ * Picks the fastest zero check supported by the CPU we're running on.
+ *
+ * @return The zero check to use
+ */
+static int (*select_zero_check(void))(const char*, const size_t)
+{
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return is_zero_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return is_zero_sse2;
+    }
+#endif
+    return is_zero_scalar;
+}
+
+/**
+ * Checks if a page of memory is entirely zero.
+ *
+ * @param page The page to check
+ * @param len  The length of the page
+ *
+ * @return 1 if the page is all zero, else 0
+ */
+int is_zero_page(const char* page, const size_t len)
+{
+    // Racing threads will all pick the same function, so this is harmless
+    static int (*zero_check)(const char*, const size_t) = NULL;
+    if (NULL == zero_check)
+    {
+        zero_check = select_zero_check();
+    }
+
+    return zero_check(page, len);
+}
+
+/**
+ * Measures the run of pages at the start of a buffer that are either all
+ * zero-filled or all contain data. The final page may be partial.
+ *
+ * @param buffer The buffer to scan
+ * @param len    The length of the buffer
+ * @param zero   Set to 1 if the run is zero-filled, else 0 (output)
+ *
+ * @return The length of the run in bytes
+ */
+size_t scan_page_run(const char* buffer, const size_t len, int* zero)
+{
+    size_t run = 0;
+    *zero = -1;
+
+    while (run < len)
+    {
+        size_t page_len = len - run;
+        if (page_len > ZERO_PAGE_SIZE)
+        {
+            page_len = ZERO_PAGE_SIZE;
+        }
+
+        int page_zero = is_zero_page(buffer + run, page_len);
+        if (-1 == *zero)
+        {
+            *zero = page_zero;
+        }
+        else if (page_zero != *zero)
+        {
+            break;
+        }
+
+        run += page_len;
+    }
+
+    return run;
+}
\ No newline at end of file
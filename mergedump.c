@@ -0,0 +1,237 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "lib/lime.h"
+#include "lib/lmat.h"
+#include "lib/manifest.h"
+#include "lib/reader.h"
+
+#include "lib/color-print.h"
+#include "lib/io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Works out where the next run of a section should be copied from. Pages in
+ * the delta take priority over those in the base.
+ * 
+ * @param base    The base capture
+ * @param delta   The differential capture
+ * @param address The address the run starts at
+ * @param max_len The maximum length of the run
+ * @param data    The data of the run (output)
+ * 
+ * @return The length of the run, else 0 if neither capture holds the address
+ */
+static uint64_t find_run(const struct lime_reader* base,
+                         const struct lime_reader* delta,
+                         const uint64_t address,
+                         uint64_t max_len,
+                         const char** data)
+{
+    uint64_t d = lime_reader_find(delta, address);
+    if (d < delta->num_sections && delta->sections[d].physical_base <= address)
+    {
+        const struct section* s = &delta->sections[d];
+        uint64_t len = s->physical_base + s->size - address;
+        len = len < max_len ? len : max_len;
+        *data = lime_read_phys(delta, address, len);
+        return NULL != *data ? len : 0;
+    }
+
+    // Stop the run where the next changed range begins
+    if (d < delta->num_sections && 
+        delta->sections[d].physical_base - address < max_len)
+    {
+        max_len = delta->sections[d].physical_base - address;
+    }
+
+    uint64_t b = lime_reader_find(base, address);
+    if (b < base->num_sections && base->sections[b].physical_base <= address)
+    {
+        const struct section* s = &base->sections[b];
+        uint64_t len = s->physical_base + s->size - address;
+        len = len < max_len ? len : max_len;
+        *data = lime_read_phys(base, address, len);
+        return NULL != *data ? len : 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Rebuilds a single section of the full capture, checking every page
+ * against the hash recorded in the manifest.
+ * 
+ * @param base     The base capture
+ * @param delta    The differential capture
+ * @param manifest The manifest of the full capture
+ * @param section  The index of the section to rebuild
+ * @param out_fd   The file descriptor of the output file
+ * @param buffer   A buffer of at least CHUNK_SIZE bytes
+ * 
+ * @return 0 for success, else -1 if there's an error
+ */
+static int merge_section(const struct lime_reader* base,
+                         const struct lime_reader* delta,
+                         const struct page_manifest* manifest,
+                         const int section,
+                         const int out_fd,
+                         char* buffer)
+{
+    const struct manifest_section* s = &manifest->sections[section];
+    lime_memory_range_header header = {
+        .magic = LIME_HEADER_MAGIC,
+        .version = LIME_HEADER_VERSION,
+        .s_addr = s->physical_base,
+        .e_addr = s->physical_base + s->size - 1,
+    };
+
+    if (-1 == write_all(out_fd, &header, sizeof(header)))
+    {
+        fprint_red(stderr, "[-] Failed to write output (errno %d)\n", errno);
+        return -1;
+    }
+
+    for (uint64_t pos = 0; pos < s->size; )
+    {
+        // Chunks stay page aligned within the section so they can be checked
+        uint64_t len = s->size - pos;
+        if (len > CHUNK_SIZE)
+        {
+            len = CHUNK_SIZE;
+        }
+
+        uint64_t filled = 0;
+        while (filled < len)
+        {
+            const char* data;
+            uint64_t run = find_run(base, delta, s->physical_base + pos + filled,
+                len - filled, &data);
+            if (0 == run)
+            {
+                fprint_red(stderr, "[-] Neither capture holds address 0x%lx\n",
+                    s->physical_base + pos + filled);
+                return -1;
+            }
+
+            memcpy(buffer + filled, data, run);
+            filled += run;
+        }
+
+        for (uint64_t page = 0; page < len; page += MANIFEST_PAGE_SIZE)
+        {
+            uint64_t page_len = len - page;
+            if (page_len > MANIFEST_PAGE_SIZE)
+            {
+                page_len = MANIFEST_PAGE_SIZE;
+            }
+
+            uint64_t index = s->first_page + (pos + page) / MANIFEST_PAGE_SIZE;
+            if (hash_page(buffer + page, page_len) != manifest->hashes[index])
+            {
+                fprint_red(stderr, "[-] Page at 0x%lx doesn't match the manifest\n",
+                    s->physical_base + pos + page);
+                return -1;
+            }
+        }
+
+        if (-1 == write_all(out_fd, buffer, len))
+        {
+            fprint_red(stderr, "[-] Failed to write output (errno %d)\n", errno);
+            return -1;
+        }
+        pos += len;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    int ret = 0;
+    int out_fd = -1;
+    struct lime_reader* base = NULL;
+    struct lime_reader* delta = NULL;
+    struct page_manifest* manifest = NULL;
+    char* buffer = NULL;
+
+    if (argc < 5)
+    {
+        printf("Usage: %s <base_dump> <delta_dump> <manifest> <output_file>\n",
+            argv[0]);
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (NULL == (base = lime_reader_open(argv[1], NULL)) || 
+        NULL == (delta = lime_reader_open(argv[2], NULL)) ||
+        NULL == (manifest = manifest_load(argv[3])))
+    {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (NULL == (buffer = malloc(CHUNK_SIZE)))
+    {
+        fprint_red(stderr, "[-] Failed to allocate buffer\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (-1 == (out_fd = 
+        open64(argv[4], O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, S_IRUSR)))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", argv[4]);
+        ret = -1;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < manifest->num_sections; i++)
+    {
+        if (-1 == merge_section(base, delta, manifest, i, out_fd, buffer))
+        {
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    print_green("[+] Rebuilt %d sections into %s\n", manifest->num_sections, 
+        argv[4]);
+
+cleanup:
+    if (out_fd >= 0)
+    {
+        close(out_fd);
+    }
+
+    lime_reader_close(base);
+    lime_reader_close(delta);
+    manifest_free(manifest);
+    free(buffer);
+
+    return ret;
+}
\ No newline at end of file
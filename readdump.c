@@ -0,0 +1,162 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "lib/reader.h"
+
+#include "lib/color-print.h"
+#include "lib/io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Prints the usage information for the program.
+ * 
+ * @param program The name the program was invoked as
+ */
+static void print_usage(const char* program)
+{
+    printf("Usage: %s [options] <dump_file> <address> <length> <output_file>\n", 
+        program);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -i, --index <file>  Use (or build) a sidecar index of the dump\n");
+    printf("  -h, --help          Show this help message\n");
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option long_options[] = {
+        { "index", required_argument, NULL, 'i' },
+        { "help",  no_argument,       NULL, 'h' },
+        { NULL,    0,                 NULL, 0   }
+    };
+
+    int ret = 0;
+    int out_fd = -1;
+    const char* index_file = NULL;
+    const char* output_file = NULL;
+    struct lime_reader* reader = NULL;
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "i:h", long_options, NULL)))
+    {
+        switch (opt)
+        {
+        case 'i':
+            index_file = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (argc - optind < 4)
+    {
+        print_usage(argv[0]);
+        ret = -1;
+        goto cleanup;
+    }
+    const char* dump_file = argv[optind];
+    char* address_end;
+    char* length_end;
+    uint64_t address = strtoull(argv[optind + 1], &address_end, 0);
+    uint64_t length = strtoull(argv[optind + 2], &length_end, 0);
+    if (address_end == argv[optind + 1] || '\0' != *address_end ||
+        length_end == argv[optind + 2] || '\0' != *length_end)
+    {
+        fprint_red(stderr, "[-] Invalid address or length: %s %s\n", 
+            argv[optind + 1], argv[optind + 2]);
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (NULL == (reader = lime_reader_open(dump_file, index_file)))
+    {
+        ret = -1;
+        goto cleanup;
+    }
+
+    print_green("[*] Indexed %lu ranges in %s\n", reader->num_sections, dump_file);
+
+    output_file = argv[optind + 3];
+    if (-1 == (out_fd = 
+        open64(output_file, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, S_IRUSR)))
+    {
+        fprint_red(stderr, "[-] Could not open %s\n", output_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    // The requested range may span several adjacent ranges of the dump
+    for (uint64_t pos = 0; pos < length; )
+    {
+        uint64_t i = lime_reader_find(reader, address + pos);
+        const struct section* s = &reader->sections[i];
+        if (i >= reader->num_sections || s->physical_base > address + pos)
+        {
+            fprint_red(stderr, "[-] Address 0x%lx wasn't captured\n", 
+                address + pos);
+            ret = -1;
+            goto cleanup;
+        }
+
+        uint64_t run = s->physical_base + s->size - (address + pos);
+        if (run > length - pos)
+        {
+            run = length - pos;
+        }
+
+        const char* data = lime_read_phys(reader, address + pos, run);
+        if (NULL == data || -1 == write_all(out_fd, data, run))
+        {
+            fprint_red(stderr, "[-] Failed to read 0x%lx (errno %d)\n", 
+                address + pos, errno);
+            ret = -1;
+            goto cleanup;
+        }
+        pos += run;
+    }
+
+    print_green("[+] Read 0x%lx bytes from 0x%lx to %s\n", length, address, 
+        output_file);
+
+cleanup:
+    if (out_fd >= 0)
+    {
+        close(out_fd);
+
+        // Don't leave a partial copy that looks like a good one
+        if (-1 == ret)
+        {
+            unlink(output_file);
+        }
+    }
+
+    lime_reader_close(reader);
+
+    return ret;
+}
\ No newline at end of file
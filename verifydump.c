@@ -0,0 +1,278 @@
+/*
+This file is part of Linux Memory Dumper.
+
+Linux Memory Dumper is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Linux Memory Dumper is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Linux Memory Dumper. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
+
+#include "lib/merkle.h"
+#include "lib/reader.h"
+
+#include "lib/color-print.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+
+// State shared between all of the hashing threads
+struct verify_context
+{
+    struct merkle_tree*         tree;
+
+    // The mapped contents of each section of the tree
+    const char**                data;
+
+    uint64_t                    next_leaf;
+    int                         failed;
+};
+
+/**
+ * Prints the usage information for the program.
+ * 
+ * @param program The name the program was invoked as
+ */
+static void print_usage(const char* program)
+{
+    printf("Usage: %s [options] <dump_file> <hash_file>\n", program);
+    printf("\n");
+    printf("Checks a LiME file or ELF core against the hashes written by\n"
+           "dumpmemory --hash.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -t, --threads <n>  Hash with n threads (default: one per CPU)\n");
+    printf("  -h, --help         Show this help message\n");
+}
+
+/**
+ * Finds the section of the tree that a leaf belongs to.
+ * 
+ * @param tree The tree
+ * @param leaf The index of the leaf
+ * 
+ * @return The index of the section containing the leaf
+ */
+static int find_section_for_leaf(const struct merkle_tree* tree, 
+                                 const uint64_t leaf)
+{
+    int lo = 0;
+    int hi = tree->num_sections - 1;
+
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (tree->sections[mid].first_leaf <= leaf)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * The entry point for each hashing thread. Threads pull leaves off of a
+ * shared counter until every leaf has been hashed.
+ * 
+ * @param arg The verify context
+ * 
+ * @return NULL
+ */
+static void* verify_worker(void* arg)
+{
+    struct verify_context* ctx = (struct verify_context*) arg;
+
+    while (!__atomic_load_n(&ctx->failed, __ATOMIC_RELAXED))
+    {
+        uint64_t leaf = __atomic_fetch_add(&ctx->next_leaf, 1, __ATOMIC_RELAXED);
+        if (leaf >= ctx->tree->num_leaves)
+        {
+            break;
+        }
+
+        int s = find_section_for_leaf(ctx->tree, leaf);
+        const struct merkle_section* section = &ctx->tree->sections[s];
+        uint64_t offset = (leaf - section->first_leaf) * MERKLE_LEAF_SIZE;
+        size_t len = section->size - offset;
+        if (len > MERKLE_LEAF_SIZE)
+        {
+            len = MERKLE_LEAF_SIZE;
+        }
+
+        if (-1 == merkle_hash_leaves(ctx->tree, s, offset, ctx->data[s] + offset,
+            len))
+        {
+            __atomic_store_n(&ctx->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option long_options[] = {
+        { "threads", required_argument, NULL, 't' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL,      0,                 NULL, 0   }
+    };
+
+    int ret = 0;
+    int num_threads = get_nprocs();
+    int started = 0;
+    pthread_t threads[MAX_HASH_THREADS];
+    struct lime_reader* reader = NULL;
+    unsigned char* expected = NULL;
+    char text[2 * MERKLE_HASH_SIZE + 1];
+    struct verify_context ctx = {
+        .tree = NULL,
+        .data = NULL,
+        .next_leaf = 0,
+        .failed = 0,
+    };
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "t:h", long_options, NULL)))
+    {
+        switch (opt)
+        {
+        case 't':
+            num_threads = atoi(optarg);
+            if (num_threads < 1)
+            {
+                fprint_red(stderr, "[-] Need at least 1 thread\n");
+                ret = -1;
+                goto cleanup;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (argc - optind < 2)
+    {
+        print_usage(argv[0]);
+        ret = -1;
+        goto cleanup;
+    }
+    const char* dump_file = argv[optind];
+    const char* hash_file = argv[optind + 1];
+
+    if (num_threads > MAX_HASH_THREADS)
+    {
+        num_threads = MAX_HASH_THREADS;
+    }
+
+    if (NULL == (ctx.tree = merkle_load(hash_file)) ||
+        NULL == (reader = lime_reader_open(dump_file, NULL)))
+    {
+        ret = -1;
+        goto cleanup;
+    }
+
+    ctx.data = calloc(ctx.tree->num_sections + 1, sizeof(const char*));
+    expected = malloc((ctx.tree->num_sections + 1) * MERKLE_HASH_SIZE);
+    if (NULL == ctx.data || NULL == expected)
+    {
+        fprint_red(stderr, "[-] Failed to allocate the section table\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    // Every hashed section has to have been captured in one piece
+    for (int i = 0; i < ctx.tree->num_sections; i++)
+    {
+        const struct merkle_section* s = &ctx.tree->sections[i];
+        if (NULL == (ctx.data[i] = lime_read_phys(reader, s->physical_base, 
+            s->size)))
+        {
+            fprint_red(stderr, "[-] Section 0x%lx - 0x%lx is missing from %s\n",
+                s->physical_base, s->physical_base + s->size - 1, dump_file);
+            ret = -1;
+            goto cleanup;
+        }
+        memcpy(expected + i * MERKLE_HASH_SIZE, s->hash, MERKLE_HASH_SIZE);
+    }
+
+    print_green("[*] Hashing %d sections of %s with %d threads\n", 
+        ctx.tree->num_sections, dump_file, num_threads);
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        if (0 != pthread_create(&threads[i], NULL, verify_worker, &ctx))
+        {
+            fprint_red(stderr, "[-] Failed to start hashing thread %d\n", i);
+            ctx.failed = 1;
+            break;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    unsigned char root[MERKLE_HASH_SIZE];
+    memcpy(root, ctx.tree->root, MERKLE_HASH_SIZE);
+    if (ctx.failed || 0 == started || -1 == merkle_compute_root(ctx.tree))
+    {
+        fprint_red(stderr, "[-] Failed to hash %s\n", dump_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < ctx.tree->num_sections; i++)
+    {
+        const struct merkle_section* s = &ctx.tree->sections[i];
+        if (0 != memcmp(expected + i * MERKLE_HASH_SIZE, s->hash, 
+            MERKLE_HASH_SIZE))
+        {
+            fprint_red(stderr, "[-] Section 0x%lx - 0x%lx doesn't match\n",
+                s->physical_base, s->physical_base + s->size - 1);
+            ret = -1;
+        }
+    }
+
+    merkle_format_hash(ctx.tree->root, text);
+    if (0 != memcmp(root, ctx.tree->root, MERKLE_HASH_SIZE))
+    {
+        fprint_red(stderr, "[-] Root %s doesn't match %s\n", text, hash_file);
+        ret = -1;
+    }
+    else if (0 == ret)
+    {
+        print_green("[+] %s matches %s (root %s)\n", dump_file, hash_file, text);
+    }
+
+cleanup:
+    lime_reader_close(reader);
+    merkle_free(ctx.tree);
+    free(ctx.data);
+    free(expected);
+
+    return ret;
+}
\ No newline at end of file